@@ -0,0 +1,219 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file alloc_budget.cpp
+ * \brief Heap allocations per song change, checked against a budget
+ *
+ * Replays song changes, each a scrobble and a now playing update, through
+ * an engine with a webhook scrobbler posting to a loopback HTTP server, and
+ * fails if the steady state allocates more than the budget per song change.
+ * The server runs in a child process so that only mpdfm's allocations are
+ * counted. Needs the counting operator new, meson links it against a copy
+ * of libmpdfm built with it unless the build has `-Dalloc_stats=true`.
+ *
+ * ```
+ * alloc_budget [budget] [song changes]
+ * ```
+ */
+#include <alloc_stats.hpp>
+#include <array>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/filesystem.hpp>
+#include <config/config_file.hpp>
+#include <csignal>
+#include <engine.hpp>
+#include <fstream>
+#include <gsl/gsl>
+#include <http_client.hpp>
+#include <local_http.hpp>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+    namespace asio = boost::asio;
+    namespace fs   = boost::filesystem;
+
+    //! \brief Song changes replayed before counting
+    constexpr size_t warmup = 50;
+
+    //! \brief The loopback server, in a child process
+    struct target {
+        pid_t pid;
+        unsigned short port;
+        int requests;  // one byte per request served
+    };
+
+    target start_target() {
+        std::array<int, 2> port_pipe {};
+        std::array<int, 2> request_pipe {};
+        if (pipe(port_pipe.data()) != 0 || pipe(request_pipe.data()) != 0) {
+            throw std::runtime_error("pipe failed");
+        }
+
+        auto pid = fork();
+        if (pid < 0) {
+            throw std::runtime_error("fork failed");
+        }
+        if (pid == 0) {
+            asio::io_context io;
+            int requests = request_pipe[1];
+            mpdfm::local_http_server server(
+                io, "127.0.0.1:0",
+                [requests](auto &) {
+                    mpdfm::local_http_server::response res;
+                    res.result(boost::beast::http::status::ok);
+                    res.body() = "{}";
+                    char c     = 0;
+                    static_cast<void>(write(requests, &c, 1));
+                    return res;
+                },
+                "loopback target");
+            auto port = server.port();
+            static_cast<void>(write(port_pipe[1], &port, sizeof(port)));
+            io.run();
+            _exit(0);
+        }
+
+        target t { pid, 0, request_pipe[0] };
+        if (read(port_pipe[0], &t.port, sizeof(t.port)) != sizeof(t.port)) {
+            throw std::runtime_error("loopback target failed to start");
+        }
+        close(port_pipe[0]);
+        close(port_pipe[1]);
+        close(request_pipe[1]);
+        return t;
+    }
+
+    //! \brief Blocks until the target served \p n more requests
+    void wait_for(const target &t, size_t n) {
+        std::array<char, 64> buf {};  // NOLINT arbitrary
+        while (n > 0) {
+            auto got = read(t.requests, buf.data(), std::min(n, buf.size()));
+            if (got <= 0) {
+                throw std::runtime_error("loopback target went away");
+            }
+            n -= static_cast<size_t>(got);
+        }
+    }
+
+    std::string write_config(const fs::path &dir, unsigned short port) {
+        auto path = (dir / "mpdfm.cfg").native();
+        std::ofstream cfg(path);
+        cfg << "webhook {\n"
+            << "    url = \"http://127.0.0.1:" << port << "/plays\"\n"
+            << R"(    template = "{\"artist\":\"${artist}\",)"
+            << R"(\"track\":\"${track}\",\"ts\":${timestamp}}")" << '\n'
+            << "    store = \"" << (dir / "webhook.cache").native()
+            << "\"\n"
+            << "}\n";
+        return path;
+    }
+
+    //! \brief What MPD would have handed over for the song \p i
+    mpdfm::scrobble_entry song(size_t i) {
+        mpdfm::alloc::scope account(mpdfm::alloc::tag::mpd);
+        mpdfm::scrobble_entry s;
+        s.artist       = "Boards of Canada";
+        s.album        = "Music Has the Right to Children";
+        s.album_artist = s.artist;
+        s.track        = "Roygbiv";
+        s.track_number = "10";
+        s.uri          = "Boards of Canada/Music Has the Right to Children/"
+                "10 Roygbiv.flac";
+        s.duration     = 151;  // NOLINT
+        s.elapsed      = s.duration;
+        s.timestamp    = static_cast<time_t>(1'600'000'000 + i * 200);
+        return s;
+    }
+
+    void replay(mpdfm::engine &engine, const target &t, size_t first,
+                size_t count) {
+        for (auto i = first; i < first + count; i++) {
+            engine.scrobble(song(i));
+            engine.now_playing(song(i + 1));
+            wait_for(t, 2);
+        }
+    }
+}  // namespace
+
+int main(int argc, const char **argv) {  // NOLINT let exceptions terminate
+    gsl::span<const char *> args(argv, argc);
+    uint64_t budget = args.size() > 1 ? std::stoull(args[1]) : 0;
+    size_t events   = args.size() > 2 ? std::stoul(args[2]) : 500;  // NOLINT
+    if (!mpdfm::alloc::enabled) {
+        spdlog::error("built without -Dalloc_stats=true, nothing to count");
+        return 77;  // NOLINT meson's exit code for skipped
+    }
+    spdlog::set_level(spdlog::level::warn);
+
+    // before any thread is started
+    auto t = start_target();
+    auto dir =
+        fs::temp_directory_path() / fs::unique_path("mpdfm-bench-%%%%%%%%");
+    fs::create_directories(dir);
+
+    asio::io_context io;
+    auto work = asio::make_work_guard(io);
+    std::thread io_thread([&io]() { io.run(); });
+
+    int status = 0;
+    {
+        mpdfm::engine engine(io);
+        if (engine.add_scrobblers(
+                mpdfm::config_file(write_config(dir, t.port)))
+            != 1) {
+            throw std::runtime_error("cannot set up the webhook scrobbler");
+        }
+
+        replay(engine, t, 0, warmup);
+        auto before = mpdfm::alloc::get();
+        replay(engine, t, warmup, events);
+        auto used = mpdfm::alloc::difference(mpdfm::alloc::get(), before);
+
+        for (size_t i = 0; i < used.size(); i++) {
+            auto tag = static_cast<mpdfm::alloc::tag>(i);
+            fmt::print("{:<10} {:>8.1f} allocations {:>10.1f} bytes\n",
+                       mpdfm::alloc::tag_name(tag),
+                       static_cast<double>(used[i].allocations) / events,
+                       static_cast<double>(used[i].bytes) / events);
+        }
+        auto per_event =
+            static_cast<double>(mpdfm::alloc::total(used).allocations)
+            / events;
+        fmt::print("{:<10} {:>8.1f} allocations per song change\n", "total",
+                   per_event);
+        if (budget != 0 && per_event > static_cast<double>(budget)) {
+            spdlog::error("over the budget of {} allocations per song change",
+                          budget);
+            status = 1;
+        }
+
+        // the scrobbler's last completion handler may still be queued
+        work.reset();
+        io.stop();
+        io_thread.join();
+    }
+
+    kill(t.pid, SIGTERM);
+    waitpid(t.pid, nullptr, 0);
+    fs::remove_all(dir);
+    return status;
+}
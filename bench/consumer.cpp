@@ -0,0 +1,69 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file consumer.cpp
+ * \brief A program embedding the engine, built by installed_headers.sh
+ *        against an install of libmpdfm
+ *
+ * Uses every installed header, so one that includes something that isn't
+ * installed (an internal header, GSL, taocpp/json, libmpdclient) fails the
+ * build.
+ */
+#include <config/config_file.hpp>
+#include <engine.hpp>
+#include <filter.hpp>
+#include <registry.hpp>
+#include <scrobbler.hpp>
+
+namespace {
+    //! \brief The smallest scrobbler an embedder could bring
+    struct counter : mpdfm::scrobbler {
+        size_t scrobbles = 0;
+
+    protected:
+        void do_send_now_playing(const mpdfm::scrobble_entry & /*s*/)
+            override {}
+        void do_send_scrobble(const mpdfm::scrobble_entry & /*s*/) override {
+            scrobbles++;
+        }
+        bool do_check_preconditions(const mpdfm::scrobble_entry &s) override {
+            return mpdfm::meets_scrobble_rules(s);
+        }
+    };
+}  // namespace
+
+int main() {
+    boost::asio::io_context io;
+    mpdfm::engine engine(io);
+    auto owned = std::make_unique<counter>();
+    auto &c    = *owned;
+    engine.add_scrobbler(std::move(owned),
+                         mpdfm::parse_filter_rules("genre = podcast"),
+                         "counter");
+
+    mpdfm::scrobble_entry song;
+    song.artist   = "Artist";
+    song.track    = "Track";
+    song.duration = 200;  // NOLINT magic number
+    song.elapsed  = 200;  // NOLINT magic number
+    engine.scrobble(song);
+    song.genre = "Podcast";
+    engine.scrobble(song);
+    io.run();
+    return c.scrobbles == 1 ? 0 : 1;
+}
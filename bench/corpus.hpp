@@ -0,0 +1,149 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef BENCH_CORPUS_HPP
+#define BENCH_CORPUS_HPP
+
+#include <array>
+#include <random>
+#include <scrobbler.hpp>
+#include <string>
+#include <vector>
+
+/*!
+ * \brief Generated tags for the benchmarks
+ *
+ * Tags are made of words from a few scripts, so that encoding, escaping and
+ * hashing see multi-byte UTF-8 the way a real library does. The corpora are
+ * deterministic, every run benchmarks the same input.
+ */
+namespace mpdfm::bench {
+    enum class script { ascii, latin, cjk, mixed };
+
+    inline const char *script_name(script s) {
+        static const std::array<const char *, 4> names { "ascii", "latin",
+                                                         "cjk", "mixed" };
+        return names.at(static_cast<size_t>(s));
+    }
+
+    //! \brief Makes scrobble entries with tags in a given script
+    class corpus {
+    public:
+        explicit corpus(script s, unsigned seed = 42)  // NOLINT arbitrary
+            : m_script(s), m_random(seed) {}
+
+        //! \returns A random tag of one to four words
+        std::string tag() {
+            std::uniform_int_distribution<size_t> words(1, 4);
+            std::string result;
+            for (auto n = words(m_random); n > 0; n--) {
+                if (!result.empty()) {
+                    result += ' ';
+                }
+                result += word();
+            }
+            return result;
+        }
+
+        //! \returns An entry with every tag filled in, played in full
+        scrobble_entry entry() {
+            std::uniform_int_distribution<time_t> length(90, 600);  // NOLINT
+            scrobble_entry s;
+            s.artist       = tag();
+            s.album_artist = s.artist;
+            s.album        = tag();
+            s.track        = tag();
+            s.genre        = tag();
+            s.track_number = std::to_string(m_random() % 20 + 1);  // NOLINT
+            s.mbid         = "9b1c0b3f-3e4b-4fb3-a2c8-0d6d1c0e6a57";
+            s.uri          = s.album_artist + '/' + s.album + '/'
+                    + s.track_number + ' ' + s.track + ".flac";
+            s.duration  = length(m_random);
+            s.elapsed   = s.duration;
+            s.timestamp = m_next_timestamp;
+            m_next_timestamp += s.duration;
+            return s;
+        }
+
+        std::vector<scrobble_entry> entries(size_t n) {
+            std::vector<scrobble_entry> result;
+            result.reserve(n);
+            for (size_t i = 0; i < n; i++) {
+                result.push_back(entry());
+            }
+            return result;
+        }
+
+    private:
+        const std::string &word() {
+            static const std::vector<std::string> ascii {
+                "the",    "night", "river",   "echo",    "blue",
+                "static", "velvet", "machine", "summer", "garden",
+                "Live",   "Remastered", "(Demo)", "feat.", "&"
+            };
+            static const std::vector<std::string> latin {
+                "Café",    "Björk",  "Sigur Rós", "Mötley", "Déjà",
+                "Über",    "Øresund", "Ærø",      "Señor",  "Ça",
+                "François", "Łódź",   "Dvořák",    "Émilie", "Ñandú"
+            };
+            static const std::vector<std::string> cjk {
+                "東京",       "事変",     "椎名林檎",
+                "宇多田ヒカル", "夜に駆ける", "坂本龍一",
+                "周杰倫",     "방탄소년단", "아이유",
+                "初音ミク",   "青春",     "ライブ",
+                "交響曲",     "第九番",   "사랑"
+            };
+            static const std::vector<std::string> other {
+                "Кино",    "Звезда",  "Земфира", "Ελληνικά",
+                "Μίκης",   "עברית",   "العربية", "फ़िल्म",
+                "ไทย",      "🎵"
+            };
+
+            auto pick = [this](const std::vector<std::string> &pool)
+                -> const std::string & {
+                return pool[m_random() % pool.size()];
+            };
+            switch (m_script) {
+            case script::ascii:
+                return pick(ascii);
+            case script::latin:
+                return pick(latin);
+            case script::cjk:
+                return pick(cjk);
+            case script::mixed:
+                break;
+            }
+            // roughly what a large library looks like
+            auto roll = m_random() % 10;  // NOLINT
+            if (roll < 5) {               // NOLINT
+                return pick(ascii);
+            }
+            if (roll < 7) {  // NOLINT
+                return pick(latin);
+            }
+            if (roll < 9) {  // NOLINT
+                return pick(cjk);
+            }
+            return pick(other);
+        }
+
+        script m_script;
+        std::mt19937 m_random;
+        time_t m_next_timestamp = 1'600'000'000;  // NOLINT arbitrary
+    };
+}  // namespace mpdfm::bench
+
+#endif // BENCH_CORPUS_HPP
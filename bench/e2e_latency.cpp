@@ -0,0 +1,586 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file e2e_latency.cpp
+ * \brief Time from an MPD player event to the scrobbling targets getting it
+ *
+ * Runs the mpdfm binary against a mock MPD playing a timeline (see
+ * tools/mock_mpd.hpp) with two targets: a mock-as20 fed by an as20
+ * scrobbler (see tools/mock_as20.hpp) and a loopback HTTP target fed by a
+ * webhook scrobbler. Both run in this process, and every song change is
+ * timed through each stage, for each target:
+ *
+ * | stage      | from                          | to                        |
+ * |------------|-------------------------------|---------------------------|
+ * | mpd        | MPD switches songs            | mpdfm asks for currentsong|
+ * | dispatch   | mpdfm asks for currentsong    | target gets now playing   |
+ * | end to end | MPD switches songs            | target gets now playing   |
+ * | scrobble   | the next song starts          | target gets the scrobble  |
+ *
+ * Every song MPD plays gets a MusicBrainz track id made of its song id,
+ * replacing any the timeline gives it, and the targets are matched on that,
+ * so timelines may repeat titles. Song changes superseded before mpdfm
+ * asked about them are counted as coalesced, as MPD would report them as
+ * one event. Scrobbles only show up for songs played long enough by the
+ * clock, the default storm has none.
+ *
+ * ```
+ * e2e_latency MPDFM [--storm RATE:COUNT] [--script FILE] [--json FILE]
+ *             [--label NAME]
+ * ```
+ *
+ * The JSON has the percentiles of every stage in microseconds and the
+ * throughput, so that results of two builds can be compared.
+ */
+#include <algorithm>
+#include <array>
+#include <boost/asio/post.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/filesystem.hpp>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <gsl/gsl>
+#include <local_http.hpp>
+#include <map>
+#include <mock_as20.hpp>
+#include <mock_mpd.hpp>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <string_view>
+#include <sys/wait.h>
+#include <tao/json.hpp>
+#include <unistd.h>
+
+namespace {
+    namespace asio = boost::asio;
+    namespace fs   = boost::filesystem;
+    namespace as20 = mpdfm::tools::as20;
+    namespace mpd  = mpdfm::tools::mpd;
+    using clock    = std::chrono::steady_clock;
+
+    //! \brief How long to wait for stragglers once the timeline ran out
+    constexpr std::chrono::seconds drain_timeout { 10 };
+
+    //! \brief What mpdfm and mock-as20 agree on
+    constexpr const char *api_key     = "e2e-api-key";
+    constexpr const char *api_secret  = "e2e-api-secret";
+    constexpr const char *session_key = "e2e-session-key";
+
+    struct arguments {
+        std::string mpdfm;
+        std::string storm = "1200:600";  // 20 a second, for 30 seconds
+        std::string script;
+        std::string json;
+        std::string label;
+    };
+
+    //! \brief Where mpdfm sends song changes to
+    enum target : size_t { to_as20, to_webhook, targets };
+
+    constexpr std::array<const char *, targets> target_names { "as20",
+                                                               "webhook" };
+
+    //! \brief Prefix of the MusicBrainz track ids tagging every song
+    constexpr std::string_view tag_prefix = "00000000-0000-4000-8000-";
+
+    std::string tag(unsigned id) {
+        return fmt::format("{}{:012}", tag_prefix, id);
+    }
+
+    //! \returns The song id in \p mbid, if it is one of ours
+    std::optional<unsigned> untag(std::string_view mbid) {
+        if (mbid.substr(0, tag_prefix.size()) != tag_prefix) {
+            return std::nullopt;
+        }
+        return gsl::narrow<unsigned>(
+            std::stoul(std::string(mbid.substr(tag_prefix.size()))));
+    }
+
+    //! \brief When a song change got to a target
+    struct arrival {
+        std::optional<clock::time_point> now_playing;
+        std::optional<clock::time_point> scrobble;
+    };
+
+    //! \brief When a song change made it through each stage
+    struct song_change {
+        clock::time_point event;
+        std::optional<clock::time_point> query;
+        std::optional<clock::time_point> ended;
+        std::array<arrival, targets> arrivals;
+    };
+
+    struct summary {
+        size_t count = 0;
+        double p50   = 0;
+        double p99   = 0;
+        double p999  = 0;
+        double max   = 0;
+        double mean  = 0;
+    };
+
+    //! \returns Nearest rank percentiles of \p us, in microseconds
+    summary summarize(std::vector<double> us) {
+        summary s;
+        s.count = us.size();
+        if (us.empty()) {
+            return s;
+        }
+        std::sort(us.begin(), us.end());
+        auto at = [&us](double p) {
+            auto rank = static_cast<size_t>(
+                std::ceil(p * static_cast<double>(us.size())));
+            return us[std::clamp<size_t>(rank, 1, us.size()) - 1];
+        };
+        s.p50  = at(0.5);    // NOLINT
+        s.p99  = at(0.99);   // NOLINT
+        s.p999 = at(0.999);  // NOLINT
+        s.max  = us.back();
+        for (auto v : us) {
+            s.mean += v;
+        }
+        s.mean /= static_cast<double>(us.size());
+        return s;
+    }
+
+    double micros(clock::duration d) {
+        return std::chrono::duration<double, std::micro>(d).count();
+    }
+
+    //! \brief The harness: mock MPD and both targets, on one io_context
+    class harness {
+    public:
+        harness(const arguments &args, fs::path dir)
+            : m_binary(args.mpdfm),
+              m_dir(std::move(dir)),
+              m_target(
+                m_io, "127.0.0.1:0",
+                [this](auto &req) { return receive(req); },
+                "benchmark target"),
+              m_as20(m_io, as20_options()),
+              m_mpd(m_io, mpd_options(args)),
+              m_signals(m_io, SIGCHLD),
+              m_drain(m_io) {
+            m_as20.start();
+            m_mpd.start();
+            m_signals.async_wait([this](auto ec, int) {
+                if (!ec) {
+                    spdlog::error("mpdfm exited, see its log in {}",
+                                  m_dir.native());
+                    m_failed = true;
+                    m_io.stop();
+                }
+            });
+        }
+
+        //! \brief Plays the timeline, returns once all of it got through
+        void run(const std::string &config) {
+            m_mpdfm = spawn(config);
+            m_io.run();
+            kill(m_mpdfm, SIGTERM);
+            waitpid(m_mpdfm, nullptr, 0);
+        }
+
+        [[nodiscard]] unsigned short mpd_port() const {
+            return m_mpd.port();
+        }
+
+        [[nodiscard]] unsigned short target_port() const {
+            return m_target.port();
+        }
+
+        [[nodiscard]] unsigned short as20_port() const {
+            return m_as20.port();
+        }
+
+        [[nodiscard]] bool failed() const { return m_failed; }
+
+        //! \returns The results, as written with --json
+        tao::json::value results(const arguments &args) const {
+            //! \brief Microseconds of each stage through one target
+            struct stages_of {
+                std::vector<double> dispatch;
+                std::vector<double> end_to_end;
+                std::vector<double> scrobble;
+            };
+
+            std::vector<double> mpd;
+            std::array<stages_of, targets> through;
+            size_t coalesced = 0;
+            std::optional<clock::time_point> last;
+            for (auto &[id, c] : m_changes) {
+                if (!c.query) {
+                    coalesced++;
+                    continue;
+                }
+                mpd.push_back(micros(*c.query - c.event));
+                for (size_t t = 0; t < targets; t++) {
+                    auto &a = c.arrivals[t];
+                    if (a.now_playing) {
+                        through[t].dispatch.push_back(
+                            micros(*a.now_playing - *c.query));
+                        through[t].end_to_end.push_back(
+                            micros(*a.now_playing - c.event));
+                        last = std::max(last.value_or(*a.now_playing),
+                                        *a.now_playing);
+                    }
+                    if (c.ended && a.scrobble) {
+                        through[t].scrobble.push_back(
+                            micros(*a.scrobble - *c.ended));
+                    }
+                }
+            }
+
+            double seconds = 0;
+            if (m_start && last) {
+                seconds =
+                    std::chrono::duration<double>(*last - *m_start).count();
+            }
+            auto rate = [seconds](size_t n) {
+                return seconds > 0 ? static_cast<double>(n) / seconds : 0;
+            };
+            tao::json::value stages      = tao::json::empty_object;
+            tao::json::value now_playing = tao::json::empty_object;
+            tao::json::value scrobbles   = tao::json::empty_object;
+            auto add = [&stages](const std::string &name,
+                                 const std::vector<double> &values) {
+                auto s       = summarize(values);
+                stages[name] = tao::json::value {
+                    { "count", s.count },  { "p50_us", s.p50 },
+                    { "p99_us", s.p99 },   { "p999_us", s.p999 },
+                    { "max_us", s.max },   { "mean_us", s.mean },
+                };
+            };
+            add("mpd", mpd);
+            for (size_t t = 0; t < targets; t++) {
+                std::string name = target_names.at(t);
+                add(name + "_dispatch", through.at(t).dispatch);
+                add(name + "_end_to_end", through.at(t).end_to_end);
+                add(name + "_scrobble", through.at(t).scrobble);
+                now_playing[name] = through.at(t).end_to_end.size();
+                scrobbles[name]   = through.at(t).scrobble.size();
+            }
+            auto &primary = through.at(to_as20).end_to_end;
+            return {
+                { "label", args.label },
+                { "timeline", args.script.empty() ? "storm " + args.storm
+                                                  : args.script },
+                { "player_events", m_mpd.events() },
+                { "song_changes", m_changes.size() },
+                { "coalesced", coalesced },
+                { "now_playing", std::move(now_playing) },
+                { "scrobbles", std::move(scrobbles) },
+                { "unmatched", m_unmatched },
+                { "seconds", seconds },
+                { "song_changes_per_second", rate(primary.size()) },
+                { "player_events_per_second", rate(m_mpd.events()) },
+                { "stages", std::move(stages) },
+            };
+        }
+
+    private:
+        as20::options as20_options() {
+            as20::options opts;
+            opts.listen      = "127.0.0.1:0";
+            opts.api_key     = api_key;
+            opts.secret      = api_secret;
+            opts.session_key = session_key;
+            opts.seed        = 42;  // NOLINT
+            opts.on_request  = [this](const std::string &method,
+                                     const as20::params &p) {
+                acknowledged(method, p);
+            };
+            return opts;
+        }
+
+        mpd::options mpd_options(const arguments &args) {
+            mpd::options opts;
+            opts.listen = "127.0.0.1:0";
+            opts.seed   = 42;  // NOLINT the same timeline for every build
+            if (args.script.empty()) {
+                opts.storm = args.storm;
+            } else {
+                opts.script = args.script;
+            }
+            opts.on_song = [](mpd::song &s) {
+                auto mbid = tag(s.id);
+                for (auto &[name, value] : s.tags) {
+                    if (name == "MUSICBRAINZ_TRACKID") {
+                        value = std::move(mbid);
+                        return;
+                    }
+                }
+                s.tags.emplace_back("MUSICBRAINZ_TRACKID", std::move(mbid));
+            };
+            opts.on_change = [this](const mpd::player &p) {
+                changed(p);
+            };
+            opts.on_command = [this](const std::string &command) {
+                if (command == "idle" && !m_start) {
+                    // mpdfm is up and waiting, the clock starts now
+                    m_start = clock::now();
+                    asio::post(m_io, [this]() { m_mpd.play(); });
+                } else if (command == "currentsong") {
+                    queried();
+                }
+            };
+            opts.on_finish = [this]() {
+                m_finished = true;
+                m_drain.expires_after(drain_timeout);
+                m_drain.async_wait([this](auto ec) {
+                    if (!ec) {
+                        spdlog::warn("gave up waiting for the targets");
+                        m_io.stop();
+                    }
+                });
+                check_done();
+            };
+            return opts;
+        }
+
+        void changed(const mpd::player &p) {
+            auto now = clock::now();
+            if (!p.playing || (m_current && *m_current == p.playing->id)) {
+                return;  // pause, resume or seek
+            }
+            if (m_current) {
+                m_changes[*m_current].ended = now;
+            }
+            m_current = p.playing->id;
+            m_changes[p.playing->id].event = now;
+        }
+
+        //! \brief mpdfm asked for the current song, the latest one
+        void queried() {
+            if (!m_current) {
+                return;
+            }
+            auto &c = m_changes[*m_current];
+            if (!c.query) {
+                c.query = clock::now();
+            }
+        }
+
+        //! \brief Notes that \p t got the song tagged \p mbid
+        void arrived(target t, std::string_view mbid, bool scrobble) {
+            auto id = untag(mbid);
+            auto it = id ? m_changes.find(*id) : m_changes.end();
+            if (it == m_changes.end()) {
+                m_unmatched++;
+                return;
+            }
+            auto &a    = it->second.arrivals[t];
+            auto &when = scrobble ? a.scrobble : a.now_playing;
+            if (!when) {
+                when = clock::now();  // not a retry
+            }
+        }
+
+        void acknowledged(const std::string &method, const as20::params &p) {
+            if (method == "track.updateNowPlaying") {
+                auto mbid = p.find("mbid");
+                arrived(to_as20, mbid == p.end() ? "" : mbid->second, false);
+            } else if (method == "track.scrobble") {
+                for (size_t i = 0;; i++) {
+                    auto mbid = p.find("mbid[" + std::to_string(i) + ']');
+                    if (mbid == p.end()) {
+                        break;
+                    }
+                    arrived(to_as20, mbid->second, true);
+                }
+            }
+            check_done();
+        }
+
+        mpdfm::local_http_server::response receive(
+            const mpdfm::local_http_server::request &req) {
+            try {
+                auto body = tao::json::from_string(req.body());
+                arrived(to_webhook, body.at("mbid").get_string(),
+                        body.at("event").get_string() == "scrobble");
+            } catch (const std::exception &e) {
+                spdlog::warn("target: {}", e.what());
+                m_unmatched++;
+            }
+            check_done();
+
+            mpdfm::local_http_server::response res;
+            res.result(boost::beast::http::status::ok);
+            res.body() = "{}";
+            return res;
+        }
+
+        //! \brief Stops once every song mpdfm asked about got through
+        void check_done() {
+            if (!m_finished) {
+                return;
+            }
+            for (auto &[id, c] : m_changes) {
+                auto missing = [](auto &a) { return !a.now_playing; };
+                if (c.query
+                    && std::any_of(c.arrivals.begin(), c.arrivals.end(),
+                                   missing)) {
+                    return;
+                }
+            }
+            m_io.stop();
+        }
+
+        pid_t spawn(const std::string &config) {
+            auto log = (m_dir / "mpdfm.log").native();
+            auto pid = fork();
+            if (pid < 0) {
+                throw std::runtime_error("fork failed");
+            }
+            if (pid == 0) {
+                // NOLINTNEXTLINE the usual mode
+                int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                dup2(fd, STDOUT_FILENO);
+                dup2(fd, STDERR_FILENO);
+                // flight recorder dumps and the like stay in the directory
+                setenv("XDG_CONFIG_HOME", m_dir.c_str(), 1);
+                execl(m_binary.c_str(), m_binary.c_str(), config.c_str(),
+                      nullptr);
+                _exit(127);  // NOLINT as the shell does
+            }
+            return pid;
+        }
+
+        std::string m_binary;
+        fs::path m_dir;
+        asio::io_context m_io;
+        mpdfm::local_http_server m_target;
+        as20::server m_as20;
+        mpd::server m_mpd;
+        asio::signal_set m_signals;
+        asio::steady_timer m_drain;
+        pid_t m_mpdfm = -1;
+
+        std::map<unsigned, song_change> m_changes;
+        std::optional<unsigned> m_current;
+        std::optional<clock::time_point> m_start;
+        size_t m_unmatched = 0;
+        bool m_finished    = false;
+        bool m_failed      = false;
+    };
+}  // namespace
+
+namespace {
+    arguments parse_arguments(gsl::span<const char *> args) {
+        if (args.size() < 2) {
+            throw std::runtime_error(
+                "usage: e2e_latency MPDFM [--storm RATE:COUNT] "
+                "[--script FILE] [--json FILE] [--label NAME]");
+        }
+        arguments a;
+        a.mpdfm = args[1];
+        for (size_t i = 2; i + 1 < args.size(); i += 2) {
+            std::string_view flag(args[i]);
+            if (flag == "--storm") {
+                a.storm = args[i + 1];
+            } else if (flag == "--script") {
+                a.script = args[i + 1];
+            } else if (flag == "--json") {
+                a.json = args[i + 1];
+            } else if (flag == "--label") {
+                a.label = args[i + 1];
+            } else {
+                throw std::runtime_error("unknown option "
+                                         + std::string(flag));
+            }
+        }
+        return a;
+    }
+
+    std::string write_config(const fs::path &dir, const harness &h) {
+        auto path = (dir / "mpdfm.cfg").native();
+        std::ofstream cfg(path);
+        cfg << "mpd_host = \"127.0.0.1\"\n"
+            << "mpd_port = \"" << h.mpd_port() << "\"\n"
+            << "as20 {\n"
+            << "    url = \"http://127.0.0.1:" << h.as20_port() << "/2.0/\"\n"
+            << "    api_key = \"" << api_key << "\"\n"
+            << "    api_secret = \"" << api_secret << "\"\n"
+            << "    session = \"" << session_key << "\"\n"
+            << "    store = \"" << (dir / "as20.cache").native() << "\"\n"
+            << "}\n"
+            << "webhook {\n"
+            << "    url = \"http://127.0.0.1:" << h.target_port()
+            << "/plays\"\n"
+            << R"(    template = "{\"event\":\"${event}\",)"
+            << R"(\"mbid\":\"${mbid}\"}")" << '\n'
+            << "    store = \"" << (dir / "webhook.cache").native()
+            << "\"\n"
+            << "}\n";
+        return path;
+    }
+
+    void print(const tao::json::value &results) {
+        fmt::print("{:<18} {:>8} {:>10} {:>10} {:>10} {:>10}\n", "stage",
+                   "count", "p50 us", "p99 us", "p999 us", "max us");
+        for (auto &[name, s] : results.at("stages").get_object()) {
+            fmt::print("{:<18} {:>8} {:>10.0f} {:>10.0f} {:>10.0f} "
+                       "{:>10.0f}\n",
+                       name, s.at("count").as<uint64_t>(),
+                       s.at("p50_us").as<double>(),
+                       s.at("p99_us").as<double>(),
+                       s.at("p999_us").as<double>(),
+                       s.at("max_us").as<double>());
+        }
+        fmt::print("{} song changes, {} coalesced, {:.1f} a second "
+                   "through to as20 ({:.1f} player events a second)\n",
+                   results.at("song_changes").as<uint64_t>(),
+                   results.at("coalesced").as<uint64_t>(),
+                   results.at("song_changes_per_second").as<double>(),
+                   results.at("player_events_per_second").as<double>());
+    }
+}  // namespace
+
+int main(int argc, const char **argv) {  // NOLINT let exceptions terminate
+    auto args = parse_arguments(gsl::span<const char *>(argv, argc));
+    spdlog::set_level(spdlog::level::warn);
+
+    auto dir =
+        fs::temp_directory_path() / fs::unique_path("mpdfm-e2e-%%%%%%%%");
+    fs::create_directories(dir);
+
+    harness h(args, dir);
+    h.run(write_config(dir, h));
+    if (h.failed()) {
+        return 1;  // the directory is kept for mpdfm's log
+    }
+
+    auto results = h.results(args);
+    print(results);
+    if (!args.json.empty()) {
+        std::ofstream out(args.json);
+        out << tao::json::to_string(results, 2) << '\n';
+    }
+    fs::remove_all(dir);
+    for (auto &[name, n] : results.at("now_playing").get_object()) {
+        if (n.as<uint64_t>() == 0) {
+            spdlog::error("nothing got through to {}", name);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,334 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file footprint.cpp
+ * \brief Runs the mpdfm binary with the small profile, checks that it
+ *        starts, follows the player and shuts down, and that it stays within
+ *        its memory budget
+ *
+ * The small profile runs everything on the main thread, so anything
+ * keeping the io_context busy past the end either hangs startup or
+ * shutdown. The first run has the sections with long-lived operations
+ * (the control socket, event_socket and stats), which have to wind down on
+ * SIGTERM. The second run has a single as20 scrobbler, against mock-as20
+ * (see tools/mock_as20.hpp), and samples RssAnon and VmHWM from
+ * /proc/PID/status as it goes.
+ *
+ * The budget is for RssAnon, the heap and stacks, as that is what mpdfm
+ * controls. VmHWM also counts the pages of the shared libraries it maps
+ * (libstdc++, OpenSSL, boost and spdlog alone are about 5.5MB), so it is
+ * only printed.
+ *
+ * ```
+ * footprint MPDFM [BUDGET_KIB]
+ * ```
+ *
+ * Fails if mpdfm doesn't start idling within 10 seconds, exits early,
+ * doesn't exit cleanly within 10 seconds of SIGTERM, or if its RssAnon
+ * goes above BUDGET_KIB, 2048 unless given.
+ */
+#include <algorithm>
+#include <boost/asio/post.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/filesystem.hpp>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <gsl/gsl>
+#include <mock_as20.hpp>
+#include <mock_mpd.hpp>
+#include <spdlog/spdlog.h>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+    namespace asio = boost::asio;
+    namespace as20 = mpdfm::tools::as20;
+    namespace fs   = boost::filesystem;
+    namespace mpd  = mpdfm::tools::mpd;
+
+    constexpr std::chrono::seconds startup_timeout { 10 };
+    constexpr std::chrono::seconds shutdown_timeout { 10 };
+    constexpr std::chrono::milliseconds sample_interval { 50 };
+
+    //! \brief The README's target, 2MB RssAnon with a single as20 scrobbler
+    constexpr uint64_t default_budget_kib = 2 * 1024;
+
+    //! \brief What mpdfm and mock-as20 agree on
+    constexpr const char *api_key     = "footprint-api-key";
+    constexpr const char *api_secret  = "footprint-api-secret";
+    constexpr const char *session_key = "footprint-session-key";
+
+    //! \brief Mock MPD, mock-as20 and the mpdfm process, on one io_context
+    class harness {
+    public:
+        harness(std::string binary, fs::path dir)
+            : m_binary(std::move(binary)),
+              m_dir(std::move(dir)),
+              m_as20(m_io, as20_options()),
+              m_mpd(m_io, mpd_options()),
+              m_signals(m_io, SIGCHLD),
+              m_deadline(m_io),
+              m_sampler(m_io) {
+            m_as20.start();
+            m_mpd.start();
+        }
+
+        //! \returns Whether mpdfm went through the timeline and exited
+        bool run(const std::string &config) {
+            m_mpdfm = spawn(config);
+            wait_exit();
+            expect("start idling", startup_timeout);
+            sample_every(sample_interval);
+            m_io.run();
+            if (m_mpdfm > 0) {
+                kill(m_mpdfm, SIGKILL);
+                waitpid(m_mpdfm, nullptr, 0);
+            }
+            return m_passed;
+        }
+
+        [[nodiscard]] unsigned short mpd_port() const {
+            return m_mpd.port();
+        }
+
+        [[nodiscard]] unsigned short as20_port() const {
+            return m_as20.port();
+        }
+
+        //! \returns The highest RssAnon seen, in KiB
+        [[nodiscard]] uint64_t anon_kib() const { return m_anon_kib; }
+
+        //! \returns The highest VmHWM seen, in KiB
+        [[nodiscard]] uint64_t peak_kib() const { return m_peak_kib; }
+
+    private:
+        static as20::options as20_options() {
+            as20::options opts;
+            opts.listen      = "127.0.0.1:0";
+            opts.api_key     = api_key;
+            opts.secret      = api_secret;
+            opts.session_key = session_key;
+            opts.seed        = 42;  // NOLINT
+            return opts;
+        }
+
+        mpd::options mpd_options() {
+            mpd::options opts;
+            opts.listen = "127.0.0.1:0";
+            opts.seed   = 42;        // NOLINT the same timeline every run
+            opts.storm  = "600:20";  // NOLINT 10 a second, for 2 seconds
+            opts.on_command = [this](const std::string &command) {
+                if (command == "idle" && !m_idling) {
+                    m_idling = true;
+                    m_deadline.cancel();
+                    asio::post(m_io, [this]() { m_mpd.play(); });
+                }
+            };
+            opts.on_finish = [this]() {
+                sample();
+                m_stopping = true;
+                kill(m_mpdfm, SIGTERM);
+                expect("exit after SIGTERM", shutdown_timeout);
+            };
+            return opts;
+        }
+
+        //! \brief Fails unless the deadline is cancelled within \p timeout
+        void expect(const char *what, std::chrono::seconds timeout) {
+            m_deadline.expires_after(timeout);
+            m_deadline.async_wait([this, what, timeout](auto ec) {
+                if (!ec) {
+                    spdlog::error("mpdfm did not {} within {}s, see its log "
+                                  "in {}",
+                                  what, timeout.count(), m_dir.native());
+                    m_io.stop();
+                }
+            });
+        }
+
+        //! \brief Reads RssAnon and VmHWM of mpdfm while it runs
+        void sample() {
+            if (m_mpdfm <= 0 || m_stopping) {
+                return;
+            }
+            std::ifstream status("/proc/" + std::to_string(m_mpdfm)
+                                 + "/status");
+            std::string line;
+            while (std::getline(status, line)) {
+                std::istringstream in(line);
+                std::string name;
+                uint64_t kib = 0;
+                in >> name >> kib;
+                if (name == "RssAnon:") {
+                    m_anon_kib = std::max(m_anon_kib, kib);
+                } else if (name == "VmHWM:") {
+                    m_peak_kib = std::max(m_peak_kib, kib);
+                }
+            }
+        }
+
+        void sample_every(std::chrono::milliseconds interval) {
+            m_sampler.expires_after(interval);
+            m_sampler.async_wait([this, interval](auto ec) {
+                if (ec || m_mpdfm <= 0) {
+                    return;
+                }
+                sample();
+                sample_every(interval);
+            });
+        }
+
+        void wait_exit() {
+            m_signals.async_wait([this](auto ec, int) {
+                if (ec) {
+                    return;
+                }
+                int status = 0;
+                if (waitpid(m_mpdfm, &status, WNOHANG) != m_mpdfm) {
+                    wait_exit();
+                    return;
+                }
+                m_mpdfm = -1;
+                m_sampler.cancel();
+                m_passed = m_stopping && WIFEXITED(status)
+                           && WEXITSTATUS(status) == 0;
+                if (!m_passed) {
+                    spdlog::error("mpdfm exited {}with status {:#x}, see "
+                                  "its log in {}",
+                                  m_stopping ? "" : "early ", status,
+                                  m_dir.native());
+                }
+                m_io.stop();
+            });
+        }
+
+        pid_t spawn(const std::string &config) {
+            auto log = (m_dir / "mpdfm.log").native();
+            auto pid = fork();
+            if (pid < 0) {
+                throw std::runtime_error("fork failed");
+            }
+            if (pid == 0) {
+                // NOLINTNEXTLINE the usual mode
+                int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                dup2(fd, STDOUT_FILENO);
+                dup2(fd, STDERR_FILENO);
+                // flight recorder dumps and the like stay in the directory
+                setenv("XDG_CONFIG_HOME", m_dir.c_str(), 1);
+                execl(m_binary.c_str(), m_binary.c_str(), config.c_str(),
+                      nullptr);
+                _exit(127);  // NOLINT as the shell does
+            }
+            return pid;
+        }
+
+        std::string m_binary;
+        fs::path m_dir;
+        asio::io_context m_io;
+        as20::server m_as20;
+        mpd::server m_mpd;
+        asio::signal_set m_signals;
+        asio::steady_timer m_deadline;
+        asio::steady_timer m_sampler;
+        pid_t m_mpdfm       = -1;
+        bool m_idling       = false;
+        bool m_stopping     = false;
+        bool m_passed       = false;
+        uint64_t m_anon_kib = 0;
+        uint64_t m_peak_kib = 0;
+    };
+
+    //! \brief The sections that have to wind down on SIGTERM
+    std::string write_config(const fs::path &dir, const harness &h) {
+        auto path = (dir / "mpdfm.cfg").native();
+        std::ofstream cfg(path);
+        cfg << "mpd_host = \"127.0.0.1\"\n"
+            << "mpd_port = \"" << h.mpd_port() << "\"\n"
+            << "profile = \"small\"\n"
+            << "control = \"" << (dir / "control.sock").native() << "\"\n"
+            << "event_socket {\n"
+            << "    path = \"" << (dir / "events.sock").native() << "\"\n"
+            << "}\n"
+            << "stats {\n"
+            << "    path = \"" << (dir / "stats.json").native() << "\"\n"
+            << "}\n";
+        return path;
+    }
+
+    //! \brief What the memory budget is for, a single as20 scrobbler
+    std::string write_budget_config(const fs::path &dir, const harness &h) {
+        auto path = (dir / "budget.cfg").native();
+        std::ofstream cfg(path);
+        cfg << "mpd_host = \"127.0.0.1\"\n"
+            << "mpd_port = \"" << h.mpd_port() << "\"\n"
+            << "profile = \"small\"\n"
+            << "as20 {\n"
+            << "    url = \"http://127.0.0.1:" << h.as20_port() << "/2.0/\"\n"
+            << "    api_key = \"" << api_key << "\"\n"
+            << "    api_secret = \"" << api_secret << "\"\n"
+            << "    session = \"" << session_key << "\"\n"
+            << "    store = \"" << (dir / "as20.cache").native() << "\"\n"
+            << "}\n";
+        return path;
+    }
+}  // namespace
+
+int main(int argc, const char **argv) {  // NOLINT let exceptions terminate
+    gsl::span<const char *> args(argv, argc);
+    if (args.size() != 2 && args.size() != 3) {
+        spdlog::error("usage: footprint MPDFM [BUDGET_KIB]");
+        return 2;
+    }
+    auto budget = args.size() == 3 ? std::stoull(args[2]) : default_budget_kib;
+    spdlog::set_level(spdlog::level::warn);
+
+    auto dir = fs::temp_directory_path()
+               / fs::unique_path("mpdfm-footprint-%%%%%%%%");
+    fs::create_directories(dir);
+
+    {
+        harness h(args[1], dir);
+        if (!h.run(write_config(dir, h))) {
+            return 1;  // the directory is kept for mpdfm's log
+        }
+    }
+
+    harness h(args[1], dir);
+    if (!h.run(write_budget_config(dir, h))) {
+        return 1;
+    }
+    fmt::print("peak RssAnon {} KiB, budget {} KiB, peak RSS (VmHWM) {} KiB\n",
+               h.anon_kib(), budget, h.peak_kib());
+    if (h.anon_kib() == 0) {
+        spdlog::error("could not read mpdfm's /proc/PID/status");
+        return 1;
+    }
+    if (h.anon_kib() > budget) {
+        spdlog::error("mpdfm went over its memory budget, see its log in {}",
+                      dir.native());
+        return 1;
+    }
+    fs::remove_all(dir);
+    return 0;
+}
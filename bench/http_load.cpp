@@ -0,0 +1,575 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file http_load.cpp
+ * \brief Load generator for http_request, against a loopback server
+ *
+ * Keeps a number of request streams going at once, each one firing its
+ * next request as soon as the previous one finished, over HTTP and then
+ * HTTPS. The server runs in a child process, so the CPU time and
+ * allocations reported are the client's alone. For each variant it prints
+ * requests a second, the latency distribution (total and per phase), CPU
+ * time per request, connections opened and, in builds configured with
+ * `-Dalloc_stats=true`, allocations per request.
+ *
+ * http_request opens a connection per request, so today's numbers are the
+ * baseline to measure connection pooling, pipelining or HTTP/2 against.
+ *
+ * ```
+ * http_load [--concurrency N] [--requests N] [--body BYTES]
+ *           [--only http|https] [--json FILE]
+ * ```
+ */
+#include <algorithm>
+#include <alloc_stats.hpp>
+#include <array>
+#include <boost/asio/signal_set.hpp>
+#include <boost/beast/http.hpp>
+#include <cmath>
+#include <csignal>
+#include <fstream>
+#include <gsl/gsl>
+#include <http_client.hpp>
+#include <metrics.hpp>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <tao/json.hpp>
+#include <unistd.h>
+#include <uris.hpp>
+
+namespace {
+    namespace asio = boost::asio;
+    namespace ssl  = boost::asio::ssl;
+    namespace http = boost::beast::http;
+    using boost::asio::ip::tcp;
+    using clock = std::chrono::steady_clock;
+    using mpdfm::metrics::histogram;
+
+    struct arguments {
+        size_t concurrency = 32;     // NOLINT
+        size_t requests    = 10000;  // NOLINT per variant
+        size_t body        = 256;    // NOLINT about a scrobble
+        std::string only;
+        std::string json;
+    };
+
+    //! \brief Connections the server accepted, shared with the parent
+    struct accepted {
+        std::atomic<uint64_t> plain { 0 };
+        std::atomic<uint64_t> tls { 0 };
+    };
+
+    //! \brief A throwaway self signed certificate, in PEM
+    struct certificate {
+        std::string cert;
+        std::string key;
+    };
+
+    template<typename T, void (*Free)(T *)>
+    using openssl_ptr = std::unique_ptr<T, std::integral_constant<
+                                               decltype(Free), Free>>;
+
+    std::string to_pem(const std::function<int(BIO *)> &write) {
+        openssl_ptr<BIO, BIO_free_all> bio(BIO_new(BIO_s_mem()));
+        if (!bio || write(bio.get()) != 1) {
+            throw std::runtime_error("cannot write PEM");
+        }
+        char *data = nullptr;
+        auto size  = BIO_get_mem_data(bio.get(), &data);
+        return { data, static_cast<size_t>(size) };
+    }
+
+    certificate make_certificate() {
+        openssl_ptr<EVP_PKEY_CTX, EVP_PKEY_CTX_free> kctx(
+            EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr));
+        EVP_PKEY *raw = nullptr;
+        if (!kctx || EVP_PKEY_keygen_init(kctx.get()) <= 0
+            || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(
+                   kctx.get(), NID_X9_62_prime256v1)
+                   <= 0
+            || EVP_PKEY_keygen(kctx.get(), &raw) <= 0) {
+            throw std::runtime_error("cannot generate a key");
+        }
+        openssl_ptr<EVP_PKEY, EVP_PKEY_free> key(raw);
+
+        openssl_ptr<X509, X509_free> cert(X509_new());
+        X509_set_version(cert.get(), 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert.get()), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert.get()), 86400);  // NOLINT
+        X509_set_pubkey(cert.get(), key.get());
+        auto *name = X509_get_subject_name(cert.get());
+        X509_NAME_add_entry_by_txt(
+            name, "CN", MBSTRING_ASC,
+            // NOLINTNEXTLINE OpenSSL wants bytes
+            reinterpret_cast<const unsigned char *>("127.0.0.1"), -1, -1, 0);
+        X509_set_issuer_name(cert.get(), name);
+        if (X509_sign(cert.get(), key.get(), EVP_sha256()) == 0) {
+            throw std::runtime_error("cannot sign the certificate");
+        }
+
+        return { to_pem([&](BIO *b) {
+                     return PEM_write_bio_X509(b, cert.get());
+                 }),
+                 to_pem([&](BIO *b) {
+                     return PEM_write_bio_PrivateKey(b, key.get(), nullptr,
+                                                     nullptr, 0, nullptr,
+                                                     nullptr);
+                 }) };
+    }
+
+    //! \brief One server connection, over TCP or TLS
+    template<typename Stream>
+    class session : public std::enable_shared_from_this<session<Stream>> {
+    public:
+        explicit session(Stream stream) : m_stream(std::move(stream)) {}
+
+        void start() {
+            if constexpr (std::is_same_v<Stream, tcp::socket>) {
+                read();
+            } else {
+                m_stream.async_handshake(
+                    ssl::stream_base::server,
+                    [self = this->shared_from_this()](auto ec) {
+                        if (!ec) {
+                            self->read();
+                        }
+                    });
+            }
+        }
+
+    private:
+        void read() {
+            m_req = {};
+            http::async_read(m_stream, m_buffer, m_req,
+                             [self = this->shared_from_this()](auto ec,
+                                                               size_t) {
+                                 if (!ec) {
+                                     self->respond();
+                                 }
+                             });
+        }
+
+        void respond() {
+            m_res = { http::status::ok, m_req.version() };
+            m_res.set(http::field::content_type, "application/json");
+            m_res.keep_alive(m_req.keep_alive());
+            m_res.body() = R"({"ok":true})";
+            m_res.prepare_payload();
+            http::async_write(m_stream, m_res,
+                              [self = this->shared_from_this()](auto ec,
+                                                                size_t) {
+                                  if (!ec && !self->m_res.need_eof()) {
+                                      self->read();
+                                  }
+                              });
+        }
+
+        Stream m_stream;
+        boost::beast::flat_buffer m_buffer;
+        http::request<http::string_body> m_req;
+        http::response<http::string_body> m_res;
+    };
+
+    void accept(tcp::acceptor &acceptor, ssl::context *tls,
+                std::atomic<uint64_t> &count) {
+        acceptor.async_accept([&acceptor, tls, &count](auto ec,
+                                                       tcp::socket socket) {
+            if (ec == asio::error::operation_aborted) {
+                return;
+            }
+            if (!ec) {
+                count.fetch_add(1, std::memory_order_relaxed);
+                socket.set_option(tcp::no_delay(true), ec);
+                if (tls != nullptr) {
+                    using stream = ssl::stream<tcp::socket>;
+                    std::make_shared<session<stream>>(
+                        stream(std::move(socket), *tls))
+                        ->start();
+                } else {
+                    std::make_shared<session<tcp::socket>>(std::move(socket))
+                        ->start();
+                }
+            }
+            accept(acceptor, tls, count);
+        });
+    }
+
+    //! \brief The loopback server, in a child process
+    struct server {
+        pid_t pid;
+        std::array<unsigned short, 2> ports;  // HTTP, HTTPS
+        accepted *connections;
+    };
+
+    server start_server(const certificate &cert) {
+        // NOLINTNEXTLINE shared with the child
+        auto *shared = static_cast<accepted *>(
+            mmap(nullptr, sizeof(accepted), PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0));
+        if (shared == MAP_FAILED) {
+            throw std::runtime_error("mmap failed");
+        }
+        new (shared) accepted;
+
+        std::array<int, 2> port_pipe {};
+        if (pipe(port_pipe.data()) != 0) {
+            throw std::runtime_error("pipe failed");
+        }
+        auto pid = fork();
+        if (pid < 0) {
+            throw std::runtime_error("fork failed");
+        }
+        if (pid == 0) {
+            asio::io_context io;
+            ssl::context tls(ssl::context::tls_server);
+            tls.use_certificate_chain(asio::buffer(cert.cert));
+            tls.use_private_key(asio::buffer(cert.key), ssl::context::pem);
+
+            auto loopback = asio::ip::make_address("127.0.0.1");
+            tcp::acceptor plain_acceptor(io, { loopback, 0 });
+            tcp::acceptor tls_acceptor(io, { loopback, 0 });
+            for (auto *a : { &plain_acceptor, &tls_acceptor }) {
+                a->listen(asio::socket_base::max_listen_connections);
+            }
+            accept(plain_acceptor, nullptr, shared->plain);
+            accept(tls_acceptor, &tls, shared->tls);
+
+            std::array<unsigned short, 2> ports {
+                plain_acceptor.local_endpoint().port(),
+                tls_acceptor.local_endpoint().port()
+            };
+            static_cast<void>(
+                write(port_pipe[1], ports.data(), sizeof(ports)));
+            io.run();
+            _exit(0);
+        }
+
+        server s { pid, {}, shared };
+        if (read(port_pipe[0], s.ports.data(), sizeof(s.ports))
+            != sizeof(s.ports)) {
+            throw std::runtime_error("loopback server failed to start");
+        }
+        close(port_pipe[0]);
+        close(port_pipe[1]);
+        return s;
+    }
+
+    using request = mpdfm::http_request<http::string_body, http::string_body>;
+
+    //! \brief Keeps concurrency requests going until total were made
+    class load {
+    public:
+        load(asio::io_context &io, ssl::context &tls, mpdfm::uri uri,
+             const arguments &args, size_t total)
+            : m_io(io),
+              m_tls(tls),
+              m_uri(std::move(uri)),
+              m_body(args.body, 'x'),
+              m_total(total),
+              m_concurrency(args.concurrency) {}
+
+        //! \brief Runs all of the requests, returns once they finished
+        void run() {
+            for (size_t i = 0; i < m_concurrency; i++) {
+                next();
+            }
+            m_io.restart();
+            m_io.run();
+        }
+
+        [[nodiscard]] const histogram &latency() const { return m_latency; }
+        [[nodiscard]] uint64_t errors() const { return m_errors; }
+
+    private:
+        void next() {
+            if (m_started == m_total) {
+                return;
+            }
+            m_started++;
+            auto http = request::make(m_uri, m_io, m_tls);
+            http->request().method(http::verb::post);
+            http->request().set(http::field::content_type,
+                                "application/x-www-form-urlencoded");
+            http->request().body() = m_body;
+            http->run([this, begin = clock::now()](auto http, auto ec) {
+                m_latency.observe(clock::now() - begin);
+                if (ec || http->response().result() != http::status::ok) {
+                    if (m_errors++ == 0) {
+                        spdlog::error("request failed: {}",
+                                      ec ? ec.message()
+                                         : std::to_string(
+                                             http->response().result_int()));
+                    }
+                }
+                next();
+            });
+        }
+
+        asio::io_context &m_io;
+        ssl::context &m_tls;
+        mpdfm::uri m_uri;
+        std::string m_body;
+        size_t m_total;
+        size_t m_concurrency;
+        size_t m_started  = 0;
+        uint64_t m_errors = 0;
+        histogram m_latency;
+    };
+
+    //! \returns Histogram counts in \p after but not in \p before
+    histogram::snapshot difference(const histogram::snapshot &after,
+                                   const histogram::snapshot &before) {
+        histogram::snapshot d;
+        for (size_t i = 0; i < d.counts.size(); i++) {
+            d.counts[i] = after.counts[i] - before.counts[i];
+        }
+        d.count  = after.count - before.count;
+        d.sum_us = after.sum_us - before.sum_us;
+        return d;
+    }
+
+    //! \returns The upper bound of the bucket holding percentile \p p, in us
+    uint64_t percentile(const histogram::snapshot &s, double p) {
+        auto rank = static_cast<uint64_t>(
+            std::ceil(p * static_cast<double>(s.count)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < s.counts.size(); i++) {
+            seen += s.counts[i];
+            if (seen >= std::max<uint64_t>(rank, 1)) {
+                return histogram::upper_bound(i);
+            }
+        }
+        return 0;
+    }
+
+    tao::json::value percentiles(const histogram::snapshot &s) {
+        return {
+            { "p50_us", percentile(s, 0.5) },    // NOLINT
+            { "p90_us", percentile(s, 0.9) },    // NOLINT
+            { "p99_us", percentile(s, 0.99) },   // NOLINT
+            { "p999_us", percentile(s, 0.999) }, // NOLINT
+            { "max_us", percentile(s, 1) },
+            { "mean_us",
+              s.count == 0 ? 0.0
+                           : static_cast<double>(s.sum_us)
+                                 / static_cast<double>(s.count) },
+        };
+    }
+
+    double cpu_seconds() {
+        rusage usage {};
+        getrusage(RUSAGE_SELF, &usage);
+        auto seconds = [](const timeval &t) {
+            return static_cast<double>(t.tv_sec)
+                   + static_cast<double>(t.tv_usec) / 1e6;  // NOLINT
+        };
+        return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+    }
+
+    std::array<histogram::snapshot, 4> phase_snapshots() {
+        std::array<histogram::snapshot, 4> s;
+        for (size_t i = 0; i < s.size(); i++) {
+            s[i] = mpdfm::internal::http_phase_latency(
+                       static_cast<mpdfm::internal::http_phase>(i))
+                       .collect();
+        }
+        return s;
+    }
+
+    //! \brief Runs one variant, \returns its results
+    tao::json::value run_variant(const std::string &scheme,
+                                 unsigned short port,
+                                 std::atomic<uint64_t> &connections,
+                                 ssl::context &tls, const arguments &args) {
+        asio::io_context io;
+        mpdfm::uri uri(fmt::format("{}://127.0.0.1:{}/load", scheme, port));
+
+        // warm up the allocator, the TLS session code and the server
+        load(io, tls, uri, args, args.concurrency * 4).run();
+
+        load measured(io, tls, uri, args, args.requests);
+        auto phases_before      = phase_snapshots();
+        auto allocations_before = mpdfm::alloc::get();
+        auto connections_before = connections.load();
+        auto cpu_before         = cpu_seconds();
+        mpdfm::metrics::stopwatch wall;
+
+        measured.run();
+
+        auto seconds = std::chrono::duration<double>(wall.elapsed()).count();
+        auto cpu     = cpu_seconds() - cpu_before;
+        auto opened  = connections.load() - connections_before;
+        auto used    = mpdfm::alloc::difference(mpdfm::alloc::get(),
+                                                allocations_before);
+        auto phases_after = phase_snapshots();
+
+        auto n       = static_cast<double>(args.requests);
+        auto latency = measured.latency().collect();
+        tao::json::value buckets = tao::json::empty_array;
+        for (size_t i = 0; i < latency.counts.size(); i++) {
+            if (latency.counts[i] != 0) {
+                buckets.push_back(tao::json::value::array(
+                    { histogram::upper_bound(i), latency.counts[i] }));
+            }
+        }
+        tao::json::value phases = tao::json::empty_object;
+        for (size_t i = 0; i < phases_after.size(); i++) {
+            auto d = difference(phases_after[i], phases_before[i]);
+            if (d.count != 0) {
+                phases[mpdfm::internal::http_phase_name(
+                    static_cast<mpdfm::internal::http_phase>(i))] =
+                    percentiles(d);
+            }
+        }
+        tao::json::value result {
+            { "requests", args.requests },
+            { "concurrency", args.concurrency },
+            { "body_bytes", args.body },
+            { "errors", measured.errors() },
+            { "seconds", seconds },
+            { "requests_per_second", n / seconds },
+            { "cpu_us_per_request", cpu * 1e6 / n },  // NOLINT
+            { "connections", opened },
+            { "requests_per_connection",
+              opened == 0 ? 0.0 : n / static_cast<double>(opened) },
+            { "latency", percentiles(latency) },
+            { "histogram", std::move(buckets) },
+            { "phases", std::move(phases) },
+        };
+        if (mpdfm::alloc::enabled) {
+            auto total = mpdfm::alloc::total(used);
+            result["allocations_per_request"] =
+                static_cast<double>(total.allocations) / n;
+            result["bytes_per_request"] = static_cast<double>(total.bytes) / n;
+        }
+        return result;
+    }
+
+    void print(const std::string &name, const tao::json::value &r) {
+        auto &l = r.at("latency");
+        fmt::print("{}: {:.0f} requests/s, {:.1f} us CPU per request, "
+                   "{} connections, {} errors\n",
+                   name, r.at("requests_per_second").as<double>(),
+                   r.at("cpu_us_per_request").as<double>(),
+                   r.at("connections").as<uint64_t>(),
+                   r.at("errors").as<uint64_t>());
+        if (r.get_object().count("allocations_per_request") != 0) {
+            fmt::print("  {:.1f} allocations, {:.0f} bytes per request\n",
+                       r.at("allocations_per_request").as<double>(),
+                       r.at("bytes_per_request").as<double>());
+        }
+        fmt::print("  {:<8} {:>8} {:>8} {:>8} {:>8} {:>8}\n", "us", "p50",
+                   "p90", "p99", "p999", "max");
+        auto row = [](const std::string &what, const tao::json::value &p) {
+            fmt::print("  {:<8} {:>8} {:>8} {:>8} {:>8} {:>8}\n", what,
+                       p.at("p50_us").as<uint64_t>(),
+                       p.at("p90_us").as<uint64_t>(),
+                       p.at("p99_us").as<uint64_t>(),
+                       p.at("p999_us").as<uint64_t>(),
+                       p.at("max_us").as<uint64_t>());
+        };
+        row("request", l);
+        for (auto &[phase, p] : r.at("phases").get_object()) {
+            row(phase, p);
+        }
+
+        // one line per non-empty bucket, with a bar scaled to the largest
+        uint64_t most = 0;
+        for (auto &b : r.at("histogram").get_array()) {
+            most = std::max(most, b.at(1).as<uint64_t>());
+        }
+        for (auto &b : r.at("histogram").get_array()) {
+            auto count = b.at(1).as<uint64_t>();
+            fmt::print("  <= {:>8} us {:>8} {}\n", b.at(0).as<uint64_t>(),
+                       count, std::string(count * 50 / most, '#'));  // NOLINT
+        }
+    }
+
+    arguments parse_arguments(gsl::span<const char *> args) {
+        arguments a;
+        for (size_t i = 1; i + 1 < args.size(); i += 2) {
+            std::string_view flag(args[i]);
+            std::string value(args[i + 1]);
+            if (flag == "--concurrency") {
+                a.concurrency = std::stoul(value);
+            } else if (flag == "--requests") {
+                a.requests = std::stoul(value);
+            } else if (flag == "--body") {
+                a.body = std::stoul(value);
+            } else if (flag == "--only") {
+                a.only = value;
+            } else if (flag == "--json") {
+                a.json = value;
+            } else {
+                throw std::runtime_error("unknown option "
+                                         + std::string(flag));
+            }
+        }
+        if (a.concurrency == 0 || a.requests == 0) {
+            throw std::runtime_error("nothing to do");
+        }
+        return a;
+    }
+}  // namespace
+
+int main(int argc, const char **argv) {  // NOLINT let exceptions terminate
+    auto args = parse_arguments(gsl::span<const char *>(argv, argc));
+    spdlog::set_level(spdlog::level::warn);
+
+    // before any thread is started
+    auto cert = make_certificate();
+    auto srv  = start_server(cert);
+
+    // as mpdfm's own context, trusting only the throwaway certificate
+    ssl::context tls(ssl::context::tls_client);
+    // NOLINTNEXTLINE intended use
+    tls.set_options(ssl::context::no_sslv2 | ssl::context::no_sslv3
+                    | ssl::context::no_tlsv1 | ssl::context::no_tlsv1_1);
+    tls.set_verify_mode(ssl::context::verify_peer);
+    tls.add_certificate_authority(asio::buffer(cert.cert));
+
+    tao::json::value results = tao::json::empty_object;
+    int status               = 0;
+    for (auto &[scheme, port, connections] :
+         { std::tuple { "http", srv.ports[0], &srv.connections->plain },
+           std::tuple { "https", srv.ports[1], &srv.connections->tls } }) {
+        if (!args.only.empty() && args.only != scheme) {
+            continue;
+        }
+        auto r = run_variant(scheme, port, *connections, tls, args);
+        print(scheme, r);
+        if (r.at("errors").as<uint64_t>() != 0) {
+            status = 1;
+        }
+        results[scheme] = std::move(r);
+    }
+    if (!args.json.empty()) {
+        std::ofstream out(args.json);
+        out << tao::json::to_string(results, 2) << '\n';
+    }
+
+    kill(srv.pid, SIGTERM);
+    waitpid(srv.pid, nullptr, 0);
+    return status;
+}
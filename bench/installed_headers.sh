@@ -0,0 +1,27 @@
+#!/bin/sh
+# Installs the build into a scratch directory, then builds and runs
+# consumer.cpp with nothing but what pkg-config reports for mpdfm, so an
+# installed header that needs an internal or vendored one fails here.
+#
+#   installed_headers.sh BUILD_DIR LIBDIR CONSUMER CXX...
+set -eu
+
+build=$1
+libdir=$2
+consumer=$3
+shift 3
+
+dest=$(mktemp -d)
+trap 'rm -rf "$dest"' EXIT
+
+meson install -C "$build" --destdir "$dest" --no-rebuild --quiet
+
+PKG_CONFIG_PATH="$dest$libdir/pkgconfig"
+PKG_CONFIG_SYSROOT_DIR="$dest"
+export PKG_CONFIG_PATH PKG_CONFIG_SYSROOT_DIR
+flags=$(pkg-config --cflags --libs mpdfm)
+
+# the flags are meant to be split
+# shellcheck disable=SC2086
+"$@" -std=c++17 "$consumer" -o "$dest/consumer" $flags
+LD_LIBRARY_PATH="$dest$libdir" "$dest/consumer"
@@ -0,0 +1,198 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file micro.cpp
+ * \brief Microbenchmarks of the per-scrobble code paths
+ *
+ * Each benchmark runs once per script of bench/corpus.hpp, e.g.
+ *
+ * ```
+ * micro --benchmark_filter='urlencode/cjk'
+ * ```
+ */
+#include "corpus.hpp"
+
+#include <benchmark/benchmark.h>
+#include <boost/filesystem.hpp>
+#include <config/config_file.hpp>
+#include <fstream>
+#include <protocols/as20_request.hpp>
+#include <scrobble_cache.hpp>
+#include <scrobble_json.hpp>
+#include <tao/json.hpp>
+#include <uris.hpp>
+
+namespace {
+    using mpdfm::bench::corpus;
+    using mpdfm::bench::script;
+
+    //! \brief Registers \p f once for each script, as `name/script`
+    template<typename Function>
+    void for_each_script(const std::string &name, Function f) {
+        for (auto s :
+             { script::ascii, script::latin, script::cjk, script::mixed }) {
+            benchmark::RegisterBenchmark(
+                (name + '/' + mpdfm::bench::script_name(s)).c_str(),
+                [f, s](benchmark::State &state) { f(state, s); });
+        }
+    }
+
+    void urlencode(benchmark::State &state, script s) {
+        corpus c(s);
+        std::vector<std::string> tags;
+        size_t bytes = 0;
+        for (int i = 0; i < 256; i++) {  // NOLINT
+            tags.push_back(c.tag());
+            bytes += tags.back().size();
+        }
+        for (auto _ : state) {
+            for (auto &t : tags) {
+                benchmark::DoNotOptimize(mpdfm::urlencode(t));
+            }
+        }
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations()
+                                                     * bytes));
+    }
+
+    void as20_add_track(benchmark::State &state, script s) {
+        auto entry = corpus(s).entry();
+        for (auto _ : state) {
+            mpdfm::internal::audioscrobbler_request req("secret");
+            req.add_track(entry);
+            benchmark::DoNotOptimize(req);
+        }
+    }
+
+    //! \returns A scrobble request of \p entries, as sent for a batch
+    mpdfm::internal::audioscrobbler_request
+        batch(const std::vector<mpdfm::scrobble_entry> &entries) {
+        mpdfm::internal::audioscrobbler_request req("secret");
+        req["method"]  = "track.scrobble";
+        req["api_key"] = "0123456789abcdef0123456789abcdef";
+        req["sk"]      = "fedcba9876543210fedcba9876543210";
+        for (size_t i = 0; i < entries.size(); i++) {
+            std::string suffix = '[' + std::to_string(i) + ']';
+            req.add_track(entries[i], suffix);
+            req["timestamp" + suffix] = std::to_string(entries[i].timestamp);
+        }
+        return req;
+    }
+
+    void as20_sign(benchmark::State &state, script s) {
+        auto req = batch(corpus(s).entries(1));
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(req.sign());
+        }
+    }
+
+    //! \brief Forms a request of \p Scrobbles tracks
+    template<size_t Scrobbles>
+    void as20_form(benchmark::State &state, script s) {
+        auto req = batch(corpus(s).entries(Scrobbles));
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(req.form());
+        }
+    }
+
+    void uri_parse(benchmark::State &state, script s) {
+        corpus c(s);
+        std::vector<std::string> uris {
+            "https://ws.audioscrobbler.com/2.0/",
+            "http://127.0.0.1:8080/plays",
+            "https://api.listenbrainz.org/1/submit-listens",
+            "http://127.0.0.1:9000/hook?token=abc",
+        };
+        for (int i = 0; i < 4; i++) {  // NOLINT
+            uris.push_back("https://example.org/search?q="
+                           + mpdfm::urlencode(c.tag()));
+        }
+        for (auto _ : state) {
+            for (auto &u : uris) {
+                benchmark::DoNotOptimize(mpdfm::uri(u));
+            }
+        }
+    }
+
+    void config_parse(benchmark::State &state, script s) {
+        corpus c(s);
+        auto path = (boost::filesystem::temp_directory_path()
+                     / boost::filesystem::unique_path("mpdfm-%%%%%%%%.cfg"))
+                        .native();
+        {
+            std::ofstream cfg(path);
+            cfg << "mpd_host = \"127.0.0.1\"\nmpd_port = \"6600\"\n";
+            for (int i = 0; i < 8; i++) {  // NOLINT
+                cfg << "local {\n"
+                    << "    path = \"/tmp/" << c.tag() << ".ndjson\"\n"
+                    << "    exclude = \"artist=" << c.tag() << ";genre="
+                    << c.tag() << "\"\n"
+                    << "}\n";
+            }
+        }
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(mpdfm::config_file(path));
+        }
+        boost::filesystem::remove(path);
+    }
+
+    void json_round_trip(benchmark::State &state, script s) {
+        auto entries = corpus(s).entries(64);  // NOLINT
+        for (auto _ : state) {
+            for (auto &e : entries) {
+                benchmark::DoNotOptimize(
+                    tao::json::from_string(mpdfm::to_json(e))
+                        .as<mpdfm::scrobble_entry>());
+            }
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations()
+                                                     * entries.size()));
+    }
+
+    void cache_insert_extract(benchmark::State &state, script s) {
+        auto entries = corpus(s).entries(50);  // NOLINT
+        mpdfm::scrobble_cache cache("", 0);    // in memory
+        for (auto _ : state) {
+            cache.insert(entries);
+            auto sent = cache.extract(entries.size());
+            cache.settle(sent.size());
+            benchmark::DoNotOptimize(sent);
+        }
+        state.SetItemsProcessed(static_cast<int64_t>(state.iterations()
+                                                     * entries.size()));
+    }
+}  // namespace
+
+int main(int argc, char **argv) {
+    for_each_script("urlencode", urlencode);
+    for_each_script("as20 add_track", as20_add_track);
+    for_each_script("as20 sign", as20_sign);
+    for_each_script("as20 form", as20_form<1>);
+    // a full batch, as sent after an outage
+    for_each_script("as20 form batch", as20_form<50>);  // NOLINT
+    for_each_script("uri parse", uri_parse);
+    for_each_script("config parse", config_parse);
+    for_each_script("json round trip", json_round_trip);
+    for_each_script("cache insert extract", cache_insert_extract);
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+}
@@ -0,0 +1,416 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file mqtt_qos1.cpp
+ * \brief Publishes through a real mosquitto with the mqtt scrobbler and
+ *        checks QoS 1 delivery
+ *
+ * First more scrobbles than the in-flight window holds are published, they
+ * only all arrive if every PUBACK frees its slot. Then the broker is
+ * stopped, so a scrobble goes unacknowledged, killed and started again on
+ * the same port; that scrobble has to be redelivered after the reconnect,
+ * and none of the acknowledged ones.
+ *
+ * Deliveries are watched by a subscriber of its own, speaking just enough
+ * MQTT 3.1.1 over a blocking socket.
+ *
+ * ```
+ * mqtt_qos1 MOSQUITTO
+ * ```
+ *
+ * Exits with 77, which meson counts as skipped, if MOSQUITTO is empty.
+ */
+#include <algorithm>
+#include <array>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/filesystem.hpp>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <fcntl.h>
+#include <fstream>
+#include <gsl/gsl>
+#include <http_client.hpp>
+#include <netinet/in.h>
+#include <optional>
+#include <poll.h>
+#include <protocols/mqtt.hpp>
+#include <set>
+#include <spdlog/spdlog.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+    namespace asio = boost::asio;
+    namespace fs   = boost::filesystem;
+    using clock    = std::chrono::steady_clock;
+
+    constexpr std::chrono::seconds delivery_timeout { 15 };
+    // how long an acknowledged scrobble gets to show up again
+    constexpr std::chrono::seconds redelivery_window { 3 };
+    constexpr std::chrono::seconds connect_timeout { 10 };
+    // long enough for packets on loopback to arrive
+    constexpr std::chrono::milliseconds settle_time { 500 };
+
+    constexpr const char *topic = "mpdfm-qos1";
+    // more than the in-flight window of 2
+    constexpr int batch = 10;
+
+    //! \returns A loopback port nothing listens on right now
+    unsigned short free_port() {
+        asio::io_context io;
+        asio::ip::tcp::acceptor a(
+            io, { asio::ip::make_address("127.0.0.1"), 0 });
+        return a.local_endpoint().port();
+    }
+
+    //! \brief A mosquitto process listening on loopback
+    class broker {
+    public:
+        broker(std::string binary, fs::path dir)
+            : m_binary(std::move(binary)), m_dir(std::move(dir)) {}
+
+        ~broker() { kill(); }
+
+        broker(const broker &) = delete;
+        broker &operator=(const broker &) = delete;
+
+        void start(unsigned short port) {
+            auto config = (m_dir / "mosquitto.conf").native();
+            std::ofstream(config) << "listener " << port << " 127.0.0.1\n"
+                                  << "allow_anonymous true\n";
+            auto log = (m_dir / "mosquitto.log").native();
+            m_pid    = fork();
+            if (m_pid < 0) {
+                throw std::runtime_error("fork failed");
+            }
+            if (m_pid == 0) {
+                // NOLINTNEXTLINE the usual mode
+                int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_APPEND,
+                              0644);  // NOLINT permission bits
+                dup2(fd, STDOUT_FILENO);
+                dup2(fd, STDERR_FILENO);
+                execl(m_binary.c_str(), m_binary.c_str(), "-v", "-c",
+                      config.c_str(), nullptr);
+                _exit(127);  // NOLINT as the shell does
+            }
+        }
+
+        //! \brief Keeps the connections open, but answers nothing
+        void pause() { ::kill(m_pid, SIGSTOP); }
+
+        void kill() {
+            if (m_pid > 0) {
+                ::kill(m_pid, SIGKILL);
+                waitpid(m_pid, nullptr, 0);
+                m_pid = -1;
+            }
+        }
+
+    private:
+        std::string m_binary;
+        fs::path m_dir;
+        pid_t m_pid = -1;
+    };
+
+    //! \brief Subscribes to everything below topic, with QoS 0
+    class subscriber {
+    public:
+        subscriber() = default;
+        ~subscriber() { close(); }
+
+        subscriber(const subscriber &) = delete;
+        subscriber &operator=(const subscriber &) = delete;
+
+        //! \brief Connects and subscribes, retrying while the broker starts
+        void connect(unsigned short port) {
+            close();
+            auto deadline = clock::now() + connect_timeout;
+            while (!try_connect(port)) {
+                if (clock::now() > deadline) {
+                    throw std::runtime_error("cannot connect to mosquitto");
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+            m_in.clear();
+
+            std::string body;
+            put_string(body, "MQTT");
+            body += static_cast<char>(4);     // NOLINT protocol level 3.1.1
+            body += static_cast<char>(0x02);  // NOLINT clean session
+            put_u16(body, 0);                 // no keepalive
+            put_string(body, "mpdfm-qos1-subscriber");
+            send(0x10, body);  // NOLINT CONNECT
+            auto connack = next_packet(connect_timeout);
+            if (!connack || connack->first != 0x20  // NOLINT CONNACK
+                || connack->second.size() < 2 || connack->second[1] != 0) {
+                throw std::runtime_error("mosquitto refused the subscriber");
+            }
+
+            body.clear();
+            put_u16(body, 1);
+            put_string(body, std::string(topic) + "/#");
+            body += static_cast<char>(0);
+            send(0x82, body);  // NOLINT SUBSCRIBE
+            auto suback = next_packet(connect_timeout);
+            if (!suback || suback->first != 0x90) {  // NOLINT SUBACK
+                throw std::runtime_error("mosquitto refused the subscription");
+            }
+        }
+
+        //! \returns The payload of the next PUBLISH, if one arrives in time
+        std::optional<std::string> next(std::chrono::milliseconds timeout) {
+            auto deadline = clock::now() + timeout;
+            for (;;) {
+                auto left = std::chrono::duration_cast<
+                    std::chrono::milliseconds>(deadline - clock::now());
+                auto p = next_packet(
+                    std::max(left, std::chrono::milliseconds(0)));
+                if (!p) {
+                    return std::nullopt;
+                }
+                if ((p->first & 0xf0) != 0x30) {  // NOLINT PUBLISH
+                    continue;
+                }
+                // QoS 0, so the topic is followed by the payload directly
+                auto &body = p->second;
+                if (body.size() < 2) {
+                    throw std::runtime_error("malformed PUBLISH");
+                }
+                auto len = static_cast<size_t>(
+                    (static_cast<uint8_t>(body[0]) << 8)  // NOLINT byte join
+                    | static_cast<uint8_t>(body[1]));
+                return body.substr(2 + len);
+            }
+        }
+
+    private:
+        bool try_connect(unsigned short port) {
+            m_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_in addr {};
+            addr.sin_family      = AF_INET;
+            addr.sin_port        = htons(port);
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            // NOLINTNEXTLINE sockaddr cast
+            if (::connect(m_fd, reinterpret_cast<sockaddr *>(&addr),
+                          sizeof(addr))
+                == 0) {
+                return true;
+            }
+            close();
+            return false;
+        }
+
+        void close() {
+            if (m_fd >= 0) {
+                ::close(m_fd);
+                m_fd = -1;
+            }
+        }
+
+        static void put_u16(std::string &out, uint16_t v) {
+            out += static_cast<char>(v >> 8);    // NOLINT byte split
+            out += static_cast<char>(v & 0xff);  // NOLINT byte split
+        }
+
+        static void put_string(std::string &out, const std::string &s) {
+            put_u16(out, gsl::narrow_cast<uint16_t>(s.size()));
+            out += s;
+        }
+
+        void send(uint8_t header, const std::string &body) {
+            // the packets sent here stay below 128 bytes
+            std::string out;
+            out += static_cast<char>(header);
+            out += static_cast<char>(body.size());
+            out += body;
+            if (::write(m_fd, out.data(), out.size())
+                != static_cast<ssize_t>(out.size())) {
+                throw std::runtime_error("cannot write to mosquitto");
+            }
+        }
+
+        //! \returns Type byte and body of the next packet, if one came
+        std::optional<std::pair<uint8_t, std::string>>
+            next_packet(std::chrono::milliseconds timeout) {
+            auto deadline = clock::now() + timeout;
+            for (;;) {
+                size_t len = 0;
+                size_t pos = 1;
+                size_t mul = 1;
+                bool done  = false;
+                while (pos < m_in.size() && pos <= 4) {  // NOLINT varint
+                    auto b = static_cast<uint8_t>(m_in[pos++]);
+                    len += (b & 0x7f) * mul;  // NOLINT varint
+                    mul *= 128;               // NOLINT varint
+                    if ((b & 0x80) == 0) {    // NOLINT continuation bit
+                        done = true;
+                        break;
+                    }
+                }
+                if (done && m_in.size() >= pos + len) {
+                    std::pair<uint8_t, std::string> p {
+                        static_cast<uint8_t>(m_in[0]), m_in.substr(pos, len)
+                    };
+                    m_in.erase(0, pos + len);
+                    return p;
+                }
+
+                auto left = std::chrono::duration_cast<
+                    std::chrono::milliseconds>(deadline - clock::now());
+                pollfd pfd { m_fd, POLLIN, 0 };
+                if (left.count() <= 0
+                    || poll(&pfd, 1, static_cast<int>(left.count())) <= 0) {
+                    return std::nullopt;
+                }
+                std::array<char, 4096> buf {};  // NOLINT magic number
+                auto n = ::read(m_fd, buf.data(), buf.size());
+                if (n <= 0) {
+                    throw std::runtime_error("mosquitto closed the "
+                                             "subscriber's connection");
+                }
+                m_in.append(buf.data(), static_cast<size_t>(n));
+            }
+        }
+
+        int m_fd = -1;
+        std::string m_in;
+    };
+
+    //! \brief The scrobble published for \p track
+    mpdfm::scrobble_entry entry(const std::string &track) {
+        mpdfm::scrobble_entry e;
+        e.artist    = "mqtt_qos1";
+        e.track     = track;
+        e.timestamp = 1262304000;  // NOLINT any time will do
+        return e;
+    }
+
+    //! \returns The tracks of \p expected that didn't arrive in \p timeout
+    std::set<std::string> await(subscriber &sub,
+                                std::set<std::string> expected,
+                                std::chrono::seconds timeout) {
+        auto deadline = clock::now() + timeout;
+        while (!expected.empty() && clock::now() < deadline) {
+            auto payload = sub.next(
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - clock::now()));
+            if (!payload) {
+                break;
+            }
+            for (auto it = expected.begin(); it != expected.end(); ++it) {
+                if (payload->find('"' + *it + '"') != std::string::npos) {
+                    expected.erase(it);
+                    break;
+                }
+            }
+        }
+        return expected;
+    }
+}  // namespace
+
+int main(int argc, const char **argv) {  // NOLINT let exceptions terminate
+    gsl::span<const char *> args(argv, argc);
+    if (args.size() != 2) {
+        spdlog::error("usage: mqtt_qos1 MOSQUITTO");
+        return 2;
+    }
+    if (std::string(args[1]).empty()) {
+        fmt::print("mosquitto is not installed, skipping\n");
+        return 77;  // NOLINT meson's skip status
+    }
+    spdlog::set_level(spdlog::level::warn);
+
+    auto dir = fs::temp_directory_path()
+               / fs::unique_path("mpdfm-mqtt-qos1-%%%%%%%%");
+    fs::create_directories(dir);
+    auto port = free_port();
+    broker mosquitto(args[1], dir);
+    mosquitto.start(port);
+    subscriber sub;
+    sub.connect(port);
+
+    auto &io   = mpdfm::io_context();
+    auto guard = asio::make_work_guard(io);
+    std::thread worker([&io]() { io.run(); });
+
+    mpdfm::mqtt::options opts;
+    opts.host      = "127.0.0.1";
+    opts.port      = std::to_string(port);
+    opts.topic     = topic;
+    opts.client_id = "mpdfm-qos1";
+    opts.in_flight = 2;
+    auto scrobbler = std::make_unique<mpdfm::mqtt>(std::move(opts));
+    auto publish   = [&](const std::string &track) {
+        asio::post(io, [&scrobbler, e = entry(track)]() {
+            scrobbler->scrobble(e);
+        });
+    };
+
+    bool passed = true;
+    auto fail   = [&](const std::string &what) {
+        spdlog::error("{}, see the broker's log in {}", what, dir.native());
+        passed = false;
+    };
+
+    // the window only moves on with every PUBACK
+    std::set<std::string> first;
+    for (int i = 0; i < batch; ++i) {
+        first.insert("acked-" + std::to_string(i));
+        publish("acked-" + std::to_string(i));
+    }
+    if (auto missing = await(sub, first, delivery_timeout);
+        !missing.empty()) {
+        fail(fmt::format("{} of {} scrobbles were not delivered",
+                         missing.size(), batch));
+    }
+    std::this_thread::sleep_for(settle_time);
+
+    // the broker takes this one, but never acknowledges it
+    mosquitto.pause();
+    publish("unacked");
+    std::this_thread::sleep_for(settle_time);
+    mosquitto.kill();
+    mosquitto.start(port);
+    sub.connect(port);
+    if (passed && !await(sub, { "unacked" }, delivery_timeout).empty()) {
+        fail("the unacknowledged scrobble was not redelivered");
+    }
+    // acknowledged ones stay delivered
+    if (passed
+        && await(sub, first, redelivery_window).size() != first.size()) {
+        fail("an acknowledged scrobble was delivered again");
+    }
+
+    asio::post(io, [&scrobbler]() { scrobbler->stop(); });
+    guard.reset();
+    worker.join();
+    scrobbler.reset();
+
+    if (!passed) {
+        return 1;  // the directory is kept for the broker's log
+    }
+    fs::remove_all(dir);
+    return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef ALLOC_STATS_HPP
+#define ALLOC_STATS_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/*!
+ * \brief Heap allocation accounting, per subsystem
+ *
+ * Builds configured with `-Dalloc_stats=true` replace the global operator
+ * new and count every allocation against the subsystem tag of the calling
+ * thread, which a scope sets for as long as it lives. Allocations made
+ * outside of any scope count as tag::other. Everywhere else scopes compile
+ * to nothing and the counts stay zero.
+ *
+ * The counts are meant for debug and benchmark builds, see
+ * bench/alloc_budget.cpp, and `allocations` on the control socket.
+ */
+namespace mpdfm::alloc {
+    enum class tag : uint8_t {
+        other,
+        mpd,        //!< player events, copying tags from MPD
+        engine,     //!< rewriting, filtering, dispatch
+        scrobbler,  //!< the protocols, encoding requests
+        http,       //!< http_request, beast
+        cache,      //!< scrobble caches
+        count
+    };
+
+    //! \returns The name of \p t, as used in reports
+    const char *tag_name(tag t);
+
+    struct counts {
+        uint64_t allocations = 0;
+        uint64_t bytes       = 0;
+    };
+    using snapshot = std::array<counts, static_cast<size_t>(tag::count)>;
+
+#ifdef MPDFM_ALLOC_STATS
+    constexpr bool enabled = true;
+
+    //! \brief Sets the tag of this thread, \returns the previous one
+    tag exchange_tag(tag t);
+
+    //! \returns The counts so far, indexed by tag
+    snapshot get();
+
+    //! \brief Attributes this thread's allocations to \p t while alive
+    class scope {
+    public:
+        explicit scope(tag t) : m_previous(exchange_tag(t)) {}
+        ~scope() { exchange_tag(m_previous); }
+
+        scope(const scope &) = delete;
+        scope &operator=(const scope &) = delete;
+        scope(scope &&)                 = delete;
+        scope &operator=(scope &&) = delete;
+
+    private:
+        tag m_previous;
+    };
+#else
+    constexpr bool enabled = false;
+
+    inline snapshot get() { return {}; }
+
+    class scope {
+    public:
+        explicit scope(tag /*unused*/) {}
+    };
+#endif
+
+    //! \returns The sum of \p s over all tags
+    counts total(const snapshot &s);
+
+    //! \returns \p after - \p before, tag by tag
+    snapshot difference(const snapshot &after, const snapshot &before);
+}  // namespace mpdfm::alloc
+
+#endif // ALLOC_STATS_HPP
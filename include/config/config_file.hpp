@@ -18,6 +18,7 @@
 #define CONFIG_CONFIG_FILE_HPP
 
 #include <map>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
@@ -0,0 +1,98 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef CONTROL_HPP
+#define CONTROL_HPP
+
+#include <boost/asio/io_context.hpp>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <tao/json/value.hpp>
+#include <vector>
+
+namespace mpdfm {
+    /*!
+     * \brief A command of the control socket
+     *
+     * The handler gets the words following the command name and returns the
+     * result, or throws to report an error.
+     */
+    struct control_command {
+        std::function<tao::json::value(const std::vector<std::string> &)>
+            handler;
+        //! \brief One line description, listed by `help`
+        std::string help;
+        /*!
+         * \brief Whether the handler may take a while (e.g. writes files),
+         *        in which case it runs off the io_context
+         */
+        bool blocking = false;
+    };
+
+    /*!
+     * \brief Line based control interface on a UNIX socket
+     *
+     * A client writes one command per line, made of words separated by
+     * spaces, and gets one line of JSON back for each, in order:
+     *
+     * ```
+     * $ echo backlog | socat - UNIX-CONNECT:/run/user/1000/mpdfm-control.sock
+     * {"ok":true,"result":{"as20":0,"listenbrainz":3}}
+     * ```
+     *
+     * Failures come back as `{"ok":false,"error":"..."}`. `help` lists the
+     * commands.
+     *
+     * Connections are served on a strand of the io_context. Handlers not
+     * marked blocking run there too, and so have to be quick; blocking ones
+     * run on a thread of their own, one at a time.
+     */
+    struct control_server {
+        using commands = std::map<std::string, control_command>;
+
+        /*!
+         * \brief Binds \p path, replacing a stale socket file, and starts
+         *        accepting connections
+         *
+         * \throws std::runtime_error if another process listens on \p path
+         */
+        control_server(boost::asio::io_context &io,
+                       const std::string &path,
+                       commands c);
+
+        //! \brief Calls stop()
+        ~control_server();
+
+        control_server(const control_server &) = delete;
+        control_server &operator=(const control_server &) = delete;
+        control_server(control_server &&)                 = delete;
+        control_server &operator=(control_server &&) = delete;
+
+        /*!
+         * \brief Closes the socket and all connections, and waits for a
+         *        blocking command that is still running
+         */
+        void stop();
+
+    private:
+        struct impl;
+        std::shared_ptr<impl> m_impl;
+    };
+}  // namespace mpdfm
+
+#endif // CONTROL_HPP
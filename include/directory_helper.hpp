@@ -18,6 +18,8 @@
 #define DIRECTORY_HELPER_HPP
 
 #include <boost/filesystem.hpp>
+#include <string>
+#include <sys/types.h>
 
 namespace mpdfm {
     /*!
@@ -34,6 +36,31 @@ namespace mpdfm {
      * First checks $HOME and then falls back to passwd
      */
     boost::filesystem::path get_home_directory();
+
+    /*!
+     * \brief Removes a UNIX socket left over from an earlier run at \p path
+     *
+     * \throws std::runtime_error if another process is listening on it
+     */
+    void remove_stale_socket(const std::string &path);
+
+    /*!
+     * \brief Makes files created while it lives accessible to the owner
+     *        only, so a socket is never bound with looser permissions
+     *
+     * The umask is per process, keep the scope short.
+     */
+    class owner_only_umask {
+    public:
+        owner_only_umask();
+        ~owner_only_umask();
+
+        owner_only_umask(const owner_only_umask &) = delete;
+        owner_only_umask &operator=(const owner_only_umask &) = delete;
+
+    private:
+        mode_t m_previous;
+    };
 }  // namespace mpdfm
 
 #endif // DIRECTORY_HELPER_HPP
@@ -0,0 +1,175 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef ENGINE_HPP
+#define ENGINE_HPP
+
+#include "filter.hpp"
+#include "scrobbler.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <config/config_file.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mpdfm {
+    /*!
+     * \brief The scrobbling engine, meant to be embedded
+     *
+     * An engine owns a set of scrobblers and hands now playing updates and
+     * scrobbles to all of them. It does not talk to MPD on its own: the
+     * mpdfm executable is a front-end that feeds it events from MPD, while
+     * other programs (e.g. a player daemon linking against libmpdfm) can
+     * submit events they already know about directly.
+     *
+     * All network I/O happens on the io_context given to the constructor,
+     * which the caller is responsible for running. Only one engine should
+     * exist at a time, as it makes its io_context the one returned by
+     * mpdfm::io_context().
+     *
+     * A scrobbler that throws is removed from the engine, and once no
+     * scrobblers are left now_playing() and scrobble() throw.
+     *
+     * Before anything else, names can be canonicalized with a rewrite
+     * table, see load_rewrites(). Scrobblers can come with rules excluding
+     * songs from them. The rules
+     * of all scrobblers are compiled into one filter_set, so each event is
+     * matched once, however many scrobblers there are.
+     *
+     * Submissions can be paused, see pause().
+     *
+     * All member functions are safe to call from any thread.
+     */
+    struct engine {
+        //! \brief A scrobbler and the amount of scrobbles it has queued
+        struct backlog_entry {
+            std::string name;
+            size_t backlog;
+        };
+
+        /*!
+         * \brief Creates an engine without any scrobblers
+         * \param io The io_context all network I/O will be done on
+         */
+        explicit engine(boost::asio::io_context &io);
+        ~engine();
+
+        engine(const engine &) = delete;
+        engine &operator=(const engine &) = delete;
+        engine(engine &&)                 = delete;
+        engine &operator=(engine &&) = delete;
+
+        /*!
+         * \brief Adds a scrobbler, the engine takes ownership of it
+         * \param exclude Songs matching any of these are not sent to it
+         * \param name What to call it in backlogs(), defaults to its
+         *             position
+         */
+        void add_scrobbler(std::unique_ptr<scrobbler> s,
+                           const std::vector<filter_rule> &exclude = {},
+                           std::string name = {});
+
+        /*!
+         * \brief Constructs and adds a scrobbler for every section of \p cfg
+         *
+         * The `exclude` key of a section holds its filter rules, see
+         * parse_filter_rules(). Sections that fail to construct are logged
+         * and skipped.
+         *
+         * \returns The amount of scrobblers added
+         */
+        size_t add_scrobblers(const config_file &cfg);
+
+        /*!
+         * \brief Rewrites names of every event with the table at \p path
+         *
+         * The table is reloaded when the file changes, see rewriter.
+         *
+         * \throws std::runtime_error if the table can't be opened
+         */
+        void load_rewrites(const std::string &path);
+
+        /*!
+         * \brief Sends a now playing update to all scrobblers
+         * \returns Whether any scrobbler got it, none do while paused
+         * \throws std::runtime_error if no scrobblers are left
+         */
+        bool now_playing(const scrobble_entry &s);
+
+        /*!
+         * \brief Scrobbles \p s on every scrobbler whose preconditions it
+         *        meets
+         *
+         * \p s should have its timestamp and elapsed fields filled out.
+         *
+         * \throws std::runtime_error if no scrobblers are left
+         */
+        void scrobble(const scrobble_entry &s);
+
+        /*!
+         * \brief Scrobbles a batch of entries
+         *
+         * Each scrobbler gets the entries meeting its preconditions in one
+         * go, so that backlogs are sent in as few requests as possible.
+         *
+         * \returns The amount of entries any scrobbler took, including
+         *          those held back while paused
+         * \throws std::runtime_error if no scrobblers are left
+         */
+        size_t scrobble(const std::vector<scrobble_entry> &entries);
+
+        //! \returns The amount of scrobblers in the engine
+        [[nodiscard]] size_t size() const;
+
+        /*!
+         * \brief Pauses or resumes submissions
+         *
+         * While paused, now playing updates are dropped and the engine holds
+         * scrobbles back from every scrobbler, at most
+         * profile().max_backlog each. They count towards backlogs().
+         * Resuming hands them over and flushes the backlogs. Scrobbles still
+         * held back when the engine is destroyed are queued with
+         * scrobbler::enqueue(), so scrobblers with a backlog keep them.
+         */
+        void pause(bool paused);
+
+        //! \returns Whether submissions are paused
+        [[nodiscard]] bool paused() const;
+
+        //! \brief Starts sending every scrobbler's backlog, see flush()
+        void flush();
+
+        //! \returns The backlog of every scrobbler, in the order added
+        [[nodiscard]] std::vector<backlog_entry> backlogs() const;
+
+        /*!
+         * \brief Stops every scrobbler and the rewrite table's reload
+         *        timer, see scrobbler::stop()
+         *
+         * Afterwards, running the io_context returns once requests in
+         * flight are done. Unlike the other member functions, it has to be
+         * called from within the io_context.
+         */
+        void stop();
+
+    private:
+        struct impl;
+        std::unique_ptr<impl> m_impl;
+    };
+}  // namespace mpdfm
+
+#endif // ENGINE_HPP
@@ -0,0 +1,145 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef FILTER_HPP
+#define FILTER_HPP
+
+#include "scrobbler.hpp"
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace mpdfm {
+    //! \brief A condition on one property of a song
+    struct filter_rule {
+        enum class field { artist, album, album_artist, track, genre, uri };
+        enum class kind { equals, prefix, suffix, contains };
+
+        field what;
+        kind match;
+        std::string value;  //!< ASCII lowercased
+    };
+
+    /*!
+     * \brief Parses the `exclude` key of a scrobbler section
+     *
+     * Rules are separated by semicolons, each being a field, an operator and
+     * a value. Matching ignores ASCII case.
+     *
+     * ```
+     * exclude = "genre = podcast; genre = audiobook; uri ^= spoken/"
+     * ```
+     *
+     * - `=` the whole value matches, an empty value matches a missing tag
+     * - `^=` the value starts with it
+     * - `$=` the value ends with it
+     * - `*=` the value contains it
+     *
+     * Fields are artist, album, album_artist, track, genre and uri (the
+     * path of the song in the MPD library).
+     *
+     * \throws std::runtime_error on a malformed rule
+     */
+    std::vector<filter_rule> parse_filter_rules(const std::string &text);
+
+    /*!
+     * \brief The rules of many owners, compiled into one matcher per field
+     *
+     * Every distinct pattern of every owner goes into one Aho-Corasick
+     * automaton per field. Values are matched with a start and end marker
+     * around them, so exact, prefix and suffix rules are ordinary patterns
+     * too, and a single scan of each field finds every rule of every owner
+     * matching a song. The cost per song depends on the length of its tags
+     * and the amount of matches, not on the amount of owners or rules.
+     *
+     * Not thread safe.
+     */
+    class filter_set {
+    public:
+        //! \brief Adds rules excluding songs for \p owner
+        void add(uint32_t owner, const std::vector<filter_rule> &rules);
+
+        //! \brief Builds the automata, required after adding rules
+        void compile();
+
+        //! \returns Sorted owners with a rule matching \p s
+        [[nodiscard]] std::vector<uint32_t>
+            match(const scrobble_entry &s) const;
+
+        //! \returns true if no rules were added
+        [[nodiscard]] bool empty() const;
+
+    private:
+        static constexpr size_t fields = 6;
+
+        //! \brief Aho-Corasick automaton with sparse transitions
+        struct automaton {
+            static constexpr uint32_t none = UINT32_MAX;
+
+            struct edge {
+                unsigned char c;
+                uint32_t to;
+            };
+            struct state {
+                uint32_t first_edge = 0;  // into edges, sorted by c
+                uint32_t end_edge   = 0;
+                uint32_t fail       = 0;
+                // pattern ending here, or none
+                uint32_t pattern = none;
+                // closest state with a pattern along the fail links
+                uint32_t next_match = none;
+            };
+
+            std::vector<state> states;
+            std::vector<edge> edges;
+
+            void build(const std::vector<std::string> &patterns);
+            [[nodiscard]] uint32_t step(uint32_t s, unsigned char c) const;
+
+            //! \brief Calls \p f with every pattern occurring in \p text
+            template<typename F>
+            void scan(const std::string &text, F f) const {
+                if (states.empty()) {
+                    return;
+                }
+                uint32_t s = 0;
+                for (unsigned char c : text) {
+                    s = step(s, c);
+                    auto m = states[s].pattern != none ? s
+                                                       : states[s].next_match;
+                    for (; m != none; m = states[m].next_match) {
+                        f(states[m].pattern);
+                    }
+                }
+            }
+        };
+
+        struct field_rules {
+            // pattern (with markers) to its index
+            std::map<std::string, uint32_t> index;
+            std::vector<std::string> patterns;
+            std::vector<std::vector<uint32_t>> owners;  // by pattern
+            automaton matcher;
+        };
+
+        std::array<field_rules, fields> m_fields;
+    };
+}  // namespace mpdfm
+
+#endif // FILTER_HPP
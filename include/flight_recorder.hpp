@@ -0,0 +1,66 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef FLIGHT_RECORDER_HPP
+#define FLIGHT_RECORDER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <spdlog/sinks/sink.h>
+#include <string>
+#include <string_view>
+
+/*!
+ * \brief Always-on record of recent events, for post-mortem analysis
+ *
+ * Events go into a fixed ring of the last `capacity` events, shared by all
+ * threads. Recording takes no locks, it claims a slot with one atomic
+ * increment and publishes it seqlock style, so it is cheap enough to leave
+ * on everywhere. dump() writes the ring out, oldest event first, and is
+ * called on fatal errors and when a scrobbler is dropped.
+ */
+namespace mpdfm::flight {
+    //! \brief Number of events kept
+    constexpr size_t capacity = 1024;
+    //! \brief Bytes of an event's detail kept, the rest is cut off
+    constexpr size_t detail_size = 88;
+
+    /*!
+     * \brief Records an event
+     *
+     * \param kind What happened, has to outlive the program (a literal)
+     * \param detail Free text, cut off after detail_size bytes
+     * \param value A number that goes with the event, e.g. a status code
+     */
+    void record(const char *kind, std::string_view detail = {},
+                int64_t value = 0);
+
+    //! \brief Sets the file dump() writes to, nothing is written until set
+    void set_dump_path(std::string path);
+
+    /*!
+     * \brief Writes the recorded events to the dump path, replacing the
+     *        previous dump
+     *
+     * \param reason Why, written at the top of the dump
+     */
+    void dump(std::string_view reason);
+
+    //! \returns An spdlog sink that records every log message it gets
+    std::shared_ptr<spdlog::sinks::sink> log_sink();
+}  // namespace mpdfm::flight
+
+#endif // FLIGHT_RECORDER_HPP
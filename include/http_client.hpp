@@ -18,18 +18,25 @@
 #define HTTP_CLIENT_HPP
 
 #include <algorithm>
+#include <alloc_stats.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ssl/context.hpp>
 #include <cctype>
 #include <charconv>
+#include <flight_recorder.hpp>
 #include <functional>
 #include <gsl/gsl>
 #include <memory>
+#include <metrics.hpp>
+#include <optional>
+#include <probes.hpp>
+#include <profile.hpp>
 #include <spdlog/fmt/ostr.h>
 #include <spdlog/spdlog.h>
 #include <string>
 #include <string_view>
 #include <system_error>
+#include <trace.hpp>
 #include <type_traits>
 #include <utility>
 
@@ -74,6 +81,34 @@ namespace mpdfm {
 
     //
 
+    /*!
+     * \brief Reads a response from \p stream, refusing bodies larger than
+     *        the runtime profile allows
+     *
+     * \param parser Storage for the parser, has to outlive the operation
+     */
+    template<typename Stream, typename ResBody>
+    void read_response(
+        Stream &stream,
+        boost::beast::flat_buffer &buf,
+        std::optional<boost::beast::http::response_parser<ResBody>> &parser,
+        boost::beast::http::response<ResBody> &res,
+        proto_callback_t callback) {
+        parser.emplace();
+        parser->body_limit(profile().http_body_limit);
+        boost::beast::http::async_read(
+            stream,
+            buf,
+            *parser,
+            [&parser, &res, cb = std::move(callback)](auto ec,
+                                                      auto /*size*/) {
+                if (!ec) {
+                    res = parser->release();
+                }
+                cb(ec);
+            });
+    }
+
     /*!
      * \brief Converts a std::string_view into the boost equivalent
      */
@@ -87,6 +122,24 @@ namespace mpdfm {
                   boost::asio::io_context &io,
                   boost::asio::ssl::context &ssl);
 
+    template<typename ReqBody, typename ResBody>
+    gsl::owner<protocol<ReqBody, ResBody> *>
+        get_proto(const mpdfm::uri &uri, boost::asio::io_context &io);
+
+    namespace internal {
+        //! \brief Steps of a request, connect includes the TLS handshake
+        enum class http_phase { resolve, connect, write, read };
+
+        //! \returns The latency histogram of \p phase
+        metrics::histogram &http_phase_latency(http_phase phase);
+
+        //! \returns The name of \p phase in traces
+        const char *http_phase_name(http_phase phase);
+
+        //! \brief Counts a finished request
+        void count_http_request(bool ok);
+    }  // namespace internal
+
     /*!
      * \brief Performs a HTTP(S) request
      * \tparam ReqBody the request body type
@@ -121,6 +174,15 @@ namespace mpdfm {
             : http_request(
                   uri, io, get_proto<ReqBody, ResBody>(uri, io, ssl)) {}
 
+        /*!
+         * \brief Creates a http_request using ssl_context() for https
+         *
+         * \param uri Target URI
+         * \param io io_context to use
+         */
+        http_request(const uri &uri, io_context &io)
+            : http_request(uri, io, get_proto<ReqBody, ResBody>(uri, io)) {}
+
         /*!
          * \brief Creates a http_request using a user-provided protocol
          *
@@ -169,8 +231,12 @@ namespace mpdfm {
          */
         template<typename CallbackType>
         void run(CallbackType ct) {
+            alloc::scope account(alloc::tag::http);
             m_callback = std::move(ct);
             m_req.prepare_payload();
+            m_phase.reset();
+            m_started = m_phase.started();
+            flight::record("http request", m_uri.host());
             spdlog::debug("DEBUG(http_client):\n{}", m_req);
 
             auto port = m_uri.port();
@@ -190,6 +256,7 @@ namespace mpdfm {
                 }
                 m_proto->connect({ make_address(m_uri.host()), result },
                                  [http = this->shared_from_this()](auto ec) {
+                                     alloc::scope account(alloc::tag::http);
                                      http->connect_callback(ec);
                                  });
             } else {
@@ -198,10 +265,13 @@ namespace mpdfm {
                     port,
                     [this, http = this->shared_from_this()](auto err,
                                                             auto result) {
+                        alloc::scope account(alloc::tag::http);
                         if (err) {
-                            m_callback(http, err);
+                            complete(std::move(http), err);
                         } else {
-                            http->m_proto->connect(result, [http](auto ec) {
+                            observe(internal::http_phase::resolve);
+                            m_proto->connect(result, [http](auto ec) {
+                                alloc::scope account(alloc::tag::http);
                                 http->connect_callback(ec);
                             });
                         }
@@ -213,12 +283,50 @@ namespace mpdfm {
         [[nodiscard]] const mpdfm::uri &get_uri() const { return m_uri; }
 
     private:
+        void observe(internal::http_phase phase) {
+            auto now     = trace::clock::now();
+            auto started = m_phase.started();
+            internal::http_phase_latency(phase).observe(now - started);
+            trace::complete(internal::http_phase_name(phase), started, now,
+                            this);
+            MPDFM_PROBE(http_phase, this, static_cast<int>(phase),
+                        internal::probe_us(now - started));
+            m_phase.reset();
+        }
+
+        void finish(error_code ec) {
+            auto now = trace::clock::now();
+            bool ok  = !ec;
+            if (ok) {
+                flight::record("http response", m_uri.host(),
+                               m_res.result_int());
+            } else {
+                flight::record("http error",
+                               std::string(m_uri.host()) + ": "
+                                   + ec.message(),
+                               ec.value());
+            }
+            internal::count_http_request(ok);
+            trace::complete("http request", m_started, now, this);
+            MPDFM_PROBE(http_done, this, static_cast<int>(ok),
+                        internal::probe_us(now - m_started));
+        }
+
+        //! \brief Ends the request and hands it to the callback
+        void complete(std::shared_ptr<this_type> http, error_code ec) {
+            finish(ec);
+            alloc::scope account(alloc::tag::scrobbler);
+            m_callback(std::move(http), ec);
+        }
+
         void connect_callback(error_code ec) {
             auto http = this->shared_from_this();
             if (ec) {
-                m_callback(std::move(http), ec);
+                complete(std::move(http), ec);
             } else {
+                observe(internal::http_phase::connect);
                 m_proto->write(m_req, [http = std::move(http)](auto ec) {
+                    alloc::scope account(alloc::tag::http);
                     http->handle_read(ec);
                 });
             }
@@ -227,11 +335,16 @@ namespace mpdfm {
         void handle_read(error_code ec) {
             auto http = this->shared_from_this();
             if (ec) {
-                m_callback(std::move(http), ec);
+                complete(std::move(http), ec);
             } else {
-                m_proto->read(m_res, [http = std::move(http)](auto ec) {
+                observe(internal::http_phase::write);
+                m_proto->read(m_res, [this, http = std::move(http)](auto ec) {
+                    alloc::scope account(alloc::tag::http);
                     spdlog::debug("DEBUG(http_client):\n{}", http->response());
-                    http->m_callback(std::move(http), ec);
+                    if (!ec) {
+                        observe(internal::http_phase::read);
+                    }
+                    complete(std::move(http), ec);
                 });
             }
         }
@@ -240,6 +353,8 @@ namespace mpdfm {
         std::function<void(std::shared_ptr<this_type>, error_code)> m_callback;
         std::unique_ptr<protocol<ReqBody, ResBody>> m_proto;
         boost::asio::ip::tcp::resolver m_resolver;
+        metrics::stopwatch m_phase;
+        trace::clock::time_point m_started;
 
         boost::beast::http::request<ReqBody> m_req;
         boost::beast::http::response<ResBody> m_res;
@@ -305,13 +420,7 @@ namespace mpdfm {
         }
 
         void read(response &res, proto_callback_t callback) override {
-            boost::beast::http::async_read(
-                m_stream,
-                m_buf,
-                res,
-                [cb = std::move(callback)](auto ec, auto /*size*/) {
-                    cb(ec);
-                });
+            read_response(m_stream, m_buf, m_parser, res, std::move(callback));
         }
 
         std::string_view default_port() override {
@@ -332,11 +441,17 @@ namespace mpdfm {
         void do_handshake(proto_callback_t cb) {
             m_stream.async_handshake(
                 boost::asio::ssl::stream_base::client,
-                [cb = std::move(cb)](auto err) { cb(err); });
+                [this, cb = std::move(cb), begin = trace::clock::now()](
+                    auto err) {
+                    trace::complete("tls handshake", begin,
+                                    trace::clock::now(), this);
+                    cb(err);
+                });
         }
 
         boost::asio::ssl::stream<boost::asio::ip::tcp::socket> m_stream;
-        boost::beast::flat_buffer m_buf;
+        boost::beast::flat_buffer m_buf { profile().http_buffer };
+        std::optional<boost::beast::http::response_parser<ResBody>> m_parser;
         std::string m_host;
     };
 
@@ -370,13 +485,7 @@ namespace mpdfm {
         }
 
         void read(response &res, proto_callback_t callback) override {
-            boost::beast::http::async_read(
-                m_socket,
-                m_buf,
-                res,
-                [cb = std::move(callback)](auto ec, auto /*size*/) {
-                    cb(ec);
-                });
+            read_response(m_socket, m_buf, m_parser, res, std::move(callback));
         }
 
         std::string_view default_port() override {
@@ -395,7 +504,8 @@ namespace mpdfm {
 
     private:
         boost::asio::ip::tcp::socket m_socket;
-        boost::beast::flat_buffer m_buf;
+        boost::beast::flat_buffer m_buf { profile().http_buffer };
+        std::optional<boost::beast::http::response_parser<ResBody>> m_parser;
     };
 
     /*!
@@ -441,9 +551,39 @@ namespace mpdfm {
 
     //! \returns An io_context instance
     boost::asio::io_context &io_context();
-    //! \returns A ssl::context instance
+    /*!
+     * \brief Makes io_context() return \p io from now on, rather than the
+     *        built-in instance
+     *
+     * For programs embedding mpdfm that run their own io_context. Has to be
+     * called before any I/O is started.
+     */
+    void use_io_context(boost::asio::io_context &io);
+    /*!
+     * \returns A ssl::context instance, created with the system's CA store
+     *          on first use
+     */
     boost::asio::ssl::context &ssl_context();
 
+    /*!
+     * \brief Protocol factory using ssl_context(), so that plain HTTP
+     *        doesn't pay for loading the CA store
+     */
+    template<typename ReqBody, typename ResBody>
+    gsl::owner<protocol<ReqBody, ResBody> *>
+        get_proto(const mpdfm::uri &uri, boost::asio::io_context &io) {
+        using namespace std::literals::string_view_literals;
+        auto proto_str = uri.scheme();
+        if (streq_insensitive(proto_str, "https"sv)) {  // NOLINT magic strings
+            return new https_protocol<ReqBody, ResBody>(
+                io, ssl_context(), std::string(uri.host()));
+        }
+        if (streq_insensitive(proto_str, "http"sv)) {  // NOLINT magic strings
+            return new http_protocol<ReqBody, ResBody>(io);
+        }
+        throw std::runtime_error("unsupported protocol");
+    }
+
 }  // namespace mpdfm
 
 #endif // HTTP_CLIENT_HPP
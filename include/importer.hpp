@@ -0,0 +1,86 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef IMPORTER_HPP
+#define IMPORTER_HPP
+
+#include "filter.hpp"
+#include "rewrite_table.hpp"
+#include "scrobbler.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <vector>
+
+namespace mpdfm {
+    //! \brief Counters of an import
+    struct import_stats {
+        uint64_t bytes    = 0;  //!< input consumed so far
+        size_t lines      = 0;  //!< lines read, including a CSV header
+        size_t imported   = 0;  //!< entries handed to the scrobbler
+        size_t invalid    = 0;  //!< unparsable or incomplete entries
+        size_t duplicates = 0;  //!< repeats of a recent play
+        size_t excluded   = 0;  //!< entries matching an exclude rule
+        size_t backlog    = 0;  //!< imported entries not sent yet
+    };
+
+    //! \brief What the engine would apply to an entry for the scrobbler
+    struct import_rules {
+        std::vector<filter_rule> exclude;         //!< the section's rules
+        std::unique_ptr<rewrite_table> rewrites;  //!< the config's, if any
+    };
+
+    /*!
+     * \brief Streams a play history into a scrobbler
+     *
+     * The input is read one line at a time and is either NDJSON, one
+     * scrobble_entry object per line (the format of the local history), or
+     * CSV with a header line naming the scrobble_entry field of each
+     * column, e.g.
+     *
+     * ```
+     * timestamp,artist,track,album
+     * 1262304000,Artist,"Title, with a comma",Album
+     * ```
+     *
+     * Columns with other names are ignored, quoted values may not span
+     * lines. Entries need an artist, a track and a timestamp that's not in
+     * the future. As in the engine, names are first rewritten with the
+     * table of \p rules, and entries matching its exclude rules are skipped.
+     * Entries with the timestamp, artist and track of one of the last 64Ki
+     * entries are skipped as duplicates, which is also how backlogs
+     * deduplicate.
+     *
+     * Entries are enqueued in chunks and the scrobbler drains them one
+     * request at a time. Reading pauses while more than \p high_water
+     * entries are waiting, so memory use doesn't depend on the input size
+     * and the import proceeds at whatever rate the service sustains.
+     *
+     * \param progress Called about once a second
+     * \returns Once every entry was sent
+     * \throws std::exception if the scrobbler gives up
+     */
+    import_stats import_history(
+        std::istream &in,
+        scrobbler &target,
+        const import_rules &rules,
+        size_t high_water,
+        const std::function<void(const import_stats &)> &progress);
+}  // namespace mpdfm
+
+#endif // IMPORTER_HPP
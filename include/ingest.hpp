@@ -0,0 +1,81 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef INGEST_HPP
+#define INGEST_HPP
+
+#include "engine.hpp"
+#include "local_http.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <memory>
+#include <string>
+
+namespace mpdfm {
+    /*!
+     * \brief Local HTTP API through which other players submit plays
+     *
+     * Submissions are handed to an engine, and hence go through the same
+     * caching, batching and retrying as plays coming from MPD.
+     *
+     * - `POST /now_playing` takes a single entry
+     * - `POST /scrobble` takes a single entry, or with a content type of
+     *   `application/x-ndjson` any amount of them, one per line
+     *
+     * Entries are JSON objects in the same shape as in scrobble caches.
+     * artist and track are required, scrobbles also need a timestamp and
+     * elapsed time. A batch with an invalid entry is rejected as a whole
+     * with 400, otherwise the answer is 202 and `{"accepted":N}`, N being
+     * the entries that any scrobbler took: those excluded from every
+     * scrobbler or not meeting the scrobble rules are not counted. Bodies
+     * over 8MiB get 413.
+     *
+     * The API is unauthenticated, and is hence meant to be bound to the
+     * loopback interface. Connections are kept alive, so a client can
+     * stream batches without reconnecting.
+     */
+    struct ingest_server {
+        /*!
+         * \brief Starts listening on \p address
+         * \param address `host:port`, where host is an IP address
+         */
+        ingest_server(engine &e,
+                      boost::asio::io_context &io,
+                      const std::string &address);
+
+        //! \brief Calls stop()
+        ~ingest_server();
+
+        ingest_server(const ingest_server &) = delete;
+        ingest_server &operator=(const ingest_server &) = delete;
+        ingest_server(ingest_server &&)                 = delete;
+        ingest_server &operator=(ingest_server &&) = delete;
+
+        /*!
+         * \brief Stops accepting and closes all connections
+         *
+         * The engine must outlive the server until this was called.
+         */
+        void stop();
+
+    private:
+        struct impl;
+        std::shared_ptr<impl> m_impl;
+        local_http_server m_server;
+    };
+}  // namespace mpdfm
+
+#endif // INGEST_HPP
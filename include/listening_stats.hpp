@@ -0,0 +1,165 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef LISTENING_STATS_HPP
+#define LISTENING_STATS_HPP
+
+#include "scrobbler.hpp"
+
+#include <array>
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace mpdfm {
+    namespace internal {
+        /*!
+         * \brief Keys ordered by a counter that goes up and down by one
+         *
+         * Keys are kept in an array sorted by descending count, with the
+         * first and last index of every count on the side. Changing a count
+         * swaps the key to the edge of its block of equal counts, which
+         * keeps the array sorted, so both updates are O(1) and the top k
+         * keys are simply the first k of the array.
+         */
+        class ranking {
+            struct block {
+                uint32_t first;
+                uint32_t last;
+            };
+
+            std::vector<uint32_t> m_order;   // keys by descending count
+            std::vector<uint32_t> m_pos;     // index of a key in m_order
+            std::vector<uint32_t> m_counts;  // count of a key
+            std::unordered_map<uint32_t, block> m_blocks;
+
+            void swap_keys(uint32_t a, uint32_t b);
+
+        public:
+            //! \brief Adds keys with a count of zero up to \p size
+            void resize(size_t size);
+
+            void increment(uint32_t key);
+            void decrement(uint32_t key);
+
+            //! \brief Replaces all counts, indexed by key
+            void assign(std::vector<uint32_t> counts);
+
+            //! \returns The count of \p key
+            [[nodiscard]] uint32_t count(uint32_t key) const {
+                return m_counts[key];
+            }
+
+            //! \returns Up to \p k keys with a non-zero count, best first
+            [[nodiscard]] std::vector<uint32_t> top(size_t k) const;
+        };
+    }  // namespace internal
+
+    /*!
+     * \brief Incrementally maintained top artists, albums and tracks
+     *
+     * Every counted play updates a ranking per dimension and window, so a
+     * top-k query costs O(k) no matter how long the history is. Names are
+     * interned once per dimension and everything else refers to them by a
+     * 32 bit id.
+     *
+     * The day and week windows are made of one bucket of counts per local
+     * calendar day, for the last 7 days. Once a day leaves a window its
+     * bucket is subtracted from that window's ranking, which costs as much
+     * as counting its plays did. Plays older than a week only count towards
+     * the all-time ranking.
+     *
+     * All member functions are thread safe.
+     */
+    struct listening_stats {
+        enum class dimension { artists, albums, tracks };
+        enum class window { day, week, all };
+
+        //! \brief A line of a top-k query
+        struct row {
+            std::string artist;
+            std::string title;  //!< album or track, empty for artists
+            uint32_t count;
+        };
+
+        //! \brief Counts a play
+        void add(const scrobble_entry &s);
+
+        //! \returns Up to \p k entries with the most plays in \p w
+        std::vector<row> top(dimension d, window w, size_t k);
+
+        //! \returns The amount of plays counted
+        [[nodiscard]] uint64_t plays() const;
+
+        /*!
+         * \brief Writes the counters to \p path
+         *
+         * The snapshot is written next to \p path and renamed over it, so a
+         * crash leaves either the old or the new snapshot behind.
+         */
+        void save(const std::string &path) const;
+
+        /*!
+         * \brief Replaces the counters with the ones saved at \p path
+         * \throws std::exception if the snapshot can't be read
+         */
+        void load(const std::string &path);
+
+        /*!
+         * \throws std::invalid_argument for an unknown name
+         */
+        static dimension parse_dimension(std::string_view name);
+        static window parse_window(std::string_view name);
+
+    private:
+        static constexpr size_t dimensions = 3;
+        static constexpr size_t week_days  = 7;
+
+        //! \brief Interned names and their rankings
+        struct table {
+            // deque, so the views in ids stay valid while it grows
+            std::deque<std::string> names;
+            std::unordered_map<std::string_view, uint32_t> ids;
+            std::array<internal::ranking, 3> rankings;  // NOLINT by window
+
+            uint32_t intern(std::string name);
+        };
+
+        //! \brief Plays of one local calendar day
+        struct day_bucket {
+            int64_t day;
+            std::array<std::unordered_map<uint32_t, uint32_t>, dimensions>
+                counts;
+        };
+
+        // requires m_mutex to be held
+        void advance(int64_t today);
+        void expire(const day_bucket &b, window w);
+
+        mutable std::mutex m_mutex;
+        std::array<table, dimensions> m_tables;
+        std::deque<day_bucket> m_days;  // oldest first
+        int64_t m_today = 0;
+        uint64_t m_plays = 0;
+    };
+}  // namespace mpdfm
+
+#endif // LISTENING_STATS_HPP
@@ -0,0 +1,78 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef LOCAL_HTTP_HPP
+#define LOCAL_HTTP_HPP
+
+#include <boost/asio/io_context.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace mpdfm {
+    /*!
+     * \brief Small HTTP server for local APIs
+     *
+     * The acceptor and every connection run on a single strand of the io
+     * context, and so does the handler. Connections are kept alive for as
+     * long as the client wants.
+     */
+    struct local_http_server {
+        using request =
+            boost::beast::http::request<boost::beast::http::string_body>;
+        using response =
+            boost::beast::http::response<boost::beast::http::string_body>;
+        using handler = std::function<response(const request &)>;
+
+        /*!
+         * \brief Starts listening on \p address
+         *
+         * \param address `host:port`, where host is an IP address. Anything
+         *                but a loopback address gets a warning. Port 0
+         *                picks a free port, see port().
+         * \param name What the server is, for log messages
+         * \param max_body Largest request body accepted, larger ones are
+         *                 answered with 413 and the connection is closed
+         */
+        local_http_server(boost::asio::io_context &io,
+                          const std::string &address,
+                          handler h,
+                          const std::string &name,
+                          size_t max_body = 64 * 1024);  // NOLINT 64KiB
+
+        //! \brief Calls stop()
+        ~local_http_server();
+
+        local_http_server(const local_http_server &) = delete;
+        local_http_server &operator=(const local_http_server &) = delete;
+        local_http_server(local_http_server &&)                 = delete;
+        local_http_server &operator=(local_http_server &&) = delete;
+
+        //! \brief Stops accepting and closes all connections
+        void stop();
+
+        //! \returns The port listened on
+        [[nodiscard]] unsigned short port() const;
+
+    private:
+        struct impl;
+        std::shared_ptr<impl> m_impl;
+    };
+}  // namespace mpdfm
+
+#endif // LOCAL_HTTP_HPP
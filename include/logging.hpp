@@ -0,0 +1,112 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef LOGGING_HPP
+#define LOGGING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <spdlog/spdlog.h>
+
+/*!
+ * \brief Logs like spdlog::log, at most a few times a minute per call site
+ *
+ * Meant for messages that repeat on every attempt while a service is down.
+ * The first limiter::burst messages of each limiter::interval are logged,
+ * the rest are counted and summed up in a "suppressed N messages" line
+ * before the next one that gets through (or by report_suppressed()).
+ *
+ * ```
+ * MPDFM_LOG_LIMITED(spdlog::level::err, "scrobble fail: {}", e.what());
+ * ```
+ */
+#define MPDFM_LOG_LIMITED(level, ...)                                        \
+    do {                                                                     \
+        static mpdfm::logging::limiter mpdfm_limiter_(__FILE__, __LINE__,    \
+                                                      level);                \
+        if (mpdfm_limiter_.admit()) {                                        \
+            spdlog::log(level, __VA_ARGS__);                                 \
+        }                                                                    \
+    } while (false)
+
+namespace mpdfm::logging {
+    /*!
+     * \brief Rate limit of one call site, see MPDFM_LOG_LIMITED
+     *
+     * Lock free; under contention the counts are approximate, which is fine
+     * for what they are used for.
+     */
+    class limiter {
+    public:
+        //! \brief Messages logged per interval
+        static constexpr uint64_t burst = 5;
+        //! \brief Length of an interval
+        static constexpr std::chrono::seconds interval { 60 };
+
+        limiter(const char *file, int line, spdlog::level::level_enum level);
+
+        limiter(const limiter &) = delete;
+        limiter &operator=(const limiter &) = delete;
+        limiter(limiter &&)                 = delete;
+        limiter &operator=(limiter &&) = delete;
+        ~limiter()                      = default;
+
+        /*!
+         * \returns Whether the message should be logged, after logging the
+         *          summary of the previous interval if something was
+         *          suppressed in it
+         */
+        bool admit();
+
+        //! \brief Logs and resets the count of suppressed messages
+        void report();
+
+    private:
+        friend void report_suppressed();
+
+        const char *m_file;
+        int m_line;
+        spdlog::level::level_enum m_level;
+
+        std::atomic<int64_t> m_window { 0 };  // ns, start of the interval
+        std::atomic<uint64_t> m_count { 0 };
+        std::atomic<uint64_t> m_suppressed { 0 };
+
+        limiter *m_next = nullptr;  // all limiters, for report_suppressed()
+    };
+
+    /*!
+     * \brief Makes the default logger asynchronous
+     *
+     * Messages are formatted on the calling thread and written by a thread
+     * of their own, through a queue of \p queue_size messages. When the
+     * queue is full the oldest message is dropped, so logging never waits
+     * for the terminal or the disk. Does nothing if \p queue_size is zero.
+     *
+     * The sinks and level of the current default logger carry over.
+     */
+    void start_async(size_t queue_size);
+
+    /*!
+     * \brief Logs the summaries of all call sites with suppressed messages
+     *        and flushes the default logger, called on exit
+     */
+    void report_suppressed();
+}  // namespace mpdfm::logging
+
+#endif // LOGGING_HPP
@@ -0,0 +1,169 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*!
+ * \brief Counters, gauges and latency histograms
+ *
+ * Metrics are looked up once, typically into a function-local static, and
+ * updated lock-free from then on:
+ *
+ * ```
+ * static auto &sent = metrics::get_counter("mpdfm_sent_total", "...");
+ * sent.add();
+ * ```
+ *
+ * Counters and histograms are sharded by thread, every thread updates its
+ * own cache line and only reading sums the shards up. expose() renders
+ * everything in the Prometheus text format.
+ */
+namespace mpdfm::metrics {
+    //! \brief Label names and values of a metric
+    using labels = std::vector<std::pair<std::string, std::string>>;
+
+    namespace internal {
+        constexpr size_t shards = 16;
+
+        //! \returns The shard of the calling thread
+        size_t shard();
+
+        template<typename T>
+        struct alignas(64) padded {  // NOLINT cache line size
+            std::atomic<T> value { 0 };
+        };
+    }  // namespace internal
+
+    //! \brief A count that only goes up
+    class counter {
+        std::array<internal::padded<uint64_t>, internal::shards> m_shards;
+
+    public:
+        void add(uint64_t n = 1) {
+            m_shards[internal::shard()].value.fetch_add(
+                n, std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] uint64_t value() const;
+    };
+
+    //! \brief A value that goes up and down
+    class gauge {
+        std::atomic<int64_t> m_value { 0 };
+
+    public:
+        void add(int64_t n) {
+            m_value.fetch_add(n, std::memory_order_relaxed);
+        }
+        void set(int64_t n) { m_value.store(n, std::memory_order_relaxed); }
+
+        [[nodiscard]] int64_t value() const {
+            return m_value.load(std::memory_order_relaxed);
+        }
+    };
+
+    /*!
+     * \brief Histogram of durations with log-linear buckets
+     *
+     * As in HDR histograms, every power of two microseconds is split into
+     * four linear buckets, so a recorded duration is off by at most 25%
+     * from the bucket it is reported in, from a microsecond to a day.
+     * Recording is two relaxed atomic additions.
+     */
+    class histogram {
+    public:
+        static constexpr size_t sub_buckets = 4;
+        // powers of two up to 2^36us, about 19 hours
+        static constexpr size_t buckets = sub_buckets + 35 * sub_buckets;
+
+        //! \brief Bucket counts and totals, summed over all shards
+        struct snapshot {
+            std::array<uint64_t, buckets> counts {};
+            uint64_t count  = 0;
+            uint64_t sum_us = 0;
+        };
+
+        void observe(std::chrono::steady_clock::duration d);
+        void observe_us(uint64_t us);
+
+        [[nodiscard]] snapshot collect() const;
+
+        //! \returns The bucket a duration of \p us goes into
+        static size_t bucket_of(uint64_t us);
+
+        //! \returns The largest duration, in us, that goes into bucket \p i
+        static uint64_t upper_bound(size_t i);
+
+    private:
+        struct alignas(64) shard {  // NOLINT cache line size
+            std::array<std::atomic<uint64_t>, buckets> counts {};
+            std::atomic<uint64_t> sum_us { 0 };
+        };
+        std::array<shard, internal::shards> m_shards;
+    };
+
+    //! \brief Measures time since construction or the last reset
+    class stopwatch {
+        std::chrono::steady_clock::time_point m_start =
+            std::chrono::steady_clock::now();
+
+    public:
+        [[nodiscard]] std::chrono::steady_clock::duration elapsed() const {
+            return std::chrono::steady_clock::now() - m_start;
+        }
+
+        void reset() { m_start = std::chrono::steady_clock::now(); }
+
+        [[nodiscard]] std::chrono::steady_clock::time_point started() const {
+            return m_start;
+        }
+    };
+
+    /*!
+     * \brief Gets or creates a metric
+     *
+     * A name is only registered with one type and help text, and a metric
+     * lives for as long as the program does.
+     *
+     * \throws std::logic_error if \p name has another type
+     */
+    counter &get_counter(const std::string &name,
+                         const std::string &help,
+                         const labels &l = {});
+    gauge &get_gauge(const std::string &name,
+                     const std::string &help,
+                     const labels &l = {});
+    histogram &get_histogram(const std::string &name,
+                             const std::string &help,
+                             const labels &l = {});
+
+    //! \returns The sum of the counter \p name over all labels, 0 if unknown
+    uint64_t total(const std::string &name);
+
+    //! \returns Every metric in the Prometheus text exposition format
+    std::string expose();
+}  // namespace mpdfm::metrics
+
+#endif // METRICS_HPP
@@ -63,6 +63,11 @@ namespace mpdfm {
         [[nodiscard]] std::string tag(mpd_tag_type type,
                                       unsigned idx = 0) const;
 
+        /*!
+         * \brief Returns the path of this song in the music directory
+         */
+        [[nodiscard]] std::string uri() const;
+
         /**
          * \brief Returns the id of this song
          */
@@ -136,6 +141,29 @@ namespace mpdfm {
          */
         void send_noidle();
 
+        /*!
+         * \brief Enters idle mode without waiting for an event
+         *
+         * Together with fd() and recv_idle() this allows waiting for events
+         * on an event loop.
+         *
+         * \param mask Event mask
+         */
+        void send_idle_mask(mpd_idle mask);
+
+        /*!
+         * \brief Receives the response to send_idle_mask()
+         *
+         * Blocks unless fd() is readable.
+         */
+        mpd_idle recv_idle();
+
+        /*!
+         * \returns The file descriptor of the underlying socket. The
+         *          connection keeps ownership of it.
+         */
+        [[nodiscard]] int fd() const;
+
         /*!
          * \brief Retrieves the currently playing song from the server
          */
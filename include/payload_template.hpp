@@ -0,0 +1,95 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PAYLOAD_TEMPLATE_HPP
+#define PAYLOAD_TEMPLATE_HPP
+
+#include "scrobbler.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mpdfm {
+    /*!
+     * \brief A text template over scrobble_entry fields
+     *
+     * Placeholders are written as `${field}`, where field is any of the
+     * scrobble_entry members (artist, track, album, track_number, mbid,
+     * album_artist, duration, timestamp, elapsed) or `event`, the kind of
+     * event being rendered. `$$` stands for a literal `$`.
+     *
+     * The template is compiled once, on construction, into a flat sequence
+     * of "emit literal" and "emit field" operations, so rendering is a
+     * single pass over that sequence without looking at the source again.
+     */
+    struct payload_template {
+        //! \brief How string fields are escaped
+        enum class escaping {
+            none,  //!< inserted verbatim
+            json   //!< escaped for use inside of a JSON string literal
+        };
+
+        /*!
+         * \brief Compiles \p source
+         * \throws std::runtime_error on unknown fields or unterminated
+         *         placeholders
+         */
+        explicit payload_template(const std::string &source,
+                                  escaping esc = escaping::json);
+
+        /*!
+         * \brief Appends the template rendered for \p s to \p out
+         * \param event What `${event}` expands to
+         */
+        void render(std::string &out,
+                    const scrobble_entry &s,
+                    std::string_view event) const;
+
+        //! \returns A rough estimate of how long a rendered entry will be
+        [[nodiscard]] size_t size_hint() const;
+
+    private:
+        enum class field {
+            literal,
+            artist,
+            track,
+            album,
+            track_number,
+            mbid,
+            album_artist,
+            duration,
+            timestamp,
+            elapsed,
+            event
+        };
+
+        struct op {
+            field what;
+            // slice of m_literals, only used for field::literal
+            size_t offset;
+            size_t length;
+        };
+
+        void emit_string(std::string &out, std::string_view value) const;
+
+        std::vector<op> m_ops;
+        std::string m_literals;
+        escaping m_escaping;
+    };
+}  // namespace mpdfm
+
+#endif // PAYLOAD_TEMPLATE_HPP
@@ -0,0 +1,78 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PROBES_HPP
+#define PROBES_HPP
+
+/*!
+ * \file probes.hpp
+ * \brief USDT probes for bpftrace, perf and SystemTap
+ *
+ * Builds with `-Dusdt=enabled` (the default `auto` enables them when
+ * sys/sdt.h is found) get static probes under the `mpdfm` provider. A probe
+ * is a single nop until a tracer attaches to it. Its arguments are still
+ * computed, so they are kept to values at hand. List them with
+ *
+ * ```
+ * bpftrace -l 'usdt:/usr/bin/mpdfm:*'
+ * ```
+ *
+ * Durations are in microseconds.
+ *
+ * | probe               | arguments                                       |
+ * |---------------------|-------------------------------------------------|
+ * | player_event        | song id (0 for none), mpd_state                 |
+ * | player_event_done   | song id, duration                               |
+ * | song_start          | song id, start time                             |
+ * | song_pause          | song id, seconds played so far                  |
+ * | song_resume         | song id, seconds played so far                  |
+ * | http_phase          | request, phase (resolve, connect, write, read), |
+ * |                     | duration                                        |
+ * | http_done           | request, 1 on success, duration                 |
+ * | as20_batch          | batch size                                      |
+ * | as20_ack            | batch size, round trip time                     |
+ * | as20_requeue        | batch size, round trip time                     |
+ * | cache_save          | path, entries, duration                         |
+ *
+ * e.g. to see HTTP connect latencies:
+ *
+ * ```
+ * bpftrace -e 'usdt:/usr/bin/mpdfm:mpdfm:http_phase /arg1 == 1/ {
+ *     @connect_us = hist(arg2); }'
+ * ```
+ */
+
+#include <chrono>
+#include <cstdint>
+
+#ifdef MPDFM_USDT
+#include <sys/sdt.h>
+//! \brief Fires the probe \p name, with up to 12 arguments
+#define MPDFM_PROBE(...) STAP_PROBEV(mpdfm, __VA_ARGS__)
+#else
+// arguments are not evaluated, but count as used
+#define MPDFM_PROBE(name, ...) static_cast<void>(sizeof((__VA_ARGS__)))
+#endif
+
+namespace mpdfm::internal {
+    //! \returns \p d in microseconds, for probe arguments
+    inline int64_t probe_us(std::chrono::steady_clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(d)
+            .count();
+    }
+}  // namespace mpdfm::internal
+
+#endif // PROBES_HPP
@@ -0,0 +1,87 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <config/config_file.hpp>
+#include <cstddef>
+
+namespace mpdfm {
+    /*!
+     * \brief Resource limits mpdfm runs with
+     *
+     * The defaults are picked at build time: builds configured with
+     * `-Dsmall_footprint=true` default to the limits of the small profile,
+     * meant for embedded hosts (e.g. a Raspberry Pi Zero next to MPD).
+     * Either way, the profile can be switched using the `profile` key of the
+     * root configuration section, and each limit can be overridden on its
+     * own:
+     *
+     * ```
+     * profile = "small"      # or "default"
+     * max_backlog = "200"    # cached scrobbles per scrobbler, 0 = unlimited
+     * http_buffer = "8192"   # bytes buffered for response headers
+     * http_body_limit = "65536"
+     * log_queue = "128"      # 0 = log synchronously
+     * single_threaded = "yes"
+     * ```
+     */
+    struct runtime_profile {
+        /*!
+         * \brief Run the io_context on the main thread instead of a
+         *        dedicated io thread
+         */
+        bool single_threaded = false;
+
+        /*!
+         * \brief Maximum amount of scrobbles a scrobbler keeps around,
+         *        the oldest are dropped first. Zero means no limit.
+         */
+        size_t max_backlog = 0;
+
+        //! \brief Limit of the buffer HTTP responses are read into
+        size_t http_buffer = 0;
+
+        //! \brief Largest HTTP response body accepted
+        size_t http_body_limit = 0;
+
+        /*!
+         * \brief Log messages queued for the logging thread, the oldest are
+         *        dropped first. Zero means logging synchronously.
+         */
+        size_t log_queue = 0;
+
+        //! \returns The limits of the default profile
+        static runtime_profile normal();
+
+        //! \returns The limits of the small footprint profile
+        static runtime_profile small();
+    };
+
+    //! \returns The profile currently in effect
+    const runtime_profile &profile();
+
+    /*!
+     * \brief Applies the profile described by the root section \p root
+     *
+     * Has to be called before anything that depends on the profile (such as
+     * scrobblers) is constructed.
+     */
+    void load_profile(const config_section &root);
+}  // namespace mpdfm
+
+#endif // PROFILE_HPP
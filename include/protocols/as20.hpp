@@ -19,21 +19,16 @@
 
 #include "../scrobbler.hpp"
 
+#include <atomic>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
 #include <config/config_file.hpp>
-#include <mutex>
-#include <set>
+#include <gsl/gsl>
+#include <optional>
+#include <scrobble_cache.hpp>
 #include <uris.hpp>
 
-    namespace mpdfm {
-    namespace internal {
-        struct ts_compare {
-            template<typename T>
-            bool operator()(const T &lhs, const T &rhs) const {
-                return lhs.timestamp < rhs.timestamp;
-            }
-        };
-    }  // namespace internal
-
+namespace mpdfm {
     /*!
      * \brief AudioScrobbler 2.0 implementation
      */
@@ -58,21 +53,33 @@
     protected:
         void do_send_now_playing(const scrobble_entry &s) override;
         void do_send_scrobble(const scrobble_entry &s) override;
+        void do_send_scrobbles(const std::vector<scrobble_entry> &s) override;
+        void do_enqueue(const std::vector<scrobble_entry> &s) override;
+        void do_flush() override;
+        [[nodiscard]] size_t do_backlog() const override;
         bool do_check_preconditions(const scrobble_entry &s) override;
+        void do_stop() override;
 
     private:
         void send_scrobbles_coalesced();
+        /*!
+         * \brief Waits out a rate limit, \p hint seconds if the response
+         *        said so, otherwise twice as long as last time
+         */
+        void back_off(std::optional<std::chrono::seconds> hint);
         // gets set to true when send_scrobbles_coalesced has failed fatally
-        bool m_fail_flag = false;
+        std::atomic<bool> m_fail_flag = false;
 
         std::string m_session_key;
         std::string m_api_key;
         std::string m_api_secret;  // "shared" secret
         uri m_target;
 
-        std::set<scrobble_entry, internal::ts_compare> m_cache;
-        std::mutex m_cache_mutex;
-        std::string m_path;
+        scrobble_cache m_cache;
+        boost::asio::steady_timer m_retry;
+        // set while waiting out a rate limit
+        std::atomic<bool> m_retry_pending = false;
+        std::chrono::seconds m_backoff {};
     };
 }  // namespace mpdfm
 
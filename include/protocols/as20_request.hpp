@@ -0,0 +1,65 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PROTOCOLS_AS20_REQUEST_HPP
+#define PROTOCOLS_AS20_REQUEST_HPP
+
+#include "../scrobbler.hpp"
+
+#include <boost/container/flat_map.hpp>
+#include <string>
+
+namespace mpdfm::internal {
+    /*!
+     * \brief Handles formation of AS20 requests
+     */
+    struct audioscrobbler_request {
+        /*!
+         * \brief Creates a new as20 request that will be signed with the
+         *        \p secret
+         *
+         * \param secret The secret to use to sign the request
+         */
+        explicit audioscrobbler_request(std::string secret)
+            : m_api_secret(std::move(secret)) {}
+
+        //! \brief MD5 signs the request
+        [[nodiscard]] std::string sign() const;
+
+        //! \brief Gets the parameter \p key using std::map operator[]
+        std::string &operator[](const std::string &key) {
+            return m_params[key];
+        }
+
+        //! \brief Joins and signs all the parameters
+        std::string form();
+
+        //! \brief Helper for adding all track information to a request
+        void add_track(const scrobble_entry &s,
+                       const std::string &suffix = "");
+
+    private:
+        void add_tag(const std::string &value, const std::string &field) {
+            if (!value.empty()) {
+                (*this)[field] = value;
+            }
+        }
+        boost::container::flat_map<std::string, std::string> m_params;
+        std::string m_api_secret;
+    };
+}  // namespace mpdfm::internal
+
+#endif // PROTOCOLS_AS20_REQUEST_HPP
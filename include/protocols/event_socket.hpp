@@ -0,0 +1,85 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PROTOCOLS_EVENT_SOCKET_HPP
+#define PROTOCOLS_EVENT_SOCKET_HPP
+
+#include "../scrobbler.hpp"
+
+#include <config/config_file.hpp>
+#include <gsl/gsl>
+#include <memory>
+#include <string>
+
+namespace mpdfm {
+    /*!
+     * \brief Streams plays to local subscribers over a UNIX socket
+     *
+     * Every client connecting to the socket receives one record per event,
+     * a JSON object on a line of its own:
+     *
+     * ```
+     * {"event":"now_playing","entry":{"artist":"...",...}}
+     * ```
+     *
+     * New subscribers first get the last now playing event. Each event is
+     * serialized once into a shared buffer, which is queued on every client
+     * and written together with the rest of its queue using scatter I/O.
+     * Clients that have more than `max_queued` records waiting are
+     * disconnected rather than holding anything up.
+     *
+     * ```
+     * event_socket {
+     *     path = "/run/user/1000/mpdfm.sock"
+     *     # optional
+     *     max_queued = "64"
+     * }
+     * ```
+     */
+    struct event_socket : public scrobbler {  // NOLINT virtual destructor
+        struct factory                        // NOLINT virtual destructor
+            : public scrobbler_factory {
+            ~factory() override = default;
+
+        protected:
+            gsl::owner<scrobbler *>
+                do_fabrication(const config_section &section) override;
+            void do_authenticate(int argc, const char **argv) override;
+        };
+
+        /*!
+         * \brief Binds \p path, replacing a stale socket file
+         * \param max_queued Records a client may lag behind before it gets
+         *                   dropped
+         */
+        event_socket(const std::string &path, size_t max_queued);
+
+        //! \brief Disconnects all clients and removes the socket file
+        ~event_socket() override;
+
+    protected:
+        void do_send_now_playing(const scrobble_entry &s) override;
+        void do_send_scrobble(const scrobble_entry &s) override;
+        bool do_check_preconditions(const scrobble_entry &s) override;
+        void do_stop() override;
+
+    private:
+        struct server;
+        std::shared_ptr<server> m_server;
+    };
+}  // namespace mpdfm
+
+#endif // PROTOCOLS_EVENT_SOCKET_HPP
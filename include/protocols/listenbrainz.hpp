@@ -0,0 +1,97 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PROTOCOLS_LISTENBRAINZ_HPP
+#define PROTOCOLS_LISTENBRAINZ_HPP
+
+#include "../scrobbler.hpp"
+
+#include <atomic>
+#include <boost/asio/steady_timer.hpp>
+#include <config/config_file.hpp>
+#include <gsl/gsl>
+#include <scrobble_cache.hpp>
+#include <uris.hpp>
+
+namespace mpdfm {
+    /*!
+     * \brief ListenBrainz implementation
+     *
+     * Listens are submitted as JSON and authenticated with a user token,
+     * there's no request signing. Backlogs are sent as `import` submissions
+     * of up to 1000 listens per request.
+     *
+     * ```
+     * listenbrainz {
+     *     token != "pass mpdfm-listenbrainz-token"
+     *     store = "/home/user/.cache/mpdfm/listenbrainz.cache"
+     *     # url = "https://api.listenbrainz.org/"
+     * }
+     * ```
+     */
+    struct listenbrainz : public scrobbler {  // NOLINT virtual destructor
+        struct factory                        // NOLINT virtual destructor
+            : public scrobbler_factory {
+            ~factory() override = default;
+
+        protected:
+            gsl::owner<scrobbler *>
+                do_fabrication(const config_section &section) override;
+            void do_authenticate(int argc, const char **argv) override;
+        };
+
+        /*!
+         * \param token User token
+         * \param api_root Root of the API, e.g. https://api.listenbrainz.org/
+         * \param store Path of the scrobble cache
+         */
+        listenbrainz(std::string token,
+                     const std::string &api_root,
+                     std::string store);
+        ~listenbrainz() override;
+
+    protected:
+        void do_send_now_playing(const scrobble_entry &s) override;
+        void do_send_scrobble(const scrobble_entry &s) override;
+        void do_send_scrobbles(const std::vector<scrobble_entry> &s) override;
+        void do_enqueue(const std::vector<scrobble_entry> &s) override;
+        void do_flush() override;
+        [[nodiscard]] size_t do_backlog() const override;
+        bool do_check_preconditions(const scrobble_entry &s) override;
+        void do_stop() override;
+
+    private:
+        void send_listens_coalesced();
+        void retry_in(std::chrono::seconds delay);
+        //! \brief Splits up or drops \p sent, answered with 400 Bad Request
+        void rejected(const std::vector<scrobble_entry> &sent,
+                      const std::string &message);
+        // gets set to true when the token got rejected
+        std::atomic<bool> m_fail_flag = false;
+
+        std::string m_token;
+        uri m_target;
+
+        scrobble_cache m_cache;
+        boost::asio::steady_timer m_retry;
+        // set while waiting out a rate limit
+        std::atomic<bool> m_retry_pending = false;
+        // listens left to send one per submission, after a rejected batch
+        std::atomic<size_t> m_isolate = 0;
+    };
+}  // namespace mpdfm
+
+#endif // PROTOCOLS_LISTENBRAINZ_HPP
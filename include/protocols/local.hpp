@@ -0,0 +1,135 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PROTOCOLS_LOCAL_HPP
+#define PROTOCOLS_LOCAL_HPP
+
+#include "../scrobbler.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <config/config_file.hpp>
+#include <gsl/gsl>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace mpdfm {
+    /*!
+     * \brief Keeps the listening history in a local file
+     *
+     * Every play is appended to \p path as one JSON object per line
+     * (NDJSON), in the same shape as scrobble caches, so the history can be
+     * queried with any line based JSON tool.
+     *
+     * Writes use group commit: scrobbles are serialized into a pending
+     * buffer, and a single flush, run on a thread of the journal's own so
+     * the io context never waits for the disk, appends everything that
+     * accumulated with one write and one fdatasync.
+     * A burst of scrobbles (e.g. an import) therefore costs one sync per
+     * flush rather than one per play. When a flush fails, the rows that
+     * weren't written are kept, and a few seconds later the sync, and the
+     * write of those rows, are tried again.
+     *
+     * ```
+     * local {
+     *     path = "/home/user/.local/share/mpdfm/history.ndjson"
+     *     # "scrobbles" (default) only records plays meeting the usual
+     *     # scrobbling rules, "plays" records everything that was played
+     *     record = "scrobbles"
+     * }
+     * ```
+     */
+    struct local : public scrobbler {  // NOLINT virtual destructor
+        struct factory                 // NOLINT virtual destructor
+            : public scrobbler_factory {
+            ~factory() override = default;
+
+        protected:
+            gsl::owner<scrobbler *>
+                do_fabrication(const config_section &section) override;
+            void do_authenticate(int argc, const char **argv) override;
+        };
+
+        /*!
+         * \param path History file, created if missing
+         * \param all_plays Whether to record plays that don't meet the
+         *                  scrobbling rules
+         */
+        local(const std::string &path, bool all_plays);
+
+        //! \brief Flushes anything still pending
+        ~local() override;
+
+    protected:
+        void do_send_now_playing(const scrobble_entry &s) override;
+        void do_send_scrobble(const scrobble_entry &s) override;
+        void do_send_scrobbles(const std::vector<scrobble_entry> &s) override;
+        bool do_check_preconditions(const scrobble_entry &s) override;
+        void do_stop() override;
+
+    private:
+        //! \brief Queues serialized rows for the next flush
+        void append(const std::string &lines);
+
+        //! \brief Shared with the retry timer, which may outlive the
+        //!        scrobbler
+        struct journal : std::enable_shared_from_this<journal> {
+            journal(const std::string &path, boost::asio::io_context &io);
+            ~journal();
+            journal(const journal &) = delete;
+            journal &operator=(const journal &) = delete;
+            journal(journal &&)                 = delete;
+            journal &operator=(journal &&) = delete;
+
+            //! \brief Appends and syncs everything pending
+            void flush();
+
+            //! \brief Queues a flush on the writer thread
+            void schedule_flush();
+
+            //! \brief Flushes again after a failure, on the strand
+            void retry_later();
+
+            std::string path;
+            int fd = -1;
+
+            // runs the flushes, which block on write and fdatasync
+            boost::asio::thread_pool writer { 1 };
+
+            // of the io context, guards retry and stopped
+            boost::asio::strand<boost::asio::io_context::executor_type> strand;
+            boost::asio::steady_timer retry;
+            bool stopped = false;
+
+            // guards pending and scheduled
+            std::mutex mutex;
+            std::string pending;
+            bool scheduled = false;
+
+            // serializes flushes, and guards unsynced: written but not synced
+            std::mutex write_mutex;
+            bool unsynced = false;
+        };
+
+        std::shared_ptr<journal> m_journal;
+        bool m_all_plays;
+    };
+}  // namespace mpdfm
+
+#endif // PROTOCOLS_LOCAL_HPP
@@ -0,0 +1,106 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PROTOCOLS_MQTT_HPP
+#define PROTOCOLS_MQTT_HPP
+
+#include "../scrobbler.hpp"
+
+#include <chrono>
+#include <config/config_file.hpp>
+#include <gsl/gsl>
+#include <memory>
+#include <string>
+
+namespace mpdfm {
+    /*!
+     * \brief Publishes plays to an MQTT broker
+     *
+     * Events are published with QoS 1 over a single, persistent MQTT 3.1.1
+     * connection running on mpdfm::io_context(). Up to `in_flight` messages
+     * may be waiting for their PUBACK at once, the rest are queued. When
+     * the connection drops, it is re-established with a backoff and
+     * unacknowledged messages are sent again.
+     *
+     * Now playing events go to `<topic>/now_playing` (retained by default),
+     * scrobbles to `<topic>/scrobble`. The payload is the scrobble entry as
+     * a JSON object.
+     *
+     * Queued messages only live in memory; this is an event feed, use one
+     * of the other scrobblers to keep a record of plays. At most
+     * `max_queued` messages wait while the broker is away (or the
+     * profile's max_backlog, if that's lower), then the oldest are dropped.
+     *
+     * ```
+     * mqtt {
+     *     host = "127.0.0.1"
+     *     # optional
+     *     port = "1883"
+     *     topic = "mpdfm"
+     *     client_id = "mpdfm"
+     *     username = "user"
+     *     password != "pass mpdfm-mqtt"
+     *     keepalive = "60"
+     *     in_flight = "16"
+     *     max_queued = "256"
+     *     retain_now_playing = "true"
+     * }
+     * ```
+     */
+    struct mqtt : public scrobbler {  // NOLINT virtual destructor
+        struct factory                // NOLINT virtual destructor
+            : public scrobbler_factory {
+            ~factory() override = default;
+
+        protected:
+            gsl::owner<scrobbler *>
+                do_fabrication(const config_section &section) override;
+            void do_authenticate(int argc, const char **argv) override;
+        };
+
+        //! \brief Connection settings
+        struct options {
+            std::string host;
+            std::string port = "1883";
+            std::string topic = "mpdfm";
+            std::string client_id = "mpdfm";
+            std::string username;
+            std::string password;
+            std::chrono::seconds keepalive { 60 };  // NOLINT magic number
+            size_t in_flight = 16;                  // NOLINT magic number
+            size_t max_queued = 256;                // NOLINT magic number
+            bool retain_now_playing = true;
+        };
+
+        explicit mqtt(options opts);
+        ~mqtt() override;
+
+    protected:
+        void do_send_now_playing(const scrobble_entry &s) override;
+        void do_send_scrobble(const scrobble_entry &s) override;
+        bool do_check_preconditions(const scrobble_entry &s) override;
+        void do_stop() override;
+
+    private:
+        struct session;
+        std::shared_ptr<session> m_session;
+        std::string m_now_playing_topic;
+        std::string m_scrobble_topic;
+        bool m_retain_now_playing;
+    };
+}  // namespace mpdfm
+
+#endif // PROTOCOLS_MQTT_HPP
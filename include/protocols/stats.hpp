@@ -0,0 +1,81 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PROTOCOLS_STATS_HPP
+#define PROTOCOLS_STATS_HPP
+
+#include "../scrobbler.hpp"
+
+#include <chrono>
+#include <config/config_file.hpp>
+#include <gsl/gsl>
+#include <listening_stats.hpp>
+#include <memory>
+#include <string>
+
+namespace mpdfm {
+    /*!
+     * \brief Keeps listening statistics as scrobbles pass by
+     *
+     * Counters are kept in memory, see listening_stats, and snapshotted to
+     * \p path every \p interval seconds if anything changed, as well as on
+     * shutdown. `mpdfm stats` reads the snapshot, the `stats` command of the
+     * control socket the live counters.
+     *
+     * ```
+     * stats {
+     *     path = "/home/user/.local/share/mpdfm/stats.json"
+     *     # interval = "300"
+     * }
+     * ```
+     */
+    struct stats : public scrobbler {  // NOLINT virtual destructor
+        struct factory                 // NOLINT virtual destructor
+            : public scrobbler_factory {
+            ~factory() override = default;
+
+        protected:
+            gsl::owner<scrobbler *>
+                do_fabrication(const config_section &section) override;
+            void do_authenticate(int argc, const char **argv) override;
+        };
+
+        /*!
+         * \param path Snapshot file, loaded if it exists
+         * \param interval Time between snapshots
+         */
+        stats(std::string path, std::chrono::seconds interval);
+
+        //! \brief Writes a last snapshot
+        ~stats() override;
+
+        //! \returns The live counters, usable from any thread
+        [[nodiscard]] std::shared_ptr<listening_stats> counters() const;
+
+    protected:
+        void do_send_now_playing(const scrobble_entry &s) override;
+        void do_send_scrobble(const scrobble_entry &s) override;
+        bool do_check_preconditions(const scrobble_entry &s) override;
+        void do_stop() override;
+
+    private:
+        // shared with the snapshot timer, which may outlive the scrobbler
+        struct state;
+        std::shared_ptr<state> m_state;
+    };
+}  // namespace mpdfm
+
+#endif // PROTOCOLS_STATS_HPP
@@ -0,0 +1,105 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef PROTOCOLS_WEBHOOK_HPP
+#define PROTOCOLS_WEBHOOK_HPP
+
+#include "../scrobbler.hpp"
+
+#include <atomic>
+#include <config/config_file.hpp>
+#include <gsl/gsl>
+#include <optional>
+#include <payload_template.hpp>
+#include <scrobble_cache.hpp>
+#include <uris.hpp>
+
+namespace mpdfm {
+    /*!
+     * \brief POSTs plays to an HTTP endpoint using a configurable payload
+     *
+     * The payload of each play is described by a payload_template, which
+     * is compiled when the configuration is loaded. Scrobbles are sent in
+     * batches, each batch being the rendered entries joined by
+     * `batch_separator` and wrapped in `batch_prefix` and `batch_suffix`.
+     *
+     * ```
+     * webhook {
+     *     url = "http://127.0.0.1:8080/plays"
+     *     template = "{\"event\":\"${event}\",\"artist\":\"${artist}\"}"
+     *     # optional
+     *     now_playing_template = "..."   # defaults to template, "" disables
+     *     batch_size = "100"             # defaults to 1
+     *     batch_prefix = "["
+     *     batch_separator = ","          # defaults to a newline
+     *     batch_suffix = "]"
+     *     content_type = "application/json"
+     *     escape = "json"                # or "none"
+     *     authorization = "Bearer ..."
+     *     store = "/home/user/.cache/mpdfm/webhook.cache"
+     * }
+     * ```
+     */
+    struct webhook : public scrobbler {  // NOLINT virtual destructor
+        struct factory                   // NOLINT virtual destructor
+            : public scrobbler_factory {
+            ~factory() override = default;
+
+        protected:
+            gsl::owner<scrobbler *>
+                do_fabrication(const config_section &section) override;
+            void do_authenticate(int argc, const char **argv) override;
+        };
+
+        //! \brief Everything describing how requests are formed
+        struct options {
+            std::string url;
+            payload_template scrobble;
+            std::optional<payload_template> now_playing;
+            size_t batch_size = 1;
+            std::string prefix;
+            std::string separator = "\n";
+            std::string suffix;
+            std::string content_type = "application/json";
+            std::string authorization;
+            std::string store;
+        };
+
+        explicit webhook(options opts);
+        ~webhook() override;
+
+    protected:
+        void do_send_now_playing(const scrobble_entry &s) override;
+        void do_send_scrobble(const scrobble_entry &s) override;
+        void do_send_scrobbles(const std::vector<scrobble_entry> &s) override;
+        void do_enqueue(const std::vector<scrobble_entry> &s) override;
+        void do_flush() override;
+        [[nodiscard]] size_t do_backlog() const override;
+        bool do_check_preconditions(const scrobble_entry &s) override;
+
+    private:
+        void send_coalesced();
+
+        // gets set to true when the endpoint rejected a request
+        std::atomic<bool> m_fail_flag = false;
+
+        options m_opts;
+        uri m_target;
+        scrobble_cache m_cache;
+    };
+}  // namespace mpdfm
+
+#endif // PROTOCOLS_WEBHOOK_HPP
@@ -0,0 +1,36 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef REGISTRY_HPP
+#define REGISTRY_HPP
+
+#include "scrobbler.hpp"
+
+#include <string>
+
+namespace mpdfm {
+    /*!
+     * \brief Looks up the factory for the scrobbler type \p name
+     *
+     * The name is the one used for configuration sections, e.g. `as20`.
+     * Safe to call from multiple threads.
+     *
+     * \throws std::out_of_range if there is no such scrobbler type
+     */
+    scrobbler_factory &get_factory(const std::string &name);
+}  // namespace mpdfm
+
+#endif // REGISTRY_HPP
@@ -0,0 +1,159 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef REWRITE_TABLE_HPP
+#define REWRITE_TABLE_HPP
+
+#include "scrobbler.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+namespace mpdfm {
+    /*!
+     * \brief Read-only table of canonical names, mapped from a file
+     *
+     * The file is a hash table with open addressing, laid out so that it
+     * can be used straight from the mapping: opening a table only checks
+     * its header, nothing is parsed or copied to the heap, and a lookup is
+     * a hash and a few probes. The pages of the file are shared with every
+     * other process mapping it.
+     *
+     * Tables are compiled with compile() from lines of tab separated
+     * `field, name, replacement`, where field is artist, album,
+     * album_artist or track, e.g.
+     *
+     * ```
+     * artist	Beatles, The	The Beatles
+     * album	Abbey Road (Remastered)	Abbey Road
+     * ```
+     *
+     * The file uses the byte order of the machine that compiled it.
+     */
+    struct rewrite_table {
+        enum class field : char { artist, album, album_artist, track };
+
+        /*!
+         * \brief Maps the table at \p path
+         * \throws std::runtime_error if it can't be mapped or isn't a table
+         */
+        explicit rewrite_table(const std::string &path);
+        ~rewrite_table();
+
+        rewrite_table(const rewrite_table &) = delete;
+        rewrite_table &operator=(const rewrite_table &) = delete;
+        rewrite_table(rewrite_table &&)                 = delete;
+        rewrite_table &operator=(rewrite_table &&) = delete;
+
+        //! \returns The replacement of \p name, which points into the map
+        [[nodiscard]] std::optional<std::string_view>
+            lookup(field f, std::string_view name) const;
+
+        //! \brief Replaces the names of \p s that have an entry
+        void apply(scrobble_entry &s) const;
+
+        //! \returns The amount of entries
+        [[nodiscard]] size_t size() const;
+
+        /*!
+         * \brief Compiles tab separated lines from \p in into \p path
+         *
+         * The table is written next to \p path and renamed over it, so
+         * processes watching it never see a partial file. Empty lines and
+         * lines starting with `#` are skipped, a later entry for the same
+         * name wins.
+         *
+         * \returns The amount of entries
+         * \throws std::runtime_error on malformed lines
+         */
+        static size_t compile(std::istream &in, const std::string &path);
+
+    private:
+        struct header;
+        struct slot;
+
+        const char *m_data = nullptr;
+        size_t m_size      = 0;
+        const header *m_header;
+        const slot *m_slots;
+        const char *m_strings;
+    };
+
+    /*!
+     * \brief Applies a rewrite_table, swapping it when its file changes
+     *
+     * The file is checked every \p interval. A new table is mapped next to
+     * the old one and swapped in once it opened fine, rewrites in progress
+     * keep using the old mapping until they are done. A table that fails to
+     * open is logged, and the previous one stays in use.
+     *
+     * The timer's handlers hold on to the rewriter, so it has to be owned by
+     * a std::shared_ptr, and checks start with start().
+     */
+    struct rewriter : std::enable_shared_from_this<rewriter> {
+        /*!
+         * \throws std::runtime_error if the table can't be opened
+         */
+        rewriter(std::string path,
+                 boost::asio::io_context &io,
+                 std::chrono::seconds interval = std::chrono::seconds(2));
+
+        //! \brief Rewrites \p s with the current table
+        void apply(scrobble_entry &s) const;
+
+        //! \brief Starts watching the file
+        void start();
+
+        //! \brief Stops watching the file, from any thread
+        void stop();
+
+    private:
+        //! \brief Identity of the file a table was mapped from
+        struct file_id {
+            dev_t device = 0;
+            ino_t inode  = 0;
+            time_t mtime = 0;
+            off_t size   = 0;
+
+            bool operator==(const file_id &other) const;
+        };
+
+        static file_id identify(const std::string &path);
+        void schedule_check();
+        void check();
+
+        std::string m_path;
+        std::chrono::seconds m_interval;
+        file_id m_file;
+
+        mutable std::mutex m_mutex;  // guards m_table
+        std::shared_ptr<const rewrite_table> m_table;
+
+        boost::asio::steady_timer m_timer;
+        bool m_stopped = false;  // only touched on the io_context
+    };
+}  // namespace mpdfm
+
+#endif // REWRITE_TABLE_HPP
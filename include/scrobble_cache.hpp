@@ -0,0 +1,115 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SCROBBLE_CACHE_HPP
+#define SCROBBLE_CACHE_HPP
+
+#include "profile.hpp"
+#include "scrobbler.hpp"
+
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace mpdfm {
+    namespace internal {
+        struct ts_compare {
+            template<typename T>
+            bool operator()(const T &lhs, const T &rhs) const {
+                return std::tie(lhs.timestamp, lhs.artist, lhs.track)
+                       < std::tie(rhs.timestamp, rhs.artist, rhs.track);
+            }
+        };
+    }  // namespace internal
+
+    /*!
+     * \brief Thread safe, persistent backlog of scrobbles waiting to be sent
+     *
+     * Scrobbles are ordered by their timestamp and deduplicated by their
+     * timestamp, artist and track. The backlog is loaded from \p path on
+     * construction and written back on destruction. Neither builds an
+     * intermediate JSON DOM, the entries are streamed from and to the file
+     * directly.
+     *
+     * When the backlog grows past its limit the oldest scrobbles are dropped.
+     */
+    struct scrobble_cache {
+        //! \brief Container type used for the backlog
+        using container = std::set<scrobble_entry, internal::ts_compare>;
+
+        /*!
+         * \brief Loads the backlog stored at \p path
+         *
+         * \param path Where the backlog is persisted, or an empty string for
+         *             a purely in-memory backlog
+         * \param limit Maximum amount of scrobbles to keep, zero means
+         *              unlimited. Defaults to the runtime profile's limit.
+         */
+        explicit scrobble_cache(std::string path,
+                                size_t limit = profile().max_backlog);
+        ~scrobble_cache();
+
+        scrobble_cache(const scrobble_cache &) = delete;
+        scrobble_cache &operator=(const scrobble_cache &) = delete;
+        scrobble_cache(scrobble_cache &&)                 = delete;
+        scrobble_cache &operator=(scrobble_cache &&) = delete;
+
+        //! \brief Adds a scrobble to the backlog
+        void insert(const scrobble_entry &s);
+
+        //! \brief Adds several scrobbles to the backlog
+        void insert(const std::vector<scrobble_entry> &entries);
+
+        /*!
+         * \brief Removes and returns up to \p count of the oldest scrobbles
+         *
+         * They count as in flight until they are settled or requeued.
+         */
+        std::vector<scrobble_entry> extract(size_t count);
+
+        //! \brief Marks \p count extracted scrobbles as sent
+        void settle(size_t count);
+
+        //! \brief Puts extracted scrobbles that failed to send back
+        void requeue(const std::vector<scrobble_entry> &entries);
+
+        //! \returns The amount of scrobbles in the backlog
+        [[nodiscard]] size_t size() const;
+
+        //! \returns The amount of extracted scrobbles not settled yet
+        [[nodiscard]] size_t in_flight() const;
+
+        //! \returns true if there's nothing to send
+        [[nodiscard]] bool empty() const;
+
+        //! \brief Writes the backlog out to the path it was loaded from
+        void save() const;
+
+    private:
+        // requires m_mutex to be held
+        void enforce_limit();
+
+        container m_entries;
+        mutable std::mutex m_mutex;
+        size_t m_in_flight = 0;
+        std::string m_path;
+        size_t m_limit;
+    };
+}  // namespace mpdfm
+
+#endif // SCROBBLE_CACHE_HPP
@@ -0,0 +1,55 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef SCROBBLE_JSON_HPP
+#define SCROBBLE_JSON_HPP
+
+#include "scrobbler.hpp"
+
+#include <tao/json/binding.hpp>
+
+/*!
+ * \file scrobble_json.hpp
+ * \brief JSON binding of scrobble_entry, in the shape of scrobble caches
+ *
+ * Kept out of scrobbler.hpp, which is installed, so embedders don't need
+ * taocpp/json.
+ */
+namespace tao::json {
+    template<>
+    struct traits<mpdfm::scrobble_entry>
+        : binding::basic_object<
+              binding::for_unknown_key::skip,
+              binding::for_nothing_value::suppress,
+              TAO_JSON_BIND_OPTIONAL("artist", &mpdfm::scrobble_entry::artist),
+              TAO_JSON_BIND_OPTIONAL("track", &mpdfm::scrobble_entry::track),
+              TAO_JSON_BIND_OPTIONAL("album", &mpdfm::scrobble_entry::album),
+              TAO_JSON_BIND_OPTIONAL("track_number",
+                                     &mpdfm::scrobble_entry::track_number),
+              TAO_JSON_BIND_OPTIONAL("mbid", &mpdfm::scrobble_entry::mbid),
+              TAO_JSON_BIND_OPTIONAL("album_artist",
+                                     &mpdfm::scrobble_entry::album_artist),
+              TAO_JSON_BIND_OPTIONAL("genre", &mpdfm::scrobble_entry::genre),
+              TAO_JSON_BIND_OPTIONAL("uri", &mpdfm::scrobble_entry::uri),
+              TAO_JSON_BIND_OPTIONAL("duration",
+                                     &mpdfm::scrobble_entry::duration),
+              TAO_JSON_BIND_OPTIONAL("timestamp",
+                                     &mpdfm::scrobble_entry::timestamp),
+              TAO_JSON_BIND_OPTIONAL("elapsed",
+                                     &mpdfm::scrobble_entry::elapsed)> {};
+}  // namespace tao::json
+
+#endif // SCROBBLE_JSON_HPP
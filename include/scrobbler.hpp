@@ -17,13 +17,14 @@
 #ifndef SCROBBLER_HPP
 #define SCROBBLER_HPP
 
-#include "mpc.hpp"
-
 #include <config/config_file.hpp>
-#include <gsl/gsl>
-#include <tao/json/binding.hpp>
+#include <ctime>
+#include <string>
+#include <vector>
 
 namespace mpdfm {
+    struct song;
+
     /*!
      * \brief Trivial wrapper around songs to add a timestamp
      */
@@ -68,6 +69,16 @@ namespace mpdfm {
          */
         std::string album_artist;
 
+        /*!
+         * \brief Track genre
+         */
+        std::string genre;
+
+        /*!
+         * \brief Path of the song relative to the MPD music directory
+         */
+        std::string uri;
+
         /*!
          * \brief How long is the track (seconds)
          */
@@ -84,6 +95,21 @@ namespace mpdfm {
         time_t elapsed = 0;
     };
 
+    /*!
+     * \brief The usual scrobbling rules
+     *
+     * A track is scrobbled if it's longer than 30 seconds and was played for
+     * at least half its duration or 4 minutes, whichever comes first.
+     */
+    bool meets_scrobble_rules(const scrobble_entry &s);
+
+    /*!
+     * \brief Serializes \p s as a compact JSON object
+     *
+     * The object has the same shape as the entries of a scrobble cache.
+     */
+    std::string to_json(const scrobble_entry &s);
+
     /*!
      * \brief scrobbler client
      * This class is meant to be inherited from to implement the underlying
@@ -98,6 +124,36 @@ namespace mpdfm {
          */
         void scrobble(const scrobble_entry &song);
 
+        /*!
+         * \brief Sends/saves several scrobbles at once
+         *
+         * Scrobblers with a backlog queue all of them before sending, so
+         * they go out in as few requests as the protocol allows.
+         *
+         * \param songs Songs to scrobble, all meeting the preconditions
+         */
+        void scrobble(const std::vector<scrobble_entry> &songs);
+
+        /*!
+         * \brief Adds scrobbles to the backlog without sending anything
+         *
+         * Used for bulk imports, which feed the backlog and drain it at the
+         * pace of the service using flush() and backlog().
+         */
+        void enqueue(const std::vector<scrobble_entry> &songs);
+
+        /*!
+         * \brief Starts sending the backlog, unless it's already being sent
+         *        or the scrobbler is waiting out a rate limit
+         */
+        void flush();
+
+        /*!
+         * \returns The amount of scrobbles that are not known to be sent
+         *          yet, including those in flight
+         */
+        [[nodiscard]] size_t backlog() const;
+
         /*!
          * \brief updates the scrobble server with the currently playing song
          *
@@ -115,6 +171,15 @@ namespace mpdfm {
          */
         bool check_preconditions(const scrobble_entry &song);
 
+        /*!
+         * \brief Cancels timers and closes connections that would keep the
+         *        io_context busy, before shutting down
+         *
+         * Has to be called from within the io_context. Requests in flight
+         * still complete.
+         */
+        void stop();
+
     protected:
         /*!
          * \brief updates the scrobble server with the currently playing song
@@ -134,6 +199,42 @@ namespace mpdfm {
          */
         virtual void do_send_scrobble(const scrobble_entry &s) = 0;
 
+        /*!
+         * \brief Sends a batch of scrobbles
+         *
+         * Defaults to calling do_send_scrobble for each of them.
+         */
+        virtual void do_send_scrobbles(const std::vector<scrobble_entry> &s);
+
+        /*!
+         * \brief Queues scrobbles, see enqueue()
+         *
+         * Defaults to sending them right away.
+         */
+        virtual void do_enqueue(const std::vector<scrobble_entry> &s);
+
+        /*!
+         * \brief Drains the backlog, see flush()
+         *
+         * Defaults to doing nothing, for scrobblers without a backlog.
+         */
+        virtual void do_flush();
+
+        /*!
+         * \brief Size of the backlog, see backlog()
+         *
+         * Defaults to zero, for scrobblers without a backlog.
+         */
+        [[nodiscard]] virtual size_t do_backlog() const;
+
+        /*!
+         * \brief Winds down long-lived operations, see stop()
+         *
+         * Defaults to doing nothing, for scrobblers that only make
+         * requests.
+         */
+        virtual void do_stop();
+
         /*!
          * \brief Checks whether the scribble conditions have been met yet
          * \param s The song to check for
@@ -149,10 +250,11 @@ namespace mpdfm {
         virtual ~scrobbler_factory() = default;
 
         /*!
-         * \brief Constructs and returns a new scrobbler on the heap
+         * \brief Constructs and returns a new scrobbler on the heap, which
+         *        the caller owns
          * \param section The configuration section for the scrobbler
          */
-        gsl::owner<scrobbler *> operator()(const config_section &section);
+        scrobbler *operator()(const config_section &section);
 
         /*! \brief Runs authentication for the scrobbler built by this factory
          * \param argc Argument count
@@ -162,32 +264,9 @@ namespace mpdfm {
         void authenticate(int argc, const char **argv);
 
     protected:
-        virtual gsl::owner<scrobbler *>
-            do_fabrication(const config_section &)                = 0;
+        virtual scrobbler *do_fabrication(const config_section &) = 0;
         virtual void do_authenticate(int argc, const char **argv) = 0;
     };
 }  // namespace mpdfm
 
-namespace tao::json {
-    template<>
-    struct traits<mpdfm::scrobble_entry>
-        : binding::basic_object<
-              binding::for_unknown_key::skip,
-              binding::for_nothing_value::suppress,
-              TAO_JSON_BIND_OPTIONAL("artist", &mpdfm::scrobble_entry::artist),
-              TAO_JSON_BIND_OPTIONAL("track", &mpdfm::scrobble_entry::track),
-              TAO_JSON_BIND_OPTIONAL("album", &mpdfm::scrobble_entry::album),
-              TAO_JSON_BIND_OPTIONAL("track_number",
-                                     &mpdfm::scrobble_entry::track_number),
-              TAO_JSON_BIND_OPTIONAL("mbid", &mpdfm::scrobble_entry::mbid),
-              TAO_JSON_BIND_OPTIONAL("album_artist",
-                                     &mpdfm::scrobble_entry::album_artist),
-              TAO_JSON_BIND_OPTIONAL("duration",
-                                     &mpdfm::scrobble_entry::duration),
-              TAO_JSON_BIND_OPTIONAL("timestamp",
-                                     &mpdfm::scrobble_entry::timestamp),
-              TAO_JSON_BIND_OPTIONAL("elapsed",
-                                     &mpdfm::scrobble_entry::elapsed)> {};
-}  // namespace tao::json
-
 #endif // SCROBBLER_HPP
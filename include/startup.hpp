@@ -0,0 +1,100 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef STARTUP_HPP
+#define STARTUP_HPP
+
+#include <boost/asio/io_context.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace mpdfm {
+    //! \brief Clock used for all startup timings
+    using startup_clock = std::chrono::steady_clock;
+
+    /*!
+     * \returns The point in time the process is considered to have started
+     *          at. All startup timings are reported relative to it.
+     */
+    startup_clock::time_point process_start();
+
+    /*!
+     * \brief Debug logs how long it took since process_start() to reach
+     *        the milestone \p what
+     */
+    void log_startup_mark(std::string_view what);
+
+    /*!
+     * \brief Dependency graph of startup phases
+     *
+     * Each phase is a callable with a list of phases it depends on. Once all
+     * of its dependencies have completed, a phase is handed to the
+     * io_context, while the thread calling run() keeps picking up ready
+     * phases as well. This way, independent phases (e.g. loading the caches
+     * of different scrobblers and connecting to MPD) run concurrently.
+     *
+     * If a phase throws, everything that depends on it is skipped and run()
+     * rethrows the first exception once no more phases can make progress.
+     *
+     * Phases may add new phases to the graph while it is running; this is
+     * how phases whose existence depends on the configuration are made.
+     */
+    struct startup_graph {
+        //! \brief Phase body
+        using task_type = std::function<void()>;
+
+        startup_graph();
+
+        /*!
+         * \brief Adds a phase to the graph
+         *
+         * \param name Unique name of the phase, used for reporting and in
+         *             dependency lists
+         * \param task The work to do
+         * \param deps Names of phases that have to complete before this one,
+         *             all of them must have been added beforehand
+         */
+        void add(std::string name,
+                 task_type task,
+                 const std::vector<std::string> &deps = {});
+
+        /*!
+         * \brief Runs all phases and blocks until they are finished
+         *
+         * \param io The io_context phases may be offloaded to. If it is not
+         *           being run by any thread, all phases simply run on the
+         *           calling thread.
+         */
+        void run(boost::asio::io_context &io);
+
+        /*!
+         * \brief Debug logs when each phase started and how long it took
+         */
+        void report() const;
+
+    private:
+        struct phase;
+        struct state;
+
+        std::shared_ptr<state> m_state;
+    };
+}  // namespace mpdfm
+
+#endif // STARTUP_HPP
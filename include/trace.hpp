@@ -0,0 +1,110 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/*!
+ * \brief Span tracing in the Chrome trace event format
+ *
+ * Tracing is off unless start() is called. While off, a span costs one
+ * relaxed atomic load. While on, every thread records into its own ring
+ * buffer of the most recent events, which dump() writes as JSON that
+ * chrome://tracing and ui.perfetto.dev open.
+ *
+ * Names have to be string literals, or otherwise outlive the tracer.
+ */
+namespace mpdfm::trace {
+    using clock = std::chrono::steady_clock;
+
+    namespace internal {
+        extern std::atomic<bool> enabled;
+
+        void record(const char *name,
+                    clock::time_point begin,
+                    clock::time_point end,
+                    const void *id);
+    }  // namespace internal
+
+    //! \returns Whether events are being recorded
+    inline bool enabled() {
+        return internal::enabled.load(std::memory_order_relaxed);
+    }
+
+    /*!
+     * \brief Records the time between \p begin and \p end
+     *
+     * \param id Groups asynchronous events, e.g. the steps of one request
+     *           that run in several callbacks, onto one track. nullptr for
+     *           events that nest on their thread's track.
+     */
+    inline void complete(const char *name,
+                         clock::time_point begin,
+                         clock::time_point end,
+                         const void *id = nullptr) {
+        if (enabled()) {
+            internal::record(name, begin, end, id);
+        }
+    }
+
+    //! \brief Records the lifetime of a scope
+    class span {
+        const char *m_name = nullptr;
+        clock::time_point m_begin;
+
+    public:
+        explicit span(const char *name) {
+            if (enabled()) {
+                m_name  = name;
+                m_begin = clock::now();
+            }
+        }
+
+        ~span() {
+            if (m_name != nullptr) {
+                internal::record(m_name, m_begin, clock::now(), nullptr);
+            }
+        }
+
+        span(const span &) = delete;
+        span &operator=(const span &) = delete;
+        span(span &&)                 = delete;
+        span &operator=(span &&) = delete;
+    };
+
+    /*!
+     * \brief Starts recording
+     *
+     * \param path Where dump() writes the trace
+     * \param events Capacity of each thread's ring buffer
+     */
+    void start(const std::string &path,
+               size_t events = 64 * 1024);  // NOLINT 64Ki events
+
+    /*!
+     * \brief Writes the events currently in the ring buffers, oldest first
+     *
+     * Recording continues. Does nothing if tracing was never started.
+     */
+    void dump();
+}  // namespace mpdfm::trace
+
+#endif // TRACE_HPP
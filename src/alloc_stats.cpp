@@ -0,0 +1,173 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <alloc_stats.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#ifdef MPDFM_ALLOC_STATS
+#include <atomic>
+
+namespace {
+    constexpr auto tags = static_cast<size_t>(mpdfm::alloc::tag::count);
+
+    // plain arrays of atomics, nothing here may allocate
+    std::array<std::atomic<uint64_t>, tags> allocations {};
+    std::array<std::atomic<uint64_t>, tags> bytes {};
+
+    thread_local mpdfm::alloc::tag current = mpdfm::alloc::tag::other;
+
+    void count(size_t size) {
+        auto i = static_cast<size_t>(current);
+        allocations[i].fetch_add(1, std::memory_order_relaxed);
+        bytes[i].fetch_add(size, std::memory_order_relaxed);
+    }
+
+    void *allocate(size_t size) {
+        count(size);
+        // malloc(0) may return null, new may not
+        if (void *p = std::malloc(size == 0 ? 1 : size)) {
+            return p;
+        }
+        throw std::bad_alloc();
+    }
+
+    void *allocate(size_t size, std::align_val_t align) {
+        count(size);
+        void *p = nullptr;
+        if (posix_memalign(&p, std::max(static_cast<size_t>(align),
+                                        sizeof(void *)),
+                           size == 0 ? 1 : size)
+            != 0) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+}  // namespace
+
+mpdfm::alloc::tag mpdfm::alloc::exchange_tag(tag t) {
+    auto previous = current;
+    current       = t;
+    return previous;
+}
+
+mpdfm::alloc::snapshot mpdfm::alloc::get() {
+    snapshot s;
+    for (size_t i = 0; i < tags; i++) {
+        s[i].allocations = allocations[i].load(std::memory_order_relaxed);
+        s[i].bytes       = bytes[i].load(std::memory_order_relaxed);
+    }
+    return s;
+}
+
+// NOLINTBEGIN replacing the global allocation functions
+void *operator new(size_t size) {
+    return allocate(size);
+}
+
+void *operator new[](size_t size) {
+    return allocate(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t & /*unused*/) noexcept {
+    try {
+        return allocate(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *operator new[](size_t size,
+                     const std::nothrow_t & /*unused*/) noexcept {
+    try {
+        return allocate(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void *operator new(size_t size, std::align_val_t align) {
+    return allocate(size, align);
+}
+
+void *operator new[](size_t size, std::align_val_t align) {
+    return allocate(size, align);
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t /*unused*/) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, size_t /*unused*/) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t /*unused*/) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p, std::align_val_t /*unused*/) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p,
+                     size_t /*unused*/,
+                     std::align_val_t /*unused*/) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void *p,
+                       size_t /*unused*/,
+                       std::align_val_t /*unused*/) noexcept {
+    std::free(p);
+}
+// NOLINTEND
+#endif
+
+const char *mpdfm::alloc::tag_name(tag t) {
+    static const std::array<const char *, static_cast<size_t>(tag::count)>
+        names { "other", "mpd", "engine", "scrobbler", "http", "cache" };
+    return names.at(static_cast<size_t>(t));
+}
+
+mpdfm::alloc::counts mpdfm::alloc::total(const snapshot &s) {
+    counts sum;
+    for (auto &c : s) {
+        sum.allocations += c.allocations;
+        sum.bytes += c.bytes;
+    }
+    return sum;
+}
+
+mpdfm::alloc::snapshot mpdfm::alloc::difference(const snapshot &after,
+                                                const snapshot &before) {
+    snapshot d;
+    for (size_t i = 0; i < d.size(); i++) {
+        d[i].allocations = after[i].allocations - before[i].allocations;
+        d[i].bytes       = after[i].bytes - before[i].bytes;
+    }
+    return d;
+}
@@ -16,7 +16,16 @@
  */
 #include <config/config_file.hpp>
 
-#include <boost/process.hpp>
+#ifdef MPDFM_SMALL_FOOTPRINT
+#    include <array>
+#    include <boost/algorithm/string/trim.hpp>
+#    include <cstdio>
+#    include <memory>
+#else
+#    include <boost/process.hpp>
+#endif
+#include <future>
+#include <limits>
 #include <tao/pegtl.hpp>
 #include <tao/pegtl/contrib/parse_tree.hpp>
 #include <tao/pegtl/contrib/unescape.hpp>
@@ -160,22 +169,46 @@ std::string mpdfm::config_section::value(const std::string &key,
 }
 
 namespace {
+#ifdef MPDFM_SMALL_FOOTPRINT
+    // boost::process pulls in a lot of code for what is a single popen call
+    std::string evaluate(const std::string &cmd) {
+        std::unique_ptr<FILE, int (*)(FILE *)> pipe(popen(cmd.c_str(), "r"),
+                                                    pclose);
+        if (!pipe) {
+            throw std::runtime_error("evaluation failure for: " + cmd);
+        }
+
+        std::string res;
+        std::array<char, 256> buf {};  // NOLINT magic num
+        size_t read = 0;
+        while ((read = fread(buf.data(), 1, buf.size(), pipe.get())) > 0) {
+            res.append(buf.data(), read);
+        }
+
+        if (pclose(pipe.release()) != 0) {
+            throw std::runtime_error("evaluation failure for: " + cmd);
+        }
+
+        boost::trim(res);
+        return res;
+    }
+#else
     std::string evaluate(const std::string &cmd) {
         boost::process::ipstream is;
         // This is here because boost::process quotes the argument given to
         // system when used in combination with boost::process::shell.
         auto exit =
-#ifdef _WIN32
+#    ifdef _WIN32
             boost::process::system(
                 boost::process::shell(), cmd, boost::process::std_out > is);
-#elif defined(__unix__)
+#    elif defined(__unix__)
             boost::process::system(boost::process::shell(),
                                    "-c",
                                    cmd,
                                    boost::process::std_out > is);
-#else
-#    error "unsupported operating system"
-#endif
+#    else
+#        error "unsupported operating system"
+#    endif
         if (exit != 0) {
             throw std::runtime_error("evaluation failure for: " + cmd);
         }
@@ -187,6 +220,7 @@ namespace {
         boost::trim_right(res);
         return res;
     }
+#endif
 }  // namespace
 
 mpdfm::config_file::config_file() : m_root({}) {}
@@ -205,6 +239,26 @@ mpdfm::config_file::config_file(const std::string &file) : m_root({}) {
         throw std::runtime_error("configuration file parse error");
     }
 
+    // evaluated pairs are usually password managers or similar, which can
+    // take a while to respond. run all of them concurrently and collect the
+    // results once the whole file has been walked
+    struct pending_evaluation {
+        size_t section;  // root_index for the root section
+        std::string name;
+        std::future<std::string> value;
+    };
+    constexpr auto root_index = std::numeric_limits<size_t>::max();
+    std::vector<pending_evaluation> pending;
+    auto evaluate_later = [&pending](size_t section,
+                                     std::string name,
+                                     std::string cmd) {
+        pending.push_back({ section,
+                            std::move(name),
+                            std::async(std::launch::async,
+                                       evaluate,
+                                       std::move(cmd)) });
+    };
+
     // TODO(w1d3): possibly clean this up one day, but it works for now in this
     //             foul state
     for (auto &node : tree->children) {
@@ -215,27 +269,29 @@ mpdfm::config_file::config_file(const std::string &file) : m_root({}) {
         } else if (node->is_type<config::epair>()) {
             auto name  = node->children[0]->string();
             auto value = config::unescaped(node->children[1]->string());
-            m_root.insert_or_fail(name, evaluate(value));
+            evaluate_later(root_index, std::move(name), std::move(value));
         } else if (node->is_type<config::section>()) {
             auto name  = node->children[0]->string();
             auto &data = node->children[1];
             config_section sec(name);
             for (auto &node : data->children) {
+                auto name  = node->children[0]->string();
+                auto value = config::unescaped(node->children[1]->string());
                 if (node->is_type<config::tpair>()) {
-                    auto name = node->children[0]->string();
-                    auto value =
-                        config::unescaped(node->children[1]->string());
                     sec.insert_or_fail(name, std::move(value));
                 } else {
-                    auto name = node->children[0]->string();
-                    auto value =
-                        config::unescaped(node->children[1]->string());
-                    sec.insert_or_fail(name, evaluate(value));
+                    evaluate_later(
+                        m_sections.size(), std::move(name), std::move(value));
                 }
             }
             m_sections.emplace_back(std::move(sec));
         }
     }
+
+    for (auto &p : pending) {
+        auto &sec = p.section == root_index ? m_root : m_sections[p.section];
+        sec.insert_or_fail(p.name, p.value.get());
+    }
 }
 
 const std::vector<mpdfm::config_section> &
@@ -0,0 +1,242 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <control.hpp>
+
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/filesystem.hpp>
+#include <directory_helper.hpp>
+#include <istream>
+#include <set>
+#include <spdlog/spdlog.h>
+#include <sstream>
+#include <tao/json.hpp>
+
+namespace {
+    namespace asio = boost::asio;
+    using stream = asio::local::stream_protocol;
+
+    // longest command line accepted
+    constexpr size_t max_line = 4096;
+
+    std::vector<std::string> split_words(const std::string &line) {
+        std::istringstream in(line);
+        std::vector<std::string> words;
+        for (std::string w; in >> w;) {
+            words.push_back(std::move(w));
+        }
+        return words;
+    }
+
+    std::string error_reply(const std::string &message) {
+        return tao::json::to_string(
+                   tao::json::value { { "ok", false }, { "error", message } })
+               + '\n';
+    }
+}  // namespace
+
+/*!
+ * \brief Acceptor and connections, running on one strand; blocking
+ *        commands run on m_pool
+ */
+struct mpdfm::control_server::impl : std::enable_shared_from_this<impl> {
+    struct session {
+        explicit session(asio::strand<asio::io_context::executor_type> &s)
+            : socket(s), input(max_line) {}
+
+        stream::socket socket;
+        asio::streambuf input;
+        std::string reply;
+    };
+    using session_ptr = std::shared_ptr<session>;
+
+    impl(asio::io_context &io, std::string path, commands c)
+        : m_path(std::move(path)),
+          m_commands(std::move(c)),
+          m_strand(asio::make_strand(io)),
+          m_acceptor(m_strand) {
+        m_commands.emplace("help", control_command { [this](auto &) {
+                                                        return help();
+                                                    },
+                                                     "lists the commands" });
+
+        remove_stale_socket(m_path);
+        stream::endpoint ep(m_path);
+        m_acceptor.open(ep.protocol());
+        {
+            owner_only_umask private_files;
+            m_acceptor.bind(ep);
+        }
+        m_acceptor.listen();
+    }
+
+    void start() {
+        asio::post(m_strand, [self = shared_from_this()]() {
+            self->accept();
+        });
+    }
+
+    void stop() {
+        boost::system::error_code ignored;
+        boost::filesystem::remove(m_path, ignored);
+        asio::post(m_strand, [self = shared_from_this()]() {
+            boost::system::error_code ignored;
+            self->m_acceptor.close(ignored);
+            for (auto &s : self->m_sessions) {
+                s->socket.close(ignored);
+            }
+            self->m_sessions.clear();
+        });
+        m_pool.join();
+    }
+
+private:
+    void accept() {
+        auto s = std::make_shared<session>(m_strand);
+        m_acceptor.async_accept(
+            s->socket, [self = shared_from_this(), s](auto ec) {
+                if (ec == asio::error::operation_aborted) {
+                    return;
+                }
+                if (ec) {
+                    spdlog::error("control socket: accept failed: {}",
+                                  ec.message());
+                } else {
+                    self->m_sessions.insert(s);
+                    self->read(s);
+                }
+                self->accept();
+            });
+    }
+
+    void read(const session_ptr &s) {
+        asio::async_read_until(
+            s->socket, s->input, '\n',
+            [self = shared_from_this(), s](auto ec, size_t) {
+                if (ec == asio::error::not_found) {
+                    self->respond(s, error_reply("line too long"), false);
+                    return;
+                }
+                if (ec) {
+                    self->remove(s);
+                    return;
+                }
+                std::istream in(&s->input);
+                std::string line;
+                std::getline(in, line);
+                self->run(s, split_words(line));
+            });
+    }
+
+    //! \brief Runs a command, and replies once it is done
+    void run(const session_ptr &s, std::vector<std::string> words) {
+        if (words.empty()) {
+            read(s);
+            return;
+        }
+        auto it = m_commands.find(words.front());
+        if (it == m_commands.end()) {
+            respond(s, error_reply("unknown command " + words.front()
+                                   + ", try help"));
+            return;
+        }
+        words.erase(words.begin());
+
+        auto &command = it->second;
+        if (!command.blocking) {
+            respond(s, execute(command, words));
+            return;
+        }
+        asio::post(m_pool, [self = shared_from_this(), s, &command,
+                            words = std::move(words)]() {
+            auto reply = execute(command, words);
+            asio::post(self->m_strand,
+                       [self, s, reply = std::move(reply)]() mutable {
+                           self->respond(s, std::move(reply));
+                       });
+        });
+    }
+
+    static std::string execute(const control_command &command,
+                               const std::vector<std::string> &args) {
+        try {
+            return tao::json::to_string(tao::json::value {
+                       { "ok", true }, { "result", command.handler(args) } })
+                   + '\n';
+        } catch (const std::exception &e) {
+            return error_reply(e.what());
+        }
+    }
+
+    void respond(const session_ptr &s, std::string reply, bool more = true) {
+        if (!s->socket.is_open()) {
+            return;  // stopped while a blocking command ran
+        }
+        s->reply = std::move(reply);
+        asio::async_write(s->socket, asio::buffer(s->reply),
+                          [self = shared_from_this(), s, more](auto ec,
+                                                               size_t) {
+                              if (ec || !more) {
+                                  self->remove(s);
+                                  return;
+                              }
+                              self->read(s);
+                          });
+    }
+
+    void remove(const session_ptr &s) {
+        boost::system::error_code ignored;
+        s->socket.close(ignored);
+        m_sessions.erase(s);
+    }
+
+    tao::json::value help() const {
+        tao::json::value result = tao::json::empty_object;
+        for (auto &[name, command] : m_commands) {
+            result[name] = command.help;
+        }
+        return result;
+    }
+
+    std::string m_path;
+    commands m_commands;
+    asio::strand<asio::io_context::executor_type> m_strand;
+    stream::acceptor m_acceptor;
+    std::set<session_ptr> m_sessions;
+    asio::thread_pool m_pool { 1 };
+};
+
+mpdfm::control_server::control_server(boost::asio::io_context &io,
+                                      const std::string &path,
+                                      commands c)
+    : m_impl(std::make_shared<impl>(io, path, std::move(c))) {
+    m_impl->start();
+    spdlog::info("control socket listening on {}", path);
+}
+
+mpdfm::control_server::~control_server() {
+    stop();
+}
+
+void mpdfm::control_server::stop() {
+    m_impl->stop();
+}
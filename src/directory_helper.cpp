@@ -16,8 +16,11 @@
  */
 #include <directory_helper.hpp>
 
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
 #include <boost/system/system_error.hpp>
 #include <pwd.h>
+#include <sys/stat.h>
 
 boost::filesystem::path mpdfm::get_home_directory() {
     auto env_home = std::getenv("HOME");
@@ -50,3 +53,28 @@ boost::filesystem::path mpdfm::get_config_path() {
     }
     return home / ".config";
 }
+
+void mpdfm::remove_stale_socket(const std::string &path) {
+    namespace fs = boost::filesystem;
+    using stream = boost::asio::local::stream_protocol;
+    if (fs::status(path).type() != fs::socket_file) {
+        return;
+    }
+    // a socket nobody listens on is left over from an earlier run
+    boost::asio::io_context io;
+    boost::system::error_code ec;
+    stream::socket probe(io);
+    probe.connect(stream::endpoint(path), ec);
+    if (!ec) {
+        throw std::runtime_error("socket " + path
+                                 + " is in use by another process");
+    }
+    fs::remove(path);
+}
+
+mpdfm::owner_only_umask::owner_only_umask()
+    : m_previous(umask(S_IRWXG | S_IRWXO)) {}
+
+mpdfm::owner_only_umask::~owner_only_umask() {
+    umask(m_previous);
+}
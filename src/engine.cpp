@@ -0,0 +1,353 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <engine.hpp>
+
+#include <algorithm>
+#include <alloc_stats.hpp>
+#include <atomic>
+#include <flight_recorder.hpp>
+#include <http_client.hpp>
+#include <iterator>
+#include <logging.hpp>
+#include <metrics.hpp>
+#include <mutex>
+#include <optional>
+#include <profile.hpp>
+#include <registry.hpp>
+#include <rewrite_table.hpp>
+#include <spdlog/spdlog.h>
+#include <trace.hpp>
+#include <vector>
+
+struct mpdfm::engine::impl {
+    struct member {
+        std::unique_ptr<mpdfm::scrobbler> target;
+        uint32_t id;  // owner of its filter rules
+        std::string name;
+        // scrobbles held back while paused
+        std::vector<scrobble_entry> held;
+    };
+    using scrobbler_vec = std::vector<member>;
+
+    mutable std::mutex mutex;
+    scrobbler_vec scrobblers;
+    uint32_t next_id = 0;
+    // changed with mutex held, so tasks see it change between scrobblers
+    std::atomic<bool> paused { false };
+
+    // guards the filters, which are compiled on first use after a change
+    std::mutex filter_mutex;
+    filter_set filters;
+    bool filters_compiled = true;
+
+    // set by load_rewrites
+    std::mutex rewrite_mutex;
+    std::shared_ptr<rewriter> rewrites;
+
+    /*!
+     * \returns \p s, or a rewritten copy of it in \p copy if there's a
+     *          rewrite table
+     */
+    const scrobble_entry &rewrite(const scrobble_entry &s,
+                                  std::optional<scrobble_entry> &copy) {
+        std::shared_ptr<rewriter> r;
+        {
+            std::unique_lock lock(rewrite_mutex);
+            r = rewrites;
+        }
+        if (!r) {
+            return s;
+        }
+        trace::span span("rewrite");
+        copy.emplace(s);
+        r->apply(*copy);
+        return *copy;
+    }
+
+    //! \returns Sorted ids of the scrobblers excluding \p s
+    std::vector<uint32_t> excluded_by(const scrobble_entry &s) {
+        std::unique_lock lock(filter_mutex);
+        if (filters.empty()) {
+            return {};
+        }
+        if (!filters_compiled) {
+            filters.compile();
+            filters_compiled = true;
+        }
+        trace::span span("filter");
+        return filters.match(s);
+    }
+
+    /*!
+     * \brief Holds \p entries back for \p x until submissions resume,
+     *        keeping at most profile().max_backlog
+     */
+    static void hold(member &x, const std::vector<scrobble_entry> &entries) {
+        x.held.insert(x.held.end(), entries.begin(), entries.end());
+        auto limit = profile().max_backlog;
+        if (limit == 0 || x.held.size() <= limit) {
+            return;
+        }
+        static auto &dropped = metrics::get_counter(
+            "mpdfm_backlog_dropped_total",
+            "Scrobbles dropped because the backlog was full");
+        auto excess = x.held.size() - limit;
+        dropped.add(excess);
+        MPDFM_LOG_LIMITED(spdlog::level::warn,
+                          "{}: too many scrobbles held back while paused, "
+                          "dropping {} oldest",
+                          x.name, excess);
+        auto end = std::next(x.held.begin(), static_cast<ptrdiff_t>(excess));
+        x.held.erase(x.held.begin(), end);
+    }
+
+    template<typename Task>
+    void run_scrobbler_task(Task task) {
+        bool removed = false;
+        bool empty   = false;
+        {
+            std::unique_lock lock(mutex);
+            for (auto i = scrobblers.begin(); i != scrobblers.end();) {
+                try {
+                    alloc::scope account(alloc::tag::scrobbler);
+                    task(*i);
+                    i++;
+                } catch (const std::exception &e) {
+                    spdlog::error("scrobbler operation failed: {}", e.what());
+                    i       = scrobblers.erase(i);
+                    removed = true;
+                }
+            }
+            empty = scrobblers.empty();
+        }
+        // written without the lock, other events needn't wait for the disk
+        if (removed) {
+            flight::dump("scrobbler removed");
+        }
+        if (empty) {
+            throw std::runtime_error("no scrobblers left");
+        }
+    }
+};
+
+mpdfm::engine::engine(boost::asio::io_context &io)
+    : m_impl(std::make_unique<impl>()) {
+    use_io_context(io);
+}
+
+mpdfm::engine::~engine() {
+    // scrobblers with a backlog keep what is still held back
+    for (auto &x : m_impl->scrobblers) {
+        if (x.held.empty()) {
+            continue;
+        }
+        try {
+            x.target->enqueue(x.held);
+        } catch (const std::exception &e) {
+            spdlog::error("{}: lost {} scrobble(s) held back while paused: {}",
+                          x.name, x.held.size(), e.what());
+        }
+    }
+}
+
+void mpdfm::engine::add_scrobbler(std::unique_ptr<scrobbler> s,
+                                  const std::vector<filter_rule> &exclude,
+                                  std::string name) {
+    std::unique_lock lock(m_impl->mutex);
+    auto id = m_impl->next_id++;
+    if (name.empty()) {
+        name = "scrobbler " + std::to_string(id);
+    }
+    if (!exclude.empty()) {
+        std::unique_lock filter_lock(m_impl->filter_mutex);
+        m_impl->filters.add(id, exclude);
+        m_impl->filters_compiled = false;
+    }
+    m_impl->scrobblers.push_back({ std::move(s), id, std::move(name) });
+}
+
+size_t mpdfm::engine::add_scrobblers(const config_file &cfg) {
+    size_t added = 0;
+    for (auto &sec : cfg.sections()) {
+        try {
+            auto exclude = parse_filter_rules(sec.value("exclude", {}));
+            // NOLINTNEXTLINE unique_ptr is owning
+            std::unique_ptr<scrobbler> s(get_factory(sec.name())(sec));
+            add_scrobbler(std::move(s), exclude, sec.name());
+            added++;
+        } catch (const std::exception &e) {
+            spdlog::error("got an error while setting up scrobbler: {}",
+                          e.what());
+        }
+    }
+    return added;
+}
+
+namespace {
+    bool contains(const std::vector<uint32_t> &ids, uint32_t id) {
+        return std::binary_search(ids.begin(), ids.end(), id);
+    }
+}  // namespace
+
+void mpdfm::engine::load_rewrites(const std::string &path) {
+    auto r = std::make_shared<rewriter>(path, io_context());
+    r->start();
+    {
+        std::unique_lock lock(m_impl->rewrite_mutex);
+        std::swap(m_impl->rewrites, r);
+    }
+    // the one replaced
+    if (r) {
+        r->stop();
+    }
+}
+
+bool mpdfm::engine::now_playing(const scrobble_entry &in) {
+    trace::span span("engine now_playing");
+    alloc::scope account(alloc::tag::engine);
+    if (m_impl->paused) {
+        return false;
+    }
+    std::optional<scrobble_entry> copy;
+    const auto &s = m_impl->rewrite(in, copy);
+    auto excluded = m_impl->excluded_by(s);
+    bool taken    = false;
+    m_impl->run_scrobbler_task([&](auto &x) {
+        if (!contains(excluded, x.id)) {
+            x.target->now_playing(s);
+            taken = true;
+        }
+    });
+    return taken;
+}
+
+void mpdfm::engine::scrobble(const scrobble_entry &in) {
+    trace::span span("engine scrobble");
+    alloc::scope account(alloc::tag::engine);
+    std::optional<scrobble_entry> copy;
+    const auto &s = m_impl->rewrite(in, copy);
+    auto excluded = m_impl->excluded_by(s);
+    m_impl->run_scrobbler_task([&](auto &x) {
+        if (contains(excluded, x.id) || !x.target->check_preconditions(s)) {
+            return;
+        }
+        if (m_impl->paused) {
+            impl::hold(x, { s });
+        } else {
+            x.target->scrobble(s);
+        }
+    });
+}
+
+size_t mpdfm::engine::scrobble(const std::vector<scrobble_entry> &in) {
+    trace::span span("engine scrobble batch");
+    alloc::scope account(alloc::tag::engine);
+    std::vector<scrobble_entry> entries;
+    std::vector<std::vector<uint32_t>> excluded;
+    entries.reserve(in.size());
+    excluded.reserve(in.size());
+    for (auto &s : in) {
+        std::optional<scrobble_entry> copy;
+        entries.push_back(m_impl->rewrite(s, copy));
+        excluded.push_back(m_impl->excluded_by(entries.back()));
+    }
+
+    std::vector<bool> taken(entries.size());
+    m_impl->run_scrobbler_task([&](auto &x) {
+        std::vector<scrobble_entry> accepted;
+        accepted.reserve(entries.size());
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (!contains(excluded[i], x.id)
+                && x.target->check_preconditions(entries[i])) {
+                accepted.push_back(entries[i]);
+                taken[i] = true;
+            }
+        }
+        if (accepted.empty()) {
+            return;
+        }
+        if (m_impl->paused) {
+            impl::hold(x, accepted);
+        } else {
+            x.target->scrobble(accepted);
+        }
+    });
+    return static_cast<size_t>(std::count(taken.begin(), taken.end(), true));
+}
+
+size_t mpdfm::engine::size() const {
+    std::unique_lock lock(m_impl->mutex);
+    return m_impl->scrobblers.size();
+}
+
+void mpdfm::engine::pause(bool paused) {
+    {
+        std::unique_lock lock(m_impl->mutex);
+        if (m_impl->paused.exchange(paused) == paused) {
+            return;
+        }
+    }
+    if (paused) {
+        spdlog::info("submissions paused");
+        return;
+    }
+    spdlog::info("submissions resumed");
+    // what was held back goes out first, then the backlogs
+    m_impl->run_scrobbler_task([](auto &x) {
+        if (!x.held.empty()) {
+            auto held = std::move(x.held);
+            x.held.clear();
+            x.target->scrobble(held);
+        }
+        x.target->flush();
+    });
+}
+
+bool mpdfm::engine::paused() const {
+    return m_impl->paused;
+}
+
+void mpdfm::engine::flush() {
+    m_impl->run_scrobbler_task([](auto &x) { x.target->flush(); });
+}
+
+std::vector<mpdfm::engine::backlog_entry> mpdfm::engine::backlogs() const {
+    std::unique_lock lock(m_impl->mutex);
+    std::vector<backlog_entry> result;
+    result.reserve(m_impl->scrobblers.size());
+    for (auto &x : m_impl->scrobblers) {
+        result.push_back({ x.name, x.target->backlog() + x.held.size() });
+    }
+    return result;
+}
+
+void mpdfm::engine::stop() {
+    {
+        std::unique_lock lock(m_impl->mutex);
+        for (auto &x : m_impl->scrobblers) {
+            try {
+                x.target->stop();
+            } catch (const std::exception &e) {
+                spdlog::error("cannot stop {}: {}", x.name, e.what());
+            }
+        }
+    }
+    std::unique_lock lock(m_impl->rewrite_mutex);
+    if (m_impl->rewrites) {
+        m_impl->rewrites->stop();
+    }
+}
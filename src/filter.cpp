@@ -0,0 +1,282 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <filter.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+namespace {
+    using mpdfm::filter_rule;
+    using namespace std::string_view_literals;
+
+    // surround values, so anchored rules are plain substrings
+    constexpr char begin_marker = '\x02';
+    constexpr char end_marker   = '\x03';
+
+    constexpr std::array<std::pair<std::string_view, filter_rule::field>, 6>
+        field_names { {
+            { "artist"sv, filter_rule::field::artist },
+            { "album"sv, filter_rule::field::album },
+            { "album_artist"sv, filter_rule::field::album_artist },
+            { "track"sv, filter_rule::field::track },
+            { "genre"sv, filter_rule::field::genre },
+            { "uri"sv, filter_rule::field::uri },
+        } };
+
+    // the character in front of '=', plain '=' is an exact match
+    constexpr std::array<std::pair<char, filter_rule::kind>, 3> operators { {
+        { '^', filter_rule::kind::prefix },
+        { '$', filter_rule::kind::suffix },
+        { '*', filter_rule::kind::contains },
+    } };
+
+    std::string_view trim(std::string_view s) {
+        auto first = s.find_first_not_of(" \t\n");
+        if (first == std::string_view::npos) {
+            return {};
+        }
+        auto last = s.find_last_not_of(" \t\n");
+        return s.substr(first, last - first + 1);
+    }
+
+    void lowercase(std::string &s) {
+        for (auto &c : s) {
+            if (c >= 'A' && c <= 'Z') {
+                c = static_cast<char>(c - 'A' + 'a');
+            }
+        }
+    }
+
+    filter_rule parse_rule(std::string_view text) {
+        auto op = text.find('=');
+        if (op == std::string_view::npos || op == 0) {
+            throw std::runtime_error("filter rule without an operator: "
+                                     + std::string(text));
+        }
+
+        auto kind     = filter_rule::kind::equals;
+        auto name_end = op;
+        for (auto [symbol, k] : operators) {
+            if (text[op - 1] == symbol) {
+                kind     = k;
+                name_end = op - 1;
+                break;
+            }
+        }
+
+        auto name = trim(text.substr(0, name_end));
+        auto f    = std::find_if(field_names.begin(), field_names.end(),
+                              [name](auto &p) { return p.first == name; });
+        if (f == field_names.end()) {
+            throw std::runtime_error("unknown filter field: "
+                                     + std::string(name));
+        }
+
+        filter_rule rule { f->second, kind,
+                           std::string(trim(text.substr(op + 1))) };
+        lowercase(rule.value);
+        if (rule.value.empty() && kind != filter_rule::kind::equals) {
+            // would match every song
+            throw std::runtime_error("empty filter value for "
+                                     + std::string(name));
+        }
+        return rule;
+    }
+
+    std::string pattern_of(const filter_rule &rule) {
+        switch (rule.match) {
+        case filter_rule::kind::equals:
+            return begin_marker + rule.value + end_marker;
+        case filter_rule::kind::prefix:
+            return begin_marker + rule.value;
+        case filter_rule::kind::suffix:
+            return rule.value + end_marker;
+        case filter_rule::kind::contains:
+            return rule.value;
+        }
+        return rule.value;
+    }
+
+    const std::string &value_of(const mpdfm::scrobble_entry &s, size_t f) {
+        switch (static_cast<filter_rule::field>(f)) {
+        case filter_rule::field::artist:
+            return s.artist;
+        case filter_rule::field::album:
+            return s.album;
+        case filter_rule::field::album_artist:
+            return s.album_artist;
+        case filter_rule::field::track:
+            return s.track;
+        case filter_rule::field::genre:
+            return s.genre;
+        case filter_rule::field::uri:
+            return s.uri;
+        }
+        return s.artist;
+    }
+}  // namespace
+
+std::vector<mpdfm::filter_rule>
+    mpdfm::parse_filter_rules(const std::string &text) {
+    std::vector<filter_rule> rules;
+    std::string_view rest(text);
+    while (!rest.empty()) {
+        auto end  = rest.find(';');
+        auto rule = trim(rest.substr(0, end));
+        if (!rule.empty()) {
+            rules.push_back(parse_rule(rule));
+        }
+        if (end == std::string_view::npos) {
+            break;
+        }
+        rest.remove_prefix(end + 1);
+    }
+    return rules;
+}
+
+// filter_set
+
+void mpdfm::filter_set::add(uint32_t owner,
+                            const std::vector<filter_rule> &rules) {
+    for (auto &rule : rules) {
+        auto &f = m_fields.at(static_cast<size_t>(rule.what));
+        auto [it, inserted] = f.index.try_emplace(
+            pattern_of(rule), static_cast<uint32_t>(f.patterns.size()));
+        if (inserted) {
+            f.patterns.push_back(it->first);
+            f.owners.emplace_back();
+        }
+        auto &owners = f.owners[it->second];
+        if (owners.empty() || owners.back() != owner) {
+            owners.push_back(owner);
+        }
+    }
+}
+
+void mpdfm::filter_set::compile() {
+    for (auto &f : m_fields) {
+        f.matcher.build(f.patterns);
+    }
+}
+
+std::vector<uint32_t>
+    mpdfm::filter_set::match(const scrobble_entry &s) const {
+    std::vector<uint32_t> result;
+    std::string text;
+    for (size_t i = 0; i < fields; i++) {
+        auto &f = m_fields[i];
+        if (f.patterns.empty()) {
+            continue;
+        }
+        auto &value = value_of(s, i);
+        text.clear();
+        text.reserve(value.size() + 2);
+        text += begin_marker;
+        text += value;
+        text += end_marker;
+        lowercase(text);
+        f.matcher.scan(text, [&](uint32_t pattern) {
+            auto &owners = f.owners[pattern];
+            result.insert(result.end(), owners.begin(), owners.end());
+        });
+    }
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+bool mpdfm::filter_set::empty() const {
+    return std::all_of(m_fields.begin(), m_fields.end(),
+                       [](auto &f) { return f.patterns.empty(); });
+}
+
+// automaton
+
+void mpdfm::filter_set::automaton::build(
+    const std::vector<std::string> &patterns) {
+    states.clear();
+    edges.clear();
+    if (patterns.empty()) {
+        return;
+    }
+
+    // trie first, with ordered children so the edges come out sorted
+    std::vector<std::map<unsigned char, uint32_t>> children(1);
+    states.emplace_back();
+    for (uint32_t p = 0; p < patterns.size(); p++) {
+        uint32_t s = 0;
+        for (unsigned char c : patterns[p]) {
+            auto [it, inserted] = children[s].try_emplace(
+                c, static_cast<uint32_t>(states.size()));
+            if (inserted) {
+                states.emplace_back();
+                children.emplace_back();
+            }
+            s = it->second;
+        }
+        states[s].pattern = p;
+    }
+
+    for (uint32_t s = 0; s < states.size(); s++) {
+        states[s].first_edge = static_cast<uint32_t>(edges.size());
+        for (auto [c, to] : children[s]) {
+            edges.push_back({ c, to });
+        }
+        states[s].end_edge = static_cast<uint32_t>(edges.size());
+    }
+
+    // fail links in breadth first order, a state's fail link is shallower
+    // than the state itself and hence already final
+    std::deque<uint32_t> queue;
+    for (auto [c, to] : children[0]) {
+        queue.push_back(to);
+    }
+    while (!queue.empty()) {
+        auto s = queue.front();
+        queue.pop_front();
+        for (auto [c, to] : children[s]) {
+            auto fail = step(states[s].fail, c);
+            states[to].fail = fail;
+            states[to].next_match = states[fail].pattern != none
+                                        ? fail
+                                        : states[fail].next_match;
+            queue.push_back(to);
+        }
+    }
+}
+
+uint32_t mpdfm::filter_set::automaton::step(uint32_t s,
+                                            unsigned char c) const {
+    for (;;) {
+        auto first = edges.begin() + states[s].first_edge;
+        auto last  = edges.begin() + states[s].end_edge;
+        auto it    = std::lower_bound(
+            first, last, c, [](const edge &e, unsigned char v) {
+                return e.c < v;
+            });
+        if (it != last && it->c == c) {
+            return it->to;
+        }
+        if (s == 0) {
+            return 0;
+        }
+        s = states[s].fail;
+    }
+}
@@ -0,0 +1,207 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <flight_recorder.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <spdlog/details/null_mutex.h>
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/sinks/base_sink.h>
+#include <spdlog/spdlog.h>
+
+namespace {
+    using word = uint64_t;
+    constexpr size_t detail_words =
+        (mpdfm::flight::detail_size + sizeof(word) - 1) / sizeof(word);
+
+    /*!
+     * \brief One event
+     *
+     * Every field is an atomic, written and read relaxed, so a reader racing
+     * a writer gets a torn event rather than undefined behaviour, and the
+     * version tells torn events apart: it is odd while the slot is being
+     * written and 2 * (sequence number + 1) once it is complete.
+     */
+    struct alignas(64) slot {  // NOLINT cache line size
+        std::atomic<uint64_t> version { 0 };
+        std::atomic<int64_t> time { 0 };  // ns since the epoch
+        std::atomic<const char *> kind { nullptr };
+        std::atomic<int64_t> value { 0 };
+        std::atomic<uint32_t> length { 0 };
+        std::array<std::atomic<word>, detail_words> detail {};
+    };
+
+    //! \brief A consistent copy of a slot
+    struct event {
+        int64_t time;
+        const char *kind;
+        int64_t value;
+        std::string detail;
+    };
+
+    struct recorder {
+        std::atomic<uint64_t> next { 0 };
+        std::array<slot, mpdfm::flight::capacity> slots;
+
+        std::mutex dump_mutex;
+        std::string path;
+    };
+
+    recorder &global() {
+        static recorder r;
+        return r;
+    }
+
+    //! \returns A copy of the event with sequence number \p seq, if intact
+    std::optional<event> read(const slot &s, uint64_t seq) {
+        auto complete = 2 * (seq + 1);
+        if (s.version.load(std::memory_order_acquire) != complete) {
+            return std::nullopt;
+        }
+        event e;
+        e.time  = s.time.load(std::memory_order_relaxed);
+        e.kind  = s.kind.load(std::memory_order_relaxed);
+        e.value = s.value.load(std::memory_order_relaxed);
+        std::array<word, detail_words> words {};
+        for (size_t i = 0; i < detail_words; i++) {
+            words[i] = s.detail[i].load(std::memory_order_relaxed);
+        }
+        size_t length = s.length.load(std::memory_order_relaxed);
+        length        = std::min(length, mpdfm::flight::detail_size);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (s.version.load(std::memory_order_relaxed) != complete) {
+            return std::nullopt;  // overwritten while copying
+        }
+        // NOLINTNEXTLINE the words hold characters
+        e.detail.assign(reinterpret_cast<const char *>(words.data()), length);
+        return e;
+    }
+
+    std::string format_time(int64_t ns) {
+        auto seconds = static_cast<time_t>(ns / 1'000'000'000);
+        auto millis  = (ns / 1'000'000) % 1'000;
+        std::tm local {};
+        localtime_r(&seconds, &local);
+        std::array<char, 32> buf {};  // NOLINT enough for the format
+        auto n = std::strftime(buf.data(), buf.size(), "%F %T", &local);
+        return fmt::format("{}.{:03}", std::string_view(buf.data(), n),
+                           millis);
+    }
+
+    class recorder_sink
+        : public spdlog::sinks::base_sink<spdlog::details::null_mutex> {
+    protected:
+        void sink_it_(const spdlog::details::log_msg &msg) override {
+            auto level = spdlog::level::to_string_view(msg.level);
+            mpdfm::flight::record(
+                level.data(),
+                std::string_view(msg.payload.data(), msg.payload.size()));
+        }
+
+        void flush_() override {}
+    };
+}  // namespace
+
+void mpdfm::flight::record(const char *kind,
+                           std::string_view detail,
+                           int64_t value) {
+    auto &r  = global();
+    auto seq = r.next.fetch_add(1, std::memory_order_relaxed);
+    auto &s  = r.slots[seq % capacity];
+
+    s.version.store(2 * seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    s.time.store(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(),
+        std::memory_order_relaxed);
+    s.kind.store(kind, std::memory_order_relaxed);
+    s.value.store(value, std::memory_order_relaxed);
+
+    auto length = std::min(detail.size(), detail_size);
+    std::array<word, detail_words> words {};
+    std::memcpy(words.data(), detail.data(), length);
+    for (size_t i = 0; i < detail_words; i++) {
+        s.detail[i].store(words[i], std::memory_order_relaxed);
+    }
+    s.length.store(static_cast<uint32_t>(length), std::memory_order_relaxed);
+
+    s.version.store(2 * (seq + 1), std::memory_order_release);
+}
+
+void mpdfm::flight::set_dump_path(std::string path) {
+    auto &r = global();
+    std::unique_lock lock(r.dump_mutex);
+    r.path = std::move(path);
+}
+
+void mpdfm::flight::dump(std::string_view reason) {
+    auto &r = global();
+    std::unique_lock lock(r.dump_mutex);
+    if (r.path.empty()) {
+        return;
+    }
+
+    auto end   = r.next.load(std::memory_order_acquire);
+    auto begin = end > capacity ? end - capacity : 0;
+    std::string out = fmt::format(
+        "flight recorder dump ({}) at {}\n", reason,
+        format_time(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::system_clock::now().time_since_epoch())
+                        .count()));
+    for (auto seq = begin; seq < end; seq++) {
+        auto e = read(r.slots[seq % capacity], seq);
+        if (!e) {
+            continue;
+        }
+        fmt::format_to(std::back_inserter(out), "{} {} {} {}\n",
+                       format_time(e->time), e->kind, e->value, e->detail);
+    }
+
+    auto tmp = r.path + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::trunc);
+        file << out;
+        file.flush();
+        if (!file.good()) {
+            spdlog::error("cannot write flight recorder dump to {}", tmp);
+            return;
+        }
+    }
+    boost::system::error_code ec;
+    boost::filesystem::rename(tmp, r.path, ec);
+    if (ec) {
+        spdlog::error("cannot write flight recorder dump to {}: {}", r.path,
+                      ec.message());
+        return;
+    }
+    spdlog::info("wrote flight recorder dump to {}", r.path);
+}
+
+std::shared_ptr<spdlog::sinks::sink> mpdfm::flight::log_sink() {
+    return std::make_shared<recorder_sink>();
+}
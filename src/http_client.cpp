@@ -16,11 +16,25 @@
  */
 #include <http_client.hpp>
 
+#include <array>
+#include <atomic>
+
+namespace {
+    std::atomic<boost::asio::io_context *> io_override = nullptr;
+}  // namespace
+
 boost::asio::io_context &mpdfm::io_context() {
+    if (auto io = io_override.load()) {
+        return *io;
+    }
     static boost::asio::io_context ctx;
     return ctx;
 }
 
+void mpdfm::use_io_context(boost::asio::io_context &io) {
+    io_override = &io;
+}
+
 namespace ssl = boost::asio::ssl;
 
 namespace {
@@ -41,3 +55,34 @@ ssl::context &mpdfm::ssl_context() {
     static ssl_context_wrapper ctx;
     return ctx.ctx;
 }
+
+mpdfm::metrics::histogram &
+    mpdfm::internal::http_phase_latency(http_phase phase) {
+    static std::array<metrics::histogram *, 4> phases {
+        &metrics::get_histogram("mpdfm_http_phase_seconds",
+                                "Time spent in each step of HTTP requests",
+                                { { "phase", "resolve" } }),
+        &metrics::get_histogram("mpdfm_http_phase_seconds", "",
+                                { { "phase", "connect" } }),
+        &metrics::get_histogram("mpdfm_http_phase_seconds", "",
+                                { { "phase", "write" } }),
+        &metrics::get_histogram("mpdfm_http_phase_seconds", "",
+                                { { "phase", "read" } }),
+    };
+    return *phases.at(static_cast<size_t>(phase));
+}
+
+const char *mpdfm::internal::http_phase_name(http_phase phase) {
+    static const std::array<const char *, 4> names { "resolve", "connect",
+                                                     "write", "read" };
+    return names.at(static_cast<size_t>(phase));
+}
+
+void mpdfm::internal::count_http_request(bool ok) {
+    static auto &succeeded = metrics::get_counter(
+        "mpdfm_http_requests_total", "Finished HTTP requests",
+        { { "result", "ok" } });
+    static auto &failed = metrics::get_counter(
+        "mpdfm_http_requests_total", "", { { "result", "error" } });
+    (ok ? succeeded : failed).add();
+}
@@ -0,0 +1,361 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <importer.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <optional>
+#include <scrobble_json.hpp>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tao/json/consume_string.hpp>
+#include <tao/json/contrib/traits.hpp>
+#include <thread>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+
+    // entries handed to the scrobbler at once
+    constexpr size_t chunk_size = 500;
+    // timestamps remembered for deduplication
+    constexpr size_t dedupe_window = 64 * 1024;
+    constexpr std::chrono::milliseconds poll_interval(20);
+    constexpr std::chrono::seconds report_interval(1);
+    constexpr std::chrono::seconds max_retry_interval(60);
+
+    using column = std::variant<std::monostate,
+                                std::string mpdfm::scrobble_entry::*,
+                                time_t mpdfm::scrobble_entry::*>;
+
+    column column_for(std::string_view name) {
+        using mpdfm::scrobble_entry;
+        if (name == "artist") {
+            return &scrobble_entry::artist;
+        }
+        if (name == "track") {
+            return &scrobble_entry::track;
+        }
+        if (name == "album") {
+            return &scrobble_entry::album;
+        }
+        if (name == "track_number") {
+            return &scrobble_entry::track_number;
+        }
+        if (name == "mbid") {
+            return &scrobble_entry::mbid;
+        }
+        if (name == "album_artist") {
+            return &scrobble_entry::album_artist;
+        }
+        if (name == "genre") {
+            return &scrobble_entry::genre;
+        }
+        if (name == "uri") {
+            return &scrobble_entry::uri;
+        }
+        if (name == "duration") {
+            return &scrobble_entry::duration;
+        }
+        if (name == "timestamp") {
+            return &scrobble_entry::timestamp;
+        }
+        if (name == "elapsed") {
+            return &scrobble_entry::elapsed;
+        }
+        return {};
+    }
+
+    void assign(mpdfm::scrobble_entry & /*s*/,
+                std::monostate /*ignored*/,
+                std::string & /*value*/) {}
+
+    void assign(mpdfm::scrobble_entry &s,
+                std::string mpdfm::scrobble_entry::*field,
+                std::string &value) {
+        s.*field = std::move(value);
+    }
+
+    void assign(mpdfm::scrobble_entry &s,
+                time_t mpdfm::scrobble_entry::*field,
+                std::string &value) {
+        if (!value.empty()) {
+            s.*field = std::stoll(value);
+        }
+    }
+
+    /*!
+     * \brief Splits a CSV line into \p out
+     * \returns false on an unterminated quote
+     */
+    bool split_csv(std::string_view line, std::vector<std::string> &out) {
+        out.clear();
+        std::string value;
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); i++) {
+            char c = line[i];
+            if (quoted) {
+                if (c != '"') {
+                    value += c;
+                } else if (i + 1 < line.size() && line[i + 1] == '"') {
+                    value += '"';
+                    i++;
+                } else {
+                    quoted = false;
+                }
+            } else if (c == '"') {
+                quoted = true;
+            } else if (c == ',') {
+                out.push_back(std::move(value));
+                value.clear();
+            } else if (c != '\r') {
+                value += c;
+            }
+        }
+        out.push_back(std::move(value));
+        return !quoted;
+    }
+
+    //! \brief Turns lines into entries, guessing the format from the first
+    class line_parser {
+        enum class format { unknown, ndjson, csv };
+
+        format m_format = format::unknown;
+        std::vector<column> m_columns;
+        std::vector<std::string> m_values;
+
+    public:
+        /*!
+         * \returns An entry, or nothing for lines without one (the header)
+         * \throws std::exception on malformed lines
+         */
+        std::optional<mpdfm::scrobble_entry> parse(std::string_view line) {
+            if (m_format == format::unknown) {
+                if (line.front() == '{') {
+                    m_format = format::ndjson;
+                } else {
+                    m_format = format::csv;
+                    if (!split_csv(line, m_values)) {
+                        throw std::runtime_error("malformed CSV header");
+                    }
+                    for (auto &name : m_values) {
+                        m_columns.push_back(column_for(name));
+                    }
+                    return std::nullopt;
+                }
+            }
+
+            if (m_format == format::ndjson) {
+                return tao::json::consume_string<mpdfm::scrobble_entry>(line);
+            }
+
+            if (!split_csv(line, m_values)) {
+                throw std::runtime_error("unterminated quote");
+            }
+            mpdfm::scrobble_entry s;
+            auto n = std::min(m_values.size(), m_columns.size());
+            for (size_t i = 0; i < n; i++) {
+                std::visit([&](auto field) { assign(s, field, m_values[i]); },
+                           m_columns[i]);
+            }
+            return s;
+        }
+    };
+
+    bool valid(const mpdfm::scrobble_entry &s, time_t now) {
+        constexpr time_t clock_skew = 60;
+        return !s.artist.empty() && !s.track.empty() && s.timestamp > 0
+               && s.timestamp <= now + clock_skew;
+    }
+
+    //! \brief Remembers the most recent plays by timestamp, artist and track
+    class dedupe_filter {
+        std::unordered_set<size_t> m_seen;
+        std::deque<size_t> m_order;
+
+        static size_t key(const mpdfm::scrobble_entry &s) {
+            std::hash<std::string> hash;
+            auto h = std::hash<time_t>()(s.timestamp);
+            for (auto part : { hash(s.artist), hash(s.track) }) {
+                h ^= part + 0x9e3779b9 + (h << 6) + (h >> 2);  // NOLINT
+            }
+            return h;
+        }
+
+    public:
+        //! \returns false if \p s was played recently
+        bool insert(const mpdfm::scrobble_entry &s) {
+            auto k = key(s);
+            if (!m_seen.insert(k).second) {
+                return false;
+            }
+            m_order.push_back(k);
+            if (m_order.size() > dedupe_window) {
+                m_seen.erase(m_order.front());
+                m_order.pop_front();
+            }
+            return true;
+        }
+    };
+
+    //! \brief Feeds the scrobbler and waits for it to catch up
+    class feeder {
+        mpdfm::scrobbler &m_target;
+        mpdfm::import_stats &m_stats;
+        const std::function<void(const mpdfm::import_stats &)> &m_progress;
+
+        clock_type::time_point m_last_report = clock_type::now();
+        clock_type::time_point m_next_flush  = clock_type::now();
+        std::chrono::seconds m_retry_interval { 1 };
+        size_t m_last_backlog = 0;
+
+        void report() {
+            m_stats.backlog = m_target.backlog();
+            auto now        = clock_type::now();
+            if (now - m_last_report >= report_interval) {
+                m_last_report = now;
+                m_progress(m_stats);
+            }
+        }
+
+    public:
+        feeder(mpdfm::scrobbler &target,
+               mpdfm::import_stats &stats,
+               const std::function<void(const mpdfm::import_stats &)> &p)
+            : m_target(target), m_stats(stats), m_progress(p) {}
+
+        void submit(std::vector<mpdfm::scrobble_entry> &chunk) {
+            if (chunk.empty()) {
+                return;
+            }
+            m_target.enqueue(chunk);
+            m_stats.imported += chunk.size();
+            chunk.clear();
+            m_target.flush();
+            report();
+        }
+
+        //! \brief Blocks until at most \p limit entries are waiting
+        void wait_until(size_t limit) {
+            for (;;) {
+                auto backlog = m_target.backlog();
+                if (backlog <= limit) {
+                    return;
+                }
+
+                // a failed request leaves its batch in the backlog without
+                // anything sending it again, so retry with a backoff
+                auto now = clock_type::now();
+                if (backlog < m_last_backlog) {
+                    m_retry_interval = std::chrono::seconds(1);
+                    m_next_flush     = now + m_retry_interval;
+                } else if (now >= m_next_flush) {
+                    m_target.flush();
+                    m_next_flush     = now + m_retry_interval;
+                    m_retry_interval = std::min(m_retry_interval * 2,
+                                                max_retry_interval);
+                }
+                m_last_backlog = backlog;
+
+                report();
+                std::this_thread::sleep_for(poll_interval);
+            }
+        }
+    };
+}  // namespace
+
+mpdfm::import_stats mpdfm::import_history(
+    std::istream &in,
+    scrobbler &target,
+    const import_rules &rules,
+    size_t high_water,
+    const std::function<void(const import_stats &)> &progress) {
+    import_stats stats;
+    feeder feed(target, stats, progress);
+    line_parser parser;
+    dedupe_filter dedupe;
+    filter_set exclude;
+    if (!rules.exclude.empty()) {
+        exclude.add(0, rules.exclude);
+        exclude.compile();
+    }
+    auto now = std::time(nullptr);
+
+    std::vector<scrobble_entry> chunk;
+    chunk.reserve(chunk_size);
+
+    std::string line;
+    while (std::getline(in, line)) {
+        stats.lines++;
+        stats.bytes += line.size() + 1;
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+
+        std::optional<scrobble_entry> s;
+        try {
+            s = parser.parse(line);
+        } catch (const std::exception &e) {
+            spdlog::debug("line {}: {}", stats.lines, e.what());
+            stats.invalid++;
+            continue;
+        }
+        if (!s) {
+            continue;
+        }
+        if (!valid(*s, now)) {
+            spdlog::debug("line {}: missing artist, track or timestamp",
+                          stats.lines);
+            stats.invalid++;
+            continue;
+        }
+        if (rules.rewrites) {
+            rules.rewrites->apply(*s);
+        }
+        if (!exclude.empty() && !exclude.match(*s).empty()) {
+            stats.excluded++;
+            continue;
+        }
+        if (!dedupe.insert(*s)) {
+            stats.duplicates++;
+            continue;
+        }
+
+        chunk.push_back(std::move(*s));
+        if (chunk.size() == chunk_size) {
+            feed.wait_until(high_water);
+            feed.submit(chunk);
+        }
+    }
+
+    if (in.bad()) {
+        throw std::runtime_error("cannot read the history");
+    }
+
+    feed.wait_until(high_water);
+    feed.submit(chunk);
+    feed.wait_until(0);
+    stats.backlog = 0;
+    progress(stats);
+    return stats;
+}
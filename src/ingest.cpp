@@ -0,0 +1,179 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <ingest.hpp>
+
+#include <mutex>
+#include <scrobble_json.hpp>
+#include <string_view>
+#include <tao/json.hpp>
+#include <tao/json/consume_string.hpp>
+#include <tao/json/contrib/traits.hpp>
+#include <vector>
+
+namespace {
+    namespace http = boost::beast::http;
+
+    using request  = mpdfm::local_http_server::request;
+    using response = mpdfm::local_http_server::response;
+
+    // a batch of a few thousand entries is well below this
+    constexpr size_t max_body = 8 * 1024 * 1024;
+
+    //! \brief An entry that was rejected, with a message for the client
+    struct invalid_entry : std::runtime_error {
+        invalid_entry(size_t line, const std::string &what)
+            : std::runtime_error("line " + std::to_string(line) + ": "
+                                 + what) {}
+    };
+
+    mpdfm::scrobble_entry parse_entry(std::string_view text,
+                                      size_t line,
+                                      bool scrobble) {
+        mpdfm::scrobble_entry s;
+        try {
+            // parts parser, straight into the binding without a DOM
+            s = tao::json::consume_string<mpdfm::scrobble_entry>(text);
+        } catch (const std::exception &e) {
+            throw invalid_entry(line, e.what());
+        }
+        if (s.artist.empty() || s.track.empty()) {
+            throw invalid_entry(line, "artist and track are required");
+        }
+        if (scrobble && (s.timestamp <= 0 || s.elapsed <= 0)) {
+            throw invalid_entry(line, "timestamp and elapsed are required");
+        }
+        return s;
+    }
+
+    std::vector<mpdfm::scrobble_entry> parse_batch(std::string_view body) {
+        std::vector<mpdfm::scrobble_entry> entries;
+        size_t line = 0;
+        while (!body.empty()) {
+            auto end = body.find('\n');
+            auto text = body.substr(0, end);
+            line++;
+            if (text.find_first_not_of(" \t\r") != std::string_view::npos) {
+                entries.push_back(parse_entry(text, line, true));
+            }
+            if (end == std::string_view::npos) {
+                break;
+            }
+            body.remove_prefix(end + 1);
+        }
+        return entries;
+    }
+
+    response reply(const request &req,
+                   http::status status,
+                   const tao::json::value &body) {
+        response res(status, req.version());
+        res.set(http::field::content_type, "application/json");
+        res.body() = tao::json::to_string(body);
+        return res;
+    }
+
+    response error(const request &req,
+                   http::status status,
+                   const std::string &what) {
+        return reply(req, status, { { "error", what } });
+    }
+}  // namespace
+
+//! \brief Shared with the handler, which may outlive the ingest_server
+struct mpdfm::ingest_server::impl {
+    explicit impl(engine &e) : m_engine(&e) {}
+
+    response handle(const request &req) {
+        auto target = req.target();
+        bool scrobble;
+        if (target == "/scrobble") {
+            scrobble = true;
+        } else if (target == "/now_playing") {
+            scrobble = false;
+        } else {
+            return error(req, http::status::not_found, "unknown endpoint");
+        }
+        if (req.method() != http::verb::post) {
+            return error(req, http::status::method_not_allowed,
+                         "only POST is supported");
+        }
+
+        std::vector<scrobble_entry> entries;
+        try {
+            auto ndjson = req[http::field::content_type].starts_with(
+                "application/x-ndjson");
+            if (scrobble && ndjson) {
+                entries = parse_batch(req.body());
+            } else {
+                entries.push_back(parse_entry(req.body(), 1, scrobble));
+            }
+        } catch (const invalid_entry &e) {
+            return error(req, http::status::bad_request, e.what());
+        }
+
+        // entries excluded from, or not meeting the rules of, every
+        // scrobbler are not counted
+        size_t accepted = 0;
+        try {
+            std::unique_lock lock(m_engine_mutex);
+            if (m_engine == nullptr) {
+                return error(req, http::status::service_unavailable,
+                             "shutting down");
+            }
+            if (!scrobble) {
+                accepted = m_engine->now_playing(entries.front()) ? 1 : 0;
+            } else if (!entries.empty()) {
+                accepted = m_engine->scrobble(entries);
+            }
+        } catch (const std::exception &e) {
+            return error(req, http::status::service_unavailable, e.what());
+        }
+        return reply(req, http::status::accepted,
+                     { { "accepted", accepted } });
+    }
+
+    void detach() {
+        std::unique_lock lock(m_engine_mutex);
+        m_engine = nullptr;
+    }
+
+    // guards m_engine, which gets reset on stop
+    std::mutex m_engine_mutex;
+    engine *m_engine;
+};
+
+mpdfm::ingest_server::ingest_server(engine &e,
+                                    boost::asio::io_context &io,
+                                    const std::string &address)
+    : m_impl(std::make_shared<impl>(e)),
+      m_server(
+          io,
+          address,
+          [i = m_impl](const local_http_server::request &req) {
+              return i->handle(req);
+          },
+          "ingest API",
+          max_body) {}
+
+mpdfm::ingest_server::~ingest_server() {
+    stop();
+}
+
+void mpdfm::ingest_server::stop() {
+    m_impl->detach();
+    m_server.stop();
+}
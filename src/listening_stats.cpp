@@ -0,0 +1,458 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <listening_stats.hpp>
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <gsl/gsl>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <tao/json/binding.hpp>
+#include <tao/json/consume_file.hpp>
+#include <tao/json/contrib/traits.hpp>
+#include <tao/json/events/produce.hpp>
+#include <tao/json/events/to_stream.hpp>
+#include <utility>
+
+namespace {
+    // joins the artist to album and track names in keys
+    constexpr char separator = '\x1f';
+    constexpr int64_t seconds_per_day = 24 * 60 * 60;
+
+    //! \returns The local calendar day \p t falls on, counted from the epoch
+    int64_t day_of(time_t t) {
+        tm local {};
+        localtime_r(&t, &local);
+        auto shifted = static_cast<int64_t>(t) + local.tm_gmtoff;
+        // round towards negative infinity for days before the epoch
+        return (shifted - (shifted < 0 ? seconds_per_day - 1 : 0))
+               / seconds_per_day;
+    }
+
+    std::string key(const std::string &artist, const std::string &title) {
+        std::string k;
+        k.reserve(artist.size() + 1 + title.size());
+        k += artist;
+        k += separator;
+        k += title;
+        return k;
+    }
+
+    using day_counts = std::vector<std::pair<uint32_t, uint32_t>>;
+
+    // the persisted form of the counters. per-day counts are (id, count)
+    // pairs referring to the names of the same dimension
+    struct snapshot_table {
+        std::vector<std::string> names;
+        std::vector<uint32_t> counts;
+    };
+
+    struct snapshot_day {
+        int64_t day = 0;
+        day_counts artists;
+        day_counts albums;
+        day_counts tracks;
+    };
+
+    struct snapshot {
+        uint64_t plays = 0;
+        int64_t today  = 0;
+        snapshot_table artists;
+        snapshot_table albums;
+        snapshot_table tracks;
+        std::vector<snapshot_day> days;
+    };
+
+    // indexed by listening_stats::dimension
+    constexpr std::array<snapshot_table snapshot::*, 3> table_fields {
+        &snapshot::artists, &snapshot::albums, &snapshot::tracks
+    };
+    constexpr std::array<day_counts snapshot_day::*, 3> day_fields {
+        &snapshot_day::artists, &snapshot_day::albums, &snapshot_day::tracks
+    };
+}  // namespace
+
+namespace tao::json {
+    template<>
+    struct traits<snapshot_table>
+        : binding::object<
+              TAO_JSON_BIND_REQUIRED("names", &snapshot_table::names),
+              TAO_JSON_BIND_REQUIRED("counts", &snapshot_table::counts)> {};
+
+    template<>
+    struct traits<snapshot_day>
+        : binding::object<
+              TAO_JSON_BIND_REQUIRED("day", &snapshot_day::day),
+              TAO_JSON_BIND_REQUIRED("artists", &snapshot_day::artists),
+              TAO_JSON_BIND_REQUIRED("albums", &snapshot_day::albums),
+              TAO_JSON_BIND_REQUIRED("tracks", &snapshot_day::tracks)> {};
+
+    template<>
+    struct traits<snapshot>
+        : binding::object<
+              TAO_JSON_BIND_REQUIRED("plays", &snapshot::plays),
+              TAO_JSON_BIND_REQUIRED("today", &snapshot::today),
+              TAO_JSON_BIND_REQUIRED("artists", &snapshot::artists),
+              TAO_JSON_BIND_REQUIRED("albums", &snapshot::albums),
+              TAO_JSON_BIND_REQUIRED("tracks", &snapshot::tracks),
+              TAO_JSON_BIND_REQUIRED("days", &snapshot::days)> {};
+}  // namespace tao::json
+
+// ranking
+
+void mpdfm::internal::ranking::swap_keys(uint32_t a, uint32_t b) {
+    std::swap(m_order[a], m_order[b]);
+    m_pos[m_order[a]] = a;
+    m_pos[m_order[b]] = b;
+}
+
+void mpdfm::internal::ranking::resize(size_t size) {
+    while (m_order.size() < size) {
+        auto pos = gsl::narrow<uint32_t>(m_order.size());
+        // zero counts are always last, so new keys can just be appended
+        m_order.push_back(pos);
+        m_pos.push_back(pos);
+        m_counts.push_back(0);
+        auto [it, inserted] = m_blocks.try_emplace(0, block { pos, pos });
+        if (!inserted) {
+            it->second.last = pos;
+        }
+    }
+}
+
+void mpdfm::internal::ranking::increment(uint32_t key) {
+    auto count = m_counts[key];
+    auto &b    = m_blocks.at(count);
+    // the first of the block moves up into the block above
+    auto pos = b.first;
+    swap_keys(m_pos[key], pos);
+    if (b.first == b.last) {
+        m_blocks.erase(count);
+    } else {
+        b.first++;
+    }
+
+    m_counts[key] = count + 1;
+    auto [it, inserted] = m_blocks.try_emplace(count + 1, block { pos, pos });
+    if (!inserted) {
+        it->second.last = pos;
+    }
+}
+
+void mpdfm::internal::ranking::decrement(uint32_t key) {
+    auto count = m_counts[key];
+    auto &b    = m_blocks.at(count);
+    // the last of the block moves down into the block below
+    auto pos = b.last;
+    swap_keys(m_pos[key], pos);
+    if (b.first == b.last) {
+        m_blocks.erase(count);
+    } else {
+        b.last--;
+    }
+
+    m_counts[key] = count - 1;
+    auto [it, inserted] = m_blocks.try_emplace(count - 1, block { pos, pos });
+    if (!inserted) {
+        it->second.first = pos;
+    }
+}
+
+void mpdfm::internal::ranking::assign(std::vector<uint32_t> counts) {
+    m_counts = std::move(counts);
+    m_order.resize(m_counts.size());
+    std::iota(m_order.begin(), m_order.end(), 0);
+    std::stable_sort(m_order.begin(), m_order.end(),
+                     [this](uint32_t a, uint32_t b) {
+                         return m_counts[a] > m_counts[b];
+                     });
+
+    m_pos.resize(m_counts.size());
+    m_blocks.clear();
+    for (uint32_t pos = 0; pos < m_order.size(); pos++) {
+        auto key   = m_order[pos];
+        m_pos[key] = pos;
+        auto [it, inserted] =
+            m_blocks.try_emplace(m_counts[key], block { pos, pos });
+        if (!inserted) {
+            it->second.last = pos;
+        }
+    }
+}
+
+std::vector<uint32_t> mpdfm::internal::ranking::top(size_t k) const {
+    std::vector<uint32_t> result;
+    for (auto key : m_order) {
+        if (result.size() == k || m_counts[key] == 0) {
+            break;
+        }
+        result.push_back(key);
+    }
+    return result;
+}
+
+// listening_stats
+
+uint32_t mpdfm::listening_stats::table::intern(std::string name) {
+    if (auto it = ids.find(name); it != ids.end()) {
+        return it->second;
+    }
+    auto id = gsl::narrow<uint32_t>(names.size());
+    names.push_back(std::move(name));
+    ids.emplace(names.back(), id);
+    for (auto &r : rankings) {
+        r.resize(names.size());
+    }
+    return id;
+}
+
+void mpdfm::listening_stats::add(const scrobble_entry &s) {
+    std::unique_lock lock(m_mutex);
+    advance(day_of(std::time(nullptr)));
+
+    std::array<std::optional<uint32_t>, dimensions> ids;
+    ids[0] = m_tables[0].intern(s.artist);
+    if (!s.album.empty()) {
+        ids[1] = m_tables[1].intern(key(
+            s.album_artist.empty() ? s.artist : s.album_artist, s.album));
+    }
+    ids[2] = m_tables[2].intern(key(s.artist, s.track));
+    m_plays++;
+
+    // plays from a skewed clock count as today's
+    auto day    = std::min(day_of(s.timestamp), m_today);
+    bool recent = day > m_today - static_cast<int64_t>(week_days);
+    day_bucket *bucket = nullptr;
+    if (recent) {
+        auto it = std::find_if(m_days.begin(), m_days.end(),
+                               [day](auto &b) { return b.day >= day; });
+        if (it == m_days.end() || it->day != day) {
+            it = m_days.insert(it, day_bucket { day, {} });
+        }
+        bucket = &*it;
+    }
+
+    for (size_t d = 0; d < dimensions; d++) {
+        if (!ids[d]) {
+            continue;
+        }
+        auto id        = *ids[d];
+        auto &rankings = m_tables[d].rankings;
+        rankings[static_cast<size_t>(window::all)].increment(id);
+        if (bucket != nullptr) {
+            bucket->counts[d][id]++;
+            rankings[static_cast<size_t>(window::week)].increment(id);
+            if (day == m_today) {
+                rankings[static_cast<size_t>(window::day)].increment(id);
+            }
+        }
+    }
+}
+
+std::vector<mpdfm::listening_stats::row>
+    mpdfm::listening_stats::top(dimension d, window w, size_t k) {
+    std::unique_lock lock(m_mutex);
+    advance(day_of(std::time(nullptr)));
+
+    auto &t = m_tables[static_cast<size_t>(d)];
+    auto &r = t.rankings[static_cast<size_t>(w)];
+    std::vector<row> result;
+    for (auto id : r.top(k)) {
+        const auto &name = t.names[id];
+        auto sep         = name.find(separator);
+        if (sep == std::string::npos) {
+            result.push_back({ name, {}, r.count(id) });
+        } else {
+            result.push_back(
+                { name.substr(0, sep), name.substr(sep + 1), r.count(id) });
+        }
+    }
+    return result;
+}
+
+uint64_t mpdfm::listening_stats::plays() const {
+    std::unique_lock lock(m_mutex);
+    return m_plays;
+}
+
+void mpdfm::listening_stats::advance(int64_t today) {
+    if (today <= m_today) {
+        return;
+    }
+    auto yesterday = m_today;
+    m_today        = today;
+
+    for (auto &b : m_days) {
+        if (b.day == yesterday) {
+            expire(b, window::day);
+        }
+    }
+    while (!m_days.empty()
+           && m_days.front().day <= today - static_cast<int64_t>(week_days)) {
+        expire(m_days.front(), window::week);
+        m_days.pop_front();
+    }
+}
+
+void mpdfm::listening_stats::expire(const day_bucket &b, window w) {
+    for (size_t d = 0; d < dimensions; d++) {
+        auto &r = m_tables[d].rankings[static_cast<size_t>(w)];
+        for (auto [id, count] : b.counts[d]) {
+            for (uint32_t i = 0; i < count; i++) {
+                r.decrement(id);
+            }
+        }
+    }
+}
+
+void mpdfm::listening_stats::save(const std::string &path) const {
+    snapshot snap;
+    {
+        std::unique_lock lock(m_mutex);
+        snap.plays = m_plays;
+        snap.today = m_today;
+        for (size_t d = 0; d < dimensions; d++) {
+            auto &t           = m_tables[d];
+            auto &st          = snap.*table_fields[d];
+            const auto &all   = t.rankings[static_cast<size_t>(window::all)];
+            st.names.assign(t.names.begin(), t.names.end());
+            st.counts.reserve(t.names.size());
+            for (uint32_t id = 0; id < t.names.size(); id++) {
+                st.counts.push_back(all.count(id));
+            }
+        }
+        for (auto &b : m_days) {
+            auto &sd = snap.days.emplace_back();
+            sd.day   = b.day;
+            for (size_t d = 0; d < dimensions; d++) {
+                auto &counts = sd.*day_fields[d];
+                counts.assign(b.counts[d].begin(), b.counts[d].end());
+            }
+        }
+    }
+
+    auto tmp = path + ".tmp";
+    {
+        std::ofstream str(tmp);
+        if (!str.good()) {
+            throw std::runtime_error("cannot write " + tmp);
+        }
+        tao::json::events::to_stream consumer(str);
+        tao::json::events::produce(consumer, snap);
+        str.flush();
+        if (!str.good()) {
+            throw std::runtime_error("cannot write " + tmp);
+        }
+    }
+    boost::filesystem::rename(tmp, path);
+}
+
+void mpdfm::listening_stats::load(const std::string &path) {
+    // parts parser, straight into the snapshot without a DOM
+    auto snap = tao::json::consume_file<snapshot>(path);
+
+    std::array<table, dimensions> tables;
+    for (size_t d = 0; d < dimensions; d++) {
+        auto &st = snap.*table_fields[d];
+        if (st.names.size() != st.counts.size()) {
+            throw std::runtime_error("stats snapshot: names and counts of "
+                                     "different length");
+        }
+        for (auto &name : st.names) {
+            auto expected = tables[d].names.size();
+            if (tables[d].intern(std::move(name)) != expected) {
+                throw std::runtime_error("stats snapshot: duplicate name");
+            }
+        }
+        tables[d].rankings[static_cast<size_t>(window::all)].assign(
+            std::move(st.counts));
+    }
+
+    std::deque<day_bucket> days;
+    std::array<std::array<std::vector<uint32_t>, 2>, dimensions> windowed;
+    for (size_t d = 0; d < dimensions; d++) {
+        for (auto &counts : windowed[d]) {
+            counts.resize(tables[d].names.size());
+        }
+    }
+    std::sort(snap.days.begin(), snap.days.end(),
+              [](auto &a, auto &b) { return a.day < b.day; });
+    for (auto &sd : snap.days) {
+        if (sd.day <= snap.today - static_cast<int64_t>(week_days)
+            || sd.day > snap.today) {
+            continue;
+        }
+        auto &b = days.emplace_back();
+        b.day   = sd.day;
+        for (size_t d = 0; d < dimensions; d++) {
+            for (auto [id, count] : sd.*day_fields[d]) {
+                if (id >= tables[d].names.size()) {
+                    throw std::runtime_error("stats snapshot: unknown id");
+                }
+                b.counts[d][id] += count;
+                windowed[d][static_cast<size_t>(window::week)][id] += count;
+                if (sd.day == snap.today) {
+                    windowed[d][static_cast<size_t>(window::day)][id] +=
+                        count;
+                }
+            }
+        }
+    }
+    for (size_t d = 0; d < dimensions; d++) {
+        for (auto w : { window::day, window::week }) {
+            tables[d].rankings[static_cast<size_t>(w)].assign(
+                std::move(windowed[d][static_cast<size_t>(w)]));
+        }
+    }
+
+    std::unique_lock lock(m_mutex);
+    m_tables = std::move(tables);
+    m_days   = std::move(days);
+    m_today  = snap.today;
+    m_plays  = snap.plays;
+    advance(day_of(std::time(nullptr)));
+}
+
+mpdfm::listening_stats::dimension
+    mpdfm::listening_stats::parse_dimension(std::string_view name) {
+    if (name == "artists") {
+        return dimension::artists;
+    }
+    if (name == "albums") {
+        return dimension::albums;
+    }
+    if (name == "tracks") {
+        return dimension::tracks;
+    }
+    throw std::invalid_argument("expected artists, albums or tracks");
+}
+
+mpdfm::listening_stats::window
+    mpdfm::listening_stats::parse_window(std::string_view name) {
+    if (name == "day") {
+        return window::day;
+    }
+    if (name == "week") {
+        return window::week;
+    }
+    if (name == "all") {
+        return window::all;
+    }
+    throw std::invalid_argument("expected day, week or all");
+}
@@ -0,0 +1,210 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <local_http.hpp>
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http/parser.hpp>
+#include <boost/beast/http/read.hpp>
+#include <boost/beast/http/write.hpp>
+#include <gsl/gsl>
+#include <optional>
+#include <set>
+#include <spdlog/spdlog.h>
+#include <utility>
+
+namespace {
+    namespace asio = boost::asio;
+    namespace http = boost::beast::http;
+    using boost::asio::ip::tcp;
+
+    std::pair<std::string, std::string> split_address(const std::string &a) {
+        auto colon = a.rfind(':');
+        if (colon == std::string::npos) {
+            throw std::runtime_error("address must be host:port");
+        }
+        auto host = a.substr(0, colon);
+        // [::1]:port
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+            host = host.substr(1, host.size() - 2);
+        }
+        return { host, a.substr(colon + 1) };
+    }
+}  // namespace
+
+/*!
+ * \brief Acceptor and connections, all running on a single strand
+ */
+struct mpdfm::local_http_server::impl : std::enable_shared_from_this<impl> {
+    struct session : std::enable_shared_from_this<session> {
+        session(std::shared_ptr<impl> server,
+                asio::strand<asio::io_context::executor_type> &strand)
+            : server(std::move(server)), socket(strand) {}
+
+        void read() {
+            parser.emplace();
+            parser->body_limit(server->m_max_body);
+            http::async_read(socket, buffer, *parser,
+                             [self = shared_from_this()](auto ec, size_t) {
+                                 if (ec == http::error::body_limit) {
+                                     self->refuse(
+                                         http::status::payload_too_large);
+                                     return;
+                                 }
+                                 if (ec) {
+                                     self->server->close(self);
+                                     return;
+                                 }
+                                 self->respond(self->parser->release());
+                             });
+        }
+
+        //! \brief Answers a request that wasn't read in full, and closes
+        void refuse(http::status status) {
+            res.emplace(status, parser->get().version());
+            res->set(http::field::content_type, "text/plain");
+            res->body() = std::string(http::obsolete_reason(status)) + '\n';
+            res->keep_alive(false);
+            res->prepare_payload();
+            http::async_write(socket, *res,
+                              [self = shared_from_this()](auto, size_t) {
+                                  self->server->close(self);
+                              });
+        }
+
+        void respond(const request &req) {
+            res = server->m_handler(req);
+            res->keep_alive(req.keep_alive());
+            res->prepare_payload();
+            http::async_write(socket, *res,
+                              [self = shared_from_this()](auto ec, size_t) {
+                                  if (ec || self->res->need_eof()) {
+                                      self->server->close(self);
+                                      return;
+                                  }
+                                  self->read();
+                              });
+        }
+
+        std::shared_ptr<impl> server;
+        tcp::socket socket;
+        boost::beast::flat_buffer buffer;
+        std::optional<http::request_parser<http::string_body>> parser;
+        std::optional<response> res;
+    };
+    using session_ptr = std::shared_ptr<session>;
+
+    impl(asio::io_context &io,
+         const tcp::endpoint &ep,
+         handler h,
+         std::string name,
+         size_t max_body)
+        : m_handler(std::move(h)),
+          m_name(std::move(name)),
+          m_max_body(max_body),
+          m_strand(asio::make_strand(io)),
+          m_acceptor(m_strand) {
+        m_acceptor.open(ep.protocol());
+        m_acceptor.set_option(tcp::acceptor::reuse_address(true));
+        m_acceptor.bind(ep);
+        m_acceptor.listen();
+    }
+
+    void start() {
+        asio::post(m_strand, [self = shared_from_this()]() {
+            self->accept();
+        });
+    }
+
+    void accept() {
+        auto s = std::make_shared<session>(shared_from_this(), m_strand);
+        m_acceptor.async_accept(
+            s->socket, [self = shared_from_this(), s](auto ec) {
+                if (ec == asio::error::operation_aborted) {
+                    return;
+                }
+                if (ec) {
+                    spdlog::error("{}: accept failed: {}", self->m_name,
+                                  ec.message());
+                } else {
+                    self->m_sessions.insert(s);
+                    s->read();
+                }
+                self->accept();
+            });
+    }
+
+    void close(const session_ptr &s) {
+        boost::system::error_code ignored;
+        s->socket.shutdown(tcp::socket::shutdown_both, ignored);
+        s->socket.close(ignored);
+        m_sessions.erase(s);
+    }
+
+    void stop() {
+        asio::post(m_strand, [self = shared_from_this()]() {
+            boost::system::error_code ignored;
+            self->m_acceptor.close(ignored);
+            // closing drops the sessions' references to the server
+            auto sessions = std::move(self->m_sessions);
+            for (auto &s : sessions) {
+                self->close(s);
+            }
+        });
+    }
+
+    handler m_handler;
+    std::string m_name;
+    size_t m_max_body;
+
+    asio::strand<asio::io_context::executor_type> m_strand;
+    tcp::acceptor m_acceptor;
+    std::set<session_ptr> m_sessions;
+};
+
+mpdfm::local_http_server::local_http_server(boost::asio::io_context &io,
+                                            const std::string &address,
+                                            handler h,
+                                            const std::string &name,
+                                            size_t max_body) {
+    auto [host, port] = split_address(address);
+    tcp::endpoint ep(asio::ip::make_address(host),
+                     gsl::narrow<unsigned short>(std::stoul(port)));
+    if (!ep.address().is_loopback()) {
+        spdlog::warn("{} listens on {}, which is not a loopback address, "
+                     "anyone who can reach it can use it",
+                     name, host);
+    }
+
+    m_impl = std::make_shared<impl>(io, ep, std::move(h), name, max_body);
+    m_impl->start();
+    spdlog::info("{} listening on {}", name, address);
+}
+
+mpdfm::local_http_server::~local_http_server() {
+    stop();
+}
+
+void mpdfm::local_http_server::stop() {
+    m_impl->stop();
+}
+
+unsigned short mpdfm::local_http_server::port() const {
+    return m_impl->m_acceptor.local_endpoint().port();
+}
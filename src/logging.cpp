@@ -0,0 +1,104 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <logging.hpp>
+
+#include <spdlog/async.h>
+#include <spdlog/async_logger.h>
+#include <string_view>
+
+namespace {
+    std::atomic<mpdfm::logging::limiter *> &limiters() {
+        static std::atomic<mpdfm::logging::limiter *> head { nullptr };
+        return head;
+    }
+
+    int64_t now_ns() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    std::string_view file_name(std::string_view path) {
+        auto slash = path.rfind('/');
+        return slash == std::string_view::npos ? path
+                                               : path.substr(slash + 1);
+    }
+}  // namespace
+
+mpdfm::logging::limiter::limiter(const char *file,
+                                 int line,
+                                 spdlog::level::level_enum level)
+    : m_file(file), m_line(line), m_level(level) {
+    auto &head = limiters();
+    m_next     = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(m_next, this,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed)) {}
+}
+
+bool mpdfm::logging::limiter::admit() {
+    constexpr int64_t length =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(interval)
+            .count();
+    auto now   = now_ns();
+    auto start = m_window.load(std::memory_order_relaxed);
+    if ((start == 0 || now - start >= length)
+        && m_window.compare_exchange_strong(start, now,
+                                            std::memory_order_relaxed)) {
+        // this thread opened the new interval
+        m_count.store(0, std::memory_order_relaxed);
+        report();
+    }
+    if (m_count.fetch_add(1, std::memory_order_relaxed) < burst) {
+        return true;
+    }
+    m_suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void mpdfm::logging::limiter::report() {
+    auto n = m_suppressed.exchange(0, std::memory_order_relaxed);
+    if (n != 0) {
+        spdlog::log(m_level, "suppressed {} similar message(s) from {}:{}", n,
+                    file_name(m_file), m_line);
+    }
+}
+
+void mpdfm::logging::start_async(size_t queue_size) {
+    if (queue_size == 0) {
+        return;
+    }
+    // kept alive, another thread may still hold the raw default logger
+    static std::shared_ptr<spdlog::logger> previous;
+    previous = spdlog::default_logger();
+
+    spdlog::init_thread_pool(queue_size, 1);
+    auto logger = std::make_shared<spdlog::async_logger>(
+        previous->name(), previous->sinks().begin(), previous->sinks().end(),
+        spdlog::thread_pool(), spdlog::async_overflow_policy::overrun_oldest);
+    logger->set_level(previous->level());
+    logger->flush_on(previous->flush_level());
+    spdlog::set_default_logger(std::move(logger));
+}
+
+void mpdfm::logging::report_suppressed() {
+    for (auto *l = limiters().load(std::memory_order_acquire); l != nullptr;
+         l       = l->m_next) {
+        l->report();
+    }
+    spdlog::default_logger()->flush();
+}
@@ -16,36 +16,39 @@
  */
 #include "spdlog/common.h"
 #include <algorithm>
+#include <alloc_stats.hpp>
+#include <chrono>
+#include <control.hpp>
 #include <directory_helper.hpp>
+#include <engine.hpp>
+#include <flight_recorder.hpp>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <gsl/gsl>
 #include <http_client.hpp>
+#include <importer.hpp>
+#include <ingest.hpp>
 #include <iostream>
+#include <listening_stats.hpp>
+#include <local_http.hpp>
+#include <logging.hpp>
+#include <metrics.hpp>
 #include <mpc.hpp>
-#include <protocols/as20.hpp>
-#include <scrobbler.hpp>
+#include <optional>
+#include <probes.hpp>
+#include <profile.hpp>
+#include <protocols/stats.hpp>
+#include <registry.hpp>
+#include <rewrite_table.hpp>
 #include <spdlog/fmt/ostr.h>
 #include <spdlog/spdlog.h>
+#include <startup.hpp>
 #include <tao/pegtl/parse_error.hpp>
+#include <trace.hpp>
 
 namespace {
-    bool interrupted    = false;
-    using scrobbler_vec = std::vector<std::unique_ptr<mpdfm::scrobbler>>;
-
-    template<typename Task>
-    void run_scrobbler_task(scrobbler_vec &scrobblers, Task task) {
-        for (auto i = scrobblers.begin(); i != scrobblers.end();) {
-            try {
-                task(*i);
-                i++;
-            } catch (const std::exception &e) {
-                spdlog::error("scrobbler operation failed: ", e.what());
-                i = scrobblers.erase(i);
-            }
-        }
-        if (scrobblers.empty()) {
-            throw std::runtime_error("no scrobblers left");
-        }
-    }
+    using mpdfm::get_factory;
 
     class state_tracker {
         mpdfm::song m_song { nullptr };
@@ -61,6 +64,7 @@ namespace {
             if (!m_paused) {
                 m_paused = true;
                 m_elapsed += time(nullptr) - m_last_play;
+                MPDFM_PROBE(song_pause, id(), m_elapsed);
             }
         }
 
@@ -68,12 +72,14 @@ namespace {
             if (m_paused) {
                 m_paused    = false;
                 m_last_play = time(nullptr);
+                MPDFM_PROBE(song_resume, id(), m_elapsed);
             }
         }
 
         void new_song(mpdfm::song &song) {
             m_song  = song;
             m_start = time(nullptr);
+            MPDFM_PROBE(song_start, id(), m_start);
 
             m_elapsed   = 0;
             m_last_play = 0;
@@ -83,15 +89,35 @@ namespace {
         time_t elapsed() { return m_elapsed; }
         time_t start() { return m_start; }
         const mpdfm::song &song() { return m_song; }
+        unsigned id() { return m_song ? m_song.id() : 0; }
 
         void set_elapsed(time_t elapsed) { m_elapsed = elapsed; }
     };
 
+    //! \brief Copies the tags of \p s
+    mpdfm::scrobble_entry copy_tags(const mpdfm::song &s) {
+        mpdfm::trace::span span("copy tags");
+        return mpdfm::scrobble_entry(s);
+    }
+
     void handle_player_event(mpdfm::mpd_connection &conn,
                              state_tracker &last,
-                             scrobbler_vec &scrobblers) {
+                             mpdfm::engine &engine) {
+        static auto &events = mpdfm::metrics::get_counter(
+            "mpdfm_mpd_events_total", "Player events received from MPD");
+        static auto &latency = mpdfm::metrics::get_histogram(
+            "mpdfm_player_event_seconds",
+            "Time from an MPD player event to handing it to the scrobblers");
+        mpdfm::metrics::stopwatch handling;
+        mpdfm::trace::span span("player event");
+        mpdfm::alloc::scope account(mpdfm::alloc::tag::mpd);
+        events.add();
+
         auto status  = conn.run_status();
         auto current = conn.run_current_song();
+        unsigned id  = current ? current.id() : 0;
+        MPDFM_PROBE(player_event, id, status.state());
+        mpdfm::flight::record("mpd player event", {}, id);
 
         if (status.state() == MPD_STATE_PLAY) {
             last.play();
@@ -103,78 +129,556 @@ namespace {
         if (current != last.song()) {
             if (last.song()) {
                 last.pause();
-                mpdfm::scrobble_entry scr(last.song());
+                auto scr = copy_tags(last.song());
                 scr.timestamp = last.start();
                 scr.elapsed   = last.elapsed();
 
-                run_scrobbler_task(scrobblers, [&scr](auto &x) {
-                    if (x->check_preconditions(scr)) {
-                        x->scrobble(scr);
-                    }
-                });
+                engine.scrobble(scr);
             }
 
             if (current) {
-                mpdfm::scrobble_entry entry { current };
+                auto entry = copy_tags(current);
+                mpdfm::flight::record("song change", current.uri(), id);
                 last.new_song(current);
-                run_scrobbler_task(
-                    scrobblers, [&entry](auto &x) { x->now_playing(entry); });
+                engine.now_playing(entry);
             }
         }
-    }
-
-    using factory_ptr = std::unique_ptr<mpdfm::scrobbler_factory>;
-    mpdfm::scrobbler_factory &get_factory(const std::string &name) {
-        static std::map<std::string, factory_ptr> factories;
-        if (factories.empty()) {
-            // NOLINTNEXTLINE clear ownership passing
-            factories.emplace("as20", new mpdfm::as20::factory());
-        }
-        return (*factories.at(name));
+        auto took = handling.elapsed();
+        latency.observe(took);
+        MPDFM_PROBE(player_event_done, id, mpdfm::internal::probe_us(took));
     }
 
     namespace io = boost::asio;
 
-    void run_scrobblers(mpdfm::mpd_connection &conn,
-                        scrobbler_vec &scrobblers) {
-        try {
-            state_tracker last;
-
-            // graceful exits
-            io::signal_set signals(mpdfm::io_context(), SIGINT, SIGTERM);
-            signals.async_wait([&conn](auto ec, auto /*signal*/) {
-                interrupted = true;
-                if (!ec) {
-                    // if the signal set is aborted that means conn fell out of
-                    // scope
-                    conn.send_noidle();
-                }
-            });
-
-            auto song   = conn.run_current_song();
-            auto status = conn.run_status();
-            if (song && status.state() == MPD_STATE_PLAY) {
-                last.set_elapsed(status.elapsed_time());
-                last.new_song(song);
-                mpdfm::scrobble_entry entry { song };
-                run_scrobbler_task(
-                    scrobblers, [&entry](auto &x) { x->now_playing(entry); });
+    /*!
+     * \brief Waits for MPD player events on the io_context
+     *
+     * Rather than blocking a thread in idle mode, the MPD socket is watched
+     * for readability, so the whole client can run on a single thread.
+     */
+    class player_watcher {
+        mpdfm::mpd_connection &m_conn;
+        mpdfm::engine &m_engine;
+        std::function<void()> m_on_finish;
+        state_tracker m_last;
+
+        io::posix::stream_descriptor m_fd;
+        io::signal_set m_signals;
+        std::promise<void> m_done;
+        bool m_finished = false;
+
+        void finish(std::exception_ptr error = nullptr) {
+            if (m_finished) {
+                return;
+            }
+            m_finished = true;
+            m_signals.cancel();
+            m_fd.cancel();
+            if (m_on_finish) {
+                m_on_finish();
+            }
+            if (error) {
+                m_done.set_exception(error);
+            } else {
+                m_done.set_value();
             }
+        }
+
+        void wait_idle() {
+            m_conn.send_idle_mask(MPD_IDLE_PLAYER);
+            m_fd.async_wait(io::posix::stream_descriptor::wait_read,
+                            [this](auto ec) {
+                                // on abort, this may already be gone
+                                if (!ec) {
+                                    handle_idle();
+                                }
+                            });
+        }
 
-            while (!interrupted) {
-                if (auto ev = conn.run_idle_mask(MPD_IDLE_PLAYER)) {
+        void handle_idle() {
+            try {
+                if (auto ev = m_conn.recv_idle()) {
                     if ((ev & MPD_IDLE_PLAYER) != 0) {
                         spdlog::debug("received player event");
-                        handle_player_event(conn, last, scrobblers);
+                        handle_player_event(m_conn, m_last, m_engine);
                     } else {
                         spdlog::error("received unknown event: {:x}", ev);
                     }
                 }
+                wait_idle();
+            } catch (...) {
+                finish(std::current_exception());
             }
+        }
+
+    public:
+        /*!
+         * \param on_finish Called on the io_context once watching stops,
+         *        to wind down anything else keeping it busy
+         */
+        player_watcher(mpdfm::mpd_connection &conn,
+                       mpdfm::engine &engine,
+                       std::function<void()> on_finish)
+            : m_conn(conn),
+              m_engine(engine),
+              m_on_finish(std::move(on_finish)),
+              m_fd(mpdfm::io_context(), conn.fd()),
+              m_signals(mpdfm::io_context(), SIGINT, SIGTERM) {}
+
+        ~player_watcher() {
+            // the descriptor is owned by the connection
+            m_fd.release();
+        }
+
+        player_watcher(const player_watcher &) = delete;
+        player_watcher &operator=(const player_watcher &) = delete;
+        player_watcher(player_watcher &&)                 = delete;
+        player_watcher &operator=(player_watcher &&) = delete;
+
+        //! \brief Has to be called from within the io_context
+        void start() {
+            try {
+                // graceful exits
+                m_signals.async_wait([this](auto ec, auto /*signal*/) {
+                    if (!ec) {
+                        finish();
+                    }
+                });
+
+                auto song   = m_conn.run_current_song();
+                auto status = m_conn.run_status();
+                if (song && status.state() == MPD_STATE_PLAY) {
+                    m_last.set_elapsed(status.elapsed_time());
+                    m_last.new_song(song);
+                    mpdfm::scrobble_entry entry { song };
+                    m_engine.now_playing(entry);
+                    mpdfm::log_startup_mark("first now_playing");
+                }
+                mpdfm::log_startup_mark("idle loop");
+                wait_idle();
+            } catch (...) {
+                finish(std::current_exception());
+            }
+        }
+
+        //! \returns A future that is ready once watching stopped
+        std::future<void> done() { return m_done.get_future(); }
+    };
+
+    boost::filesystem::path config_path(gsl::span<const char *> args,
+                                        size_t index) {
+        if (args.size() > index) {
+            return args[index];
+        }
+        return mpdfm::get_config_path() / "mpdfm/mpdfm.cfg";
+    }
+
+    /*!
+     * \brief mpdfm import <scrobbler> <file> [config]
+     *
+     * Sends the history in file through the first section of the config
+     * using the scrobbler.
+     */
+    int run_import(gsl::span<const char *> args) {
+        std::string name(args[2]);
+        try {
+            mpdfm::config_file cfg(config_path(args, 4).native());
+            mpdfm::load_profile(cfg.root_section());
+
+            auto &sections = cfg.sections();
+            auto sec       = std::find_if(
+                sections.begin(), sections.end(),
+                [&name](auto &s) { return s.name() == name; });
+            if (sec == sections.end()) {
+                spdlog::error("no {} section in the config", name);
+                return 1;
+            }
+            // NOLINTNEXTLINE unique_ptr is owning
+            std::unique_ptr<mpdfm::scrobbler> target(get_factory(name)(*sec));
+
+            // the same names and exclusions as when playing
+            mpdfm::import_rules rules;
+            rules.exclude =
+                mpdfm::parse_filter_rules(sec->value("exclude", {}));
+            if (auto &root = cfg.root_section();
+                root.has_value("rewrite_table")) {
+                rules.rewrites = std::make_unique<mpdfm::rewrite_table>(
+                    root.value("rewrite_table"));
+            }
+
+            std::ifstream in(args[3]);
+            if (!in) {
+                spdlog::error("cannot open {}", args[3]);
+                return 1;
+            }
+            // pipes (e.g. <(zcat history.gz)) have no size and can't seek
+            double total = 0;
+            if (boost::filesystem::is_regular_file(args[3])) {
+                total = static_cast<double>(
+                    boost::filesystem::file_size(args[3]));
+            }
+
+            // stay clear of the profile's backlog limit, which drops the
+            // oldest entries
+            size_t high_water = 5000;  // NOLINT magic number
+            if (auto limit = mpdfm::profile().max_backlog; limit != 0) {
+                high_water = std::max<size_t>(1, limit / 2);
+            }
+
+            auto start  = std::chrono::steady_clock::now();
+            auto report = [&](const mpdfm::import_stats &s) {
+                std::chrono::duration<double> t =
+                    std::chrono::steady_clock::now() - start;
+                auto sent  = s.imported - s.backlog;
+                auto bytes = static_cast<double>(s.bytes);
+                auto read  = total > 0
+                                 ? fmt::format("{:.1f}%",  // NOLINT percent
+                                               100 * bytes / total)
+                                 : fmt::format("{} lines, {} bytes",
+                                               s.lines, s.bytes);
+                spdlog::info("{} read, {} sent, {} waiting, {} invalid, {} "
+                             "duplicates, {:.0f}/s",
+                             read, sent, s.backlog, s.invalid, s.duplicates,
+                             static_cast<double>(sent) / t.count());
+            };
+            auto stats = mpdfm::import_history(in, *target, rules,
+                                               high_water, report);
+            spdlog::info("imported {} of {} lines, skipped {} duplicates, "
+                         "{} excluded and {} invalid entries",
+                         stats.imported, stats.lines, stats.duplicates,
+                         stats.excluded, stats.invalid);
+            return 0;
+        } catch (const tao::pegtl::parse_error &e) {
+            spdlog::error("config parse error: {}", e.what());
+        } catch (const std::exception &e) {
+            spdlog::error("import failed: {}", e.what());
+        }
+        return 1;
+    }
+
+    /*!
+     * \brief mpdfm rewrites <input.tsv> <table>
+     *
+     * Compiles a rewrite table, see mpdfm::rewrite_table.
+     */
+    int compile_rewrites(gsl::span<const char *> args) {
+        try {
+            std::ifstream in(args[2]);
+            if (!in) {
+                spdlog::error("cannot open {}", args[2]);
+                return 1;
+            }
+            auto entries = mpdfm::rewrite_table::compile(in, args[3]);
+            spdlog::info("wrote {} entries to {}", entries, args[3]);
+            return 0;
+        } catch (const std::exception &e) {
+            spdlog::error("cannot compile rewrite table: {}", e.what());
+        }
+        return 1;
+    }
+
+    /*!
+     * \brief mpdfm stats <artists|albums|tracks> [day|week|all] [count]
+     *        [config]
+     *
+     * Prints the top entries from the snapshot of the stats section.
+     */
+    int run_stats(gsl::span<const char *> args) {
+        using mpdfm::listening_stats;
+        try {
+            auto dim = listening_stats::parse_dimension(args[2]);
+            auto win = args.size() > 3
+                           ? listening_stats::parse_window(args[3])
+                           : listening_stats::window::week;
+            size_t count = 10;  // NOLINT magic number
+            if (args.size() > 4) {
+                count = std::stoul(args[4]);
+            }
+
+            mpdfm::config_file cfg(config_path(args, 5).native());
+            auto &sections = cfg.sections();
+            auto sec       = std::find_if(
+                sections.begin(), sections.end(),
+                [](auto &s) { return s.name() == "stats"; });
+            if (sec == sections.end()) {
+                spdlog::error("no stats section in the config");
+                return 1;
+            }
+
+            listening_stats stats;
+            stats.load(sec->value("path"));
+            for (auto &row : stats.top(dim, win, count)) {
+                std::cout << row.count << '\t' << row.artist;
+                if (!row.title.empty()) {
+                    std::cout << " - " << row.title;
+                }
+                std::cout << '\n';
+            }
+            return 0;
+        } catch (const tao::pegtl::parse_error &e) {
+            spdlog::error("config parse error: {}", e.what());
+        } catch (const std::exception &e) {
+            spdlog::error("cannot show stats: {}", e.what());
+        }
+        return 1;
+    }
+
+    /*!
+     * \brief Serves mpdfm::metrics::expose() at GET /metrics on \p address
+     */
+    void serve_metrics(std::optional<mpdfm::local_http_server> &server,
+                       const std::string &address) {
+        namespace http = boost::beast::http;
+        using server_type = mpdfm::local_http_server;
+        server.emplace(
+            mpdfm::io_context(),
+            address,
+            [](const server_type::request &req) {
+                server_type::response res;
+                res.version(req.version());
+                if (req.method() != http::verb::get
+                    || req.target() != "/metrics") {
+                    res.result(http::status::not_found);
+                    return res;
+                }
+                res.result(http::status::ok);
+                res.set(http::field::content_type,
+                        "text/plain; version=0.0.4");
+                res.body() = mpdfm::metrics::expose();
+                return res;
+            },
+            "metrics endpoint");
+    }
+
+    /*!
+     * \brief The top entries of \p counters, for the `stats` command
+     *
+     * \p words are the arguments of `mpdfm stats`:
+     * <artists|albums|tracks> [day|week|all] [count]
+     */
+    tao::json::value top_plays(mpdfm::listening_stats &counters,
+                               const std::vector<std::string> &words) {
+        using mpdfm::listening_stats;
+        auto dim = listening_stats::parse_dimension(words[0]);
+        auto win = words.size() > 1 ? listening_stats::parse_window(words[1])
+                                    : listening_stats::window::week;
+        size_t count = 10;  // NOLINT magic number
+        if (words.size() > 2) {
+            count = std::stoul(words[2]);
+        }
+
+        tao::json::value result = tao::json::empty_array;
+        for (auto &row : counters.top(dim, win, count)) {
+            tao::json::value entry = { { "artist", row.artist },
+                                       { "count", row.count } };
+            if (!row.title.empty()) {
+                entry["title"] = row.title;
+            }
+            result.push_back(std::move(entry));
+        }
+        return result;
+    }
+
+    /*!
+     * \brief Commands of the control socket, see include/control.hpp
+     *
+     * \param rewrites Path of the rewrite table loaded at startup, empty
+     *                 if there is none, reread by `reload-rewrites`
+     * \param counters Those of the stats section, if there is one
+     */
+    mpdfm::control_server::commands
+        control_commands(mpdfm::engine &engine,
+                         std::string rewrites,
+                         std::shared_ptr<mpdfm::listening_stats> counters) {
+        using tao::json::value;
+        using args    = std::vector<std::string>;
+        auto started  = std::chrono::steady_clock::now();
+        auto backlogs = [&engine]() {
+            value result = tao::json::empty_object;
+            for (auto &b : engine.backlogs()) {
+                result[b.name] = b.backlog;
+            }
+            return result;
+        };
+
+        mpdfm::control_server::commands c;
+        c["stats"] = { [&engine, started, counters](const args &words) {
+                          if (!words.empty()) {
+                              if (!counters) {
+                                  throw std::runtime_error(
+                                      "no stats section in the config");
+                              }
+                              return top_plays(*counters, words);
+                          }
+                          auto up = std::chrono::steady_clock::now() - started;
+                          size_t backlog = 0;
+                          for (auto &b : engine.backlogs()) {
+                              backlog += b.backlog;
+                          }
+                          return value {
+                              { "uptime", std::chrono::duration_cast<
+                                              std::chrono::seconds>(up)
+                                              .count() },
+                              { "paused", engine.paused() },
+                              { "scrobblers", engine.size() },
+                              { "backlog", backlog },
+                              { "mpd_events", mpdfm::metrics::total(
+                                                  "mpdfm_mpd_events_total") },
+                              { "http_requests",
+                                mpdfm::metrics::total(
+                                    "mpdfm_http_requests_total") },
+                              { "dropped",
+                                mpdfm::metrics::total(
+                                    "mpdfm_backlog_dropped_total") },
+                          };
+                      },
+                       "uptime, backlog and event counts, or the top plays "
+                       "with <artists|albums|tracks> [day|week|all] [count]" };
+        c["backlog"] = { [backlogs](const args &) { return backlogs(); },
+                         "scrobbles queued by each scrobbler" };
+        c["flush"]   = { [&engine](const args &) {
+                          engine.flush();
+                          return value(nullptr);
+                      },
+                       "start sending all backlogs now" };
+        c["pause"]   = { [&engine](const args &) {
+                          engine.pause(true);
+                          return value(nullptr);
+                      },
+                       "hold scrobbles back until resume" };
+        c["resume"]  = { [&engine](const args &) {
+                           engine.pause(false);
+                           return value(nullptr);
+                       },
+                        "send again, starting with the backlogs" };
+
+        // only the rewrite table, everything else needs a restart. the
+        // config isn't read again, that would rerun its commands
+        c["reload-rewrites"] = {
+            [&engine, rewrites](const args &) {
+                if (rewrites.empty()) {
+                    throw std::runtime_error("no rewrite_table in the config");
+                }
+                engine.load_rewrites(rewrites);
+                return value(rewrites);
+            },
+            "reload the rewrite table loaded at startup",
+            true
+        };
+        c["dump-trace"] = { [](const args &) {
+                               if (!mpdfm::trace::enabled()) {
+                                   throw std::runtime_error(
+                                       "tracing is off, see the trace key");
+                               }
+                               mpdfm::trace::dump();
+                               return value(nullptr);
+                           },
+                            "write the trace",
+                            true };
+        c["dump-flight"] = { [](const args &) {
+                                mpdfm::flight::dump("control socket");
+                                return value(nullptr);
+                            },
+                             "write the flight recorder",
+                             true };
+        if (mpdfm::alloc::enabled) {
+            c["allocations"] = { [](const args &) {
+                                    value result = tao::json::empty_object;
+                                    auto counts  = mpdfm::alloc::get();
+                                    for (size_t i = 0; i < counts.size();
+                                         i++) {
+                                        auto t =
+                                            static_cast<mpdfm::alloc::tag>(i);
+                                        result[mpdfm::alloc::tag_name(t)] = {
+                                            { "allocations",
+                                              counts[i].allocations },
+                                            { "bytes", counts[i].bytes },
+                                        };
+                                    }
+                                    return result;
+                                },
+                                 "heap allocations by subsystem so far" };
+        }
+        return c;
+    }
+
+    /*!
+     * \brief Dumps the trace on SIGUSR1 and the flight recorder on SIGUSR2,
+     *        until \p signals is cancelled
+     */
+    void dump_on(io::signal_set &signals) {
+        signals.async_wait([&signals](auto ec, int signal) {
+            if (ec) {
+                return;
+            }
+            if (signal == SIGUSR1) {
+                mpdfm::trace::dump();
+            } else {
+                mpdfm::flight::dump("SIGUSR2");
+            }
+            dump_on(signals);
+        });
+    }
+
+    /*!
+     * \brief Watches MPD until interrupted or a fatal error occurs
+     *
+     * \param run_io Whether the calling thread should run the io_context
+     *               itself, as opposed to it being run by another thread
+     * \param on_finish Called once watching stopped, stops the local APIs
+     */
+    void run_scrobblers(mpdfm::mpd_connection &conn,
+                        mpdfm::engine &engine,
+                        bool run_io,
+                        std::function<void()> on_finish) {
+        try {
+            player_watcher watcher(conn, engine, std::move(on_finish));
+            auto done = watcher.done();
+            io::post(mpdfm::io_context(), [&watcher]() { watcher.start(); });
+            if (run_io) {
+                // returns once the watcher stopped and every request that
+                // was still in flight finished
+                mpdfm::io_context().restart();
+                mpdfm::io_context().run();
+            }
+            done.get();
         } catch (const std::exception &e) {
             spdlog::error("fatal error: {}", e.what());
+            mpdfm::flight::dump("fatal error");
         }
     }
+
+    /*!
+     * \brief Runs an io_context on a dedicated thread
+     */
+    class io_worker {
+        using guard_type =
+            io::executor_work_guard<io::io_context::executor_type>;
+        guard_type m_guard;
+        std::thread m_thread;
+
+    public:
+        explicit io_worker(io::io_context &io)
+            : m_guard(io::make_work_guard(io)),
+              m_thread([ctx = &io]() { ctx->run(); }) {}
+
+        ~io_worker() { stop(); }
+
+        io_worker(const io_worker &) = delete;
+        io_worker &operator=(const io_worker &) = delete;
+        io_worker(io_worker &&)                 = delete;
+        io_worker &operator=(io_worker &&) = delete;
+
+        /*!
+         * \brief Lets the thread finish outstanding work and joins it
+         */
+        void stop() {
+            m_guard.reset();
+            if (m_thread.joinable()) {
+                m_thread.join();
+            }
+        }
+    };
 }  // namespace
 
 int main(int arg_count,
@@ -189,61 +693,114 @@ int main(int arg_count,
     }
 
     gsl::span<const char *> args(arg_vec, arg_count);
-    std::thread worker { []() { mpdfm::io_context().run(); } };
-    auto guard       = io::make_work_guard(mpdfm::io_context());
-    using guard_type = decltype(guard);
-
-    class raii_guard {  // NOLINT adding a cp/mv contructor/assignment is
-                        // useless
-        guard_type &m_guard;
-        std::thread &m_worker;
-
-    public:
-        ~raii_guard() {
-            m_guard.reset();
-            m_worker.join();
-        }
-
-        raii_guard(guard_type &g, std::thread &w) : m_guard(g), m_worker(w) {}
-    } raii_guard(guard, worker);
 
     if (args.size() >= 3) {
         std::string_view arg(args[1]);
         if (arg == "auth") {
+            io_worker worker(mpdfm::io_context());
             try {
                 // NOLINTNEXTLINE main-like interface
                 get_factory(args[2]).authenticate(arg_count - 2, arg_vec + 2);
             } catch (const std::exception &e) {
                 spdlog::error("authentication process failure: {}", e.what());
             }
+        } else if (arg == "import" && args.size() >= 4) {
+            io_worker worker(mpdfm::io_context());
+            return run_import(args);
+        } else if (arg == "stats") {
+            return run_stats(args);
+        } else if (arg == "rewrites" && args.size() >= 4) {
+            return compile_rewrites(args);
         } else {
             spdlog::error("invalid command");
             return 1;
         }
     } else {
-        // parse config
+        // recent log messages end up in flight recorder dumps
+        spdlog::default_logger()->sinks().push_back(
+            mpdfm::flight::log_sink());
+
+        // runs mpdfm::io_context() unless the profile is single threaded,
+        // which is only known once the config is loaded. Until then, async
+        // operations are queued but nothing runs them. Joined as soon as
+        // watching stopped, before the scrobblers its handlers use are gone
+        std::optional<io_worker> worker;
+
+        // startup is split up into phases, the ones that don't depend on
+        // each other (e.g. loading scrobbler caches and connecting to MPD)
+        // run concurrently
+        mpdfm::startup_graph startup;
         mpdfm::config_file cfg;
         std::string pass;
         std::string host;
         int port;
+        std::vector<std::unique_ptr<mpdfm::scrobbler>> slots;
+        std::vector<std::vector<mpdfm::filter_rule>> excludes;
+        std::optional<mpdfm::mpd_connection> conn;
 
-        try {
-            // find location of config file
-            boost::filesystem::path path;
-            if (args.size() >= 2) {
-                path = args[1];
-            } else {
-                path = mpdfm::get_config_path() / "mpdfm/mpdfm.cfg";
-            }
-
-            cfg  = mpdfm::config_file(path.native());
+        startup.add("config", [&]() {
+            cfg        = mpdfm::config_file(config_path(args, 1).native());
             auto &root = cfg.root_section();
+            mpdfm::load_profile(root);
+            if (root.has_value("trace")) {
+                mpdfm::trace::start(root.value("trace"));
+            }
+            mpdfm::flight::set_dump_path(root.value(
+                "flight_recorder",
+                (mpdfm::get_config_path() / "mpdfm/flight-recorder.log")
+                    .native()));
 
             port = std::stoi(root.value("mpd_port", "6600"));
             host = root.value("mpd_host", "localhost");
             if (root.has_value("mpd_password")) {
                 pass = root.value("mpd_password");
             }
+
+            // construct all the scrobblers
+            auto &sections = cfg.sections();
+            slots.resize(sections.size());
+            excludes.resize(sections.size());
+            for (size_t i = 0; i < sections.size(); i++) {
+                auto name = "scrobbler " + std::to_string(i) + " ("
+                            + sections[i].name() + ")";
+                startup.add(
+                    std::move(name),
+                    [&sec = sections[i], &slot = slots[i],
+                     &exclude = excludes[i]]() {
+                        try {
+                            exclude = mpdfm::parse_filter_rules(
+                                sec.value("exclude", {}));
+                            // NOLINTNEXTLINE unique_ptr is owning
+                            slot.reset(get_factory(sec.name())(sec));
+                        } catch (const std::exception &e) {
+                            spdlog::error(
+                                "got an error while setting up scrobbler: {}",
+                                e.what());
+                        }
+                    },
+                    { "config" });
+            }
+        });
+
+        startup.add(
+            "mpd_connect",
+            [&]() { conn.emplace(host, gsl::narrow_cast<short>(port)); },
+            { "config" });
+
+        startup.add(
+            "mpd_auth",
+            [&]() {
+                if (!pass.empty() && !conn->run_password(pass)) {
+                    throw std::runtime_error("password auth failed");
+                }
+            },
+            { "mpd_connect" });
+
+        try {
+            // phases get a helper thread of their own
+            io::io_context startup_io;
+            io_worker helper(startup_io);
+            startup.run(startup_io);
         } catch (const std::system_error &e) {
             spdlog::error("failed to open configuration file: {}", e.what());
             return 1;
@@ -251,35 +808,114 @@ int main(int arg_count,
             spdlog::error("config parse error: {}", e.what());
             return 1;
         } catch (const std::exception &e) {
-            spdlog::error("exception raised while loading configs: {}",
-                          e.what());
+            spdlog::error("startup failed: {}", e.what());
             return 1;
         }
+        startup.report();
 
-        // construct all the scrobblers
-        scrobbler_vec scrobblers;
-        for (auto &sec : cfg.sections()) {
-            try {
-                // NOLINTNEXTLINE unique_ptr is owning
-                scrobblers.emplace_back(get_factory(sec.name())(sec));
-            } catch (const std::exception &e) {
-                spdlog::error("got an error while setting up scrobbler: ",
-                              e.what());
+        // the hot paths shouldn't wait for the terminal or the journal
+        mpdfm::logging::start_async(mpdfm::profile().log_queue);
+
+        mpdfm::engine engine(mpdfm::io_context());
+        // the live counters, for the stats command of the control socket
+        std::shared_ptr<mpdfm::listening_stats> counters;
+        for (size_t i = 0; i < slots.size(); i++) {
+            if (auto *s = dynamic_cast<mpdfm::stats *>(slots[i].get())) {
+                counters = s->counters();
+            }
+            if (slots[i]) {
+                engine.add_scrobbler(std::move(slots[i]), excludes[i],
+                                     cfg.sections()[i].name());
             }
         }
 
-        if (scrobblers.empty()) {
+        if (engine.size() == 0) {
             spdlog::error("no scrobblers set up");
             return 1;
         }
 
-        mpdfm::mpd_connection conn(host, gsl::narrow_cast<short>(port));
-        if (!pass.empty()) {
-            if (!conn.run_password(pass)) {
-                spdlog::error("password auth failed");
+        if (auto &root = cfg.root_section(); root.has_value("rewrite_table")) {
+            try {
+                engine.load_rewrites(root.value("rewrite_table"));
+            } catch (const std::exception &e) {
+                spdlog::error("cannot load the rewrite table: {}", e.what());
+                return 1;
+            }
+        }
+
+        // lets other players submit plays, see include/ingest.hpp
+        std::optional<mpdfm::ingest_server> ingest;
+        auto &root = cfg.root_section();
+        if (root.has_value("ingest")) {
+            try {
+                ingest.emplace(engine, mpdfm::io_context(),
+                               root.value("ingest"));
+            } catch (const std::exception &e) {
+                spdlog::error("cannot start the ingest API: {}", e.what());
                 return 1;
             }
         }
-        run_scrobblers(conn, scrobblers);
+
+        // Prometheus scrape target, see include/metrics.hpp
+        std::optional<mpdfm::local_http_server> metrics;
+        if (root.has_value("metrics")) {
+            try {
+                serve_metrics(metrics, root.value("metrics"));
+            } catch (const std::exception &e) {
+                spdlog::error("cannot start the metrics endpoint: {}",
+                              e.what());
+                return 1;
+            }
+        }
+
+        // scripting interface, see include/control.hpp
+        std::optional<mpdfm::control_server> control;
+        if (root.has_value("control")) {
+            try {
+                control.emplace(
+                    mpdfm::io_context(), root.value("control"),
+                    control_commands(engine,
+                                     root.value("rewrite_table", ""),
+                                     counters));
+            } catch (const std::exception &e) {
+                spdlog::error("cannot start the control socket: {}",
+                              e.what());
+                return 1;
+            }
+        }
+
+        // kill -USR2 writes the flight recorder, see
+        // include/flight_recorder.hpp, and -USR1 the trace, if tracing
+        io::signal_set dumps(mpdfm::io_context(), SIGUSR2);
+        if (mpdfm::trace::enabled()) {
+            dumps.add(SIGUSR1);
+        }
+        dump_on(dumps);
+
+        auto single_threaded = mpdfm::profile().single_threaded;
+        if (!single_threaded) {
+            worker.emplace(mpdfm::io_context());
+        }
+        // runs on the io_context, leaving it nothing to wait for but
+        // requests in flight
+        auto stop_local = [&engine, &ingest, &metrics, &control, &dumps]() {
+            if (ingest) {
+                ingest->stop();
+            }
+            if (metrics) {
+                metrics->stop();
+            }
+            if (control) {
+                control->stop();
+            }
+            dumps.cancel();
+            engine.stop();
+        };
+        run_scrobblers(*conn, engine, single_threaded, stop_local);
+        // requests still in flight complete on the worker, their handlers
+        // capture scrobblers owned by the locals above
+        worker.reset();
+        mpdfm::trace::dump();
+        mpdfm::logging::report_suppressed();
     }
 }
@@ -0,0 +1,272 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <metrics.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <spdlog/fmt/fmt.h>
+#include <stdexcept>
+
+namespace {
+    using namespace mpdfm::metrics;
+
+    constexpr double us_per_second = 1e6;
+
+    enum class kind { counter, gauge, histogram };
+
+    constexpr const char *type_name(kind k) {
+        switch (k) {
+        case kind::counter:
+            return "counter";
+        case kind::gauge:
+            return "gauge";
+        case kind::histogram:
+            return "histogram";
+        }
+        return "untyped";
+    }
+
+    //! \brief All series of a name, by their rendered labels
+    struct family {
+        kind type;
+        std::string help;
+        std::map<std::string, std::unique_ptr<counter>> counters;
+        std::map<std::string, std::unique_ptr<gauge>> gauges;
+        std::map<std::string, std::unique_ptr<histogram>> histograms;
+    };
+
+    struct registry {
+        std::mutex mutex;
+        std::map<std::string, family> families;
+    };
+
+    registry &global() {
+        static registry r;
+        return r;
+    }
+
+    void escape(std::string &out, const std::string &s, bool quotes) {
+        for (char c : s) {
+            if (c == '\\') {
+                out += "\\\\";
+            } else if (c == '\n') {
+                out += "\\n";
+            } else if (c == '"' && quotes) {
+                out += "\\\"";
+            } else {
+                out += c;
+            }
+        }
+    }
+
+    //! \returns `a="1",b="2"`, without braces so more can be appended
+    std::string render(const labels &l) {
+        std::string out;
+        for (auto &[name, value] : l) {
+            if (!out.empty()) {
+                out += ',';
+            }
+            out += name;
+            out += "=\"";
+            escape(out, value, true);
+            out += '"';
+        }
+        return out;
+    }
+
+    template<typename T>
+    T &get(const std::string &name,
+           const std::string &help,
+           const labels &l,
+           kind type,
+           std::map<std::string, std::unique_ptr<T>> family::*series) {
+        auto &r = global();
+        std::unique_lock lock(r.mutex);
+        auto [it, inserted] = r.families.try_emplace(name);
+        auto &f             = it->second;
+        if (inserted) {
+            f.type = type;
+            f.help = help;
+        } else if (f.type != type) {
+            throw std::logic_error("metric " + name
+                                   + " registered with another type");
+        }
+        auto &slot = (f.*series)[render(l)];
+        if (!slot) {
+            slot = std::make_unique<T>();
+        }
+        return *slot;
+    }
+
+    void braces(std::string &out, const std::string &labels) {
+        if (!labels.empty()) {
+            out += '{';
+            out += labels;
+            out += '}';
+        }
+    }
+}  // namespace
+
+size_t mpdfm::metrics::internal::shard() {
+    static std::atomic<size_t> next { 0 };
+    thread_local size_t index = next.fetch_add(1) % shards;
+    return index;
+}
+
+uint64_t mpdfm::metrics::counter::value() const {
+    uint64_t sum = 0;
+    for (auto &s : m_shards) {
+        sum += s.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+// histogram
+
+size_t mpdfm::metrics::histogram::bucket_of(uint64_t us) {
+    if (us < sub_buckets) {
+        return us;
+    }
+    // position of the highest bit, at least 2 here
+    size_t power = 0;
+    for (auto v = us; v > 1; v >>= 1U) {
+        power++;
+    }
+    auto sub    = (us >> (power - 2)) & (sub_buckets - 1);
+    auto bucket = sub_buckets + (power - 2) * sub_buckets + sub;
+    return std::min(bucket, buckets - 1);
+}
+
+uint64_t mpdfm::metrics::histogram::upper_bound(size_t i) {
+    if (i < sub_buckets) {
+        return i;
+    }
+    auto power = (i - sub_buckets) / sub_buckets + 2;
+    auto sub   = (i - sub_buckets) % sub_buckets;
+    auto width = uint64_t { 1 } << (power - 2);
+    return (sub_buckets + sub) * width + width - 1;
+}
+
+void mpdfm::metrics::histogram::observe(
+    std::chrono::steady_clock::duration d) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(d);
+    observe_us(static_cast<uint64_t>(std::max<int64_t>(0, us.count())));
+}
+
+void mpdfm::metrics::histogram::observe_us(uint64_t us) {
+    auto &s = m_shards[internal::shard()];
+    s.counts[bucket_of(us)].fetch_add(1, std::memory_order_relaxed);
+    s.sum_us.fetch_add(us, std::memory_order_relaxed);
+}
+
+mpdfm::metrics::histogram::snapshot
+    mpdfm::metrics::histogram::collect() const {
+    snapshot result;
+    for (auto &s : m_shards) {
+        for (size_t i = 0; i < buckets; i++) {
+            auto n = s.counts[i].load(std::memory_order_relaxed);
+            result.counts[i] += n;
+            result.count += n;
+        }
+        result.sum_us += s.sum_us.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+// registry
+
+mpdfm::metrics::counter &mpdfm::metrics::get_counter(const std::string &name,
+                                                     const std::string &help,
+                                                     const labels &l) {
+    return get(name, help, l, kind::counter, &family::counters);
+}
+
+mpdfm::metrics::gauge &mpdfm::metrics::get_gauge(const std::string &name,
+                                                 const std::string &help,
+                                                 const labels &l) {
+    return get(name, help, l, kind::gauge, &family::gauges);
+}
+
+mpdfm::metrics::histogram &
+    mpdfm::metrics::get_histogram(const std::string &name,
+                                  const std::string &help,
+                                  const labels &l) {
+    return get(name, help, l, kind::histogram, &family::histograms);
+}
+
+uint64_t mpdfm::metrics::total(const std::string &name) {
+    auto &r = global();
+    std::unique_lock lock(r.mutex);
+    auto it = r.families.find(name);
+    if (it == r.families.end()) {
+        return 0;
+    }
+    uint64_t sum = 0;
+    for (auto &[l, c] : it->second.counters) {
+        sum += c->value();
+    }
+    return sum;
+}
+
+std::string mpdfm::metrics::expose() {
+    auto &r = global();
+    std::unique_lock lock(r.mutex);
+    std::string out;
+    auto it = std::back_inserter(out);
+    for (auto &[name, f] : r.families) {
+        out += "# HELP " + name + ' ';
+        escape(out, f.help, false);
+        fmt::format_to(it, "\n# TYPE {} {}\n", name, type_name(f.type));
+
+        for (auto &[l, c] : f.counters) {
+            out += name;
+            braces(out, l);
+            fmt::format_to(it, " {}\n", c->value());
+        }
+        for (auto &[l, g] : f.gauges) {
+            out += name;
+            braces(out, l);
+            fmt::format_to(it, " {}\n", g->value());
+        }
+        for (auto &[l, h] : f.histograms) {
+            auto snap           = h->collect();
+            auto sep            = l.empty() ? "" : ",";
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i < histogram::buckets; i++) {
+                cumulative += snap.counts[i];
+                fmt::format_to(
+                    it, "{}_bucket{{{}{}le=\"{}\"}} {}\n", name, l, sep,
+                    static_cast<double>(histogram::upper_bound(i))
+                        / us_per_second,
+                    cumulative);
+            }
+            fmt::format_to(it, "{}_bucket{{{}{}le=\"+Inf\"}} {}\n", name, l,
+                           sep, snap.count);
+            out += name + "_sum";
+            braces(out, l);
+            fmt::format_to(it, " {}\n",
+                           static_cast<double>(snap.sum_us) / us_per_second);
+            out += name + "_count";
+            braces(out, l);
+            fmt::format_to(it, " {}\n", snap.count);
+        }
+    }
+    return out;
+}
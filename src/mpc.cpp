@@ -19,6 +19,7 @@
 #include <cstdlib>
 #include <mpd/client.h>
 #include <string>
+#include <trace.hpp>
 
 namespace {
     template<typename Expressed>
@@ -66,11 +67,13 @@ mpd_idle mpdfm::mpd_connection::run_idle_mask(mpd_idle mask) {
 }
 
 mpdfm::song mpdfm::mpd_connection::run_current_song() const {
+    trace::span span("mpd currentsong");
     return mpdfm::song(
         check_error(mpd_run_current_song(m_connection.get()), m_connection));
 }
 
 mpdfm::status mpdfm::mpd_connection::run_status() const {
+    trace::span span("mpd status");
     return mpdfm::status(
         check_error(mpd_run_status(m_connection.get()), m_connection));
 }
@@ -84,6 +87,20 @@ void mpdfm::mpd_connection::send_noidle() {
     check_error(mpd_send_noidle(m_connection.get()), m_connection.get());
 }
 
+void mpdfm::mpd_connection::send_idle_mask(mpd_idle mask) {
+    check_error(mpd_send_idle_mask(m_connection.get(), mask),
+                m_connection.get());
+}
+
+mpd_idle mpdfm::mpd_connection::recv_idle() {
+    return check_error(mpd_recv_idle(m_connection.get(), false),
+                       m_connection);
+}
+
+int mpdfm::mpd_connection::fd() const {
+    return mpd_connection_get_fd(m_connection.get());
+}
+
 mpdfm::song::song(::mpd_song *song)
     : m_song(std::shared_ptr<::mpd_song>(song, [](auto p) {
           if (p) {
@@ -91,6 +108,10 @@ mpdfm::song::song(::mpd_song *song)
           }
       })) {}
 
+std::string mpdfm::song::uri() const {
+    return mpd_song_get_uri(m_song.get());
+}
+
 unsigned mpdfm::song::id() const {
     return mpd_song_get_id(m_song.get());
 }
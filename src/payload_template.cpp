@@ -0,0 +1,192 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <payload_template.hpp>
+
+#include <array>
+#include <charconv>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+    auto hex_digits = "0123456789abcdef";
+
+    void append_number(std::string &out, time_t value) {
+        std::array<char, 24> buf {};  // NOLINT fits any 64 bit integer
+        auto [end, ec] =
+            std::to_chars(buf.data(), buf.data() + buf.size(), value);
+        out.append(buf.data(), end);
+    }
+
+    void append_json_escaped(std::string &out, std::string_view value) {
+        for (char c : value) {
+            switch (c) {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {  // NOLINT
+                    out += "\\u00";
+                    out += hex_digits[(c >> 4) & 0xf];  // NOLINT safe
+                    out += hex_digits[c & 0xf];         // NOLINT safe
+                } else {
+                    // multibyte UTF-8 sequences are left alone
+                    out += c;
+                }
+                break;
+            }
+        }
+    }
+}  // namespace
+
+mpdfm::payload_template::payload_template(const std::string &source,
+                                          escaping esc)
+    : m_escaping(esc) {
+    using namespace std::string_view_literals;
+    static constexpr std::array<std::pair<std::string_view, field>, 10>
+        names { { { "artist"sv, field::artist },
+                  { "track"sv, field::track },
+                  { "album"sv, field::album },
+                  { "track_number"sv, field::track_number },
+                  { "mbid"sv, field::mbid },
+                  { "album_artist"sv, field::album_artist },
+                  { "duration"sv, field::duration },
+                  { "timestamp"sv, field::timestamp },
+                  { "elapsed"sv, field::elapsed },
+                  { "event"sv, field::event } } };
+
+    // adjacent literals are merged into a single op
+    auto add_literal = [this](std::string_view text) {
+        if (text.empty()) {
+            return;
+        }
+        if (!m_ops.empty() && m_ops.back().what == field::literal) {
+            m_ops.back().length += text.size();
+        } else {
+            m_ops.push_back(
+                { field::literal, m_literals.size(), text.size() });
+        }
+        m_literals += text;
+    };
+
+    std::string_view src(source);
+    while (!src.empty()) {
+        auto dollar = src.find('$');
+        add_literal(src.substr(0, dollar));
+        if (dollar == std::string_view::npos) {
+            break;
+        }
+        src.remove_prefix(dollar + 1);
+
+        if (!src.empty() && src.front() == '$') {
+            add_literal("$"sv);
+            src.remove_prefix(1);
+            continue;
+        }
+        if (src.empty() || src.front() != '{') {
+            throw std::runtime_error(
+                "template: expected '{' or '$' after '$'");
+        }
+        auto close = src.find('}');
+        if (close == std::string_view::npos) {
+            throw std::runtime_error("template: unterminated placeholder");
+        }
+
+        auto name  = src.substr(1, close - 1);
+        auto found = false;
+        for (auto &[n, f] : names) {
+            if (n == name) {
+                m_ops.push_back({ f, 0, 0 });
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            throw std::runtime_error("template: unknown field "
+                                     + std::string(name));
+        }
+        src.remove_prefix(close + 1);
+    }
+}
+
+void mpdfm::payload_template::emit_string(std::string &out,
+                                          std::string_view value) const {
+    if (m_escaping == escaping::json) {
+        append_json_escaped(out, value);
+    } else {
+        out += value;
+    }
+}
+
+void mpdfm::payload_template::render(std::string &out,
+                                     const scrobble_entry &s,
+                                     std::string_view event) const {
+    for (auto &o : m_ops) {
+        switch (o.what) {
+        case field::literal:
+            out.append(m_literals, o.offset, o.length);
+            break;
+        case field::artist:
+            emit_string(out, s.artist);
+            break;
+        case field::track:
+            emit_string(out, s.track);
+            break;
+        case field::album:
+            emit_string(out, s.album);
+            break;
+        case field::track_number:
+            emit_string(out, s.track_number);
+            break;
+        case field::mbid:
+            emit_string(out, s.mbid);
+            break;
+        case field::album_artist:
+            emit_string(out, s.album_artist);
+            break;
+        case field::duration:
+            append_number(out, s.duration);
+            break;
+        case field::timestamp:
+            append_number(out, s.timestamp);
+            break;
+        case field::elapsed:
+            append_number(out, s.elapsed);
+            break;
+        case field::event:
+            emit_string(out, event);
+            break;
+        }
+    }
+}
+
+size_t mpdfm::payload_template::size_hint() const {
+    // assume an average of 16 bytes per field
+    constexpr size_t field_guess = 16;
+    return m_literals.size() + m_ops.size() * field_guess;
+}
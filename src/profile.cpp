@@ -0,0 +1,86 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <profile.hpp>
+
+#include <stdexcept>
+#include <string>
+
+namespace {
+    mpdfm::runtime_profile &current() {
+#ifdef MPDFM_SMALL_FOOTPRINT
+        static auto p = mpdfm::runtime_profile::small();
+#else
+        static auto p = mpdfm::runtime_profile::normal();
+#endif
+        return p;
+    }
+
+    size_t size_value(const mpdfm::config_section &root,
+                      const std::string &key,
+                      size_t def) {
+        if (!root.has_value(key)) {
+            return def;
+        }
+        return std::stoul(root.value(key));
+    }
+}  // namespace
+
+mpdfm::runtime_profile mpdfm::runtime_profile::normal() {
+    runtime_profile p;
+    p.single_threaded = false;
+    p.max_backlog     = 0;
+    p.http_buffer     = 1024 * 1024;      // NOLINT magic num
+    p.http_body_limit = 8 * 1024 * 1024;  // NOLINT beast's default
+    p.log_queue       = 8192;             // NOLINT magic num
+    return p;
+}
+
+mpdfm::runtime_profile mpdfm::runtime_profile::small() {
+    runtime_profile p;
+    p.single_threaded = true;
+    p.max_backlog     = 500;        // NOLINT magic num
+    p.http_buffer     = 8 * 1024;   // NOLINT magic num
+    p.http_body_limit = 64 * 1024;  // NOLINT as20 responses are tiny
+    p.log_queue       = 128;        // NOLINT magic num
+    return p;
+}
+
+const mpdfm::runtime_profile &mpdfm::profile() {
+    return current();
+}
+
+void mpdfm::load_profile(const config_section &root) {
+    auto &p = current();
+    if (root.has_value("profile")) {
+        auto &name = root.value("profile");
+        if (name == "small") {
+            p = runtime_profile::small();
+        } else if (name == "default") {
+            p = runtime_profile::normal();
+        } else {
+            throw std::runtime_error("unknown profile: " + name);
+        }
+    }
+
+    if (root.has_value("single_threaded")) {
+        p.single_threaded = root.value("single_threaded") == "yes";
+    }
+    p.max_backlog     = size_value(root, "max_backlog", p.max_backlog);
+    p.http_buffer     = size_value(root, "http_buffer", p.http_buffer);
+    p.http_body_limit = size_value(root, "http_body_limit", p.http_body_limit);
+    p.log_queue       = size_value(root, "log_queue", p.log_queue);
+}
@@ -19,7 +19,6 @@
 #include <algorithm>
 #include <boost/beast/http/empty_body.hpp>
 #include <boost/beast/http/string_body.hpp>
-#include <boost/container/flat_map.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/system/system_error.hpp>
 #include <ctime>
@@ -28,16 +27,38 @@
 #include <http_client.hpp>
 #include <iostream>
 #include <iterator>
+#include <logging.hpp>
+#include <metrics.hpp>
 #include <openssl/md5.h>
+#include <probes.hpp>
+#include <protocols/as20_request.hpp>
 #include <spdlog/fmt/ostr.h>
 #include <spdlog/spdlog.h>
 #include <sstream>
 #include <string_view>
 #include <tao/json.hpp>
+#include <tao/json/binding.hpp>
 #include <tao/json/contrib/traits.hpp>
+#include <trace.hpp>
 #include <uris.hpp>
 
-namespace bc = boost::container;
+namespace {
+    //! \returns Round trip time histogram of the API method \p method
+    mpdfm::metrics::histogram &request_latency(const std::string &method) {
+        return mpdfm::metrics::get_histogram(
+            "mpdfm_as20_request_seconds",
+            "AudioScrobbler API round trip time",
+            { { "method", method } });
+    }
+
+    //! \returns Counter of scrobbles that ended up \p result
+    mpdfm::metrics::counter &scrobbles(const std::string &result) {
+        return mpdfm::metrics::get_counter(
+            "mpdfm_as20_scrobbles_total",
+            "Scrobbles accepted or requeued by the AudioScrobbler API",
+            { { "result", result } });
+    }
+}  // namespace
 
 namespace mpdfm {
     //! \brief Generic response wrapper
@@ -103,104 +124,96 @@ namespace tao::json {
 }  // namespace tao::json
 
 namespace {
-    auto hex_digits = "0123456789abcdef";
+    //! \brief Backoff of rate limited scrobbles, unless the server says
+    constexpr std::chrono::seconds min_retry_delay(10);
+    constexpr std::chrono::seconds max_retry_delay(300);
+
+    //! \returns The Retry-After seconds of \p res, if any
+    template<typename Response>
+    std::optional<std::chrono::seconds> retry_after(const Response &res) {
+        auto it = res.find(boost::beast::http::field::retry_after);
+        if (it == res.end()) {
+            return std::nullopt;
+        }
+        try {
+            return std::chrono::seconds(std::stoul(std::string(it->value())));
+        } catch (const std::exception &) {
+            return std::nullopt;
+        }
+    }
 
-    /*!
-     * \brief Handles formation of AS20 requests
-     */
-    struct audioscrobbler_request {
-        /*!
-         * \brief Creates a new as20 request that will be signed with the
-         *        \p secret
-         *
-         * \param secret The secret to use to sign the request
-         */
-        explicit audioscrobbler_request(std::string secret)
-            : m_api_secret(std::move(secret)) {}
-
-        //! \brief MD5 signs the request
-        [[nodiscard]] std::string sign() const {
-            auto ctx = std::make_unique<MD5_CTX>();
-
-            if (!MD5_Init(ctx.get())) {  // NOLINT C API
-                throw std::runtime_error("md5 init failure");
-            }
+    //! \brief Parses the response to a scrobble request
+    mpdfm::response parse_response(const std::string &body) {
+        mpdfm::trace::span span("as20 parse response");
+        return tao::json::from_string(body).as<mpdfm::response>();
+    }
 
-            for (auto &p : m_params) {
-                auto &f = p.first;
-                auto &s = p.second;
-                // append each KV-pair
-                // NOLINTNEXTLINE C API
-                if (!(MD5_Update(ctx.get(), f.c_str(), f.length())
-                      // NOLINTNEXTLINE C API
-                      && MD5_Update(ctx.get(), s.c_str(), s.length()))) {
-                    // if at least one is false
-                    throw std::runtime_error("request digest failed");
-                }
-            }
+    auto hex_digits = "0123456789abcdef";
+}  // namespace
 
-            // append api secret
-            // NOLINTNEXTLINE C API
-            if (!MD5_Update(
-                    ctx.get(), m_api_secret.c_str(), m_api_secret.length())) {
-                throw std::runtime_error("request digest failed");
-            }
+std::string mpdfm::internal::audioscrobbler_request::sign() const {
+    auto ctx = std::make_unique<MD5_CTX>();
 
-            // convert to hex string
-            std::array<uint8_t, MD5_DIGEST_LENGTH> digest = { 0 };
-            if (MD5_Final(digest.data(), ctx.get()) == 0) {
-                throw std::runtime_error("request digest finalization failed");
-            }
+    if (!MD5_Init(ctx.get())) {  // NOLINT C API
+        throw std::runtime_error("md5 init failure");
+    }
 
-            std::array<char, MD5_DIGEST_LENGTH * 2 + 1> digest_str = { 0 };
-            for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
-                // safe code
-                digest_str[i * 2]     = hex_digits[digest[i] >> 4];   // NOLINT
-                digest_str[i * 2 + 1] = hex_digits[digest[i] & 0xf];  // NOLINT
-            }
-            return std::string(digest_str.data());
+    for (auto &p : m_params) {
+        auto &f = p.first;
+        auto &s = p.second;
+        // append each KV-pair
+        // NOLINTNEXTLINE C API
+        if (!(MD5_Update(ctx.get(), f.c_str(), f.length())
+              // NOLINTNEXTLINE C API
+              && MD5_Update(ctx.get(), s.c_str(), s.length()))) {
+            // if at least one is false
+            throw std::runtime_error("request digest failed");
         }
+    }
 
-        //! \brief Gets the parameter \p key using std::map operator[]
-        std::string &operator[](const std::string &key) {
-            return m_params[key];
-        }
+    // append api secret
+    // NOLINTNEXTLINE C API
+    if (!MD5_Update(ctx.get(), m_api_secret.c_str(), m_api_secret.length())) {
+        throw std::runtime_error("request digest failed");
+    }
 
-        //! \brief Joins and signs all the parameters
-        std::string form() {
-            std::stringstream s;
-            for (auto &p : m_params) {
-                s << "&" << mpdfm::urlencode(p.first) << "="
-                  << mpdfm::urlencode(p.second);
-            }
-            s << "&format=json";
-            s << "&api_sig=" << sign();
-            return s.str();
-        }
+    // convert to hex string
+    std::array<uint8_t, MD5_DIGEST_LENGTH> digest = { 0 };
+    if (MD5_Final(digest.data(), ctx.get()) == 0) {
+        throw std::runtime_error("request digest finalization failed");
+    }
 
-        //! \brief Helper for adding all track information to a request
-        inline void add_track(const mpdfm::scrobble_entry &s,
-                              const std::string &suffix = "") {
-            add_tag(s.artist, "artist" + suffix);
-            add_tag(s.track, "track" + suffix);
-            add_tag(s.album, "album" + suffix);
-            add_tag(s.track_number, "trackNumber" + suffix);
-            add_tag(s.mbid, "mbid" + suffix);
-            add_tag(s.album_artist, "albumArtist" + suffix);
-            (*this)["duration" + suffix] = std::to_string(s.duration);
-        }
+    std::array<char, MD5_DIGEST_LENGTH * 2 + 1> digest_str = { 0 };
+    for (int i = 0; i < MD5_DIGEST_LENGTH; i++) {
+        // safe code
+        digest_str[i * 2]     = hex_digits[digest[i] >> 4];   // NOLINT
+        digest_str[i * 2 + 1] = hex_digits[digest[i] & 0xf];  // NOLINT
+    }
+    return std::string(digest_str.data());
+}
 
-    private:
-        inline void add_tag(const std::string &value,
-                            const std::string &field) {
-            if (!value.empty()) {
-                (*this)[field] = value;
-            }
-        }
-        bc::flat_map<std::string, std::string> m_params;
-        std::string m_api_secret;
-    };
-}  // namespace
+std::string mpdfm::internal::audioscrobbler_request::form() {
+    trace::span span("as20 encode and sign");
+    std::stringstream s;
+    for (auto &p : m_params) {
+        s << "&" << urlencode(p.first) << "=" << urlencode(p.second);
+    }
+    s << "&format=json";
+    s << "&api_sig=" << sign();
+    return s.str();
+}
+
+void mpdfm::internal::audioscrobbler_request::add_track(
+    const scrobble_entry &s,
+    const std::string &suffix) {
+    add_tag(s.artist, "artist" + suffix);
+    add_tag(s.track, "track" + suffix);
+    add_tag(s.album, "album" + suffix);
+    add_tag(s.track_number, "trackNumber" + suffix);
+    add_tag(s.mbid, "mbid" + suffix);
+    add_tag(s.album_artist, "albumArtist" + suffix);
+    (*this)["duration" + suffix] = std::to_string(s.duration);
+}
 
 mpdfm::as20::as20(std::string sk,
                   std::string as,
@@ -211,40 +224,15 @@ mpdfm::as20::as20(std::string sk,
       m_api_key(std::move(ak)),
       m_api_secret(std::move(as)),
       m_target(tu),
-      m_path(std::move(sp)) {
+      m_cache(std::move(sp)),
+      m_retry(io_context()) {
     spdlog::debug("uri target: {}", m_target.source());
-    try {
-        if (!m_path.empty()) {
-            m_cache =
-                tao::json::parse_file(m_path).template as<decltype(m_cache)>();
-        }
-    } catch (const std::exception &e) {
-        spdlog::error(
-            "couldnt read cache (ignoring): "
-            "if missing, the file will be made once the program ends\n{}",
-            e.what());
-    }
 }
 
-mpdfm::as20::~as20() {
-    try {
-        if (m_path.empty()) {
-            return;
-        }
-        std::ofstream str(m_path);
-        if (str.good()) {
-            tao::json::to_stream(str, tao::json::value(m_cache));
-        } else {
-            spdlog::error("cannot write cache to {}", m_path);
-        }
-    } catch (const std::exception &e) {
-        spdlog::error("cannot write cache to {}: {}", m_path, e.what());
-    }
-}
+mpdfm::as20::~as20() = default;
 
 bool mpdfm::as20::do_check_preconditions(const scrobble_entry &s) {
-    auto played = std::min<unsigned>(240, s.duration / 2);  // NOLINT magic num
-    return s.duration > 30 && s.elapsed > played;           // NOLINT magic num
+    return meets_scrobble_rules(s);
 }
 
 void mpdfm::as20::do_send_now_playing(const scrobble_entry &s) {
@@ -252,7 +240,7 @@ void mpdfm::as20::do_send_now_playing(const scrobble_entry &s) {
         throw std::runtime_error("one (or more) previous scrobbles failed");
     }
 
-    audioscrobbler_request req(m_api_secret);
+    internal::audioscrobbler_request req(m_api_secret);
     req["method"]  = "track.updateNowPlaying";
     req["api_key"] = m_api_key;
     req["sk"]      = m_session_key;
@@ -261,30 +249,57 @@ void mpdfm::as20::do_send_now_playing(const scrobble_entry &s) {
     using boost::beast::http::string_body;
     using boost::beast::http::verb;
     auto http = http_request<string_body, string_body>::make(
-        m_target, io_context(), ssl_context());
+        m_target, io_context());
 
     http->request().body() = req.form();
     http->request().method(verb::post);
 
-    http->run([](auto http, auto ec) {
+    http->run([sent = metrics::stopwatch()](auto http, auto ec) {
         if (ec) {
-            spdlog::error("request error when sending now playing: {}", ec);
+            MPDFM_LOG_LIMITED(spdlog::level::err,
+                              "request error when sending now playing: {}",
+                              ec);
             return;
         }
+        static auto &latency = request_latency("track.updateNowPlaying");
+        latency.observe(sent.elapsed());
         auto code = http->response().result_int();
         // NOLINTNEXTLINE non-success codes
         if (code < 200 || code > 299) {
-            spdlog::error("now playing send failed, status: {}", code);
+            MPDFM_LOG_LIMITED(spdlog::level::err,
+                              "now playing send failed, status: {}", code);
         }
     });
 }
 
 void mpdfm::as20::do_send_scrobble(const scrobble_entry &s) {
-    {
-        std::unique_lock lock(m_cache_mutex);
-        m_cache.insert(s);
+    m_cache.insert(s);
+    if (!m_retry_pending) {
+        send_scrobbles_coalesced();
+    }
+}
+
+void mpdfm::as20::do_send_scrobbles(
+    const std::vector<scrobble_entry> &s) {
+    m_cache.insert(s);
+    if (!m_retry_pending) {
+        send_scrobbles_coalesced();
     }
-    send_scrobbles_coalesced();
+}
+
+void mpdfm::as20::do_enqueue(const std::vector<scrobble_entry> &s) {
+    m_cache.insert(s);
+}
+
+void mpdfm::as20::do_flush() {
+    // one request at a time, each one continues with the next batch
+    if (m_cache.in_flight() == 0 && !m_retry_pending) {
+        send_scrobbles_coalesced();
+    }
+}
+
+size_t mpdfm::as20::do_backlog() const {
+    return m_cache.size() + m_cache.in_flight();
 }
 
 void mpdfm::as20::send_scrobbles_coalesced() {
@@ -292,58 +307,77 @@ void mpdfm::as20::send_scrobbles_coalesced() {
     if (m_fail_flag) {
         throw std::runtime_error("one (or more) previous scrobbles failed");
     }
-    std::unique_lock l(m_cache_mutex);
-    if (m_cache.empty()) {
+    auto to_send = std::make_shared<std::vector<scrobble_entry>>(
+        m_cache.extract(batch_size));
+    if (to_send->empty()) {
         return;
     }
 
-    audioscrobbler_request req(m_api_secret);
+    internal::audioscrobbler_request req(m_api_secret);
     req["method"]  = "track.scrobble";
     req["api_key"] = m_api_key;
     req["sk"]      = m_session_key;
 
-    auto to_send = std::make_shared<std::vector<scrobble_entry>>();
-    to_send->reserve(batch_size);
-
-    for (int i = 0; i < batch_size && !m_cache.empty(); i++) {
-        auto &x = to_send->emplace_back(
-            std::move(m_cache.extract(m_cache.begin()).value()));
+    for (size_t i = 0; i < to_send->size(); i++) {
+        auto &x = (*to_send)[i];
 
         std::string suffix = '[' + std::to_string(i) + ']';
         req.add_track(x, suffix);
         req["timestamp" + suffix] = std::to_string(x.timestamp);
     }
+    MPDFM_PROBE(as20_batch, to_send->size());
 
     using boost::beast::http::string_body;
     using boost::beast::http::verb;
     auto http = http_request<string_body, string_body>::make(
-        m_target, io_context(), ssl_context());
+        m_target, io_context());
 
     http->request().body() = req.form();
     http->request().method(verb::post);
-    http->run([this, to_send](auto http, auto ec) {
-        using tao::json::from_string;
+    http->run([this, to_send, sent = metrics::stopwatch()](auto http,
+                                                           auto ec) {
+        static auto &accepted = scrobbles("accepted");
+        static auto &requeued = scrobbles("requeued");
         try {
             if (ec) {
                 throw boost::system::system_error(ec, "http failure");
             }
-            auto &r        = http->response();
-            const auto val = from_string(r.body()).template as<response>();
-            if (!val.message.empty()) {
-                switch (val.error) {
-                default: {
-                    std::unique_lock l(m_cache_mutex);
-                    m_fail_flag = true;
-                }
-                // fall through
-                case 11:  // NOLINT service offline
-                case 16:  // NOLINT temp unavailable
-                    throw std::runtime_error("api returned an error: "
-                                             + val.message);
-                    break;
+            static auto &latency = request_latency("track.scrobble");
+            latency.observe(sent.elapsed());
+            auto &res = http->response();
+            // error 29 is last.fm's rate limit, 429 one of a proxy
+            bool limited = res.result()
+                           == boost::beast::http::status::too_many_requests;
+            if (!limited) {
+                const auto val = parse_response(res.body());
+                if (!val.message.empty()) {
+                    switch (val.error) {
+                    case 29:  // NOLINT rate limit exceeded
+                        limited = true;
+                        break;
+                    default:
+                        m_fail_flag = true;
+                    // fall through
+                    case 11:  // NOLINT service offline
+                    case 16:  // NOLINT temp unavailable
+                        throw std::runtime_error("api returned an error: "
+                                                 + val.message);
+                        break;
+                    }
                 }
             }
+            if (limited) {
+                m_cache.requeue(*to_send);
+                requeued.add(to_send->size());
+                back_off(retry_after(res));
+                return;
+            }
 
+            m_backoff = {};
+            m_cache.settle(to_send->size());
+            accepted.add(to_send->size());
+            MPDFM_PROBE(as20_ack, to_send->size(),
+                        internal::probe_us(sent.elapsed()));
             try {
                 // continue sending scrobbles until another error occurs,
                 // or there are no scrobbles left to send
@@ -355,9 +389,39 @@ void mpdfm::as20::send_scrobbles_coalesced() {
         } catch (const std::exception &e) {
             // for the case of a JSON parse error it's fair to assume the
             // same as cases 11 and 16: the API is malfunctioning
-            std::unique_lock l(m_cache_mutex);
-            m_cache.insert(to_send->begin(), to_send->end());
-            spdlog::error("scrobble fail: {}", e.what());
+            m_cache.requeue(*to_send);
+            requeued.add(to_send->size());
+            MPDFM_PROBE(as20_requeue, to_send->size(),
+                        internal::probe_us(sent.elapsed()));
+            MPDFM_LOG_LIMITED(spdlog::level::err, "scrobble fail: {}",
+                              e.what());
+        }
+    });
+}
+
+void mpdfm::as20::do_stop() {
+    m_retry.cancel();
+}
+
+void mpdfm::as20::back_off(std::optional<std::chrono::seconds> hint) {
+    m_backoff = hint ? *hint
+                     : std::clamp(m_backoff * 2, min_retry_delay,
+                                  max_retry_delay);
+    spdlog::warn("as20 rate limit hit, retrying in {}s", m_backoff.count());
+
+    m_retry_pending = true;
+    m_retry.expires_after(m_backoff);
+    m_retry.async_wait([this](auto ec) {
+        // on abort, this may already be gone
+        if (ec) {
+            return;
+        }
+        m_retry_pending = false;
+        try {
+            send_scrobbles_coalesced();
+        } catch (const std::exception &e) {
+            MPDFM_LOG_LIMITED(spdlog::level::err, "as20 retry failed: {}",
+                              e.what());
         }
     });
 }
@@ -418,7 +482,7 @@ namespace {
         target += "method=auth.getToken&format=json&api_key=" + encoded_key;
 
         auto http = http_request<empty_body, string_body>::make(
-            uri, io_context(), ssl_context());
+            uri, io_context());
 
         http->request().target(target);
         http->run([&result_promise](auto http, auto ec) {
@@ -458,13 +522,13 @@ namespace {
         std::promise<session_response> result_promise;
         auto future = result_promise.get_future();
 
-        audioscrobbler_request req(api_secret);
+        mpdfm::internal::audioscrobbler_request req(api_secret);
         req["method"]  = "auth.getSession";
         req["api_key"] = api_key;
         req["token"]   = token;
 
         auto http = http_request<string_body, string_body>::make(
-            uri, io_context(), ssl_context());
+            uri, io_context());
 
         http->request().method(verb::post);
         http->request().body() = req.form();
@@ -0,0 +1,256 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <protocols/event_socket.hpp>
+
+#include <algorithm>
+#include <array>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/filesystem.hpp>
+#include <deque>
+#include <directory_helper.hpp>
+#include <http_client.hpp>
+#include <spdlog/spdlog.h>
+#include <string_view>
+#include <vector>
+
+namespace {
+    namespace asio = boost::asio;
+    using stream = boost::asio::local::stream_protocol;
+    using record = std::shared_ptr<const std::string>;
+
+    // upper bound of buffers handed to a single gathering write
+    constexpr size_t max_gather = 64;
+
+    record make_record(std::string_view event,
+                       const mpdfm::scrobble_entry &s) {
+        std::string r = R"({"event":")";
+        r += event;
+        r += R"(","entry":)";
+        r += mpdfm::to_json(s);
+        r += "}\n";
+        return std::make_shared<const std::string>(std::move(r));
+    }
+}  // namespace
+
+/*!
+ * \brief The listening socket and its subscribers
+ *
+ * Everything runs on one strand of mpdfm::io_context().
+ */
+struct mpdfm::event_socket::server : std::enable_shared_from_this<server> {
+    struct client {
+        explicit client(asio::strand<asio::io_context::executor_type> &s)
+            : socket(s) {}
+
+        stream::socket socket;
+        // records not yet written, shared with all other clients
+        std::deque<record> queue;
+        bool writing = false;
+        std::array<char, 64> discard {};  // NOLINT magic number
+    };
+    using client_ptr = std::shared_ptr<client>;
+
+    server(std::string path, size_t max_queued)
+        : m_path(std::move(path)),
+          m_max_queued(max_queued),
+          m_strand(asio::make_strand(io_context())),
+          m_acceptor(m_strand) {
+        remove_stale_socket(m_path);
+        stream::endpoint ep(m_path);
+        m_acceptor.open(ep.protocol());
+        {
+            // plays are private, from the moment the socket exists
+            owner_only_umask private_files;
+            m_acceptor.bind(ep);
+        }
+        m_acceptor.listen();
+    }
+
+    void start() {
+        asio::post(m_strand, [self = shared_from_this()]() {
+            self->accept();
+        });
+    }
+
+    void publish(record r, bool now_playing) {
+        asio::post(m_strand, [self = shared_from_this(), r = std::move(r),
+                              now_playing]() mutable {
+            self->broadcast(std::move(r), now_playing);
+        });
+    }
+
+    void stop() {
+        boost::system::error_code ignored;
+        boost::filesystem::remove(m_path, ignored);
+        asio::post(m_strand, [self = shared_from_this()]() {
+            boost::system::error_code ignored;
+            self->m_acceptor.close(ignored);
+            for (auto &c : self->m_clients) {
+                c->socket.close(ignored);
+            }
+            self->m_clients.clear();
+        });
+    }
+
+private:
+    void accept() {
+        auto c = std::make_shared<client>(m_strand);
+        m_acceptor.async_accept(
+            c->socket, [self = shared_from_this(), c](auto ec) {
+                if (ec == asio::error::operation_aborted) {
+                    return;
+                }
+                if (ec) {
+                    spdlog::error("event socket: accept failed: {}",
+                                  ec.message());
+                } else {
+                    self->m_clients.push_back(c);
+                    if (self->m_now_playing) {
+                        c->queue.push_back(self->m_now_playing);
+                        self->flush(c);
+                    }
+                    self->watch(c);
+                }
+                self->accept();
+            });
+    }
+
+    //! \brief Reads (and ignores) input, to notice clients going away
+    void watch(const client_ptr &c) {
+        c->socket.async_read_some(
+            asio::buffer(c->discard),
+            [self = shared_from_this(), c](auto ec, size_t) {
+                if (ec) {
+                    self->remove(c);
+                    return;
+                }
+                self->watch(c);
+            });
+    }
+
+    void broadcast(record r, bool now_playing) {
+        if (now_playing) {
+            m_now_playing = r;
+        }
+
+        std::vector<client_ptr> slow;
+        for (auto &c : m_clients) {
+            if (c->queue.size() >= m_max_queued) {
+                slow.push_back(c);
+                continue;
+            }
+            c->queue.push_back(r);
+            flush(c);
+        }
+        for (auto &c : slow) {
+            spdlog::warn("event socket: dropping a subscriber that fell {} "
+                         "records behind",
+                         c->queue.size());
+            remove(c);
+        }
+    }
+
+    //! \brief Writes as much of the client's queue as possible at once
+    void flush(const client_ptr &c) {
+        if (c->writing || c->queue.empty()) {
+            return;
+        }
+        auto n = std::min(c->queue.size(), max_gather);
+        std::vector<asio::const_buffer> buffers;
+        buffers.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            buffers.emplace_back(asio::buffer(*c->queue[i]));
+        }
+
+        c->writing = true;
+        // the records stay alive in the queue until the write completes
+        asio::async_write(
+            c->socket, buffers,
+            [self = shared_from_this(), c, n](auto ec, size_t) {
+                c->writing = false;
+                if (ec || !c->socket.is_open()) {
+                    self->remove(c);
+                    return;
+                }
+                auto end = c->queue.begin() + static_cast<ptrdiff_t>(n);
+                c->queue.erase(c->queue.begin(), end);
+                self->flush(c);
+            });
+    }
+
+    //! \brief Disconnects \p c, pending writes still own its queue
+    void remove(const client_ptr &c) {
+        boost::system::error_code ignored;
+        c->socket.close(ignored);
+        m_clients.erase(std::remove(m_clients.begin(), m_clients.end(), c),
+                        m_clients.end());
+    }
+
+    std::string m_path;
+    size_t m_max_queued;
+    asio::strand<asio::io_context::executor_type> m_strand;
+    stream::acceptor m_acceptor;
+    std::vector<client_ptr> m_clients;
+    record m_now_playing;
+};
+
+mpdfm::event_socket::event_socket(const std::string &path, size_t max_queued)
+    : m_server(std::make_shared<server>(path, max_queued)) {
+    m_server->start();
+}
+
+mpdfm::event_socket::~event_socket() {
+    m_server->stop();
+}
+
+void mpdfm::event_socket::do_stop() {
+    m_server->stop();
+}
+
+bool mpdfm::event_socket::do_check_preconditions(const scrobble_entry &s) {
+    return meets_scrobble_rules(s);
+}
+
+void mpdfm::event_socket::do_send_now_playing(const scrobble_entry &s) {
+    m_server->publish(make_record("now_playing", s), true);
+}
+
+void mpdfm::event_socket::do_send_scrobble(const scrobble_entry &s) {
+    m_server->publish(make_record("scrobble", s), false);
+}
+
+// factory
+
+mpdfm::scrobbler *mpdfm::event_socket::factory::do_fabrication(
+    const config_section &section) {
+    // required
+    const auto &path = section.value("path");
+    auto max_queued  = std::stoul(section.value("max_queued", "64"));
+    if (max_queued == 0) {
+        throw std::runtime_error("event_socket: max_queued must be positive");
+    }
+    return new event_socket(path, max_queued);
+}
+
+void mpdfm::event_socket::factory::do_authenticate(int /*argc*/,
+                                                   const char ** /*argv*/) {
+    spdlog::info("the event socket needs no authentication, access is "
+                 "limited to the user running mpdfm");
+}
@@ -0,0 +1,436 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <protocols/listenbrainz.hpp>
+
+#include <boost/beast/http/empty_body.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/system/system_error.hpp>
+#include <future>
+#include <gsl/span>
+#include <http_client.hpp>
+#include <logging.hpp>
+#include <spdlog/fmt/ostr.h>
+#include <spdlog/spdlog.h>
+#include <string_view>
+#include <tao/json.hpp>
+#include <tao/json/binding.hpp>
+#include <tao/json/contrib/traits.hpp>
+
+namespace mpdfm {
+    //! \brief Response to any of the ListenBrainz endpoints used here
+    struct listenbrainz_response {
+        int code = 0;
+        std::string error;
+        std::string message;
+        bool valid = false;
+        std::string user_name;
+    };
+}  // namespace mpdfm
+
+namespace tao::json {
+    template<>
+    struct traits<mpdfm::listenbrainz_response>
+        : public binding::basic_object<
+              binding::for_unknown_key::skip,
+              binding::for_nothing_value::suppress,
+              TAO_JSON_BIND_OPTIONAL("code",
+                                     &mpdfm::listenbrainz_response::code),
+              TAO_JSON_BIND_OPTIONAL("error",
+                                     &mpdfm::listenbrainz_response::error),
+              TAO_JSON_BIND_OPTIONAL("message",
+                                     &mpdfm::listenbrainz_response::message),
+              TAO_JSON_BIND_OPTIONAL("valid",
+                                     &mpdfm::listenbrainz_response::valid),
+              TAO_JSON_BIND_OPTIONAL(
+                  "user_name", &mpdfm::listenbrainz_response::user_name)> {};
+}  // namespace tao::json
+
+namespace {
+    // ListenBrainz' MAX_LISTENS_PER_REQUEST
+    constexpr size_t batch_size = 1000;
+    constexpr std::chrono::seconds default_retry_delay(10);
+
+    const std::string_view default_api_root = "https://api.listenbrainz.org/";
+
+    std::string endpoint(std::string root, std::string_view path) {
+        if (root.empty() || root.back() != '/') {
+            root += '/';
+        }
+        root += path;
+        return root;
+    }
+
+    tao::json::value track_metadata(const mpdfm::scrobble_entry &s) {
+        tao::json::value info = tao::json::empty_object;
+        auto &i               = info.get_object();
+        i.emplace("media_player", "MPD");
+        i.emplace("submission_client", "mpdfm");
+        if (!s.track_number.empty()) {
+            i.emplace("tracknumber", s.track_number);
+        }
+        if (!s.mbid.empty()) {
+            i.emplace("recording_mbid", s.mbid);
+        }
+        if (s.duration > 0) {
+            i.emplace("duration", s.duration);
+        }
+
+        tao::json::value meta = { { "artist_name", s.artist },
+                                  { "track_name", s.track },
+                                  { "additional_info", std::move(info) } };
+        if (!s.album.empty()) {
+            meta.get_object().emplace("release_name", s.album);
+        }
+        return meta;
+    }
+
+    /*!
+     * \brief Forms a submit-listens payload
+     * \param type One of single, import and playing_now
+     */
+    std::string submission(std::string_view type,
+                           gsl::span<const mpdfm::scrobble_entry> entries) {
+        const bool timestamps = type != "playing_now";
+
+        tao::json::value payload = tao::json::empty_array;
+        auto &listens            = payload.get_array();
+        listens.reserve(entries.size());
+        for (auto &s : entries) {
+            auto &l = listens.emplace_back(tao::json::empty_object);
+            if (timestamps) {
+                l.get_object().emplace("listened_at", s.timestamp);
+            }
+            l.get_object().emplace("track_metadata", track_metadata(s));
+        }
+
+        tao::json::value body = { { "listen_type", std::string(type) },
+                                  { "payload", std::move(payload) } };
+        return tao::json::to_string(body);
+    }
+
+    //! \brief Parses the error message out of a failed response
+    std::string error_message(const std::string &body) {
+        try {
+            auto r = tao::json::from_string(body)
+                         .as<mpdfm::listenbrainz_response>();
+            return r.error.empty() ? r.message : r.error;
+        } catch (const std::exception &) {
+            return body;
+        }
+    }
+
+    template<typename Response>
+    std::chrono::seconds retry_delay(const Response &res) {
+        auto it = res.find("X-RateLimit-Reset-In");
+        if (it == res.end()) {
+            return default_retry_delay;
+        }
+        try {
+            return std::chrono::seconds(
+                std::stoul(std::string(it->value())) + 1);
+        } catch (const std::exception &) {
+            return default_retry_delay;
+        }
+    }
+
+    template<typename Callback>
+    void post_json(const mpdfm::uri &target,
+                   const std::string &token,
+                   std::string body,
+                   Callback cb) {
+        using boost::beast::http::field;
+        using boost::beast::http::string_body;
+        using boost::beast::http::verb;
+        using mpdfm::http_request;
+
+        auto http = http_request<string_body, string_body>::make(
+            target, mpdfm::io_context());
+
+        auto &req = http->request();
+        req.method(verb::post);
+        req.set(field::authorization, "Token " + token);
+        req.set(field::content_type, "application/json");
+        req.body() = std::move(body);
+        http->run(std::move(cb));
+    }
+}  // namespace
+
+mpdfm::listenbrainz::listenbrainz(std::string token,
+                                  const std::string &api_root,
+                                  std::string store)
+    : m_token(std::move(token)),
+      m_target(endpoint(api_root, "1/submit-listens")),
+      m_cache(std::move(store)),
+      m_retry(io_context()) {
+    spdlog::debug("uri target: {}", m_target.source());
+}
+
+mpdfm::listenbrainz::~listenbrainz() = default;
+
+bool mpdfm::listenbrainz::do_check_preconditions(const scrobble_entry &s) {
+    // listens without an artist or a title get the whole submission
+    // rejected
+    return !s.artist.empty() && !s.track.empty() && meets_scrobble_rules(s);
+}
+
+void mpdfm::listenbrainz::do_send_now_playing(const scrobble_entry &s) {
+    if (m_fail_flag) {
+        throw std::runtime_error("one (or more) previous submissions failed");
+    }
+    if (s.artist.empty() || s.track.empty()) {
+        return;  // would be rejected, e.g. an untagged stream
+    }
+
+    auto body = submission("playing_now",
+                           gsl::span<const scrobble_entry>(&s, 1));
+    post_json(m_target, m_token, std::move(body), [](auto http, auto ec) {
+        if (ec) {
+            MPDFM_LOG_LIMITED(spdlog::level::err,
+                              "request error when sending now playing: {}",
+                              ec);
+            return;
+        }
+        auto code = http->response().result_int();
+        // NOLINTNEXTLINE non-success codes
+        if (code < 200 || code > 299) {
+            MPDFM_LOG_LIMITED(spdlog::level::err,
+                              "now playing send failed, status: {}", code);
+        }
+    });
+}
+
+void mpdfm::listenbrainz::do_send_scrobble(const scrobble_entry &s) {
+    m_cache.insert(s);
+    if (!m_retry_pending) {
+        send_listens_coalesced();
+    }
+}
+
+void mpdfm::listenbrainz::do_send_scrobbles(
+    const std::vector<scrobble_entry> &s) {
+    m_cache.insert(s);
+    if (!m_retry_pending) {
+        send_listens_coalesced();
+    }
+}
+
+void mpdfm::listenbrainz::do_enqueue(const std::vector<scrobble_entry> &s) {
+    m_cache.insert(s);
+}
+
+void mpdfm::listenbrainz::do_flush() {
+    // one request at a time, each one continues with the next batch
+    if (m_cache.in_flight() == 0 && !m_retry_pending) {
+        send_listens_coalesced();
+    }
+}
+
+size_t mpdfm::listenbrainz::do_backlog() const {
+    return m_cache.size() + m_cache.in_flight();
+}
+
+void mpdfm::listenbrainz::send_listens_coalesced() {
+    if (m_fail_flag) {
+        throw std::runtime_error("one (or more) previous submissions failed");
+    }
+
+    // after a rejected batch, its listens go one by one to find the culprit
+    auto to_send = std::make_shared<std::vector<scrobble_entry>>(
+        m_cache.extract(m_isolate > 0 ? 1 : batch_size));
+    if (to_send->empty()) {
+        return;
+    }
+
+    auto type = to_send->size() == 1 ? "single" : "import";
+    auto body = submission(type, *to_send);
+    post_json(m_target, m_token, std::move(body), [this, to_send](auto http,
+                                                                  auto ec) {
+        try {
+            if (ec) {
+                throw boost::system::system_error(ec, "http failure");
+            }
+            auto &r   = http->response();
+            auto code = r.result_int();
+            switch (code) {
+            case 429: {  // NOLINT too many requests
+                auto delay = retry_delay(r);
+                m_cache.requeue(*to_send);
+                spdlog::warn("listenbrainz rate limit hit, retrying in {}s",
+                             delay.count());
+                retry_in(delay);
+                return;
+            }
+            case 400:  // NOLINT malformed submission
+                rejected(*to_send, error_message(r.body()));
+                return;
+            case 401:  // NOLINT invalid token
+                m_fail_flag = true;
+                throw std::runtime_error("submission rejected: "
+                                         + error_message(r.body()));
+            default:
+                // NOLINTNEXTLINE non-success codes
+                if (code < 200 || code > 299) {
+                    throw std::runtime_error("server returned status "
+                                             + std::to_string(code));
+                }
+                break;
+            }
+
+            auto sent = to_send->size();
+            m_cache.settle(sent);
+            m_isolate = m_isolate > sent ? m_isolate - sent : 0;
+            try {
+                // continue sending until another error occurs, or there is
+                // nothing left to send
+                send_listens_coalesced();
+            } catch (...) {
+                // ignore exceptions. they will be rethrown just the same
+                // next time
+            }
+        } catch (const std::exception &e) {
+            m_cache.requeue(*to_send);
+            MPDFM_LOG_LIMITED(spdlog::level::err,
+                              "listenbrainz submission fail: {}", e.what());
+        }
+    });
+}
+
+void mpdfm::listenbrainz::rejected(const std::vector<scrobble_entry> &sent,
+                                   const std::string &message) {
+    if (sent.size() > 1) {
+        spdlog::warn("listenbrainz rejected a submission of {} listens ({}), "
+                     "sending them one by one",
+                     sent.size(), message);
+        m_cache.requeue(sent);
+        m_isolate = sent.size();
+    } else {
+        auto &s = sent.front();
+        spdlog::error("listenbrainz rejected \"{} - {}\" ({}), dropping it",
+                      s.artist, s.track, message);
+        m_cache.settle(1);
+        m_isolate = m_isolate > 1 ? m_isolate - 1 : 0;
+    }
+    try {
+        send_listens_coalesced();
+    } catch (...) {
+        // rethrown just the same on the next send
+    }
+}
+
+void mpdfm::listenbrainz::do_stop() {
+    m_retry.cancel();
+}
+
+void mpdfm::listenbrainz::retry_in(std::chrono::seconds delay) {
+    m_retry_pending = true;
+    m_retry.expires_after(delay);
+    m_retry.async_wait([this](auto ec) {
+        // on abort, this may already be gone
+        if (ec) {
+            return;
+        }
+        m_retry_pending = false;
+        try {
+            send_listens_coalesced();
+        } catch (const std::exception &e) {
+            MPDFM_LOG_LIMITED(spdlog::level::err,
+                              "listenbrainz retry failed: {}", e.what());
+        }
+    });
+}
+
+// factory
+
+mpdfm::scrobbler *mpdfm::listenbrainz::factory::do_fabrication(
+    const mpdfm::config_section &section) {
+    // required
+    std::string token = section.value("token");
+    auto path         = section.value("store", {});
+    auto root         = section.value("url", std::string(default_api_root));
+
+    return new listenbrainz(token, root, path);
+}
+
+namespace {
+    mpdfm::listenbrainz_response validate_token(const mpdfm::uri &uri,
+                                                const std::string &token) {
+        using boost::beast::http::empty_body;
+        using boost::beast::http::field;
+        using boost::beast::http::string_body;
+        using mpdfm::http_request;
+        using mpdfm::listenbrainz_response;
+
+        std::promise<listenbrainz_response> result_promise;
+        auto future = result_promise.get_future();
+
+        auto http = http_request<empty_body, string_body>::make(
+            uri, mpdfm::io_context());
+        http->request().set(field::authorization, "Token " + token);
+        http->run([&result_promise](auto http, auto ec) {
+            using tao::json::from_string;
+            try {
+                if (ec) {
+                    throw boost::system::system_error(
+                        ec, "token validation request failed");
+                }
+                auto v = from_string(http->response().body())
+                             .template as<listenbrainz_response>();
+                result_promise.set_value(std::move(v));
+            } catch (...) {
+                result_promise.set_exception(std::current_exception());
+            }
+        });
+
+        return future.get();
+    }
+}  // namespace
+
+void mpdfm::listenbrainz::factory::do_authenticate(int argc,
+                                                   const char **argv) {
+    gsl::span<const char *> args(argv, argc);
+    std::string root(default_api_root);
+
+    switch (argc) {
+    case 3:
+        root = args[2];
+        // fall through
+    case 2:
+        break;
+    default:
+        spdlog::error(
+            "invalid auth usage (wrong argument count)"
+            "{} <token> [api_root]\n"
+            "your token can be found at https://listenbrainz.org/profile/",
+            args[0]);
+        return;
+    }
+
+    try {
+        mpdfm::uri target(endpoint(root, "1/validate-token"));
+        auto r = validate_token(target, args[1]);
+        if (!r.valid) {
+            spdlog::error("token is not valid: {}", r.message);
+            return;
+        }
+        spdlog::info(
+            "token is valid for user {}, put it in the token key of a "
+            "listenbrainz section",
+            r.user_name);
+    } catch (const std::exception &e) {
+        spdlog::error("failed to validate token: {}", e.what());
+    }
+}
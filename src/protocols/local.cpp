@@ -0,0 +1,209 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <protocols/local.hpp>
+
+#include <boost/asio/post.hpp>
+#include <boost/filesystem.hpp>
+#include <cerrno>
+#include <fcntl.h>
+#include <http_client.hpp>
+#include <spdlog/spdlog.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace {
+    constexpr std::chrono::seconds retry_interval(5);
+
+    //! \brief Writes \p data, counting what made it to \p fd in \p written
+    void write_all(int fd, const std::string &data, size_t &written) {
+        const char *p    = data.data();
+        size_t remaining = data.size();
+        while (remaining > 0) {
+            auto n = ::write(fd, p, remaining);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(),
+                                        "write");
+            }
+            p += n;  // NOLINT pointer arithmetic
+            remaining -= static_cast<size_t>(n);
+            written += static_cast<size_t>(n);
+        }
+    }
+}  // namespace
+
+mpdfm::local::journal::journal(const std::string &path,
+                               boost::asio::io_context &io)
+    : path(path), strand(boost::asio::make_strand(io)), retry(strand) {
+    auto dir = boost::filesystem::path(path).parent_path();
+    if (!dir.empty()) {
+        boost::filesystem::create_directories(dir);
+    }
+    // NOLINTNEXTLINE vararg
+    fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                0644);  // NOLINT permission bits
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "cannot open history file " + path);
+    }
+}
+
+mpdfm::local::journal::~journal() {
+    writer.join();
+    flush();
+    ::close(fd);
+}
+
+void mpdfm::local::journal::flush() {
+    std::unique_lock write_lock(write_mutex);
+
+    std::string batch;
+    {
+        std::unique_lock lock(mutex);
+        batch.swap(pending);
+        scheduled = false;
+    }
+    if (batch.empty() && !unsynced) {
+        return;
+    }
+
+    size_t written = 0;
+    try {
+        write_all(fd, batch, written);
+        unsynced = true;
+        if (::fdatasync(fd) < 0) {
+            throw std::system_error(errno, std::generic_category(),
+                                    "fdatasync");
+        }
+        unsynced = false;
+    } catch (const std::exception &e) {
+        // only the rows that didn't make it are queued again, rows that
+        // were written only need the sync retried. a partial write may
+        // leave a torn line behind, which line based readers skip
+        spdlog::error("cannot append to {}: {}", path, e.what());
+        unsynced = unsynced || written > 0;
+        {
+            std::unique_lock lock(mutex);
+            pending.insert(0, batch, written);
+        }
+        // the retry is timed on the io context, which the writer thread
+        // only hands the failure to
+        boost::asio::post(strand, [weak = weak_from_this()]() {
+            if (auto self = weak.lock()) {
+                self->retry_later();
+            }
+        });
+    }
+}
+
+void mpdfm::local::journal::schedule_flush() {
+    // not kept alive by the writer, it is joined before the last reference
+    // is dropped, which mustn't happen on the writer itself
+    boost::asio::post(writer, [weak = weak_from_this()]() {
+        if (auto self = weak.lock()) {
+            self->flush();
+        }
+    });
+}
+
+void mpdfm::local::journal::retry_later() {
+    if (stopped) {
+        return;
+    }
+    retry.expires_after(retry_interval);
+    retry.async_wait([weak = weak_from_this()](auto ec) {
+        auto self = weak.lock();
+        if (!ec && self) {
+            self->schedule_flush();
+        }
+    });
+}
+
+mpdfm::local::local(const std::string &path, bool all_plays)
+    : m_journal(std::make_shared<journal>(path, io_context())),
+      m_all_plays(all_plays) {}
+
+mpdfm::local::~local() {
+    m_journal->writer.join();
+    m_journal->flush();
+}
+
+bool mpdfm::local::do_check_preconditions(const scrobble_entry &s) {
+    if (m_all_plays) {
+        return s.elapsed > 0;
+    }
+    return meets_scrobble_rules(s);
+}
+
+void mpdfm::local::do_stop() {
+    boost::asio::post(m_journal->strand, [j = m_journal]() {
+        j->stopped = true;
+        j->retry.cancel();
+    });
+}
+
+void mpdfm::local::do_send_now_playing(const scrobble_entry & /*s*/) {
+    // only finished plays are history
+}
+
+void mpdfm::local::do_send_scrobble(const scrobble_entry &s) {
+    auto line = to_json(s);
+    line += '\n';
+    append(line);
+}
+
+void mpdfm::local::do_send_scrobbles(const std::vector<scrobble_entry> &s) {
+    std::string lines;
+    for (auto &e : s) {
+        lines += to_json(e);
+        lines += '\n';
+    }
+    append(lines);
+}
+
+void mpdfm::local::append(const std::string &lines) {
+    std::unique_lock lock(m_journal->mutex);
+    m_journal->pending += lines;
+    if (m_journal->scheduled) {
+        // joins the flush that's already queued
+        return;
+    }
+    m_journal->scheduled = true;
+    lock.unlock();
+
+    m_journal->schedule_flush();
+}
+
+// factory
+
+mpdfm::scrobbler *
+    mpdfm::local::factory::do_fabrication(const config_section &section) {
+    // required
+    const auto &path = section.value("path");
+    auto record      = section.value("record", "scrobbles");
+    if (record != "scrobbles" && record != "plays") {
+        throw std::runtime_error("local: record must be scrobbles or plays");
+    }
+    return new local(path, record == "plays");
+}
+
+void mpdfm::local::factory::do_authenticate(int /*argc*/,
+                                            const char ** /*argv*/) {
+    spdlog::info("the local history needs no authentication");
+}
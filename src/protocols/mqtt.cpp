@@ -0,0 +1,558 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <protocols/mqtt.hpp>
+
+#include <algorithm>
+#include <array>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/strand.hpp>
+#include <boost/asio/write.hpp>
+#include <deque>
+#include <http_client.hpp>
+#include <logging.hpp>
+#include <map>
+#include <profile.hpp>
+#include <spdlog/spdlog.h>
+#include <string_view>
+
+namespace {
+    namespace asio = boost::asio;
+    using boost::asio::ip::tcp;
+
+    constexpr std::chrono::seconds max_backoff(60);
+    constexpr size_t max_string = 0xffff;
+
+    // fixed header bits of the MQTT 3.1.1 control packets used here
+    namespace packet {
+        constexpr uint8_t connect    = 0x10;
+        constexpr uint8_t connack    = 0x20;
+        constexpr uint8_t publish    = 0x30;
+        constexpr uint8_t puback     = 0x40;
+        constexpr uint8_t pingreq    = 0xc0;
+        constexpr uint8_t pingresp   = 0xd0;
+        constexpr uint8_t disconnect = 0xe0;
+
+        constexpr uint8_t dup    = 0x08;
+        constexpr uint8_t qos1   = 0x02;
+        constexpr uint8_t retain = 0x01;
+    }  // namespace packet
+
+    void put_u16(std::string &out, uint16_t v) {
+        out += static_cast<char>(v >> 8);     // NOLINT byte split
+        out += static_cast<char>(v & 0xff);   // NOLINT byte split
+    }
+
+    void put_string(std::string &out, std::string_view s) {
+        put_u16(out, gsl::narrow_cast<uint16_t>(s.size()));
+        out += s;
+    }
+
+    //! \brief Prepends the fixed header to \p body
+    std::string frame(uint8_t header, std::string_view body) {
+        std::string out;
+        out.reserve(body.size() + 5);  // NOLINT header and 4 length bytes
+        out += static_cast<char>(header);
+        auto len = body.size();
+        do {
+            auto b = static_cast<uint8_t>(len % 128);  // NOLINT varint
+            len /= 128;                                // NOLINT varint
+            if (len > 0) {
+                b |= 0x80;  // NOLINT continuation bit
+            }
+            out += static_cast<char>(b);
+        } while (len > 0);
+        out += body;
+        return out;
+    }
+
+    const char *connack_error(uint8_t rc) {
+        switch (rc) {
+        case 1:
+            return "unacceptable protocol version";
+        case 2:
+            return "client id rejected";
+        case 3:
+            return "server unavailable";
+        case 4:
+            return "bad user name or password";
+        case 5:  // NOLINT return code
+            return "not authorized";
+        default:
+            return "unknown error";
+        }
+    }
+}  // namespace
+
+/*!
+ * \brief The connection to the broker
+ *
+ * All state is owned by a strand on mpdfm::io_context(), the socket and
+ * timers are bound to it, so every completion handler runs serialized.
+ * Handlers carry the connection generation they were started for and are
+ * ignored once the connection they belong to was torn down.
+ */
+struct mpdfm::mqtt::session : std::enable_shared_from_this<session> {
+    struct message {
+        std::string topic;
+        std::string payload;
+        bool retain;
+    };
+
+    explicit session(options opts)
+        : m_opts(std::move(opts)),
+          m_strand(asio::make_strand(io_context())),
+          m_resolver(m_strand),
+          m_socket(m_strand),
+          m_retry(m_strand),
+          m_ping(m_strand) {}
+
+    void start() {
+        asio::post(m_strand, [self = shared_from_this()]() {
+            self->connect();
+        });
+    }
+
+    void publish(message m) {
+        asio::post(m_strand,
+                   [self = shared_from_this(), m = std::move(m)]() mutable {
+                       self->enqueue(std::move(m));
+                   });
+    }
+
+    void stop() {
+        asio::post(m_strand, [self = shared_from_this()]() {
+            self->shutdown();
+        });
+    }
+
+private:
+    void connect() {
+        auto gen = ++m_generation;
+        m_in.clear();
+        m_out.clear();
+        m_resolver.async_resolve(
+            m_opts.host, m_opts.port,
+            [self = shared_from_this(), gen](auto ec, auto results) {
+                if (gen != self->m_generation) {
+                    return;
+                }
+                if (ec) {
+                    self->fail("resolve: " + ec.message());
+                    return;
+                }
+                asio::async_connect(
+                    self->m_socket, results, [self, gen](auto ec, auto) {
+                        if (gen != self->m_generation) {
+                            return;
+                        }
+                        if (ec) {
+                            self->fail("connect: " + ec.message());
+                            return;
+                        }
+                        self->send_connect();
+                        self->read();
+                    });
+            });
+    }
+
+    void send_connect() {
+        uint8_t flags = 0x02;  // NOLINT clean session
+        if (!m_opts.username.empty()) {
+            flags |= 0x80;  // NOLINT user name flag
+        }
+        if (!m_opts.password.empty()) {
+            flags |= 0x40;  // NOLINT password flag
+        }
+
+        std::string body;
+        put_string(body, "MQTT");
+        body += static_cast<char>(4);  // NOLINT protocol level 3.1.1
+        body += static_cast<char>(flags);
+        put_u16(body, gsl::narrow_cast<uint16_t>(m_opts.keepalive.count()));
+        put_string(body, m_opts.client_id);
+        if (!m_opts.username.empty()) {
+            put_string(body, m_opts.username);
+        }
+        if (!m_opts.password.empty()) {
+            put_string(body, m_opts.password);
+        }
+        write(frame(packet::connect, body));
+    }
+
+    void read() {
+        m_socket.async_read_some(
+            asio::buffer(m_read_buf),
+            [self = shared_from_this(), gen = m_generation](auto ec,
+                                                            size_t n) {
+                if (gen != self->m_generation) {
+                    return;
+                }
+                if (ec) {
+                    self->fail("read: " + ec.message());
+                    return;
+                }
+                self->m_in.append(self->m_read_buf.data(), n);
+                if (self->parse(gen)) {
+                    self->read();
+                }
+            });
+    }
+
+    //! \returns false if the connection got torn down while parsing
+    bool parse(uint64_t gen) {
+        for (;;) {
+            // fixed header: type byte and a 1-4 byte remaining length
+            size_t len = 0;
+            size_t pos = 1;
+            size_t mul = 1;
+            bool done  = false;
+            while (pos < m_in.size() && pos <= 4) {  // NOLINT varint size
+                auto b = static_cast<uint8_t>(m_in[pos++]);
+                len += (b & 0x7f) * mul;  // NOLINT varint
+                mul *= 128;               // NOLINT varint
+                if ((b & 0x80) == 0) {    // NOLINT continuation bit
+                    done = true;
+                    break;
+                }
+            }
+            if (!done) {
+                if (m_in.size() > 4) {  // NOLINT varint size
+                    fail("malformed packet length");
+                    return false;
+                }
+                return true;
+            }
+            if (m_in.size() < pos + len) {
+                return true;
+            }
+
+            auto header = static_cast<uint8_t>(m_in[0]);
+            handle(header, std::string_view(m_in).substr(pos, len));
+            if (gen != m_generation) {
+                return false;
+            }
+            m_in.erase(0, pos + len);
+        }
+    }
+
+    void handle(uint8_t header, std::string_view body) {
+        switch (header & 0xf0) {  // NOLINT packet type
+        case packet::connack: {
+            if (body.size() < 2) {
+                fail("malformed CONNACK");
+                return;
+            }
+            auto rc = static_cast<uint8_t>(body[1]);
+            if (rc != 0) {
+                fail(std::string("broker refused connection: ")
+                     + connack_error(rc));
+                return;
+            }
+            spdlog::info("mqtt: connected to {}:{}", m_opts.host,
+                         m_opts.port);
+            m_connected = true;
+            m_backoff   = std::chrono::seconds(1);
+            // whatever wasn't acknowledged on the previous connection
+            for (auto &[id, m] : m_inflight) {
+                send(id, m, true);
+            }
+            pump();
+            schedule_ping();
+            break;
+        }
+        case packet::puback: {
+            if (body.size() < 2) {
+                fail("malformed PUBACK");
+                return;
+            }
+            auto id = static_cast<uint16_t>(
+                (static_cast<uint8_t>(body[0]) << 8)  // NOLINT byte join
+                | static_cast<uint8_t>(body[1]));
+            m_inflight.erase(id);
+            pump();
+            break;
+        }
+        case packet::pingresp:
+            m_awaiting_pong = false;
+            break;
+        default:
+            // nothing is subscribed to, so nothing else is expected
+            break;
+        }
+    }
+
+    void enqueue(message m) {
+        if (m_stopped) {
+            return;
+        }
+        m_queue.push_back(std::move(m));
+        auto limit = m_opts.max_queued;
+        if (profile().max_backlog != 0) {
+            limit = std::min(limit, profile().max_backlog);
+        }
+        if (m_queue.size() > limit) {
+            MPDFM_LOG_LIMITED(spdlog::level::warn,
+                              "mqtt: queue full, dropping the oldest message");
+            m_queue.pop_front();
+        }
+        pump();
+    }
+
+    //! \brief Sends queued messages while the in-flight window allows it
+    void pump() {
+        while (m_connected && !m_stopped
+               && m_inflight.size() < m_opts.in_flight
+               && !m_queue.empty()) {
+            auto id = next_id();
+            send(id, m_queue.front(), false);
+            m_inflight.emplace(id, std::move(m_queue.front()));
+            m_queue.pop_front();
+        }
+    }
+
+    uint16_t next_id() {
+        // zero is not a valid packet identifier
+        do {
+            ++m_next_id;
+        } while (m_next_id == 0 || m_inflight.count(m_next_id) != 0);
+        return m_next_id;
+    }
+
+    void send(uint16_t id, const message &m, bool dup) {
+        uint8_t header = packet::publish | packet::qos1;
+        if (dup) {
+            header |= packet::dup;
+        }
+        if (m.retain) {
+            header |= packet::retain;
+        }
+        std::string body;
+        body.reserve(m.topic.size() + m.payload.size() + 4);  // NOLINT
+        put_string(body, m.topic);
+        put_u16(body, id);
+        body += m.payload;
+        write(frame(header, body));
+    }
+
+    void write(std::string packet) {
+        m_out.push_back(std::move(packet));
+        if (m_out.size() == 1) {
+            do_write();
+        }
+    }
+
+    void do_write() {
+        asio::async_write(
+            m_socket, asio::buffer(m_out.front()),
+            [self = shared_from_this(), gen = m_generation](auto ec, size_t) {
+                if (gen != self->m_generation) {
+                    return;
+                }
+                if (ec) {
+                    self->fail("write: " + ec.message());
+                    return;
+                }
+                self->m_out.pop_front();
+                if (!self->m_out.empty()) {
+                    self->do_write();
+                } else if (self->m_stopped) {
+                    // the DISCONNECT went out
+                    self->close();
+                }
+            });
+    }
+
+    void schedule_ping() {
+        if (m_opts.keepalive.count() == 0) {
+            return;
+        }
+        m_ping.expires_after(m_opts.keepalive);
+        m_ping.async_wait(
+            [self = shared_from_this(), gen = m_generation](auto ec) {
+                if (ec || gen != self->m_generation || self->m_stopped) {
+                    return;
+                }
+                if (self->m_awaiting_pong) {
+                    self->fail("broker stopped responding");
+                    return;
+                }
+                self->m_awaiting_pong = true;
+                self->write(frame(packet::pingreq, {}));
+                self->schedule_ping();
+            });
+    }
+
+    //! \brief Tears the connection down and schedules a reconnect
+    void fail(const std::string &what) {
+        if (m_stopped) {
+            close();
+            return;
+        }
+        spdlog::error("mqtt: {}, reconnecting in {}s", what,
+                      m_backoff.count());
+        close();
+
+        m_retry.expires_after(m_backoff);
+        m_retry.async_wait(
+            [self = shared_from_this(), gen = m_generation](auto ec) {
+                if (ec || gen != self->m_generation) {
+                    return;
+                }
+                self->connect();
+            });
+        m_backoff = std::min(m_backoff * 2, max_backoff);
+    }
+
+    void close() {
+        ++m_generation;
+        m_connected     = false;
+        m_awaiting_pong = false;
+        boost::system::error_code ignored;
+        m_socket.close(ignored);
+        m_ping.cancel();
+        m_out.clear();
+    }
+
+    /*!
+     * \brief Disconnects cleanly, so the broker doesn't publish the will
+     *
+     * The DISCONNECT is queued behind writes in progress and the socket is
+     * closed once it went out, see do_write().
+     */
+    void shutdown() {
+        if (m_stopped) {
+            return;
+        }
+        m_stopped = true;
+        auto lost = m_queue.size() + m_inflight.size();
+        if (lost > 0) {
+            spdlog::warn("mqtt: {} message(s) were not delivered", lost);
+        }
+        m_retry.cancel();
+        m_resolver.cancel();
+        if (!m_connected) {
+            close();
+            return;
+        }
+        m_ping.cancel();
+        write(frame(packet::disconnect, {}));
+    }
+
+    options m_opts;
+    asio::strand<asio::io_context::executor_type> m_strand;
+    tcp::resolver m_resolver;
+    tcp::socket m_socket;
+    asio::steady_timer m_retry;
+    asio::steady_timer m_ping;
+
+    uint64_t m_generation = 0;
+    bool m_connected      = false;
+    bool m_stopped        = false;
+    bool m_awaiting_pong  = false;
+    std::chrono::seconds m_backoff { 1 };
+
+    std::array<char, 512> m_read_buf {};  // NOLINT magic number
+    std::string m_in;
+    std::deque<std::string> m_out;
+
+    std::deque<message> m_queue;
+    std::map<uint16_t, message> m_inflight;
+    uint16_t m_next_id = 0;
+};
+
+mpdfm::mqtt::mqtt(options opts)
+    : m_now_playing_topic(opts.topic + "/now_playing"),
+      m_scrobble_topic(opts.topic + "/scrobble"),
+      m_retain_now_playing(opts.retain_now_playing) {
+    m_session = std::make_shared<session>(std::move(opts));
+    m_session->start();
+}
+
+mpdfm::mqtt::~mqtt() {
+    m_session->stop();
+}
+
+void mpdfm::mqtt::do_stop() {
+    m_session->stop();
+}
+
+bool mpdfm::mqtt::do_check_preconditions(const scrobble_entry &s) {
+    return meets_scrobble_rules(s);
+}
+
+void mpdfm::mqtt::do_send_now_playing(const scrobble_entry &s) {
+    m_session->publish({ m_now_playing_topic, to_json(s),
+                         m_retain_now_playing });
+}
+
+void mpdfm::mqtt::do_send_scrobble(const scrobble_entry &s) {
+    m_session->publish({ m_scrobble_topic, to_json(s), false });
+}
+
+// factory
+
+mpdfm::scrobbler *
+    mpdfm::mqtt::factory::do_fabrication(const config_section &section) {
+    options opts;
+    // required
+    opts.host = section.value("host");
+
+    opts.port      = section.value("port", opts.port);
+    opts.topic     = section.value("topic", opts.topic);
+    opts.client_id = section.value("client_id", opts.client_id);
+    opts.username  = section.value("username", {});
+    opts.password  = section.value("password", {});
+    opts.keepalive = std::chrono::seconds(std::stoul(
+        section.value("keepalive", std::to_string(opts.keepalive.count()))));
+    opts.in_flight = std::stoul(
+        section.value("in_flight", std::to_string(opts.in_flight)));
+    opts.max_queued = std::stoul(
+        section.value("max_queued", std::to_string(opts.max_queued)));
+    auto retain = section.value("retain_now_playing", "true");
+
+    // the topic gets a suffix appended
+    if (opts.topic.size() + 12 > max_string  // NOLINT longest suffix
+        || opts.client_id.size() > max_string
+        || opts.username.size() > max_string
+        || opts.password.size() > max_string) {
+        throw std::runtime_error("mqtt: string values are limited to 64KiB");
+    }
+    if (opts.keepalive.count() > static_cast<long>(max_string)) {
+        throw std::runtime_error("mqtt: keepalive is limited to 65535s");
+    }
+    if (opts.in_flight == 0 || opts.in_flight > max_string) {
+        throw std::runtime_error("mqtt: in_flight must be within 1-65535");
+    }
+    if (opts.max_queued == 0) {
+        throw std::runtime_error("mqtt: max_queued must be at least 1");
+    }
+    if (retain != "true" && retain != "false") {
+        throw std::runtime_error("mqtt: retain_now_playing must be a bool");
+    }
+    opts.retain_now_playing = retain == "true";
+
+    return new mqtt(std::move(opts));
+}
+
+void mpdfm::mqtt::factory::do_authenticate(int /*argc*/,
+                                           const char ** /*argv*/) {
+    spdlog::info("mqtt needs no authentication, set username and password "
+                 "in the mqtt section if the broker requires them");
+}
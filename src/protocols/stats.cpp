@@ -0,0 +1,142 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <protocols/stats.hpp>
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/filesystem.hpp>
+#include <http_client.hpp>
+#include <mutex>
+#include <spdlog/spdlog.h>
+
+/*!
+ * \brief The counters and their snapshots
+ *
+ * The timer's handler holds on to it, so that it doesn't matter which
+ * thread destroys the scrobbler and when.
+ */
+struct mpdfm::stats::state : std::enable_shared_from_this<state> {
+    state(std::string path, std::chrono::seconds interval)
+        : path(std::move(path)), interval(interval), timer(io_context()) {}
+
+    void schedule_snapshot() {
+        timer.expires_after(interval);
+        timer.async_wait([self = shared_from_this()](auto ec) {
+            if (ec || self->stopped) {
+                return;
+            }
+            self->snapshot();
+            self->schedule_snapshot();
+        });
+    }
+
+    //! \brief Cancels the timer on the io_context, from any thread
+    void stop() {
+        boost::asio::post(timer.get_executor(),
+                          [self = shared_from_this()]() {
+                              self->stopped = true;
+                              self->timer.cancel();
+                          });
+    }
+
+    void snapshot() {
+        std::unique_lock lock(mutex);
+        auto plays = counters.plays();
+        if (plays == saved_plays) {
+            return;
+        }
+        try {
+            counters.save(path);
+            saved_plays = plays;
+        } catch (const std::exception &e) {
+            spdlog::error("cannot write stats snapshot to {}: {}", path,
+                          e.what());
+        }
+    }
+
+    std::string path;
+    std::chrono::seconds interval;
+    listening_stats counters;
+
+    boost::asio::steady_timer timer;
+    bool stopped = false;  // only touched on the io_context
+
+    std::mutex mutex;  // serializes snapshots
+    // play count at the last snapshot
+    uint64_t saved_plays = 0;
+};
+
+mpdfm::stats::stats(std::string path, std::chrono::seconds interval)
+    : m_state(std::make_shared<state>(std::move(path), interval)) {
+    auto dir = boost::filesystem::path(m_state->path).parent_path();
+    if (!dir.empty()) {
+        boost::filesystem::create_directories(dir);
+    }
+    if (boost::filesystem::exists(m_state->path)) {
+        try {
+            m_state->counters.load(m_state->path);
+            m_state->saved_plays = m_state->counters.plays();
+        } catch (const std::exception &e) {
+            spdlog::error("couldnt read stats snapshot (starting over): {}",
+                          e.what());
+        }
+    }
+    m_state->schedule_snapshot();
+}
+
+mpdfm::stats::~stats() {
+    m_state->stop();
+    m_state->snapshot();
+}
+
+std::shared_ptr<mpdfm::listening_stats> mpdfm::stats::counters() const {
+    return { m_state, &m_state->counters };
+}
+
+bool mpdfm::stats::do_check_preconditions(const scrobble_entry &s) {
+    return meets_scrobble_rules(s);
+}
+
+void mpdfm::stats::do_stop() {
+    m_state->stop();
+}
+
+void mpdfm::stats::do_send_now_playing(const scrobble_entry & /*s*/) {
+    // only finished plays are counted
+}
+
+void mpdfm::stats::do_send_scrobble(const scrobble_entry &s) {
+    m_state->counters.add(s);
+}
+
+// factory
+
+mpdfm::scrobbler *
+    mpdfm::stats::factory::do_fabrication(const config_section &section) {
+    // required
+    auto path     = section.value("path");
+    auto interval = std::stol(section.value("interval", "300"));
+    if (interval <= 0) {
+        throw std::runtime_error("stats: interval must be positive");
+    }
+    return new stats(path, std::chrono::seconds(interval));
+}
+
+void mpdfm::stats::factory::do_authenticate(int /*argc*/,
+                                            const char ** /*argv*/) {
+    spdlog::info("listening statistics need no authentication");
+}
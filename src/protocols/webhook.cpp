@@ -0,0 +1,225 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <protocols/webhook.hpp>
+
+#include <boost/beast/http/string_body.hpp>
+#include <boost/system/system_error.hpp>
+#include <http_client.hpp>
+#include <logging.hpp>
+#include <spdlog/fmt/ostr.h>
+#include <spdlog/spdlog.h>
+
+namespace {
+    template<typename Callback>
+    void post(const mpdfm::uri &target,
+              const mpdfm::webhook::options &opts,
+              std::string body,
+              Callback cb) {
+        using boost::beast::http::field;
+        using boost::beast::http::string_body;
+        using boost::beast::http::verb;
+        using mpdfm::http_request;
+
+        auto http = http_request<string_body, string_body>::make(
+            target, mpdfm::io_context());
+
+        auto &req = http->request();
+        req.method(verb::post);
+        req.set(field::content_type, opts.content_type);
+        if (!opts.authorization.empty()) {
+            req.set(field::authorization, opts.authorization);
+        }
+        req.body() = std::move(body);
+        http->run(std::move(cb));
+    }
+
+    //! \brief Whether a failed request may succeed when sent again later
+    bool transient(unsigned code) {
+        // NOLINTNEXTLINE request timeout, too many requests, server errors
+        return code == 408 || code == 429 || code >= 500;
+    }
+}  // namespace
+
+mpdfm::webhook::webhook(options opts)
+    : m_opts(std::move(opts)),
+      m_target(m_opts.url),
+      m_cache(m_opts.store) {
+    spdlog::debug("uri target: {}", m_target.source());
+}
+
+mpdfm::webhook::~webhook() = default;
+
+bool mpdfm::webhook::do_check_preconditions(const scrobble_entry &s) {
+    return meets_scrobble_rules(s);
+}
+
+void mpdfm::webhook::do_send_now_playing(const scrobble_entry &s) {
+    if (m_fail_flag) {
+        throw std::runtime_error("one (or more) previous submissions failed");
+    }
+    if (!m_opts.now_playing) {
+        return;
+    }
+
+    std::string body;
+    body.reserve(m_opts.now_playing->size_hint());
+    m_opts.now_playing->render(body, s, "now_playing");
+    post(m_target, m_opts, std::move(body), [](auto http, auto ec) {
+        if (ec) {
+            MPDFM_LOG_LIMITED(spdlog::level::err,
+                              "request error when sending now playing: {}",
+                              ec);
+            return;
+        }
+        auto code = http->response().result_int();
+        // NOLINTNEXTLINE non-success codes
+        if (code < 200 || code > 299) {
+            MPDFM_LOG_LIMITED(spdlog::level::err,
+                              "now playing send failed, status: {}", code);
+        }
+    });
+}
+
+void mpdfm::webhook::do_send_scrobble(const scrobble_entry &s) {
+    m_cache.insert(s);
+    send_coalesced();
+}
+
+void mpdfm::webhook::do_send_scrobbles(
+    const std::vector<scrobble_entry> &s) {
+    m_cache.insert(s);
+    send_coalesced();
+}
+
+void mpdfm::webhook::do_enqueue(const std::vector<scrobble_entry> &s) {
+    m_cache.insert(s);
+}
+
+void mpdfm::webhook::do_flush() {
+    // one request at a time, each one continues with the next batch
+    if (m_cache.in_flight() == 0) {
+        send_coalesced();
+    }
+}
+
+size_t mpdfm::webhook::do_backlog() const {
+    return m_cache.size() + m_cache.in_flight();
+}
+
+void mpdfm::webhook::send_coalesced() {
+    if (m_fail_flag) {
+        throw std::runtime_error("one (or more) previous submissions failed");
+    }
+
+    auto to_send = std::make_shared<std::vector<scrobble_entry>>(
+        m_cache.extract(m_opts.batch_size));
+    if (to_send->empty()) {
+        return;
+    }
+
+    // render the whole batch into one buffer, sized up front
+    std::string body;
+    body.reserve(m_opts.prefix.size() + m_opts.suffix.size()
+                 + to_send->size()
+                       * (m_opts.scrobble.size_hint()
+                          + m_opts.separator.size()));
+    body += m_opts.prefix;
+    for (auto it = to_send->begin(); it != to_send->end(); ++it) {
+        if (it != to_send->begin()) {
+            body += m_opts.separator;
+        }
+        m_opts.scrobble.render(body, *it, "scrobble");
+    }
+    body += m_opts.suffix;
+
+    post(m_target, m_opts, std::move(body), [this, to_send](auto http,
+                                                            auto ec) {
+        try {
+            if (ec) {
+                throw boost::system::system_error(ec, "http failure");
+            }
+            auto code = http->response().result_int();
+            // NOLINTNEXTLINE non-success codes
+            if (code < 200 || code > 299) {
+                if (!transient(code)) {
+                    m_fail_flag = true;
+                }
+                throw std::runtime_error("server returned status "
+                                         + std::to_string(code));
+            }
+
+            m_cache.settle(to_send->size());
+            try {
+                // continue sending until another error occurs, or there is
+                // nothing left to send
+                send_coalesced();
+            } catch (...) {
+                // ignore exceptions. they will be rethrown just the same
+                // next time
+            }
+        } catch (const std::exception &e) {
+            m_cache.requeue(*to_send);
+            MPDFM_LOG_LIMITED(spdlog::level::err,
+                              "webhook submission fail: {}", e.what());
+        }
+    });
+}
+
+// factory
+
+mpdfm::scrobbler *
+    mpdfm::webhook::factory::do_fabrication(const config_section &section) {
+    auto esc_name = section.value("escape", "json");
+    payload_template::escaping esc;
+    if (esc_name == "json") {
+        esc = payload_template::escaping::json;
+    } else if (esc_name == "none") {
+        esc = payload_template::escaping::none;
+    } else {
+        throw std::runtime_error("webhook: unknown escape mode " + esc_name);
+    }
+
+    // required, templates are compiled here so errors show up on load
+    options opts { section.value("url"),
+                   payload_template(section.value("template"), esc) };
+
+    auto now_playing =
+        section.value("now_playing_template", section.value("template"));
+    if (!now_playing.empty()) {
+        opts.now_playing.emplace(now_playing, esc);
+    }
+
+    opts.batch_size = std::stoul(section.value("batch_size", "1"));
+    if (opts.batch_size == 0) {
+        throw std::runtime_error("webhook: batch_size must be positive");
+    }
+    opts.prefix    = section.value("batch_prefix", {});
+    opts.separator = section.value("batch_separator", "\n");
+    opts.suffix    = section.value("batch_suffix", {});
+    opts.content_type =
+        section.value("content_type", std::string(opts.content_type));
+    opts.authorization = section.value("authorization", {});
+    opts.store         = section.value("store", {});
+
+    return new webhook(std::move(opts));
+}
+
+void mpdfm::webhook::factory::do_authenticate(int /*argc*/,
+                                              const char ** /*argv*/) {
+    spdlog::info("webhooks need no authentication, set the authorization "
+                 "key of a webhook section if the endpoint expects a header");
+}
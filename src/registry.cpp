@@ -0,0 +1,52 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <registry.hpp>
+
+#include <map>
+#include <memory>
+#include <protocols/as20.hpp>
+#include <protocols/event_socket.hpp>
+#include <protocols/listenbrainz.hpp>
+#include <protocols/local.hpp>
+#include <protocols/mqtt.hpp>
+#include <protocols/stats.hpp>
+#include <protocols/webhook.hpp>
+
+mpdfm::scrobbler_factory &mpdfm::get_factory(const std::string &name) {
+    using factory_ptr = std::unique_ptr<mpdfm::scrobbler_factory>;
+    // scrobblers are constructed concurrently, so rely on the thread
+    // safety of static initialization
+    static const auto factories = []() {
+        std::map<std::string, factory_ptr> f;
+        // NOLINTNEXTLINE clear ownership passing
+        f.emplace("as20", new mpdfm::as20::factory());
+        // NOLINTNEXTLINE clear ownership passing
+        f.emplace("listenbrainz", new mpdfm::listenbrainz::factory());
+        // NOLINTNEXTLINE clear ownership passing
+        f.emplace("webhook", new mpdfm::webhook::factory());
+        // NOLINTNEXTLINE clear ownership passing
+        f.emplace("local", new mpdfm::local::factory());
+        // NOLINTNEXTLINE clear ownership passing
+        f.emplace("mqtt", new mpdfm::mqtt::factory());
+        // NOLINTNEXTLINE clear ownership passing
+        f.emplace("event_socket", new mpdfm::event_socket::factory());
+        // NOLINTNEXTLINE clear ownership passing
+        f.emplace("stats", new mpdfm::stats::factory());
+        return f;
+    }();
+    return (*factories.at(name));
+}
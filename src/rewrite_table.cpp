@@ -0,0 +1,339 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <rewrite_table.hpp>
+
+#include <algorithm>
+#include <array>
+#include <boost/asio/post.hpp>
+#include <boost/filesystem.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <gsl/gsl>
+#include <map>
+#include <spdlog/spdlog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+    using field = mpdfm::rewrite_table::field;
+    using namespace std::string_view_literals;
+
+    constexpr std::array<char, 8> magic { 'M', 'P', 'D', 'F',
+                                          'M', 'R', 'W', '1' };
+    constexpr uint32_t empty_slot = UINT32_MAX;
+
+    constexpr std::array<std::pair<std::string_view, field>, 4> field_names {
+        { { "artist"sv, field::artist },
+          { "album"sv, field::album },
+          { "album_artist"sv, field::album_artist },
+          { "track"sv, field::track } }
+    };
+
+    //! \brief FNV-1a over the field and the name, as stored in keys
+    uint64_t hash(field f, std::string_view name) {
+        constexpr uint64_t offset_basis = 14695981039346656037ULL;
+        constexpr uint64_t prime        = 1099511628211ULL;
+        uint64_t h = offset_basis;
+        h ^= static_cast<unsigned char>(f);
+        h *= prime;
+        for (unsigned char c : name) {
+            h ^= c;
+            h *= prime;
+        }
+        return h;
+    }
+}  // namespace
+
+// the file is the header, the slots and then the strings. a key is the
+// field followed by the name
+struct mpdfm::rewrite_table::header {
+    std::array<char, 8> magic;
+    uint32_t slots;  // a power of two
+    uint32_t entries;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+};
+
+struct mpdfm::rewrite_table::slot {
+    uint64_t hash;
+    uint32_t key_offset;
+    uint32_t key_length;  // empty_slot for an empty slot
+    uint32_t value_offset;
+    uint32_t value_length;
+};
+
+mpdfm::rewrite_table::rewrite_table(const std::string &path) {
+    // NOLINTNEXTLINE vararg
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(),
+                                "cannot open rewrite table " + path);
+    }
+    struct stat st {};
+    if (::fstat(fd, &st) < 0) {
+        auto err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "fstat");
+    }
+    m_size = static_cast<size_t>(st.st_size);
+    if (m_size < sizeof(header)) {
+        ::close(fd);
+        throw std::runtime_error(path + " is not a rewrite table");
+    }
+
+    void *data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping stays valid without the descriptor
+    ::close(fd);
+    if (data == MAP_FAILED) {  // NOLINT cast in macro
+        throw std::system_error(errno, std::generic_category(), "mmap");
+    }
+    m_data = static_cast<const char *>(data);
+
+    // NOLINTNEXTLINE the layout is the file format
+    m_header = reinterpret_cast<const header *>(m_data);
+    auto slots_end =
+        sizeof(header) + uint64_t { m_header->slots } * sizeof(slot);
+    if (m_header->magic != magic || m_header->slots == 0
+        || (m_header->slots & (m_header->slots - 1)) != 0
+        || m_header->strings_offset < slots_end
+        || m_header->strings_offset > m_size
+        || m_header->strings_size > m_size - m_header->strings_offset) {
+        ::munmap(data, m_size);
+        throw std::runtime_error(path + " is not a rewrite table");
+    }
+    // NOLINTNEXTLINE the layout is the file format
+    m_slots   = reinterpret_cast<const slot *>(m_data + sizeof(header));
+    m_strings = m_data + m_header->strings_offset;  // NOLINT pointer math
+}
+
+mpdfm::rewrite_table::~rewrite_table() {
+    // NOLINTNEXTLINE munmap takes a mutable pointer
+    ::munmap(const_cast<char *>(m_data), m_size);
+}
+
+std::optional<std::string_view>
+    mpdfm::rewrite_table::lookup(field f, std::string_view name) const {
+    auto h    = hash(f, name);
+    auto mask = m_header->slots - 1;
+    auto i    = static_cast<uint32_t>(h) & mask;
+    // a well formed table always has empty slots, the bound is for the
+    // rest
+    for (uint32_t probes = 0; probes < m_header->slots; probes++) {
+        const auto &s = m_slots[i];  // NOLINT pointer arithmetic
+        if (s.key_length == empty_slot) {
+            break;
+        }
+        if (s.hash == h && s.key_length == name.size() + 1
+            && uint64_t { s.key_offset } + s.key_length
+                   <= m_header->strings_size
+            && uint64_t { s.value_offset } + s.value_length
+                   <= m_header->strings_size) {
+            // NOLINTNEXTLINE pointer arithmetic
+            std::string_view key(m_strings + s.key_offset, s.key_length);
+            if (key[0] == static_cast<char>(f) && key.substr(1) == name) {
+                // NOLINTNEXTLINE pointer arithmetic
+                return std::string_view(m_strings + s.value_offset,
+                                        s.value_length);
+            }
+        }
+        i = (i + 1) & mask;
+    }
+    return std::nullopt;
+}
+
+void mpdfm::rewrite_table::apply(scrobble_entry &s) const {
+    auto rewrite = [this](field f, std::string &name) {
+        if (auto r = lookup(f, name)) {
+            name.assign(r->data(), r->size());
+        }
+    };
+    rewrite(field::artist, s.artist);
+    rewrite(field::album, s.album);
+    rewrite(field::album_artist, s.album_artist);
+    rewrite(field::track, s.track);
+}
+
+size_t mpdfm::rewrite_table::size() const {
+    return m_header->entries;
+}
+
+size_t mpdfm::rewrite_table::compile(std::istream &in,
+                                     const std::string &path) {
+    // keys (field and name) to replacements
+    std::map<std::string, std::string> entries;
+    std::string line;
+    size_t number = 0;
+    while (std::getline(in, line)) {
+        number++;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty() || line.front() == '#') {
+            continue;
+        }
+        auto first  = line.find('\t');
+        auto second = first == std::string::npos ? first
+                                                 : line.find('\t', first + 1);
+        if (second == std::string::npos) {
+            throw std::runtime_error("line " + std::to_string(number)
+                                     + ": expected field, name and "
+                                       "replacement separated by tabs");
+        }
+        auto name = std::string_view(line).substr(0, first);
+        auto f    = std::find_if(field_names.begin(), field_names.end(),
+                              [name](auto &p) { return p.first == name; });
+        if (f == field_names.end()) {
+            throw std::runtime_error("line " + std::to_string(number)
+                                     + ": unknown field "
+                                     + std::string(name));
+        }
+        auto key = static_cast<char>(f->second)
+                   + line.substr(first + 1, second - first - 1);
+        entries[std::move(key)] = line.substr(second + 1);
+    }
+
+    uint32_t slots = 1;
+    while (slots < 2 * entries.size()) {  // at most half full
+        slots *= 2;
+    }
+    std::vector<slot> table(slots, slot { 0, 0, empty_slot, 0, 0 });
+    std::string strings;
+    for (auto &[key, value] : entries) {
+        slot s {};
+        s.hash = hash(static_cast<field>(key[0]),
+                      std::string_view(key).substr(1));
+        s.key_offset   = gsl::narrow<uint32_t>(strings.size());
+        s.key_length   = gsl::narrow<uint32_t>(key.size());
+        strings += key;
+        s.value_offset = gsl::narrow<uint32_t>(strings.size());
+        s.value_length = gsl::narrow<uint32_t>(value.size());
+        strings += value;
+
+        auto i = static_cast<uint32_t>(s.hash) & (slots - 1);
+        while (table[i].key_length != empty_slot) {
+            i = (i + 1) & (slots - 1);
+        }
+        table[i] = s;
+    }
+
+    header h {};
+    h.magic          = magic;
+    h.slots          = slots;
+    h.entries        = gsl::narrow<uint32_t>(entries.size());
+    h.strings_offset = sizeof(header) + slots * sizeof(slot);
+    h.strings_size   = strings.size();
+
+    auto tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        // NOLINTNEXTLINE the layout is the file format
+        out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+        // NOLINTNEXTLINE the layout is the file format
+        out.write(reinterpret_cast<const char *>(table.data()),
+                  static_cast<std::streamsize>(slots * sizeof(slot)));
+        out.write(strings.data(),
+                  static_cast<std::streamsize>(strings.size()));
+        out.flush();
+        if (!out.good()) {
+            throw std::runtime_error("cannot write " + tmp);
+        }
+    }
+    boost::filesystem::rename(tmp, path);
+    return entries.size();
+}
+
+// rewriter
+
+bool mpdfm::rewriter::file_id::operator==(const file_id &other) const {
+    return device == other.device && inode == other.inode
+           && mtime == other.mtime && size == other.size;
+}
+
+mpdfm::rewriter::file_id mpdfm::rewriter::identify(const std::string &path) {
+    struct stat st {};
+    if (::stat(path.c_str(), &st) < 0) {
+        return {};
+    }
+    return { st.st_dev, st.st_ino, st.st_mtime, st.st_size };
+}
+
+mpdfm::rewriter::rewriter(std::string path,
+                          boost::asio::io_context &io,
+                          std::chrono::seconds interval)
+    : m_path(std::move(path)),
+      m_interval(interval),
+      m_file(identify(m_path)),
+      m_table(std::make_shared<rewrite_table>(m_path)),
+      m_timer(io) {
+    spdlog::info("rewrite table {} has {} entries", m_path, m_table->size());
+}
+
+void mpdfm::rewriter::apply(scrobble_entry &s) const {
+    std::shared_ptr<const rewrite_table> table;
+    {
+        std::unique_lock lock(m_mutex);
+        table = m_table;
+    }
+    table->apply(s);
+}
+
+void mpdfm::rewriter::start() {
+    schedule_check();
+}
+
+void mpdfm::rewriter::stop() {
+    boost::asio::post(m_timer.get_executor(),
+                      [self = shared_from_this()]() {
+                          self->m_stopped = true;
+                          self->m_timer.cancel();
+                      });
+}
+
+void mpdfm::rewriter::schedule_check() {
+    m_timer.expires_after(m_interval);
+    m_timer.async_wait([self = shared_from_this()](auto ec) {
+        if (ec || self->m_stopped) {
+            return;
+        }
+        self->check();
+        self->schedule_check();
+    });
+}
+
+void mpdfm::rewriter::check() {
+    auto file = identify(m_path);
+    if (file == m_file || file.inode == 0) {
+        return;
+    }
+    m_file = file;
+    try {
+        auto table = std::make_shared<rewrite_table>(m_path);
+        spdlog::info("reloaded rewrite table {} ({} entries)", m_path,
+                     table->size());
+        std::unique_lock lock(m_mutex);
+        m_table = std::move(table);
+    } catch (const std::exception &e) {
+        spdlog::error("cannot reload rewrite table (keeping the old one): "
+                      "{}",
+                      e.what());
+    }
+}
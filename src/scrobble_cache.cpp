@@ -0,0 +1,187 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <scrobble_cache.hpp>
+
+#include <algorithm>
+#include <alloc_stats.hpp>
+#include <fstream>
+#include <iterator>
+#include <logging.hpp>
+#include <metrics.hpp>
+#include <probes.hpp>
+#include <scrobble_json.hpp>
+#include <spdlog/spdlog.h>
+#include <tao/json.hpp>
+#include <tao/json/consume_file.hpp>
+#include <tao/json/contrib/traits.hpp>
+#include <tao/json/events/produce.hpp>
+#include <tao/json/events/to_stream.hpp>
+
+namespace {
+    mpdfm::metrics::gauge &backlog() {
+        static auto &g = mpdfm::metrics::get_gauge(
+            "mpdfm_backlog_entries", "Scrobbles waiting to be sent");
+        return g;
+    }
+
+    //! \brief Adds the change in size of a container to the backlog gauge
+    template<typename Container>
+    class backlog_change {
+        const Container &m_entries;
+        size_t m_before;
+
+    public:
+        explicit backlog_change(const Container &entries)
+            : m_entries(entries), m_before(entries.size()) {}
+
+        backlog_change(const backlog_change &) = delete;
+        backlog_change &operator=(const backlog_change &) = delete;
+        backlog_change(backlog_change &&)                 = delete;
+        backlog_change &operator=(backlog_change &&) = delete;
+
+        ~backlog_change() {
+            backlog().add(static_cast<int64_t>(m_entries.size())
+                          - static_cast<int64_t>(m_before));
+        }
+    };
+}  // namespace
+
+mpdfm::scrobble_cache::scrobble_cache(std::string path, size_t limit)
+    : m_path(std::move(path)), m_limit(limit) {
+    backlog_change change(m_entries);
+    try {
+        if (!m_path.empty()) {
+            // parts parser: entries are read straight into the set without
+            // materializing the whole document first
+            m_entries = tao::json::consume_file<container>(m_path);
+            enforce_limit();
+        }
+    } catch (const std::exception &e) {
+        spdlog::error(
+            "couldnt read cache (ignoring): "
+            "if missing, the file will be made once the program ends\n{}",
+            e.what());
+    }
+}
+
+mpdfm::scrobble_cache::~scrobble_cache() {
+    save();
+    backlog().add(-static_cast<int64_t>(m_entries.size()));
+}
+
+void mpdfm::scrobble_cache::save() const {
+    alloc::scope account(alloc::tag::cache);
+    try {
+        if (m_path.empty()) {
+            return;
+        }
+        metrics::stopwatch saving;
+        std::ofstream str(m_path);
+        if (str.good()) {
+            std::unique_lock lock(m_mutex);
+            tao::json::events::to_stream consumer(str);
+            tao::json::events::produce(consumer, m_entries);
+            MPDFM_PROBE(cache_save, m_path.c_str(), m_entries.size(),
+                        internal::probe_us(saving.elapsed()));
+        } else {
+            spdlog::error("cannot write cache to {}", m_path);
+        }
+    } catch (const std::exception &e) {
+        spdlog::error("cannot write cache to {}: {}", m_path, e.what());
+    }
+}
+
+void mpdfm::scrobble_cache::insert(const scrobble_entry &s) {
+    alloc::scope account(alloc::tag::cache);
+    std::unique_lock lock(m_mutex);
+    backlog_change change(m_entries);
+    m_entries.insert(s);
+    enforce_limit();
+}
+
+void mpdfm::scrobble_cache::insert(
+    const std::vector<scrobble_entry> &entries) {
+    alloc::scope account(alloc::tag::cache);
+    std::unique_lock lock(m_mutex);
+    backlog_change change(m_entries);
+    m_entries.insert(entries.begin(), entries.end());
+    enforce_limit();
+}
+
+std::vector<mpdfm::scrobble_entry>
+    mpdfm::scrobble_cache::extract(size_t count) {
+    alloc::scope account(alloc::tag::cache);
+    std::unique_lock lock(m_mutex);
+    backlog_change change(m_entries);
+    std::vector<scrobble_entry> result;
+    result.reserve(std::min(count, m_entries.size()));
+    while (result.size() < count && !m_entries.empty()) {
+        result.emplace_back(
+            std::move(m_entries.extract(m_entries.begin()).value()));
+    }
+    m_in_flight += result.size();
+    return result;
+}
+
+void mpdfm::scrobble_cache::settle(size_t count) {
+    std::unique_lock lock(m_mutex);
+    m_in_flight -= std::min(count, m_in_flight);
+}
+
+void mpdfm::scrobble_cache::requeue(
+    const std::vector<scrobble_entry> &entries) {
+    static auto &retries = metrics::get_counter(
+        "mpdfm_scrobble_retries_total", "Scrobbles queued again after a "
+                                        "failed send");
+    std::unique_lock lock(m_mutex);
+    backlog_change change(m_entries);
+    retries.add(entries.size());
+    m_in_flight -= std::min(entries.size(), m_in_flight);
+    m_entries.insert(entries.begin(), entries.end());
+    enforce_limit();
+}
+
+size_t mpdfm::scrobble_cache::size() const {
+    std::unique_lock lock(m_mutex);
+    return m_entries.size();
+}
+
+size_t mpdfm::scrobble_cache::in_flight() const {
+    std::unique_lock lock(m_mutex);
+    return m_in_flight;
+}
+
+bool mpdfm::scrobble_cache::empty() const {
+    std::unique_lock lock(m_mutex);
+    return m_entries.empty();
+}
+
+void mpdfm::scrobble_cache::enforce_limit() {
+    if (m_limit == 0 || m_entries.size() <= m_limit) {
+        return;
+    }
+    static auto &dropped = metrics::get_counter(
+        "mpdfm_backlog_dropped_total",
+        "Scrobbles dropped because the backlog was full");
+    auto excess = m_entries.size() - m_limit;
+    dropped.add(excess);
+    MPDFM_LOG_LIMITED(spdlog::level::warn,
+                      "scrobble backlog full, dropping {} oldest scrobble(s)",
+                      excess);
+    auto end = std::next(m_entries.begin(), static_cast<ptrdiff_t>(excess));
+    m_entries.erase(m_entries.begin(), end);
+}
@@ -16,10 +16,57 @@
  */
 #include <scrobbler.hpp>
 
+#include <algorithm>
+#include <gsl/gsl>
+#include <mpc.hpp>
+#include <scrobble_json.hpp>
+#include <tao/json/contrib/traits.hpp>
+#include <tao/json/events/produce.hpp>
+#include <tao/json/events/to_string.hpp>
+
 void mpdfm::scrobbler::scrobble(const mpdfm::scrobble_entry &song) {
     do_send_scrobble(song);
 }
 
+void mpdfm::scrobbler::scrobble(const std::vector<scrobble_entry> &songs) {
+    do_send_scrobbles(songs);
+}
+
+void mpdfm::scrobbler::enqueue(const std::vector<scrobble_entry> &songs) {
+    do_enqueue(songs);
+}
+
+void mpdfm::scrobbler::flush() {
+    do_flush();
+}
+
+size_t mpdfm::scrobbler::backlog() const {
+    return do_backlog();
+}
+
+void mpdfm::scrobbler::stop() {
+    do_stop();
+}
+
+void mpdfm::scrobbler::do_enqueue(const std::vector<scrobble_entry> &s) {
+    do_send_scrobbles(s);
+}
+
+void mpdfm::scrobbler::do_flush() {}
+
+size_t mpdfm::scrobbler::do_backlog() const {
+    return 0;
+}
+
+void mpdfm::scrobbler::do_stop() {}
+
+void mpdfm::scrobbler::do_send_scrobbles(
+    const std::vector<scrobble_entry> &s) {
+    for (auto &song : s) {
+        do_send_scrobble(song);
+    }
+}
+
 void mpdfm::scrobbler::now_playing(const mpdfm::scrobble_entry &song) {
     do_send_now_playing(song);
 }
@@ -28,6 +75,17 @@ bool mpdfm::scrobbler::check_preconditions(const mpdfm::scrobble_entry &song) {
     return do_check_preconditions(song);
 }
 
+bool mpdfm::meets_scrobble_rules(const scrobble_entry &s) {
+    auto played = std::min<time_t>(240, s.duration / 2);  // NOLINT magic num
+    return s.duration > 30 && s.elapsed > played;         // NOLINT magic num
+}
+
+std::string mpdfm::to_json(const scrobble_entry &s) {
+    tao::json::events::to_string consumer;
+    tao::json::events::produce(consumer, s);
+    return consumer.value();
+}
+
 mpdfm::scrobble_entry::scrobble_entry(const song &s)
     : artist(s.tag(MPD_TAG_ARTIST)),
       track(s.tag(MPD_TAG_TITLE)),
@@ -35,6 +93,8 @@ mpdfm::scrobble_entry::scrobble_entry(const song &s)
       track_number(s.tag(MPD_TAG_TRACK)),
       mbid(s.tag(MPD_TAG_MUSICBRAINZ_TRACKID)),
       album_artist(s.tag(MPD_TAG_ALBUM_ARTIST)),
+      genre(s.tag(MPD_TAG_GENRE)),
+      uri(s.uri()),
       duration(s.duration()) {}
 
 gsl::owner<mpdfm::scrobbler *> mpdfm::scrobbler_factory::
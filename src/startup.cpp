@@ -0,0 +1,242 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <startup.hpp>
+
+#include <boost/asio/post.hpp>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <spdlog/spdlog.h>
+#include <stdexcept>
+
+namespace {
+    // initialized during static initialization, which is as close to the
+    // start of the process as we can get without platform specific code
+    const auto start_time = mpdfm::startup_clock::now();
+
+    auto to_ms(mpdfm::startup_clock::duration d) {
+        using ms = std::chrono::duration<double, std::milli>;
+        return std::chrono::duration_cast<ms>(d).count();
+    }
+}  // namespace
+
+mpdfm::startup_clock::time_point mpdfm::process_start() {
+    return start_time;
+}
+
+void mpdfm::log_startup_mark(std::string_view what) {
+    spdlog::debug("startup: {} after {:.2f}ms",
+                  what,
+                  to_ms(startup_clock::now() - process_start()));
+}
+
+struct mpdfm::startup_graph::phase {
+    enum class progress { waiting, ready, running, done, failed, skipped };
+
+    std::string name;
+    task_type task;
+    std::vector<size_t> dependents;
+    size_t pending = 0;  // dependencies that haven't completed yet
+    progress stage = progress::waiting;
+
+    startup_clock::time_point start;
+    startup_clock::time_point end;
+};
+
+struct mpdfm::startup_graph::state
+    : public std::enable_shared_from_this<state> {
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    std::vector<phase> phases;
+    std::map<std::string, size_t, std::less<>> index;
+    std::deque<size_t> ready;
+    size_t remaining = 0;
+
+    boost::asio::io_context *io = nullptr;
+    std::exception_ptr error;
+
+    // both require the mutex to be held
+    void make_ready(size_t i) {
+        phases[i].stage = phase::progress::ready;
+        ready.push_back(i);
+        if (io != nullptr) {
+            boost::asio::post(*io, [self = shared_from_this()]() {
+                self->run_one(false);
+            });
+        }
+        cv.notify_all();
+    }
+
+    void skip(size_t i) {
+        auto &p = phases[i];
+        if (p.stage == phase::progress::skipped) {
+            return;
+        }
+        p.stage = phase::progress::skipped;
+        remaining--;
+        for (auto d : p.dependents) {
+            skip(d);
+        }
+    }
+
+    /*!
+     * \brief Runs one ready phase, if there is one
+     * \param wait whether to block until a phase is ready or all are done
+     * \return false if there's nothing left to do
+     */
+    bool run_one(bool wait) {
+        std::unique_lock lock(mutex);
+        if (wait) {
+            cv.wait(lock,
+                    [this]() { return remaining == 0 || !ready.empty(); });
+        }
+        if (ready.empty()) {
+            return remaining != 0;
+        }
+        auto i = ready.front();
+        ready.pop_front();
+
+        phases[i].stage = phase::progress::running;
+        phases[i].start = startup_clock::now();
+        auto task       = std::move(phases[i].task);
+        lock.unlock();
+
+        std::exception_ptr err;
+        try {
+            task();
+        } catch (...) {
+            err = std::current_exception();
+        }
+
+        lock.lock();
+        auto &p = phases[i];
+        p.end   = startup_clock::now();
+        remaining--;
+        if (err) {
+            p.stage = phase::progress::failed;
+            if (!error) {
+                error = err;
+            }
+            for (auto d : p.dependents) {
+                skip(d);
+            }
+        } else {
+            p.stage = phase::progress::done;
+            for (auto d : p.dependents) {
+                if (--phases[d].pending == 0) {
+                    make_ready(d);
+                }
+            }
+        }
+        cv.notify_all();
+        return remaining != 0;
+    }
+};
+
+mpdfm::startup_graph::startup_graph() : m_state(std::make_shared<state>()) {}
+
+void mpdfm::startup_graph::add(std::string name,
+                               task_type task,
+                               const std::vector<std::string> &deps) {
+    std::unique_lock lock(m_state->mutex);
+    auto &s = *m_state;
+    if (s.index.find(name) != s.index.end()) {
+        throw std::logic_error("duplicate startup phase: " + name);
+    }
+
+    auto i = s.phases.size();
+    s.phases.emplace_back();
+    auto &p = s.phases.back();
+    p.name  = std::move(name);
+    p.task  = std::move(task);
+    s.index.emplace(p.name, i);
+    s.remaining++;
+
+    bool skipped = false;
+    for (auto &dep : deps) {
+        auto it = s.index.find(dep);
+        if (it == s.index.end()) {
+            throw std::logic_error("unknown startup phase: " + dep);
+        }
+        auto &d = s.phases[it->second];
+        d.dependents.push_back(i);
+        switch (d.stage) {
+        case phase::progress::done:
+            break;
+        case phase::progress::failed:
+        case phase::progress::skipped:
+            skipped = true;
+            break;
+        default:
+            s.phases[i].pending++;
+            break;
+        }
+    }
+
+    if (skipped) {
+        s.skip(i);
+    } else if (s.phases[i].pending == 0 && s.io != nullptr) {
+        // added by a running phase, ready right away
+        s.make_ready(i);
+    }
+}
+
+void mpdfm::startup_graph::run(boost::asio::io_context &io) {
+    {
+        std::unique_lock lock(m_state->mutex);
+        m_state->io = &io;
+        for (size_t i = 0; i < m_state->phases.size(); i++) {
+            auto &p = m_state->phases[i];
+            if (p.stage == phase::progress::waiting && p.pending == 0) {
+                m_state->make_ready(i);
+            }
+        }
+    }
+
+    while (m_state->run_one(true)) {
+    }
+
+    std::unique_lock lock(m_state->mutex);
+    m_state->io = nullptr;
+    if (m_state->error) {
+        std::rethrow_exception(m_state->error);
+    }
+}
+
+void mpdfm::startup_graph::report() const {
+    std::unique_lock lock(m_state->mutex);
+    for (auto &p : m_state->phases) {
+        switch (p.stage) {
+        case phase::progress::done:
+        case phase::progress::failed: {
+            auto failed = p.stage == phase::progress::failed;
+            spdlog::debug("startup: {:<24} +{:8.2f}ms took {:8.2f}ms{}",
+                          p.name,
+                          to_ms(p.start - process_start()),
+                          to_ms(p.end - p.start),
+                          failed ? " (failed)" : "");
+            break;
+        }
+        default:
+            spdlog::debug("startup: {:<24} skipped", p.name);
+            break;
+        }
+    }
+}
@@ -0,0 +1,195 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include <trace.hpp>
+
+#include <algorithm>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+#include <unistd.h>
+#include <vector>
+
+std::atomic<bool> mpdfm::trace::internal::enabled { false };
+
+namespace {
+    using mpdfm::trace::clock;
+
+    struct event {
+        const char *name;
+        clock::time_point begin;
+        clock::time_point end;
+        const void *id;
+    };
+
+    /*!
+     * \brief The most recent events of one thread
+     *
+     * Only the owning thread writes, the mutex is for dump() and so is
+     * uncontended otherwise.
+     */
+    struct ring {
+        std::mutex mutex;
+        std::vector<event> events;
+        size_t written = 0;
+        size_t thread;
+    };
+
+    struct tracer {
+        std::mutex mutex;
+        std::string path;
+        size_t capacity = 0;
+        clock::time_point epoch;
+        // rings outlive their threads, so events of finished threads are
+        // still dumped
+        std::vector<std::unique_ptr<ring>> rings;
+    };
+
+    tracer &global() {
+        static tracer t;
+        return t;
+    }
+
+    ring &this_thread_ring() {
+        thread_local ring *r = nullptr;
+        if (r == nullptr) {
+            auto &t = global();
+            std::unique_lock lock(t.mutex);
+            auto owned = std::make_unique<ring>();
+            owned->events.resize(t.capacity);
+            owned->thread = t.rings.size() + 1;
+            r             = owned.get();
+            t.rings.push_back(std::move(owned));
+        }
+        return *r;
+    }
+
+    double micros(clock::duration d) {
+        return std::chrono::duration<double, std::micro>(d).count();
+    }
+
+    void escape(std::string &out, const char *s) {
+        for (; *s != '\0'; s++) {  // NOLINT pointer arithmetic
+            if (*s == '"' || *s == '\\') {
+                out += '\\';
+            }
+            out += *s;
+        }
+    }
+}  // namespace
+
+void mpdfm::trace::internal::record(const char *name,
+                                    clock::time_point begin,
+                                    clock::time_point end,
+                                    const void *id) {
+    auto &r = this_thread_ring();
+    std::unique_lock lock(r.mutex);
+    r.events[r.written % r.events.size()] = { name, begin, end, id };
+    r.written++;
+}
+
+void mpdfm::trace::start(const std::string &path, size_t events) {
+    auto &t = global();
+    {
+        std::unique_lock lock(t.mutex);
+        t.path     = path;
+        t.capacity = std::max<size_t>(events, 1);
+        t.epoch    = clock::now();
+    }
+    internal::enabled = true;
+    spdlog::info("tracing, the trace is written to {}", path);
+}
+
+void mpdfm::trace::dump() {
+    auto &t = global();
+    std::unique_lock lock(t.mutex);
+    if (t.path.empty()) {
+        return;
+    }
+
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    auto it         = std::back_inserter(out);
+    auto pid        = ::getpid();
+    bool first      = true;
+    auto separate   = [&]() {
+        if (!first) {
+            out += ",\n";
+        }
+        first = false;
+    };
+
+    for (auto &r : t.rings) {
+        separate();
+        fmt::format_to(it,
+                       "{{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":{},"
+                       "\"tid\":{},\"args\":{{\"name\":\"thread {}\"}}}}",
+                       pid, r->thread, r->thread);
+
+        std::unique_lock ring_lock(r->mutex);
+        auto size  = r->events.size();
+        auto count = std::min(r->written, size);
+        for (auto i = r->written - count; i < r->written; i++) {
+            auto &e = r->events[i % size];
+            auto ts = micros(e.begin - t.epoch);
+            if (ts < 0) {
+                continue;  // began before tracing started
+            }
+            separate();
+            out += "{\"name\":\"";
+            escape(out, e.name);
+            if (e.id == nullptr) {
+                fmt::format_to(it,
+                               "\",\"ph\":\"X\",\"pid\":{},\"tid\":{},"
+                               "\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                               pid, r->thread, ts, micros(e.end - e.begin));
+                continue;
+            }
+            // async events are a begin and an end with the same id
+            auto id = reinterpret_cast<uintptr_t>(e.id);  // NOLINT
+            auto async_tail = "\",\"cat\":\"async\",\"ph\":\"{}\","
+                              "\"id\":\"{:x}\",\"pid\":{},\"tid\":{},"
+                              "\"ts\":{:.3f}}}";
+            fmt::format_to(it, async_tail, 'b', id, pid, r->thread, ts);
+            out += ",\n{\"name\":\"";
+            escape(out, e.name);
+            fmt::format_to(it, async_tail, 'e', id, pid, r->thread,
+                           micros(e.end - t.epoch));
+        }
+    }
+    out += "]}\n";
+
+    auto tmp = t.path + ".tmp";
+    {
+        std::ofstream file(tmp, std::ios::trunc);
+        file << out;
+        file.flush();
+        if (!file.good()) {
+            spdlog::error("cannot write trace to {}", tmp);
+            return;
+        }
+    }
+    boost::system::error_code ec;
+    boost::filesystem::rename(tmp, t.path, ec);
+    if (ec) {
+        spdlog::error("cannot write trace to {}: {}", t.path, ec.message());
+        return;
+    }
+    spdlog::info("wrote trace to {}", t.path);
+}
@@ -0,0 +1,132 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef TOOLS_FAULTS_HPP
+#define TOOLS_FAULTS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*!
+ * \brief Latency and fault injection shared by the mock servers
+ */
+namespace mpdfm::tools {
+    //! \returns \p s split at every \p sep
+    inline std::vector<std::string> split(const std::string &s, char sep) {
+        std::vector<std::string> parts;
+        size_t begin = 0;
+        for (auto end = s.find(sep); end != std::string::npos;
+             end      = s.find(sep, begin)) {
+            parts.push_back(s.substr(begin, end - begin));
+            begin = end + 1;
+        }
+        parts.push_back(s.substr(begin));
+        return parts;
+    }
+
+    /*!
+     * \brief A distribution of delays, in milliseconds
+     *
+     * ```
+     * fixed:50            always 50ms
+     * uniform:10:200      anything from 10 to 200ms
+     * normal:100:20       mean 100ms, standard deviation 20ms
+     * lognormal:120:0.5   median 120ms, sigma 0.5, long tailed like WANs
+     * ```
+     */
+    class latency {
+    public:
+        //! \brief No delay
+        latency() = default;
+
+        //! \throws std::runtime_error if \p spec is not one of the above
+        explicit latency(const std::string &spec) {
+            auto parts = split(spec, ':');
+            auto arg   = [&](size_t i) {
+                if (parts.size() <= i) {
+                    throw std::runtime_error("missing parameter in latency "
+                                             + spec);
+                }
+                return std::stod(parts[i]);
+            };
+            if (parts[0] == "fixed") {
+                m_kind = kind::fixed;
+                m_a    = arg(1);
+            } else if (parts[0] == "uniform") {
+                m_kind = kind::uniform;
+                m_a    = arg(1);
+                m_b    = arg(2);
+            } else if (parts[0] == "normal") {
+                m_kind = kind::normal;
+                m_a    = arg(1);
+                m_b    = arg(2);
+            } else if (parts[0] == "lognormal") {
+                m_kind = kind::lognormal;
+                m_a    = std::log(arg(1));
+                m_b    = arg(2);
+            } else {
+                throw std::runtime_error("unknown latency distribution "
+                                         + spec);
+            }
+        }
+
+        //! \returns A delay drawn using \p random
+        template<typename Random>
+        std::chrono::microseconds sample(Random &random) const {
+            double ms = 0;
+            switch (m_kind) {
+            case kind::none:
+                break;
+            case kind::fixed:
+                ms = m_a;
+                break;
+            case kind::uniform:
+                ms = std::uniform_real_distribution<>(m_a, m_b)(random);
+                break;
+            case kind::normal:
+                ms = std::normal_distribution<>(m_a, m_b)(random);
+                break;
+            case kind::lognormal:
+                ms = std::lognormal_distribution<>(m_a, m_b)(random);
+                break;
+            }
+            return std::chrono::microseconds(
+                static_cast<int64_t>(std::max(ms, 0.0) * 1000));  // NOLINT
+        }
+
+    private:
+        enum class kind { none, fixed, uniform, normal, lognormal };
+        kind m_kind = kind::none;
+        double m_a  = 0;
+        double m_b  = 0;
+    };
+
+    //! \returns \p s as a probability, \throws if it's not in [0, 1]
+    inline double probability(const std::string &s) {
+        auto p = std::stod(s);
+        if (p < 0 || p > 1) {
+            throw std::runtime_error("not a probability: " + s);
+        }
+        return p;
+    }
+}  // namespace mpdfm::tools
+
+#endif // TOOLS_FAULTS_HPP
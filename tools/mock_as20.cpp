@@ -0,0 +1,162 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file mock_as20.cpp
+ * \brief Stand-in for ws.audioscrobbler.com, for offline tests and
+ *        benchmarks of the as20 scrobbler
+ *
+ * ```
+ * mock-as20 --listen 127.0.0.1:8081 --secret s3cret \
+ *     --latency lognormal:120:0.5 --latency track.scrobble=fixed:400 \
+ *     --error 11:0.05 --error 29:0.01 --reset 0.01 --stall 0.01
+ * ```
+ *
+ * and in the config:
+ *
+ * ```
+ * as20 {
+ *     url = "http://127.0.0.1:8081/2.0/"
+ *     api_key = "anything"
+ *     api_secret = "s3cret"
+ *     session = "mock-session-key"
+ *     store = "/tmp/mock-as20.cache"
+ * }
+ * ```
+ *
+ * See mock_as20.hpp for what it implements. With --tls-cert and --tls-key
+ * it speaks HTTPS instead; point mpdfm's OpenSSL at the CA that signed the
+ * certificate with SSL_CERT_FILE. SIGINT and SIGTERM print what was served
+ * and exit.
+ */
+#include "mock_as20.hpp"
+
+#include <boost/asio/signal_set.hpp>
+#include <iostream>
+
+namespace {
+    namespace asio = boost::asio;
+    using mpdfm::tools::latency;
+    using mpdfm::tools::as20::options;
+    using mpdfm::tools::as20::server;
+
+    void usage() {
+        std::cerr
+            << "usage: mock-as20 [options]\n"
+               "  --listen HOST:PORT        default 127.0.0.1:8081\n"
+               "  --api-key KEY             only accept KEY\n"
+               "  --secret SECRET           checks signatures, default "
+               "mock-secret\n"
+               "  --session-key KEY         handed out and required, "
+               "default mock-session-key\n"
+               "  --tls-cert PEM --tls-key PEM\n"
+               "                            serve HTTPS\n"
+               "  --latency [METHOD=]SPEC   delay responses, SPEC is\n"
+               "                            fixed:MS, uniform:MIN:MAX,\n"
+               "                            normal:MEAN:SD or "
+               "lognormal:MEDIAN:SIGMA\n"
+               "  --error CODE:P            answer with API error CODE\n"
+               "                            (e.g. 11, 16, 29) with "
+               "probability P\n"
+               "  --reset P                 reset the connection instead\n"
+               "  --stall P                 never answer\n"
+               "  --seed N                  seed of the random faults\n"
+               "  -v                        log every request\n";
+    }
+
+    options parse_options(gsl::span<const char *> args) {
+        options opts;
+        for (size_t i = 1; i < args.size(); i++) {
+            std::string_view flag(args[i]);
+            if (flag == "-v") {
+                spdlog::set_level(spdlog::level::debug);
+                continue;
+            }
+            if (i + 1 == args.size()) {
+                throw std::runtime_error("missing value of "
+                                         + std::string(flag));
+            }
+            std::string value(args[++i]);
+            if (flag == "--listen") {
+                opts.listen = value;
+            } else if (flag == "--api-key") {
+                opts.api_key = value;
+            } else if (flag == "--secret") {
+                opts.secret = value;
+            } else if (flag == "--session-key") {
+                opts.session_key = value;
+            } else if (flag == "--tls-cert") {
+                opts.cert = value;
+            } else if (flag == "--tls-key") {
+                opts.key = value;
+            } else if (flag == "--latency") {
+                auto eq = value.find('=');
+                if (eq == std::string::npos) {
+                    opts.delay = latency(value);
+                } else {
+                    opts.method_delay[value.substr(0, eq)] =
+                        latency(value.substr(eq + 1));
+                }
+            } else if (flag == "--error") {
+                auto parts = mpdfm::tools::split(value, ':');
+                if (parts.size() != 2) {
+                    throw std::runtime_error("--error takes CODE:P");
+                }
+                opts.errors.emplace_back(
+                    std::stoi(parts[0]), mpdfm::tools::probability(parts[1]));
+            } else if (flag == "--reset") {
+                opts.reset = mpdfm::tools::probability(value);
+            } else if (flag == "--stall") {
+                opts.stall = mpdfm::tools::probability(value);
+            } else if (flag == "--seed") {
+                opts.seed = std::stoul(value);
+            } else {
+                throw std::runtime_error("unknown option "
+                                         + std::string(flag));
+            }
+        }
+        if (opts.cert.empty() != opts.key.empty()) {
+            throw std::runtime_error("--tls-cert and --tls-key go together");
+        }
+        return opts;
+    }
+}  // namespace
+
+int main(int argc, const char **argv) {
+    gsl::span<const char *> args(argv, argc);
+    asio::io_context io;
+    std::optional<server> s;
+    try {
+        s.emplace(io, parse_options(args));
+    } catch (const std::exception &e) {
+        spdlog::error("{}", e.what());
+        usage();
+        return 2;
+    }
+    s->start();
+
+    asio::signal_set signals(io, SIGINT, SIGTERM);
+    signals.async_wait([&](auto ec, int) {
+        if (ec) {
+            return;
+        }
+        s->report();
+        s->stop();
+        io.stop();
+    });
+    io.run();
+}
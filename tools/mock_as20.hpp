@@ -0,0 +1,569 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef TOOLS_MOCK_AS20_HPP
+#define TOOLS_MOCK_AS20_HPP
+
+#include "faults.hpp"
+
+#include <array>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http.hpp>
+#include <cctype>
+#include <functional>
+#include <gsl/gsl>
+#include <map>
+#include <memory>
+#include <openssl/md5.h>
+#include <optional>
+#include <set>
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+#include <string_view>
+#include <tao/json.hpp>
+
+/*!
+ * \file mock_as20.hpp
+ * \brief Stand-in for ws.audioscrobbler.com, for offline tests and
+ *        benchmarks of the as20 scrobbler
+ *
+ * Implements auth.getToken, auth.getSession, track.updateNowPlaying and
+ * track.scrobble, checking API keys, session keys and signatures the way
+ * last.fm does. Tokens are authorized right away. On top of that it can
+ * delay responses, answer with API errors, reset connections and stall.
+ *
+ * Used by the mock-as20 tool and the end to end benchmark, everything runs
+ * on the thread running the io_context.
+ */
+namespace mpdfm::tools::as20 {
+    namespace asio = boost::asio;
+    namespace http = boost::beast::http;
+    namespace ssl  = boost::asio::ssl;
+    using boost::asio::ip::tcp;
+
+    using params = std::map<std::string, std::string>;
+
+    //! \brief How a server is set up, see mock_as20.cpp for the flags
+    struct options {
+        std::string listen = "127.0.0.1:8081";
+        std::string api_key;  // any key is accepted when empty
+        std::string secret      = "mock-secret";
+        std::string session_key = "mock-session-key";
+        std::string cert;
+        std::string key;
+        latency delay;
+        std::map<std::string, latency> method_delay;
+        std::vector<std::pair<int, double>> errors;  // code, probability
+        double reset  = 0;
+        double stall  = 0;
+        unsigned seed = std::random_device {}();
+
+        //! \brief Called with the method and parameters of every request
+        //!        answered without an error
+        std::function<void(const std::string &, const params &)> on_request;
+    };
+
+    //! \brief An error the API answers with
+    struct api_error {
+        int code;
+    };
+
+    inline const char *error_message(int code) {
+        static const std::map<int, const char *> messages {
+            { 3, "Invalid Method - No method with that name in this "
+                 "package" },
+            { 4, "Invalid authentication token supplied" },
+            { 6, "Invalid parameters - Your request is missing a required "
+                 "parameter" },
+            { 9, "Invalid session key - Please re-authenticate" },
+            { 10, "Invalid API key - You must be granted a valid key by "
+                  "last.fm" },
+            { 11, "Service Offline - This service is temporarily offline, "
+                  "try again later." },
+            { 13, "Invalid method signature supplied" },
+            { 16, "There was a temporary error processing your request. "
+                  "Please try again" },
+            { 26, "Suspended API key - Access for your account has been "
+                  "suspended, please contact Last.fm" },
+            { 29, "Rate limit exceeded - Your IP has made too many requests "
+                  "in a short period" },
+        };
+        auto it = messages.find(code);
+        return it == messages.end() ? "Operation failed" : it->second;
+    }
+
+    inline http::status error_status(int code) {
+        switch (code) {
+        case 11:  // NOLINT service offline
+        case 16:  // NOLINT temporary error
+            return http::status::service_unavailable;
+        case 29:  // NOLINT rate limit
+            return http::status::too_many_requests;
+        case 4:   // NOLINT
+        case 9:   // NOLINT
+        case 10:  // NOLINT
+        case 13:  // NOLINT
+        case 26:  // NOLINT
+            return http::status::forbidden;
+        default:
+            return http::status::bad_request;
+        }
+    }
+
+    inline std::string urldecode(std::string_view s) {
+        std::string out;
+        out.reserve(s.size());
+        for (size_t i = 0; i < s.size(); i++) {
+            if (s[i] == '+') {
+                out += ' ';
+            } else if (s[i] == '%' && i + 2 < s.size()
+                       && std::isxdigit(static_cast<unsigned char>(s[i + 1]))
+                              != 0
+                       && std::isxdigit(static_cast<unsigned char>(s[i + 2]))
+                              != 0) {
+                out += static_cast<char>(
+                    std::stoi(std::string(s.substr(i + 1, 2)), nullptr, 16));
+                i += 2;
+            } else {
+                out += s[i];
+            }
+        }
+        return out;
+    }
+
+    //! \brief Adds the pairs of the form encoded \p s to \p p
+    inline void parse_form(std::string_view s, params &p) {
+        while (!s.empty()) {
+            auto amp  = s.find('&');
+            auto pair = s.substr(0, amp);
+            s.remove_prefix(amp == std::string_view::npos ? s.size()
+                                                          : amp + 1);
+            if (pair.empty()) {
+                continue;
+            }
+            auto eq = pair.find('=');
+            if (eq == std::string_view::npos) {
+                p[urldecode(pair)] = "";
+            } else {
+                p[urldecode(pair.substr(0, eq))] =
+                    urldecode(pair.substr(eq + 1));
+            }
+        }
+    }
+
+    /*!
+     * \returns The api_sig of \p p: the MD5 of all parameters but format
+     *          and callback, sorted by name and concatenated, followed by
+     *          the secret
+     */
+    inline std::string signature(const params &p,
+                                 const std::string &secret) {
+        std::string text;
+        for (auto &[name, value] : p) {
+            if (name != "format" && name != "callback" && name != "api_sig") {
+                text += name;
+                text += value;
+            }
+        }
+        text += secret;
+
+        std::array<unsigned char, MD5_DIGEST_LENGTH> digest {};
+        // NOLINTNEXTLINE C API
+        MD5(reinterpret_cast<const unsigned char *>(text.data()),
+            text.size(), digest.data());
+        static constexpr std::string_view hex = "0123456789abcdef";
+        std::string result;
+        for (auto b : digest) {
+            result += hex[b >> 4];    // NOLINT
+            result += hex[b & 0xf];  // NOLINT
+        }
+        return result;
+    }
+
+    /*!
+     * \brief The API, apart from the transport
+     *
+     * Runs on a single threaded io_context, so nothing here is locked.
+     */
+    class mock {
+    public:
+        enum class fault { none, reset, stall };
+
+        //! \brief What to do with a request
+        struct outcome {
+            fault what = fault::none;
+            std::chrono::microseconds delay {};
+            http::status status = http::status::ok;
+            std::string body;
+        };
+
+        explicit mock(options opts)
+            : m_opts(std::move(opts)), m_random(m_opts.seed) {}
+
+        outcome handle(const http::request<http::string_body> &req) {
+            params p;
+            auto target = req.target();
+            if (auto q = target.find('?'); q != target.npos) {
+                parse_form({ target.data() + q + 1, target.size() - q - 1 },
+                           p);
+            }
+            parse_form(req.body(), p);
+            auto method = p["method"];
+            m_served[method]++;
+
+            outcome o;
+            auto d  = m_opts.method_delay.find(method);
+            o.delay = (d == m_opts.method_delay.end() ? m_opts.delay
+                                                      : d->second)
+                          .sample(m_random);
+            if (roll(m_opts.reset)) {
+                m_resets++;
+                o.what = fault::reset;
+                return o;
+            }
+            if (roll(m_opts.stall)) {
+                m_stalls++;
+                o.what = fault::stall;
+                return o;
+            }
+
+            try {
+                for (auto &[code, probability] : m_opts.errors) {
+                    if (roll(probability)) {
+                        throw api_error { code };
+                    }
+                }
+                o.body = tao::json::to_string(dispatch(method, p));
+                if (m_opts.on_request) {
+                    m_opts.on_request(method, p);
+                }
+            } catch (const api_error &e) {
+                m_errors[e.code]++;
+                o.status = error_status(e.code);
+                o.body   = tao::json::to_string(
+                    tao::json::value { { "error", e.code },
+                                       { "message", error_message(e.code) } });
+            }
+            spdlog::debug("{} {} {}", method, static_cast<int>(o.status),
+                          o.body);
+            return o;
+        }
+
+        [[nodiscard]] const options &opts() const { return m_opts; }
+
+        void report() const {
+            for (auto &[method, n] : m_served) {
+                fmt::print("{:<24} {:>8} requests\n",
+                           method.empty() ? "(no method)" : method, n);
+            }
+            fmt::print("{:<24} {:>8}\n", "scrobbles accepted", m_scrobbles);
+            for (auto &[code, n] : m_errors) {
+                fmt::print("{:<24} {:>8}\n", fmt::format("error {}", code),
+                           n);
+            }
+            fmt::print("{:<24} {:>8}\n{:<24} {:>8}\n", "resets", m_resets,
+                       "stalls", m_stalls);
+        }
+
+    private:
+        bool roll(double probability) {
+            return probability > 0
+                   && std::uniform_real_distribution<>()(m_random)
+                          < probability;
+        }
+
+        void check_key(const params &p) const {
+            auto key = p.find("api_key");
+            bool any = m_opts.api_key.empty();
+            if (key == p.end() || (!any && key->second != m_opts.api_key)) {
+                throw api_error { 10 };  // NOLINT invalid API key
+            }
+        }
+
+        void check_signature(const params &p) const {
+            auto sig = p.find("api_sig");
+            if (sig == p.end()
+                || sig->second != signature(p, m_opts.secret)) {
+                throw api_error { 13 };  // NOLINT invalid signature
+            }
+        }
+
+        void check_session(const params &p) const {
+            auto sk = p.find("sk");
+            if (sk == p.end() || sk->second != m_opts.session_key) {
+                throw api_error { 9 };  // NOLINT invalid session key
+            }
+        }
+
+        tao::json::value dispatch(const std::string &method,
+                                  const params &p) {
+            check_key(p);
+            if (method == "auth.getToken") {
+                if (p.count("api_sig") != 0) {
+                    check_signature(p);
+                }
+                return { { "token", new_token() } };
+            }
+
+            check_signature(p);
+            if (method == "auth.getSession") {
+                auto token = p.find("token");
+                if (token == p.end() || m_tokens.erase(token->second) == 0) {
+                    throw api_error { 4 };  // NOLINT invalid token
+                }
+                return { { "session",
+                           { { "name", "mock" },
+                             { "key", m_opts.session_key },
+                             { "subscriber", 0 } } } };
+            }
+
+            check_session(p);
+            if (method == "track.updateNowPlaying") {
+                return { { "nowplaying",
+                           { { "artist", text(p, "artist") },
+                             { "track", text(p, "track") },
+                             { "album", text(p, "album") },
+                             { "ignoredMessage",
+                               { { "code", "0" }, { "#text", "" } } } } } };
+            }
+            if (method == "track.scrobble") {
+                return scrobble(p);
+            }
+            throw api_error { 3 };  // NOLINT invalid method
+        }
+
+        //! \brief Accepts up to 50 scrobbles, `artist[i]`, `track[i]`...
+        tao::json::value scrobble(const params &p) {
+            tao::json::value accepted = tao::json::empty_array;
+            for (size_t i = 0; i < 50; i++) {  // NOLINT as20's batch limit
+                auto suffix = '[' + std::to_string(i) + ']';
+                if (p.count("artist" + suffix) == 0) {
+                    break;
+                }
+                if (p.count("track" + suffix) == 0
+                    || p.count("timestamp" + suffix) == 0) {
+                    throw api_error { 6 };  // NOLINT invalid parameters
+                }
+                accepted.push_back(
+                    { { "artist", text(p, "artist" + suffix) },
+                      { "track", text(p, "track" + suffix) },
+                      { "album", text(p, "album" + suffix) },
+                      { "timestamp", p.at("timestamp" + suffix) },
+                      { "ignoredMessage",
+                        { { "code", "0" }, { "#text", "" } } } });
+            }
+            auto n = accepted.get_array().size();
+            if (n == 0) {
+                throw api_error { 6 };  // NOLINT invalid parameters
+            }
+            m_scrobbles += n;
+            return { { "scrobbles",
+                       { { "scrobble", std::move(accepted) },
+                         { "@attr",
+                           { { "accepted", n }, { "ignored", 0 } } } } } };
+        }
+
+        static tao::json::value text(const params &p,
+                                     const std::string &name) {
+            auto it = p.find(name);
+            return { { "corrected", "0" },
+                     { "#text", it == p.end() ? "" : it->second } };
+        }
+
+        std::string new_token() {
+            static constexpr std::string_view hex = "0123456789abcdef";
+            std::string token;
+            for (int i = 0; i < 32; i++) {  // NOLINT
+                token += hex[m_random() % hex.size()];
+            }
+            m_tokens.insert(token);
+            return token;
+        }
+
+        options m_opts;
+        std::mt19937 m_random;
+        std::set<std::string> m_tokens;
+
+        std::map<std::string, uint64_t> m_served;
+        std::map<int, uint64_t> m_errors;
+        uint64_t m_scrobbles = 0;
+        uint64_t m_resets    = 0;
+        uint64_t m_stalls    = 0;
+    };
+
+    //! \brief One connection, over TCP or TLS
+    template<typename Stream>
+    class session : public std::enable_shared_from_this<session<Stream>> {
+    public:
+        session(Stream stream, mock &m)
+            : m_stream(std::move(stream)),
+              m_mock(m),
+              m_timer(m_stream.get_executor()) {}
+
+        void start() {
+            if constexpr (std::is_same_v<Stream, tcp::socket>) {
+                read();
+            } else {
+                m_stream.async_handshake(
+                    ssl::stream_base::server,
+                    [self = this->shared_from_this()](auto ec) {
+                        if (ec) {
+                            spdlog::warn("tls handshake failed: {}",
+                                         ec.message());
+                            return;
+                        }
+                        self->read();
+                    });
+            }
+        }
+
+    private:
+        void read() {
+            m_req = {};
+            http::async_read(m_stream, m_buffer, m_req,
+                             [self = this->shared_from_this()](auto ec,
+                                                               size_t) {
+                                 if (!ec) {
+                                     self->respond();
+                                 }
+                             });
+        }
+
+        void respond() {
+            auto o = m_mock.handle(m_req);
+            if (o.what == mock::fault::reset) {
+                // an abortive close, the client sees ECONNRESET
+                boost::system::error_code ignored;
+                auto &socket = m_stream.lowest_layer();
+                socket.set_option(tcp::socket::linger(true, 0), ignored);
+                socket.close(ignored);
+                return;
+            }
+            if (o.what == mock::fault::stall) {
+                // never answer, only notice the client giving up
+                read();
+                return;
+            }
+
+            m_res = { o.status, m_req.version() };
+            m_res.set(http::field::server, "mock-as20");
+            m_res.set(http::field::content_type,
+                      "application/json; charset=utf-8");
+            m_res.keep_alive(m_req.keep_alive());
+            m_res.body() = std::move(o.body);
+            m_res.prepare_payload();
+
+            m_timer.expires_after(o.delay);
+            m_timer.async_wait([self = this->shared_from_this()](auto ec) {
+                if (ec) {
+                    return;
+                }
+                http::async_write(self->m_stream, self->m_res,
+                                  [self](auto ec, size_t) {
+                                      if (!ec && !self->m_res.need_eof()) {
+                                          self->read();
+                                      }
+                                  });
+            });
+        }
+
+        Stream m_stream;
+        mock &m_mock;
+        asio::steady_timer m_timer;
+        boost::beast::flat_buffer m_buffer;
+        http::request<http::string_body> m_req;
+        http::response<http::string_body> m_res;
+    };
+
+
+    //! \brief The mock on a listening socket, over TCP or TLS
+    class server {
+    public:
+        server(asio::io_context &io, options opts)
+            : m_mock(std::move(opts)),
+              m_acceptor(io, endpoint(m_mock.opts().listen)) {
+            if (!m_mock.opts().cert.empty()) {
+                m_tls.emplace(ssl::context::tls_server);
+                m_tls->use_certificate_chain_file(m_mock.opts().cert);
+                m_tls->use_private_key_file(m_mock.opts().key,
+                                            ssl::context::pem);
+            }
+        }
+
+        //! \brief Starts accepting clients
+        void start() {
+            spdlog::info("mock-as20 listening on {}://{}:{}/, seed {}",
+                         m_tls ? "https" : "http",
+                         m_acceptor.local_endpoint().address().to_string(),
+                         port(), m_mock.opts().seed);
+            accept();
+        }
+
+        //! \brief Stops accepting, connections end with their client
+        void stop() {
+            boost::system::error_code ignored;
+            m_acceptor.close(ignored);
+        }
+
+        void report() const { m_mock.report(); }
+
+        //! \returns The port listened on, for servers on port 0
+        [[nodiscard]] unsigned short port() const {
+            return m_acceptor.local_endpoint().port();
+        }
+
+    private:
+        static tcp::endpoint endpoint(const std::string &address) {
+            auto colon = address.rfind(':');
+            if (colon == std::string::npos) {
+                throw std::runtime_error("address must be host:port");
+            }
+            return { asio::ip::make_address(address.substr(0, colon)),
+                     gsl::narrow<unsigned short>(
+                         std::stoul(address.substr(colon + 1))) };
+        }
+
+        void accept() {
+            m_acceptor.async_accept([this](auto ec, tcp::socket socket) {
+                if (ec == asio::error::operation_aborted) {
+                    return;
+                }
+                if (!ec) {
+                    if (m_tls) {
+                        using stream = ssl::stream<tcp::socket>;
+                        std::make_shared<session<stream>>(
+                            stream(std::move(socket), *m_tls), m_mock)
+                            ->start();
+                    } else {
+                        std::make_shared<session<tcp::socket>>(
+                            std::move(socket), m_mock)
+                            ->start();
+                    }
+                }
+                accept();
+            });
+        }
+
+        mock m_mock;
+        tcp::acceptor m_acceptor;
+        std::optional<ssl::context> m_tls;
+    };
+}  // namespace mpdfm::tools::as20
+
+#endif // TOOLS_MOCK_AS20_HPP
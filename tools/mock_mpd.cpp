@@ -0,0 +1,119 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*!
+ * \file mock_mpd.cpp
+ * \brief Scriptable stand-in for MPD, to drive mpdfm's event loop
+ *
+ * ```
+ * mock-mpd --listen 127.0.0.1:6601 --script skips.timeline
+ * mock-mpd --storm 3000:100000      # 3000 changes a minute, 100000 total
+ * ```
+ *
+ * See mock_mpd.hpp for the timeline scripts. SIGINT and SIGTERM print what
+ * happened and exit.
+ */
+#include "mock_mpd.hpp"
+
+#include <boost/asio/signal_set.hpp>
+#include <iostream>
+
+namespace {
+    namespace asio = boost::asio;
+    using mpdfm::tools::latency;
+    using mpdfm::tools::mpd::options;
+    using mpdfm::tools::mpd::server;
+
+    void usage() {
+        std::cerr
+            << "usage: mock-mpd [options]\n"
+               "  --listen HOST:PORT     default 127.0.0.1:6601\n"
+               "  --password PASSWORD    required before anything else\n"
+               "  --script FILE          timeline to play, see "
+               "tools/mock_mpd.hpp\n"
+               "  --storm RATE[:COUNT]   random changes a minute, after the "
+               "script\n"
+               "  --loop                 play the timeline over and over\n"
+               "  --latency SPEC         delay every command, see "
+               "tools/faults.hpp\n"
+               "  --seed N               seed of everything random\n"
+               "  -v                     log every command\n";
+    }
+
+    options parse_options(gsl::span<const char *> args) {
+        options opts;
+        for (size_t i = 1; i < args.size(); i++) {
+            std::string_view flag(args[i]);
+            if (flag == "-v") {
+                spdlog::set_level(spdlog::level::debug);
+                continue;
+            }
+            if (flag == "--loop") {
+                opts.loop = true;
+                continue;
+            }
+            if (i + 1 == args.size()) {
+                throw std::runtime_error("missing value of "
+                                         + std::string(flag));
+            }
+            std::string value(args[++i]);
+            if (flag == "--listen") {
+                opts.listen = value;
+            } else if (flag == "--password") {
+                opts.password = value;
+            } else if (flag == "--script") {
+                opts.script = value;
+            } else if (flag == "--storm") {
+                opts.storm = value;
+            } else if (flag == "--latency") {
+                opts.delay = latency(value);
+            } else if (flag == "--seed") {
+                opts.seed = std::stoul(value);
+            } else {
+                throw std::runtime_error("unknown option "
+                                         + std::string(flag));
+            }
+        }
+        return opts;
+    }
+}  // namespace
+
+int main(int argc, const char **argv) {
+    gsl::span<const char *> args(argv, argc);
+    asio::io_context io;
+    std::optional<server> s;
+    try {
+        s.emplace(io, parse_options(args));
+    } catch (const std::exception &e) {
+        spdlog::error("{}", e.what());
+        usage();
+        return 2;
+    }
+    s->start();
+    s->play();
+
+    asio::signal_set signals(io, SIGINT, SIGTERM);
+    signals.async_wait([&](auto ec, int) {
+        if (ec) {
+            return;
+        }
+        s->report();
+        s->stop();
+        io.stop();
+    });
+    io.run();
+}
@@ -0,0 +1,832 @@
+/*
+ * This file is part of mpdfm.
+ *
+ * mpdfm is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * mpdfm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with mpdfm.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef TOOLS_MOCK_MPD_HPP
+#define TOOLS_MOCK_MPD_HPP
+
+#include "faults.hpp"
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <gsl/gsl>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <spdlog/fmt/fmt.h>
+#include <spdlog/spdlog.h>
+#include <sstream>
+
+/*!
+ * \file mock_mpd.hpp
+ * \brief Scriptable stand-in for MPD, to drive mpdfm's event loop
+ *
+ * Speaks the part of the MPD protocol mpdfm uses: idle, noidle, status,
+ * currentsong, password, ping, close and command lists. The player follows
+ * a timeline script, and every change is announced to idling clients as
+ * `changed: player`. Like MPD, changes that happen while a client is busy
+ * are coalesced into a single event, so storms measure how much of the
+ * timeline mpdfm keeps up with.
+ *
+ * A timeline has one step per line, `#` starts a comment:
+ *
+ * ```
+ * song 240 Artist="Boards of Canada" Title=Roygbiv   # next song, playing
+ * sleep 1000                        # ms, or a distribution as in faults.hpp
+ * pause
+ * play                              # resumes
+ * seek 120
+ * stop
+ * disconnect                        # drops every client
+ * repeat 1000
+ *     song 30
+ *     sleep uniform:20:80
+ * end
+ * storm 600 5000                    # 5000 random steps, 600 a minute
+ * ```
+ *
+ * The song's duration is what MPD reports, mpdfm still measures play time
+ * by the clock, so only songs actually played for long enough scrobble.
+ *
+ * Used by the mock-mpd tool and the end to end benchmark, everything runs
+ * on the thread running the io_context.
+ */
+namespace mpdfm::tools::mpd {
+    namespace asio = boost::asio;
+    using boost::asio::ip::tcp;
+    using clock = std::chrono::steady_clock;
+
+    /*!
+     * \brief Splits a command line into words the way MPD does: words are
+     *        separated by spaces, double quotes group, backslash escapes
+     */
+    inline std::vector<std::string> tokenize(const std::string &line) {
+        std::vector<std::string> words;
+        std::optional<std::string> word;
+        bool quoted = false;
+        for (size_t i = 0; i < line.size(); i++) {
+            char c = line[i];
+            if (quoted) {
+                if (c == '\\' && i + 1 < line.size()) {
+                    *word += line[++i];
+                } else if (c == '"') {
+                    quoted = false;
+                } else {
+                    *word += c;
+                }
+            } else if (c == '"') {
+                quoted = true;
+                word.emplace(word.value_or(""));
+            } else if (std::isspace(static_cast<unsigned char>(c)) != 0) {
+                if (word) {
+                    words.push_back(std::move(*word));
+                    word.reset();
+                }
+            } else {
+                word.emplace(word.value_or("")) += c;
+            }
+        }
+        if (quoted) {
+            throw std::runtime_error("unterminated quote");
+        }
+        if (word) {
+            words.push_back(std::move(*word));
+        }
+        return words;
+    }
+
+    //! \brief An MPD error, sent as `ACK [code@index] {command} message`
+    struct ack {
+        int code;
+        std::string message;
+    };
+
+    constexpr int ack_arg        = 2;
+    constexpr int ack_password   = 3;
+    constexpr int ack_permission = 4;
+    constexpr int ack_unknown    = 5;
+
+    struct song {
+        unsigned id  = 0;
+        unsigned pos = 0;
+        std::string file;
+        double duration = 0;
+        std::vector<std::pair<std::string, std::string>> tags;
+    };
+
+    //! \brief The player the timeline drives
+    struct player {
+        enum class state { stop, play, pause };
+
+        state current = state::stop;
+        std::optional<song> playing;
+        double elapsed_base = 0;  // seconds, as of since
+        clock::time_point since = clock::now();
+        unsigned next_id        = 1;
+        unsigned playlist       = 1;  // version
+
+        [[nodiscard]] double elapsed() const {
+            if (current != state::play) {
+                return elapsed_base;
+            }
+            std::chrono::duration<double> d = clock::now() - since;
+            return elapsed_base + d.count();
+        }
+
+        void set_state(state s) {
+            elapsed_base = elapsed();
+            since        = clock::now();
+            current      = s;
+        }
+
+        [[nodiscard]] std::string status() const {
+            static const std::array<const char *, 3> names { "stop", "play",
+                                                             "pause" };
+            std::string out = fmt::format(
+                "volume: 100\nrepeat: 0\nrandom: 0\nsingle: 0\nconsume: 0\n"
+                "playlist: {}\nplaylistlength: {}\nmixrampdb: 0.000000\n"
+                "state: {}\n",
+                playlist, playing ? playing->pos + 1 : 0,
+                names.at(static_cast<size_t>(current)));
+            if (playing && current != state::stop) {
+                auto e = elapsed();
+                fmt::format_to(std::back_inserter(out),
+                               "song: {}\nsongid: {}\ntime: {}:{}\n"
+                               "elapsed: {:.3f}\nbitrate: 320\n"
+                               "duration: {:.3f}\naudio: 44100:24:2\n",
+                               playing->pos, playing->id,
+                               static_cast<unsigned>(e),
+                               static_cast<unsigned>(playing->duration), e,
+                               playing->duration);
+            }
+            return out;
+        }
+
+        [[nodiscard]] std::string current_song() const {
+            if (!playing || current == state::stop) {
+                return {};
+            }
+            std::string out = fmt::format(
+                "file: {}\nLast-Modified: 2020-01-01T00:00:00Z\n",
+                playing->file);
+            for (auto &[name, value] : playing->tags) {
+                fmt::format_to(std::back_inserter(out), "{}: {}\n", name,
+                               value);
+            }
+            fmt::format_to(std::back_inserter(out),
+                           "Time: {}\nduration: {:.3f}\nPos: {}\nId: {}\n",
+                           static_cast<unsigned>(playing->duration),
+                           playing->duration, playing->pos, playing->id);
+            return out;
+        }
+    };
+
+    //! \brief One step of a timeline, repeat holds its body
+    struct step {
+        std::vector<std::string> words;
+        std::vector<step> body;
+    };
+
+    inline std::vector<step> parse_timeline(std::istream &in) {
+        std::vector<std::vector<step>> open(1);
+        std::vector<std::vector<std::string>> repeats;
+        std::string line;
+        for (size_t n = 1; std::getline(in, line); n++) {
+            if (auto hash = line.find('#'); hash != std::string::npos) {
+                line.resize(hash);
+            }
+            auto words = tokenize(line);
+            if (words.empty()) {
+                continue;
+            }
+            if (words[0] == "repeat") {
+                repeats.push_back(std::move(words));
+                open.emplace_back();
+            } else if (words[0] == "end") {
+                if (repeats.empty()) {
+                    throw std::runtime_error(
+                        fmt::format("line {}: end without repeat", n));
+                }
+                step s { std::move(repeats.back()), std::move(open.back()) };
+                repeats.pop_back();
+                open.pop_back();
+                open.back().push_back(std::move(s));
+            } else {
+                open.back().push_back({ std::move(words), {} });
+            }
+        }
+        if (!repeats.empty()) {
+            throw std::runtime_error("repeat without end");
+        }
+        return std::move(open.front());
+    }
+
+    class server;
+
+    //! \brief How a server is set up, see mock_mpd.cpp for the flags
+    struct options {
+        std::string listen = "127.0.0.1:6601";
+        std::string password;
+        std::string script;
+        std::string storm;  // RATE:COUNT
+        bool loop = false;
+        latency delay;
+        unsigned seed = std::random_device {}();
+
+        //! \brief Called with every new song before it plays, may change it
+        std::function<void(song &)> on_song;
+        //! \brief Called after every change of the player
+        std::function<void(const player &)> on_change;
+        //! \brief Called with the name of every command a client runs
+        std::function<void(const std::string &)> on_command;
+        //! \brief Called once the timeline ran out, unless it loops
+        std::function<void()> on_finish;
+    };
+
+    //! \brief One client connection
+    class client : public std::enable_shared_from_this<client> {
+    public:
+        client(tcp::socket socket, server &s)
+            : m_socket(std::move(socket)),
+              m_server(s),
+              m_timer(m_socket.get_executor()) {}
+
+        void start();
+
+        //! \brief Tells the client \p subsystem changed
+        void notify(const std::string &subsystem) {
+            m_pending.insert(subsystem);
+            if (m_idle) {
+                finish_idle();
+            }
+        }
+
+        void close() {
+            boost::system::error_code ignored;
+            m_timer.cancel();
+            m_socket.close(ignored);
+        }
+
+    private:
+        void read();
+        void handle(const std::string &line);
+        std::string run(const std::vector<std::string> &words);
+
+        //! \brief Answers a pending idle with whatever it waits for
+        void finish_idle() {
+            std::string out;
+            for (auto it = m_pending.begin(); it != m_pending.end();) {
+                if (m_idle->empty() || m_idle->count(*it) != 0) {
+                    out += "changed: " + *it + '\n';
+                    it = m_pending.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            if (!out.empty()) {
+                m_idle.reset();
+                send(out + "OK\n");
+            }
+        }
+
+        void send(std::string data) {
+            m_out.push_back(std::move(data));
+            if (m_out.size() == 1) {
+                write();
+            }
+        }
+
+        void write() {
+            asio::async_write(m_socket, asio::buffer(m_out.front()),
+                              [self = shared_from_this()](auto ec, size_t) {
+                                  if (ec) {
+                                      return;
+                                  }
+                                  self->m_out.pop_front();
+                                  if (!self->m_out.empty()) {
+                                      self->write();
+                                  }
+                              });
+        }
+
+        tcp::socket m_socket;
+        server &m_server;
+        asio::steady_timer m_timer;
+        asio::streambuf m_in;
+        std::deque<std::string> m_out;
+
+        bool m_authorized = false;
+        std::set<std::string> m_pending;
+        //! \brief Subsystems waited for while idling, empty for all
+        std::optional<std::set<std::string>> m_idle;
+        //! \brief Commands of an open command list
+        std::optional<std::vector<std::string>> m_list;
+        bool m_list_ok = false;
+    };
+
+    class server {
+    public:
+        server(asio::io_context &io, options opts)
+            : m_opts(std::move(opts)),
+              m_random(m_opts.seed),
+              m_acceptor(io, endpoint(m_opts.listen)),
+              m_timer(io) {
+            if (!m_opts.script.empty()) {
+                std::ifstream in(m_opts.script);
+                if (!in) {
+                    throw std::runtime_error("cannot open "
+                                             + m_opts.script);
+                }
+                m_timeline = parse_timeline(in);
+            }
+            if (!m_opts.storm.empty()) {
+                m_timeline.push_back(
+                    { { "storm", m_opts.storm.substr(
+                                     0, m_opts.storm.find(':')) },
+                      {} });
+                auto colon = m_opts.storm.find(':');
+                m_timeline.back().words.push_back(
+                    colon == std::string::npos
+                        ? "0"
+                        : m_opts.storm.substr(colon + 1));
+            }
+        }
+
+        //! \brief Starts accepting clients
+        void start() {
+            spdlog::info("mock-mpd listening on port {}, seed {}", port(),
+                         m_opts.seed);
+            accept();
+        }
+
+        //! \brief Starts playing the timeline
+        void play() {
+            m_frames.push_back({ &m_timeline, 0, 1 });
+            advance();
+        }
+
+        void stop() {
+            boost::system::error_code ignored;
+            m_acceptor.close(ignored);
+            m_timer.cancel();
+            disconnect();
+        }
+
+        void report() const {
+            fmt::print("{:<16} {:>10}\n", "player events", m_events);
+            fmt::print("{:<16} {:>10}\n", "connections", m_connections);
+            for (auto &[command, n] : m_commands) {
+                fmt::print("{:<16} {:>10}\n", command, n);
+            }
+        }
+
+        //! \returns The port listened on, for servers on port 0
+        [[nodiscard]] unsigned short port() const {
+            return m_acceptor.local_endpoint().port();
+        }
+
+        //! \returns Number of player changes so far
+        [[nodiscard]] uint64_t events() const { return m_events; }
+
+        const options &opts() const { return m_opts; }
+        const player &state() const { return m_player; }
+        std::mt19937 &random() { return m_random; }
+
+        void count(const std::string &command) {
+            m_commands[command]++;
+            if (m_opts.on_command) {
+                m_opts.on_command(command);
+            }
+        }
+
+        void forget(const std::shared_ptr<client> &c) { m_clients.erase(c); }
+
+    private:
+        static tcp::endpoint endpoint(const std::string &address) {
+            auto colon = address.rfind(':');
+            if (colon == std::string::npos) {
+                throw std::runtime_error("address must be host:port");
+            }
+            return { asio::ip::make_address(address.substr(0, colon)),
+                     gsl::narrow<unsigned short>(
+                         std::stoul(address.substr(colon + 1))) };
+        }
+
+        void accept() {
+            m_acceptor.async_accept([this](auto ec, tcp::socket socket) {
+                if (ec == asio::error::operation_aborted) {
+                    return;
+                }
+                if (!ec) {
+                    m_connections++;
+                    auto c = std::make_shared<client>(std::move(socket),
+                                                      *this);
+                    m_clients.insert(c);
+                    c->start();
+                }
+                accept();
+            });
+        }
+
+        void disconnect() {
+            auto clients = std::move(m_clients);
+            for (auto &c : clients) {
+                c->close();
+            }
+        }
+
+        void changed() {
+            m_events++;
+            if (m_opts.on_change) {
+                m_opts.on_change(m_player);
+            }
+            for (auto &c : m_clients) {
+                c->notify("player");
+            }
+        }
+
+        //! \brief Where the timeline is, one frame per open repeat
+        struct frame {
+            const std::vector<step> *steps;
+            size_t next;
+            uint64_t left;  // repetitions, 0 for forever
+        };
+
+        //! \brief Runs steps until one has to wait
+        void advance() {
+            while (!m_frames.empty()) {
+                auto &f = m_frames.back();
+                if (f.next == f.steps->size()) {
+                    if (f.left == 1) {
+                        m_frames.pop_back();
+                        continue;
+                    }
+                    if (f.left != 0) {
+                        f.left--;
+                    }
+                    f.next = 0;
+                    continue;
+                }
+                auto &s = (*f.steps)[f.next++];
+                try {
+                    if (auto wait = perform(s)) {
+                        m_timer.expires_after(*wait);
+                        m_timer.async_wait([this](auto ec) {
+                            if (!ec) {
+                                advance();
+                            }
+                        });
+                        return;
+                    }
+                } catch (const std::exception &e) {
+                    spdlog::error("timeline: {}: {}", s.words[0], e.what());
+                }
+            }
+            if (m_opts.loop && !m_timeline.empty()) {
+                m_frames.push_back({ &m_timeline, 0, 1 });
+                // yield, an empty pass must not spin
+                m_timer.expires_after(std::chrono::milliseconds(1));
+                m_timer.async_wait([this](auto ec) {
+                    if (!ec) {
+                        advance();
+                    }
+                });
+                return;
+            }
+            spdlog::info("timeline finished");
+            if (m_opts.on_finish) {
+                m_opts.on_finish();
+            }
+        }
+
+        //! \returns How long to wait before the next step, if at all
+        std::optional<std::chrono::microseconds> perform(const step &s) {
+            auto &op   = s.words[0];
+            auto arg   = [&](size_t i) -> const std::string & {
+                if (s.words.size() <= i) {
+                    throw std::runtime_error("missing argument");
+                }
+                return s.words[i];
+            };
+            if (op == "song") {
+                next_song(s.words);
+            } else if (op == "pause") {
+                m_player.set_state(player::state::pause);
+                changed();
+            } else if (op == "play") {
+                m_player.set_state(player::state::play);
+                changed();
+            } else if (op == "stop") {
+                m_player.set_state(player::state::stop);
+                m_player.elapsed_base = 0;
+                changed();
+            } else if (op == "seek") {
+                m_player.set_state(m_player.current);
+                m_player.elapsed_base = std::stod(arg(1));
+                changed();
+            } else if (op == "disconnect") {
+                disconnect();
+            } else if (op == "sleep") {
+                auto &spec = arg(1);
+                return (spec.find(':') == std::string::npos
+                            ? latency("fixed:" + spec)
+                            : latency(spec))
+                    .sample(m_random);
+            } else if (op == "repeat") {
+                m_frames.push_back({ &s.body, 0, std::stoull(arg(1)) });
+            } else if (op == "storm") {
+                m_storm_rate = std::stod(arg(1));
+                m_frames.push_back({ &storm_steps(), 0,
+                                     s.words.size() > 2
+                                         ? std::stoull(arg(2))
+                                         : 0 });
+            } else if (op == "storm-step") {
+                storm_step();
+                using ms = std::chrono::duration<double, std::milli>;
+                return std::chrono::duration_cast<std::chrono::microseconds>(
+                    ms(60'000 / m_storm_rate));  // NOLINT a minute
+            } else {
+                throw std::runtime_error("unknown step");
+            }
+            return std::nullopt;
+        }
+
+        static const std::vector<step> &storm_steps() {
+            static const std::vector<step> steps { { { "storm-step" }, {} } };
+            return steps;
+        }
+
+        //! \brief Mostly skips, with some pauses, resumes and seeks
+        void storm_step() {
+            auto roll = m_random() % 10;  // NOLINT
+            if (roll < 7 || !m_player.playing) {  // NOLINT
+                next_song({ "song" });
+                return;
+            }
+            if (roll == 7) {  // NOLINT
+                m_player.set_state(m_player.current == player::state::play
+                                       ? player::state::pause
+                                       : player::state::play);
+            } else {
+                m_player.set_state(m_player.current);
+                m_player.elapsed_base =
+                    static_cast<double>(m_random() % 200);  // NOLINT
+            }
+            changed();
+        }
+
+        //! \brief `song [duration] [Tag=Value]...`
+        void next_song(const std::vector<std::string> &words) {
+            song s;
+            s.id       = m_player.next_id++;
+            s.pos      = m_player.playing ? m_player.playing->pos + 1 : 0;
+            s.file     = fmt::format("mock/{:06}.flac", s.id);
+            s.duration = 200;  // NOLINT
+            s.tags     = {
+                { "Artist", fmt::format("Artist {}", s.id % 50) },  // NOLINT
+                { "Title", fmt::format("Track {}", s.id) },
+                { "Album", fmt::format("Album {}", s.id % 200) },  // NOLINT
+                { "Track", std::to_string(s.id % 12 + 1) },        // NOLINT
+            };
+            for (size_t i = 1; i < words.size(); i++) {
+                auto eq = words[i].find('=');
+                if (eq == std::string::npos) {
+                    s.duration = std::stod(words[i]);
+                    continue;
+                }
+                auto name  = words[i].substr(0, eq);
+                auto value = words[i].substr(eq + 1);
+                if (name == "file") {
+                    s.file = value;
+                    continue;
+                }
+                auto it = std::find_if(
+                    s.tags.begin(), s.tags.end(),
+                    [&](auto &t) { return t.first == name; });
+                if (it == s.tags.end()) {
+                    s.tags.emplace_back(name, value);
+                } else {
+                    it->second = value;
+                }
+            }
+            if (m_opts.on_song) {
+                m_opts.on_song(s);
+            }
+            m_player.playing      = std::move(s);
+            m_player.current      = player::state::play;
+            m_player.elapsed_base = 0;
+            m_player.since        = clock::now();
+            m_player.playlist++;
+            changed();
+        }
+
+        options m_opts;
+        std::mt19937 m_random;
+        tcp::acceptor m_acceptor;
+        asio::steady_timer m_timer;
+        std::set<std::shared_ptr<client>> m_clients;
+
+        player m_player;
+        std::vector<step> m_timeline;
+        std::vector<frame> m_frames;
+        double m_storm_rate = 1;
+
+        uint64_t m_events      = 0;
+        uint64_t m_connections = 0;
+        std::map<std::string, uint64_t> m_commands;
+    };
+
+    inline void client::start() {
+        m_authorized = m_server.opts().password.empty();
+        send("OK MPD 0.23.5\n");
+        read();
+    }
+
+    inline void client::read() {
+        asio::async_read_until(
+            m_socket, m_in, '\n',
+            [self = shared_from_this()](auto ec, size_t) {
+                if (ec) {
+                    self->m_server.forget(self);
+                    return;
+                }
+                std::istream in(&self->m_in);
+                std::string line;
+                std::getline(in, line);
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                auto delay = self->m_server.opts().delay.sample(
+                    self->m_server.random());
+                if (delay.count() == 0) {
+                    self->handle(line);
+                    return;
+                }
+                self->m_timer.expires_after(delay);
+                self->m_timer.async_wait([self, line](auto ec) {
+                    if (!ec) {
+                        self->handle(line);
+                    }
+                });
+            });
+    }
+
+    inline void client::handle(const std::string &line) {
+        std::vector<std::string> words;
+        try {
+            words = tokenize(line);
+        } catch (const std::exception &e) {
+            // inside a command list, the error is answered at its end
+            if (m_list) {
+                m_list->push_back(line);
+            } else {
+                send(fmt::format("ACK [{}@0] {{}} {}\n", ack_arg, e.what()));
+            }
+            read();
+            return;
+        }
+        auto command = words.empty() ? std::string() : words[0];
+        spdlog::debug("< {}", line);
+
+        if (m_idle) {
+            // anything but noidle ends the connection, as with MPD
+            if (command != "noidle") {
+                close();
+                m_server.forget(shared_from_this());
+                return;
+            }
+            m_server.count(command);
+            m_idle.reset();
+            std::string out;
+            for (auto &s : m_pending) {
+                out += "changed: " + s + '\n';
+            }
+            m_pending.clear();
+            send(out + "OK\n");
+            read();
+            return;
+        }
+
+        if (m_list) {
+            if (command == "command_list_end") {
+                auto list = std::move(*m_list);
+                m_list.reset();
+                std::string out;
+                for (size_t i = 0; i < list.size(); i++) {
+                    std::vector<std::string> w;
+                    try {
+                        try {
+                            w = tokenize(list[i]);
+                        } catch (const std::exception &e) {
+                            throw ack{ack_arg, e.what()};
+                        }
+                        out += run(w);
+                        if (m_list_ok) {
+                            out += "list_OK\n";
+                        }
+                    } catch (const ack &e) {
+                        out += fmt::format("ACK [{}@{}] {{{}}} {}\n", e.code,
+                                           i, w.empty() ? "" : w[0],
+                                           e.message);
+                        send(std::move(out));
+                        read();
+                        return;
+                    }
+                }
+                send(out + "OK\n");
+            } else {
+                m_list->push_back(line);
+            }
+            read();
+            return;
+        }
+
+        if (command == "command_list_begin"
+            || command == "command_list_ok_begin") {
+            m_list.emplace();
+            m_list_ok = command == "command_list_ok_begin";
+            read();
+            return;
+        }
+        if (command == "close") {
+            close();
+            m_server.forget(shared_from_this());
+            return;
+        }
+        if (command == "idle") {
+            m_server.count(command);
+            if (!m_authorized) {
+                send(fmt::format("ACK [{}@0] {{idle}} you don't have "
+                                 "permission for \"idle\"\n",
+                                 ack_permission));
+                read();
+                return;
+            }
+            m_idle.emplace(words.begin() + 1, words.end());
+            finish_idle();
+            read();
+            return;
+        }
+
+        try {
+            send(run(words) + "OK\n");
+        } catch (const ack &e) {
+            send(fmt::format("ACK [{}@0] {{{}}} {}\n", e.code, command,
+                             e.message));
+        }
+        read();
+    }
+
+    //! \returns The response of a plain command, without the final OK
+    inline std::string client::run(const std::vector<std::string> &words) {
+        if (words.empty()) {
+            throw ack { ack_unknown, "No command given" };
+        }
+        auto &command = words[0];
+        m_server.count(command);
+        if (command == "ping") {
+            return {};
+        }
+        if (command == "password") {
+            if (words.size() != 2) {
+                throw ack { ack_arg, "wrong number of arguments" };
+            }
+            if (words[1] != m_server.opts().password) {
+                throw ack { ack_password, "incorrect password" };
+            }
+            m_authorized = true;
+            return {};
+        }
+        if (command == "status" || command == "currentsong") {
+            if (!m_authorized) {
+                throw ack { ack_permission,
+                            "you don't have permission for \"" + command
+                                + "\"" };
+            }
+            return command == "status" ? m_server.state().status()
+                                       : m_server.state().current_song();
+        }
+        throw ack { ack_unknown, "unknown command \"" + command + "\"" };
+    }
+}  // namespace mpdfm::tools::mpd
+
+#endif // TOOLS_MOCK_MPD_HPP